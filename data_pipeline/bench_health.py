@@ -0,0 +1,133 @@
+import argparse
+import json
+import random
+import statistics
+import time
+import tracemalloc
+
+import pandas as pd
+
+from commons import *
+from health import FleetHealth
+
+# Simulated fleet: every device reports every REPORT_INTERVAL_S, a few
+# sensors fail for a while and a few devices stop reporting for good.
+REPORT_INTERVAL_S = 5
+START_S = 1_700_000_000
+SENSOR_FAULT_RATE = 1 / 20_000   # Per report and sensor
+SENSOR_FAULT_REPORTS = 60
+DEVICE_LOSS_RATE = 1 / 100_000   # Per report
+
+
+def simulate(devices, duration_s, seed):
+    """Reports tick by tick, with the arrival time they are fed at."""
+    rng = random.Random(seed)
+    fault = [[0, 0] for _ in range(devices)]
+    lost = set()
+    names = [f"sensor_{i}" for i in range(devices)]
+    for tick in range(duration_s // REPORT_INTERVAL_S):
+        ts_s = START_S + (tick + 1) * REPORT_INTERVAL_S
+        timestamp = pd.Timestamp(ts_s, unit="s", tz="UTC")
+        rows = []
+        for i in range(devices):
+            if i in lost:
+                continue
+            if rng.random() < DEVICE_LOSS_RATE:
+                lost.add(i)
+                continue
+            for s in range(2):
+                if fault[i][s] == 0 and rng.random() < SENSOR_FAULT_RATE:
+                    fault[i][s] = SENSOR_FAULT_REPORTS
+                fault[i][s] = max(fault[i][s] - 1, 0)
+            rows.append({"device": names[i], "timestamp": timestamp, "lane": 0,
+                         "sensor_1_up": fault[i][0] == 0, "sensor_2_up": fault[i][1] == 0,
+                         "window_s": REPORT_INTERVAL_S, "quiet_windows": 0})
+        yield ts_s, rows
+
+
+def scan_snapshot(df, now_s, silent_after_s):
+    """The same silent devices and down sensors, computed from history with pandas."""
+    last = df.sort_values("timestamp").groupby("device", observed=True).tail(1)
+    silent = set(last.loc[last["timestamp"] <= pd.Timestamp(now_s - silent_after_s, unit="s", tz="UTC"), "device"])
+    down = set()
+    for s in (1, 2):
+        down |= {(device, 0, s) for device in last.loc[~last[f"sensor_{s}_up"], "device"]}
+    return silent, down
+
+
+def main():
+    parser = argparse.ArgumentParser(description="Throughput and footprint of the streaming fleet health engine")
+    parser.add_argument("--devices", type=int, default=10_000)
+    parser.add_argument("--duration", type=int, default=1800, help="simulated s")
+    parser.add_argument("--seed", type=int, default=1)
+    args = parser.parse_args()
+
+    alerts = []
+    health = FleetHealth(on_alert=alerts.append)
+    update_times = []
+    check_s = 0.0
+    history = []
+    messages = 0
+    now_s = START_S
+    for now_s, rows in simulate(args.devices, args.duration, args.seed):
+        start = time.perf_counter()
+        for row in rows:
+            health.update(row, now_s)
+        update_times.append((time.perf_counter() - start) / max(len(rows), 1))
+        start = time.perf_counter()
+        if (now_s // REPORT_INTERVAL_S) % (INGEST_FLUSH_S // REPORT_INTERVAL_S) == 0:
+            health.check(now_s)
+        check_s += time.perf_counter() - start
+        messages += len(rows)
+        history += rows
+    # Devices lost more than HEALTH_SILENT_S before the end are silent by now
+    health.check(now_s)
+
+    snapshot_times = []
+    for _ in range(20):
+        start = time.perf_counter()
+        snapshot = health.snapshot(now_s)
+        snapshot_times.append(time.perf_counter() - start)
+
+    df = pd.DataFrame(history)
+    df["device"] = df["device"].astype("category")
+    start = time.perf_counter()
+    silent, down = scan_snapshot(df, now_s, HEALTH_SILENT_S)
+    scan_s = time.perf_counter() - start
+    matches = (silent == {s["device"] for s in snapshot["silent"]}
+               and down == {(d["device"], d["lane"], d["sensor"]) for d in snapshot["sensors_down"]})
+
+    # Footprint of the state alone, rebuilt for a few ticks with allocations traced
+    tracemalloc.start()
+    sized = FleetHealth()
+    for ts_s, rows in simulate(args.devices, 3 * REPORT_INTERVAL_S, args.seed):
+        for row in rows:
+            sized.update(row, ts_s)
+    state_bytes = tracemalloc.get_traced_memory()[0]
+    tracemalloc.stop()
+
+    per_message_us = statistics.median(update_times) * 1e6
+    required = args.devices / REPORT_INTERVAL_S
+    print(json.dumps({
+        "devices": args.devices,
+        "report_interval_s": REPORT_INTERVAL_S,
+        "simulated_s": args.duration,
+        "messages": messages,
+        "update_us_p50": round(per_message_us, 2),
+        "update_us_max_tick": round(max(update_times) * 1e6, 2),
+        "capacity_msg_s": round(1e6 / per_message_us),
+        "required_msg_s": round(required),
+        "headroom": round(1e6 / per_message_us / required, 1),
+        "check_total_ms": round(check_s * 1000, 2),
+        "snapshot_ms": round(statistics.median(snapshot_times) * 1000, 3),
+        "history_scan_ms": round(scan_s * 1000, 1),
+        "snapshot_matches_scan": matches,
+        "silent": len(snapshot["silent"]),
+        "sensors_down": len(snapshot["sensors_down"]),
+        "alerts": len(alerts),
+        "state_bytes_per_device": round(state_bytes / args.devices),
+    }, indent=2))
+
+
+if __name__ == "__main__":
+    main()
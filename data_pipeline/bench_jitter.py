@@ -0,0 +1,79 @@
+import argparse
+import json
+
+from commons import *
+from mqtt_traffic import read_log
+
+# Measurement cycle jitter of one device under two conditions, from the
+# jitter_hist its reports carry (see device/speed_sensor/main/jitter_hist.h).
+# Record a few minutes of reports with CONFIG_MQTT_FLOOD_TEST off and again
+# with it on, then compare:
+#
+#   python mqtt_traffic.py record idle.log --topic /device/sensor_0/data --duration 600
+#   python mqtt_traffic.py record flood.log --topic /device/sensor_0/data --duration 600
+#   python bench_jitter.py idle.log flood.log
+#
+# Must match JITTER_HIST_* in jitter_hist.h
+JITTER_HIST_BUCKETS = 12
+JITTER_HIST_BASE_US = 32
+
+
+def load(path, device=None):
+    """Summed jitter_hist, highest jitter_max_us and report count of a traffic log."""
+    counts = [0] * JITTER_HIST_BUCKETS
+    max_us = 0
+    reports = 0
+    for topic, payload, *_ in read_log(path):
+        if topic_device(topic) is None or not topic.endswith("/data"):
+            continue
+        try:
+            message = json.loads(payload.decode("utf-8"))
+        except (UnicodeDecodeError, json.JSONDecodeError):
+            continue
+        data = message.get("data") or {}
+        if (device and message.get("device") != device) or not isinstance(data.get("jitter_hist"), list):
+            continue
+        for bucket, count in enumerate(data["jitter_hist"][:JITTER_HIST_BUCKETS]):
+            counts[bucket] += int(count)
+        max_us = max(max_us, int(data.get("jitter_max_us", 0)))
+        reports += 1
+    return counts, max_us, reports
+
+
+def percentile_us(counts, percent):
+    """As jitter_hist_percentile_us(): the upper bound of the bucket holding it."""
+    samples = sum(counts)
+    if samples == 0:
+        return 0
+    needed = -(-samples * percent // 100)
+    seen = 0
+    for bucket, count in enumerate(counts[:-1]):
+        seen += count
+        if seen >= needed:
+            return JITTER_HIST_BASE_US << bucket
+    return JITTER_HIST_BASE_US << (JITTER_HIST_BUCKETS - 2)
+
+
+def main():
+    parser = argparse.ArgumentParser(description="Compare measurement cycle jitter between recorded runs")
+    parser.add_argument("logs", nargs="+", help="mqtt_traffic.py logs, e.g. without and with CONFIG_MQTT_FLOOD_TEST")
+    parser.add_argument("--device", help="default every device in the log")
+    args = parser.parse_args()
+
+    results = {}
+    for path in args.logs:
+        counts, max_us, reports = load(path, args.device)
+        results[path] = {
+            "reports": reports,
+            "cycles": sum(counts),
+            "p50_us": percentile_us(counts, 50),
+            "p99_us": percentile_us(counts, 99),
+            "p999_us": percentile_us(counts, 99.9),
+            "max_us": max_us,
+            "hist": counts,
+        }
+    print(json.dumps(results, indent=2))
+
+
+if __name__ == "__main__":
+    main()
@@ -0,0 +1,207 @@
+import argparse
+import json
+import os
+import random
+import resource
+import statistics
+import tempfile
+import threading
+import time
+import uuid
+
+import pandas as pd
+
+from commons import *
+from history import load_history, partition_dates, partition_dir, write_atomic
+from live_feed import LiveFeed, device_topics, device_view, rows_to_frame
+from query import device_history
+from schema import parse_message, to_table
+
+# Server CPU and update latency of the dashboard with many viewers: the
+# live_feed push design against the polling it replaced, in one process
+# with no browser or broker. Each viewer thread does a session's data work,
+# loading history and building its four chart frames, without Streamlit's
+# rendering. Reports come in through LiveFeed.on_message as the broker
+# would deliver them.
+#
+#   python bench_live_feed.py --viewers 50 --duration 60
+#
+# poll: as create_dashboard() was, every UPDATE_INTERVAL each session
+#       re-reads the whole history and redraws, and a report only shows once
+#       the ingester has flushed it (INGEST_FLUSH_S)
+# push: each session loads its device's history once, then appends the rows
+#       the feed hands it
+#
+# Latency is from a report arriving to a viewer of its device having it in
+# its chart frames.
+CHART_COLUMNS = ["avg_speed", "max_speed", "min_speed", "num_cars"]
+CHART_POINTS = 60
+REPORT_INTERVAL_S = 5
+
+
+class Message:
+    def __init__(self, topic, payload):
+        self.topic = topic
+        self.payload = payload
+
+
+def report(device, ts_ms, rng):
+    cars = rng.randint(0, 10)
+    return {
+        "device": device,
+        "version": "0.0.1",
+        "ts": ts_ms,
+        "data": {
+            "avg_speed": round(rng.uniform(500, 1500), 2) if cars else 0,
+            "max_speed": round(rng.uniform(1500, 2500), 2) if cars else 0,
+            "min_speed": round(rng.uniform(100, 500), 2) if cars else 0,
+            "num_cars": cars,
+            "sensor_1_up": 1,
+            "sensor_2_up": 1,
+        },
+    }
+
+
+def write_rows(root, rows):
+    df = pd.DataFrame(rows)
+    for date, part in df.groupby(partition_dates(df)):
+        write_atomic(to_table(part), os.path.join(partition_dir(root, date), f"ingest-{uuid.uuid4().hex[:8]}.parquet"))
+
+
+def write_history(root, devices, rows, rng):
+    """rows windows spread over the devices, ending now."""
+    now_ms = int(time.time() * 1000)
+    per_device = rows // len(devices)
+    history = [parse_message(report(device, now_ms - (per_device - i) * REPORT_INTERVAL_S * 1000, rng))
+               for device in devices for i in range(per_device)]
+    write_rows(root, history)
+
+
+class Bench:
+    def __init__(self, root, devices, viewers, duration, seed, push):
+        self.root = root
+        self.push = push
+        self.devices = devices
+        self.viewers = viewers
+        self.duration = duration
+        self.rng = random.Random(seed)
+        self.stop = threading.Event()
+        self.lock = threading.Lock()
+        self.arrived = {}  # (device, timestamp) -> perf_counter of arrival
+        self.latencies = []
+        self.pending = []  # Arrived but not flushed by the ingester
+        self.feed = LiveFeed(connect=False)
+
+    def seen(self, df):
+        now = time.perf_counter()
+        with self.lock:
+            for device, timestamp in zip(df["device"], df["timestamp"]):
+                arrived = self.arrived.get((device, timestamp))
+                if arrived is not None:
+                    self.latencies.append(now - arrived)
+
+    def publisher(self):
+        """Every device reports every REPORT_INTERVAL_S, staggered; the ingester flushes every INGEST_FLUSH_S."""
+        period = REPORT_INTERVAL_S / len(self.devices)
+        last_flush = time.perf_counter()
+        i = 0
+        while not self.stop.wait(period):
+            device = self.devices[i % len(self.devices)]
+            i += 1
+            message = report(device, int(time.time() * 1000), self.rng)
+            row = parse_message(message)
+            with self.lock:
+                self.arrived[(device, row["timestamp"])] = time.perf_counter()
+                self.pending.append(row)
+            if self.push:
+                topic = device_topics(device)[0]
+                self.feed.on_message(None, None, Message(topic, json.dumps(message).encode()))
+            if time.perf_counter() - last_flush >= INGEST_FLUSH_S:
+                with self.lock:
+                    rows, self.pending = self.pending, []
+                write_rows(self.root, rows)
+                last_flush = time.perf_counter()
+
+    def poll_viewer(self, device):
+        self.stop.wait(self.rng.uniform(0, UPDATE_INTERVAL))
+        shown_until = None
+        while not self.stop.is_set():
+            df = load_history(self.root)
+            device_df, frames = device_view(df, device, CHART_COLUMNS, CHART_POINTS)
+            if shown_until is not None:
+                self.seen(device_df[device_df["timestamp"] > shown_until])
+            if len(device_df):
+                shown_until = device_df["timestamp"].max()
+            self.stop.wait(UPDATE_INTERVAL)
+
+    def push_viewer(self, device):
+        self.feed.watch(device)
+        try:
+            history = device_history(device, ["version"] + CHART_COLUMNS, points=CHART_POINTS, root=self.root)
+            device_df, frames = device_view(history, device, CHART_COLUMNS, CHART_POINTS)
+            shown_until = device_df["timestamp"].max() if len(device_df) else None
+            seq = 0
+            while not self.stop.is_set():
+                rows, seq = self.feed.wait_since(device, seq, UPDATE_INTERVAL)
+                new_df = rows_to_frame(rows)
+                if len(new_df) and shown_until is not None:
+                    new_df = new_df[new_df["timestamp"] > shown_until]
+                if not len(new_df):
+                    continue
+                shown_until = new_df["timestamp"].max()
+                _, new_frames = device_view(new_df, device, CHART_COLUMNS, CHART_POINTS)
+                self.seen(new_df)
+        finally:
+            self.feed.unwatch(device)
+
+    def run(self):
+        viewer = self.push_viewer if self.push else self.poll_viewer
+        threads = [threading.Thread(target=self.publisher)]
+        threads += [threading.Thread(target=viewer, args=(self.devices[i % len(self.devices)],)) for i in range(self.viewers)]
+        start_usage = resource.getrusage(resource.RUSAGE_SELF)
+        start = time.perf_counter()
+        for thread in threads:
+            thread.start()
+        time.sleep(self.duration)
+        # Push viewers may sit out a last wait_since() timeout, idle
+        wall = time.perf_counter() - start
+        usage = resource.getrusage(resource.RUSAGE_SELF)
+        self.stop.set()
+        for thread in threads:
+            thread.join()
+        cpu = usage.ru_utime - start_usage.ru_utime + usage.ru_stime - start_usage.ru_stime
+
+        latencies = sorted(self.latencies)
+        return {
+            "viewers": self.viewers,
+            "duration_s": round(wall, 1),
+            "cpu_percent": round(100 * cpu / wall, 1),
+            "updates": len(latencies),
+            "latency_mean_s": round(statistics.mean(latencies), 3) if latencies else None,
+            "latency_p50_s": round(latencies[len(latencies) // 2], 3) if latencies else None,
+            "latency_p99_s": round(latencies[int(len(latencies) * 0.99)], 3) if latencies else None,
+            "latency_max_s": round(latencies[-1], 3) if latencies else None,
+        }
+
+
+def main():
+    parser = argparse.ArgumentParser(description="Dashboard server CPU and update latency, push against polling")
+    parser.add_argument("--viewers", type=int, default=50)
+    parser.add_argument("--devices", type=int, default=10)
+    parser.add_argument("--history-rows", type=int, default=20_000)
+    parser.add_argument("--duration", type=int, default=60, help="s per design")
+    parser.add_argument("--seed", type=int, default=1)
+    args = parser.parse_args()
+
+    devices = [f"sensor_{i}" for i in range(args.devices)]
+    results = {}
+    for name in ("poll", "push"):
+        with tempfile.TemporaryDirectory() as root:
+            write_history(root, devices, args.history_rows, random.Random(args.seed))
+            bench = Bench(root, devices, args.viewers, args.duration, args.seed, push=name == "push")
+            results[name] = bench.run()
+    print(json.dumps(results, indent=2))
+
+
+if __name__ == "__main__":
+    main()
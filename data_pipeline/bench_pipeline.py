@@ -0,0 +1,216 @@
+import argparse
+import json
+import os
+import platform
+import random
+import statistics
+import subprocess
+import sys
+import tempfile
+import time
+from types import SimpleNamespace
+
+import numpy as np
+import pandas as pd
+import pyarrow as pa
+
+import wow_sub
+from commons import *
+from health import FleetHealth
+from history import load_history, partition_dates, partition_dir, write_atomic
+from live_feed import device_view
+from query import device_history, summarize
+from schema import SCHEMA_VERSION, parse_message, to_table
+
+# Reproducible, offline benchmarks of the pipeline's hot spots. Every input is
+# generated from --seed, nothing connects to the broker, and files go to a
+# temporary directory. Results are JSON, so two commits can be compared with
+# --compare.
+HISTORY_SIZES = [10_000, 100_000, 1_000_000]
+QUICK_HISTORY_SIZES = [10_000, 100_000]
+MESSAGES = 20_000
+DEVICES = 100
+REPORT_INTERVAL_S = 5
+CHART_COLUMNS = ["avg_speed", "max_speed", "min_speed", "num_cars"]
+# Written the way compact.py writes a day
+ZSTD_LEVEL = 9
+
+
+def synthetic_reports(count, devices, seed):
+    """/device/<id>/data payloads as current firmware formats them."""
+    rng = random.Random(seed)
+    start_ms = 1_700_000_000_000
+    for n in range(count):
+        device = f"sensor_{n % devices}"
+        cars = rng.randint(0, 10)
+        yield device_topic(device, "data"), json.dumps({
+            "device": device, "version": "0.0.1", "ts": start_ms + (n // devices) * REPORT_INTERVAL_S * 1000, "lane": 0,
+            "data": {
+                "avg_speed": round(rng.uniform(15, 100), 2), "max_speed": round(rng.uniform(100, 150), 2),
+                "min_speed": round(rng.uniform(0, 15), 2), "num_cars": cars, "sensor_1_up": 1, "sensor_2_up": 1,
+                "boot_measure_ms": 812, "boot_publish_ms": 4210, "wifi_reconnects": 0, "wifi_reconnect_ms": 0,
+                "wifi_reconnect_max_ms": 0, "outbox_depth": 0, "outbox_bytes": 0, "outbox_spooled": 0,
+                "outbox_dropped": 0, "mqtt_retransmits": 0, "heap_free": rng.randint(90_000, 110_000),
+                "heap_largest": 65_536, "heap_allocs": 0, "jitter_p50_us": 64, "jitter_p99_us": 512,
+                "jitter_max_us": 1024, "jitter_hist": [rng.randint(0, 50) for _ in range(12)], "ota_active": 0,
+                "window_s": REPORT_INTERVAL_S, "quiet_windows": 0,
+            },
+        }).encode()
+
+
+def synthetic_history(rows, devices, seed):
+    """A typed history frame of the given size, spread over consecutive days."""
+    rng = np.random.default_rng(seed)
+    ticks = np.arange(rows) // devices
+    return pd.DataFrame({
+        "device": pd.Categorical([f"sensor_{i}" for i in np.arange(rows) % devices]),
+        "timestamp": pd.to_datetime(1_700_000_000_000 + ticks * REPORT_INTERVAL_S * 1000, unit="ms", utc=True),
+        "version": "0.0.1",
+        "lane": 0,
+        "avg_speed": rng.uniform(15, 100, rows).round(2),
+        "max_speed": rng.uniform(100, 150, rows).round(2),
+        "min_speed": rng.uniform(0, 15, rows).round(2),
+        "num_cars": rng.integers(0, 11, rows),
+        "sensor_1_up": True,
+        "sensor_2_up": True,
+    })
+
+
+def timed(fn, repeat):
+    """Median and best wall time of fn over repeat runs, and its last result."""
+    times = []
+    result = None
+    for _ in range(repeat):
+        start = time.perf_counter()
+        result = fn()
+        times.append(time.perf_counter() - start)
+    return {"median_s": round(statistics.median(times), 6), "min_s": round(min(times), 6), "repeat": repeat}, result
+
+
+def bench_json_decode(payloads, repeat):
+    def run():
+        for _, payload in payloads:
+            parse_message(json.loads(payload.decode()))
+    stats, _ = timed(run, repeat)
+    return {"name": "json_decode", "messages": len(payloads), **stats,
+            "per_s": round(len(payloads) / stats["median_s"])}
+
+
+def bench_ingest(payloads, repeat):
+    """wow_sub.on_mqtt_message, including the small-file flushes it triggers."""
+    messages = [SimpleNamespace(topic=topic, payload=payload) for topic, payload in payloads]
+
+    def run():
+        wow_sub.PENDING.clear()
+        wow_sub.LAST_TS.clear()
+        wow_sub.LAST_ROW.clear()
+        wow_sub.HEALTH = FleetHealth()
+        for msg in messages:
+            wow_sub.on_mqtt_message(None, None, msg)
+        wow_sub.flush_pending()
+    stats, _ = timed(run, repeat)
+    return {"name": "ingest", "messages": len(messages), **stats, "per_s": round(len(messages) / stats["median_s"])}
+
+
+def write_history(df, root):
+    for date, part in df.groupby(partition_dates(df)):
+        write_atomic(to_table(part), os.path.join(partition_dir(root, date), "bench.parquet"),
+                     compression="zstd", compression_level=ZSTD_LEVEL)
+
+
+def bench_history(rows, devices, seed, repeat, workdir):
+    df = synthetic_history(rows, devices, seed)
+    root = os.path.join(workdir, f"history-{rows}")
+    write_stats, _ = timed(lambda: write_history(df, root), repeat)
+    read_stats, history = timed(lambda: load_history(root), repeat)
+    view_stats, _ = timed(lambda: device_view(history, "sensor_7", CHART_COLUMNS), repeat)
+    query_stats, _ = timed(lambda: device_history("sensor_7", CHART_COLUMNS, points=60, root=root), repeat)
+    summary_stats, _ = timed(lambda: summarize(["device"], "hour", root=root), repeat)
+    size = sum(os.path.getsize(os.path.join(d, f)) for d, _, names in os.walk(root) for f in names)
+    return [
+        {"name": f"parquet_write[{rows}]", "rows": rows, "bytes": size, **write_stats, "per_s": round(rows / write_stats["median_s"])},
+        {"name": f"parquet_read[{rows}]", "rows": rows, **read_stats, "per_s": round(rows / read_stats["median_s"])},
+        {"name": f"display_device_data[{rows}]", "rows": rows, **view_stats},
+        {"name": f"query_device[{rows}]", "rows": rows, **query_stats},
+        {"name": f"query_hourly_summary[{rows}]", "rows": rows, **summary_stats, "per_s": round(rows / summary_stats["median_s"])},
+    ]
+
+
+def git_commit():
+    try:
+        return subprocess.run(["git", "rev-parse", "--short", "HEAD"], capture_output=True, text=True, check=True).stdout.strip()
+    except (OSError, subprocess.CalledProcessError):
+        return None
+
+
+def compare(results, baseline, tolerance):
+    """
+    Print best times against a previous run to stderr, return the benchmarks
+    slower by more than tolerance. The best of the repeats is compared, it is
+    far less noisy than the median on a shared machine.
+    """
+    before = {b["name"]: b for b in baseline["benchmarks"]}
+    regressions = []
+    print(f"{'benchmark':32} {'baseline s':>12} {'current s':>12} {'ratio':>7}", file=sys.stderr)
+    for bench in results["benchmarks"]:
+        old = before.get(bench["name"])
+        if old is None:
+            print(f"{bench['name']:32} {'-':>12} {bench['min_s']:12.4f}", file=sys.stderr)
+            continue
+        ratio = bench["min_s"] / old["min_s"] if old["min_s"] else float("inf")
+        flag = " slower" if ratio > 1 + tolerance else ""
+        print(f"{bench['name']:32} {old['min_s']:12.4f} {bench['min_s']:12.4f} {ratio:7.2f}{flag}", file=sys.stderr)
+        if flag:
+            regressions.append(bench["name"])
+    return regressions
+
+
+def main():
+    parser = argparse.ArgumentParser(description="Offline benchmarks of the data pipeline")
+    parser.add_argument("--seed", type=int, default=1)
+    parser.add_argument("--messages", type=int, default=MESSAGES)
+    parser.add_argument("--devices", type=int, default=DEVICES)
+    parser.add_argument("--repeat", type=int, default=3)
+    parser.add_argument("--quick", action="store_true", help=f"history sizes {QUICK_HISTORY_SIZES} only")
+    parser.add_argument("--output", help="write the results here as well as to stdout")
+    parser.add_argument("--compare", help="results of an earlier run to compare against")
+    parser.add_argument("--tolerance", type=float, default=0.2, help="slowdown flagged as a regression, fraction")
+    args = parser.parse_args()
+
+    payloads = list(synthetic_reports(args.messages, args.devices, args.seed))
+    benchmarks = [bench_json_decode(payloads, args.repeat)]
+    with tempfile.TemporaryDirectory() as workdir:
+        # The ingester writes under RAW_DIR relative to where it runs
+        cwd = os.getcwd()
+        os.chdir(workdir)
+        try:
+            benchmarks.append(bench_ingest(payloads, args.repeat))
+            for rows in QUICK_HISTORY_SIZES if args.quick else HISTORY_SIZES:
+                benchmarks += bench_history(rows, args.devices, args.seed, args.repeat, workdir)
+        finally:
+            os.chdir(cwd)
+
+    results = {
+        "commit": git_commit(),
+        "schema_version": SCHEMA_VERSION,
+        "python": platform.python_version(),
+        "pandas": pd.__version__,
+        "pyarrow": pa.__version__,
+        "seed": args.seed,
+        "benchmarks": benchmarks,
+    }
+    print(json.dumps(results, indent=2))
+    if args.output:
+        with open(args.output, "w") as f:
+            json.dump(results, f, indent=2)
+
+    if args.compare:
+        with open(args.compare) as f:
+            regressions = compare(results, json.load(f), args.tolerance)
+        if regressions:
+            print("Regressions:", ", ".join(regressions), file=sys.stderr)
+            sys.exit(1)
+
+
+if __name__ == "__main__":
+    main()
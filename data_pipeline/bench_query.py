@@ -0,0 +1,167 @@
+import argparse
+import json
+import os
+import resource
+import statistics
+import tempfile
+import time
+
+import numpy as np
+import pandas as pd
+import pyarrow as pa
+
+from commons import *
+from compact import DICTIONARY_COLUMNS, ZSTD_LEVEL
+from history import load_history, partition_dir, write_atomic
+from query import _speed_hist_quantiles, device_history, history_dataset, summarize
+from schema import TELEMETRY_SCHEMA
+
+# Query latency of query.py against loading the whole history into pandas, on
+# a synthetic history laid out the way compact.py leaves it: one zstd file per
+# day, sorted by device and time.
+REPORT_INTERVAL_S = 5
+DAY_S = 24 * 3600
+START = pd.Timestamp("2024-01-01", tz="UTC")
+DEVICE = "sensor_0"
+
+
+def day_table(day, devices, rng):
+    ticks = DAY_S // REPORT_INTERVAL_S
+    rows = devices * ticks
+    start_ms = (START + pd.Timedelta(days=day)).value // 1_000_000
+    # Sorted by device name, as compact.py writes them
+    names = sorted(f"sensor_{i}" for i in range(devices))
+    codes = np.repeat(np.arange(devices, dtype=np.int32), ticks)
+    timestamps = start_ms + np.tile(np.arange(ticks, dtype=np.int64) * REPORT_INTERVAL_S * 1000, devices)
+    cars = rng.poisson(0.5, rows).astype(np.uint16)
+    busy = cars > 0
+    # Every vehicle's speed in cm/s, binned the way the firmware's speed_hist does
+    vehicle_row = np.repeat(np.arange(rows), cars)
+    speeds = rng.normal(1250, 330, len(vehicle_row)).clip(150, 4000)
+    avg = (np.bincount(vehicle_row, weights=speeds, minlength=rows) / np.maximum(cars, 1)).astype(np.float32)
+    buckets = np.floor(SPEED_HIST_PER_OCTAVE * np.log2(np.maximum(speeds, SPEED_HIST_BASE_CM_S) / SPEED_HIST_BASE_CM_S))
+    buckets = buckets.clip(0, SPEED_HIST_BUCKETS - 1).astype(np.int64)
+    hist = np.zeros((rows, SPEED_HIST_BUCKETS), np.uint32)
+    np.add.at(hist, (vehicle_row, buckets), 1)
+    used = np.where(busy, SPEED_HIST_BUCKETS - np.argmax(hist[:, ::-1] > 0, axis=1), 0)
+    speed_hist = pa.ListArray.from_arrays(np.concatenate([[0], np.cumsum(used)]).astype(np.int32),
+                                          hist[np.arange(SPEED_HIST_BUCKETS) < used[:, None]])
+    columns = {
+        "device": pa.DictionaryArray.from_arrays(codes, pa.array(names)),
+        "timestamp": pa.array(timestamps, pa.timestamp("ms", tz="UTC")),
+        "version": pa.DictionaryArray.from_arrays(np.zeros(rows, np.int32), pa.array(["0.0.1"])),
+        "lane": pa.array(np.zeros(rows, np.uint8)),
+        "avg_speed": pa.array(avg),
+        "max_speed": pa.array(np.where(busy, avg + rng.uniform(0, 10, rows), 0).astype(np.float32)),
+        "min_speed": pa.array(np.where(busy, np.maximum(avg - rng.uniform(0, 10, rows), 0), 0).astype(np.float32)),
+        "num_cars": pa.array(cars),
+        "sensor_1_up": pa.array(rng.random(rows) > 0.001),
+        "sensor_2_up": pa.array(rng.random(rows) > 0.001),
+        "window_s": pa.array(np.full(rows, REPORT_INTERVAL_S, np.uint16)),
+        "speed_hist": speed_hist,
+    }
+    arrays = [columns[f.name] if f.name in columns else pa.nulls(rows, f.type) for f in TELEMETRY_SCHEMA]
+    return pa.Table.from_arrays(arrays, schema=TELEMETRY_SCHEMA)
+
+
+def write_history(root, rows, days, seed):
+    devices = max(1, rows // (days * DAY_S // REPORT_INTERVAL_S))
+    rng = np.random.default_rng(seed)
+    for day in range(days):
+        date = (START + pd.Timedelta(days=day)).strftime("%Y-%m-%d")
+        write_atomic(day_table(day, devices, rng), os.path.join(partition_dir(root, date), "compacted-bench.parquet"),
+                     compression="zstd", compression_level=ZSTD_LEVEL, row_group_size=COMPACT_ROW_GROUP_ROWS,
+                     use_dictionary=DICTIONARY_COLUMNS)
+    return devices
+
+
+def timed(fn, repeat):
+    times = []
+    for _ in range(repeat):
+        start = time.perf_counter()
+        result = fn()
+        times.append(time.perf_counter() - start)
+    return statistics.median(times), result
+
+
+def peak_rss_mb():
+    return round(resource.getrusage(resource.RUSAGE_SELF).ru_maxrss / 1024)
+
+
+def pandas_speed_quantiles(df, quantile):
+    """Per device and hour, from the summed speed histograms like summarize()."""
+    counts = df.loc[df["speed_hist"].notna(), ["device", "timestamp", "speed_hist"]].explode("speed_hist")
+    counts = counts.dropna(subset="speed_hist").astype({"speed_hist": "int64"})
+    counts["bucket"] = counts.groupby(level=0).cumcount()
+    counts["period"] = counts["timestamp"].dt.floor("h")
+    totals = counts.groupby(["device", "period", "bucket"], observed=True)["speed_hist"].sum().rename("count").reset_index()
+    return _speed_hist_quantiles(totals, ["device", "period"], quantile)
+
+
+def pandas_queries(df, end):
+    """The same questions asked of a fully loaded frame."""
+    last_week = df[(df["timestamp"] >= end - pd.Timedelta(days=7)) & (df["timestamp"] < end)]
+    day_start = end - pd.Timedelta(days=1)
+    return {
+        "dashboard": lambda: df[df["device"] == DEVICE].tail(60),
+        "device_day": lambda: df[(df["device"] == DEVICE) & (df["timestamp"] >= day_start) & (df["timestamp"] < end)],
+        "p85_by_device_hour_30d": lambda: pandas_speed_quantiles(df, 0.85),
+        "cars_per_day_7d": lambda: last_week.groupby(last_week["timestamp"].dt.floor("D"))["num_cars"].sum(),
+    }
+
+
+def layer_queries(root, end):
+    day_start = end - pd.Timedelta(days=1)
+    return {
+        "dashboard": lambda: device_history(DEVICE, ["avg_speed", "max_speed", "min_speed", "num_cars"], points=60, root=root),
+        "device_day": lambda: device_history(DEVICE, start=day_start, end=end, root=root),
+        "p85_by_device_hour_30d": lambda: summarize(["device"], "hour", start=end - pd.Timedelta(days=30), end=end, root=root),
+        "cars_per_day_7d": lambda: summarize([], "day", start=end - pd.Timedelta(days=7), end=end, quantile=None, root=root),
+    }
+
+
+def main():
+    parser = argparse.ArgumentParser(description="Latency of query.py against a full pandas load of the history")
+    parser.add_argument("--rows", type=int, default=100_000_000)
+    parser.add_argument("--days", type=int, default=30)
+    parser.add_argument("--seed", type=int, default=1)
+    parser.add_argument("--repeat", type=int, default=3)
+    parser.add_argument("--history", help="generate into, or reuse, this directory instead of a temporary one")
+    parser.add_argument("--pandas-max-rows", type=int, default=4_000_000,
+                        help="skip the full load above this, it takes close to 1 kB of memory per row")
+    args = parser.parse_args()
+
+    with tempfile.TemporaryDirectory() as workdir:
+        root = args.history or os.path.join(workdir, "raw")
+        start = time.perf_counter()
+        if not os.path.isdir(root):
+            write_history(root, args.rows, args.days, args.seed)
+        generate_s = time.perf_counter() - start
+        rows = history_dataset(root).count_rows()
+        size = sum(os.path.getsize(os.path.join(d, f)) for d, _, names in os.walk(root) for f in names)
+        end = START + pd.Timedelta(days=args.days)
+
+        results = {"rows": rows, "days": args.days, "bytes": size, "cpus": os.cpu_count(),
+                   "generate_s": round(generate_s, 1), "query": {}, "pandas": {}}
+        for name, fn in layer_queries(root, end).items():
+            seconds, out = timed(fn, args.repeat)
+            results["query"][name] = {"s": round(seconds, 4), "result_rows": len(out)}
+        results["query"]["peak_rss_mb"] = peak_rss_mb()
+
+        if rows > args.pandas_max_rows:
+            results["pandas"] = {"skipped": f"{rows} rows above --pandas-max-rows"}
+        else:
+            load_s, df = timed(lambda: load_history(root), 1)
+            results["pandas"]["load_s"] = round(load_s, 2)
+            for name, fn in pandas_queries(df, end).items():
+                seconds, out = timed(fn, args.repeat)
+                results["pandas"][name] = {"s": round(seconds, 4), "with_load_s": round(load_s + seconds, 2),
+                                           "result_rows": len(out)}
+            results["pandas"]["peak_rss_mb"] = peak_rss_mb()
+            results["speedup_with_load"] = {name: round(results["pandas"][name]["with_load_s"] / results["query"][name]["s"], 1)
+                                            for name in pandas_queries(df, end)}
+        print(json.dumps(results, indent=2))
+
+
+if __name__ == "__main__":
+    main()
@@ -0,0 +1,131 @@
+import argparse
+import json
+import math
+import random
+
+import pandas as pd
+
+from commons import *
+from compact import rollup
+from report_gate import ReportGate
+from schema import conform, expand_quiet_windows, parse_message
+
+WINDOW_S = 5
+HEARTBEAT_S = 300
+DAY_S = 24 * 3600
+# MQTT PUBLISH fixed header, topic length field and packet id (QoS1)
+PUBLISH_OVERHEAD = 2 + 2 + 2
+# Vehicles per hour on a residential street, by hour of day
+HOURLY_TRAFFIC = [2, 1, 1, 1, 2, 6, 25, 70, 110, 60, 40, 45, 50, 45, 40, 50, 80, 110, 70, 40, 25, 15, 8, 4]
+# Chance per window of a sensor fault starting, and how long one lasts
+SENSOR_FAULT_RATE = 1 / 50_000
+SENSOR_FAULT_WINDOWS = 120
+
+
+def poisson(rng, mean):
+    # Knuth, fine for the few vehicles a window sees
+    limit, k, p = math.exp(-mean), 0, rng.random()
+    while p > limit:
+        k += 1
+        p *= rng.random()
+    return k
+
+
+def simulate_day(devices, seed):
+    """Every window of every device, as the device would report it without suppression."""
+    rng = random.Random(seed)
+    for i in range(devices):
+        device = f"sensor_{i}"
+        scale = rng.uniform(0.5, 1.5)
+        fault = [0, 0]
+        for tick in range(DAY_S // WINDOW_S):
+            hour = tick * WINDOW_S // 3600
+            cars = poisson(rng, HOURLY_TRAFFIC[hour] * scale * WINDOW_S / 3600)
+            speeds = [rng.uniform(15, 60) for _ in range(cars)]
+            for s in range(2):
+                if fault[s] == 0 and rng.random() < SENSOR_FAULT_RATE:
+                    fault[s] = SENSOR_FAULT_WINDOWS
+                fault[s] = max(fault[s] - 1, 0)
+            yield {
+                "device": device, "version": "0.0.1", "ts": 1_700_000_000_000 + (tick + 1) * WINDOW_S * 1000, "lane": 0,
+                "data": {"avg_speed": round(sum(speeds) / cars, 2) if cars else 0, "max_speed": round(max(speeds, default=0), 2),
+                         "min_speed": round(min(speeds, default=0), 2), "num_cars": cars,
+                         "sensor_1_up": int(fault[0] == 0), "sensor_2_up": int(fault[1] == 0),
+                         "window_s": WINDOW_S, "quiet_windows": 0},
+            }
+
+
+def message_bytes(message):
+    return len(device_topic(message["device"], "data")) + len(json.dumps(message)) + PUBLISH_OVERHEAD
+
+
+def ingest(messages):
+    """What wow_sub.py stores for a stream of reports."""
+    rows, last = [], {}
+    for message in messages:
+        row = parse_message(message)
+        key = (row["device"], row["lane"])
+        rows.extend(expand_quiet_windows(row, last.get(key)))
+        last[key] = row
+    return conform(pd.DataFrame(rows))
+
+
+def daily_rollup(df):
+    out = rollup(df)
+    return out.sort_values(["device", "lane"]).reset_index(drop=True)
+
+
+def main():
+    parser = argparse.ArgumentParser(description="Message rate of report-on-change telemetry over a simulated day")
+    parser.add_argument("--devices", type=int, default=50)
+    parser.add_argument("--heartbeat", type=int, default=HEARTBEAT_S, help="s, 0 reports every window")
+    parser.add_argument("--seed", type=int, default=1)
+    args = parser.parse_args()
+
+    every_window = list(simulate_day(args.devices, args.seed))
+
+    gates = {}
+    adaptive = []
+    for message in every_window:
+        data = message["data"]
+        gate = gates.setdefault((message["device"], message["lane"]), ReportGate())
+        # No OTA and no lost lane events in the simulated day
+        quiet = gate.window({"window_s": WINDOW_S, "num_cars": data["num_cars"],
+                             "sensor_1_up": data["sensor_1_up"], "sensor_2_up": data["sensor_2_up"],
+                             "ota_active": 0, "events_dropped": 0}, args.heartbeat)
+        if quiet is not None:
+            adaptive.append({**message, "data": {**data, "quiet_windows": quiet}})
+
+    # Windows held back after a device's last report of the day are only put
+    # back with its next report, so compare over the windows reported so far
+    reconstructed = ingest(adaptive)
+    last_ts = reconstructed.groupby("device", observed=True)["timestamp"].max()
+    full_df = ingest(every_window)
+    full = daily_rollup(full_df[full_df["timestamp"] <= full_df["device"].map(last_ts).astype("datetime64[ns, UTC]")])
+    rebuilt = daily_rollup(reconstructed)
+    columns = ["windows", "num_cars", "max_speed", "min_speed", "sensor_1_up", "sensor_2_up", "first_ts", "last_ts"]
+    try:
+        pd.testing.assert_frame_equal(full[columns + ["avg_speed"]], rebuilt[columns + ["avg_speed"]], check_dtype=False)
+        exact = True
+    except AssertionError:
+        exact = False
+
+    every_bytes = sum(message_bytes(m) for m in every_window)
+    adaptive_bytes = sum(message_bytes(m) for m in adaptive)
+    print(json.dumps({
+        "devices": args.devices,
+        "window_s": WINDOW_S,
+        "heartbeat_s": args.heartbeat,
+        "seed": args.seed,
+        "every_window": {"messages": len(every_window), "bytes": every_bytes,
+                         "per_device_per_hour": round(len(every_window) / args.devices / 24, 1)},
+        "report_on_change": {"messages": len(adaptive), "bytes": adaptive_bytes,
+                             "per_device_per_hour": round(len(adaptive) / args.devices / 24, 1)},
+        "message_reduction": round(1 - len(adaptive) / len(every_window), 4),
+        "byte_reduction": round(1 - adaptive_bytes / every_bytes, 4),
+        "rollup_exact": bool(exact),
+    }, indent=2))
+
+
+if __name__ == "__main__":
+    main()
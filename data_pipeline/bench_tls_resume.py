@@ -0,0 +1,247 @@
+import argparse
+import json
+import os
+import socket
+import ssl
+import statistics
+import struct
+import subprocess
+import tempfile
+import threading
+import time
+
+from commons import *
+
+# Cost of an MQTT reconnect over TLS with and without resuming the previous
+# session, as device/speed_sensor/main/mqtt_tls.c does: TCP connect, TLS 1.2
+# handshake (mbedTLS's default on the device) and CONNECT / CONNACK, counting
+# the bytes each way and timing the handshake.
+#
+# Against the broker's TLS listener (see mosquitto/README.md):
+#
+#   python bench_tls_resume.py --host 172.20.10.10 --port 8883 --user recorder <password>
+#
+# or with --local against a TLS server of its own on localhost, with a
+# throwaway CA and an RSA 2048 server key like the WoW CA's, to see the
+# protocol cost without a broker. Handshake times here are this machine's;
+# the device's, and its heap, are in its MQTT_TLS / MQTT_EVENT_CONNECTED log
+# lines.
+BENCH_CLIENT_ID = "bench_tls_resume"
+
+
+def connect_packet(client_id, creds):
+    """MQTT 3.1.1 CONNECT, clean session, 60 s keepalive."""
+
+    def field(text):
+        raw = text.encode("utf-8")
+        return struct.pack("!H", len(raw)) + raw
+
+    flags = 0x02
+    payload = field(client_id)
+    if creds:
+        flags |= 0xC0
+        payload += field(creds[0]) + field(creds[1])
+    body = field("MQTT") + bytes([4, flags]) + struct.pack("!H", 60) + payload
+    length = b""
+    remaining = len(body)
+    while True:
+        byte, remaining = remaining % 128, remaining // 128
+        length += bytes([byte | (0x80 if remaining else 0)])
+        if not remaining:
+            break
+    return b"\x10" + length + body
+
+
+class CountingTls:
+    """TLS over a plain socket through memory BIOs, counting the bytes on the wire."""
+
+    def __init__(self, sock, context, session):
+        self.sock = sock
+        self.incoming = ssl.MemoryBIO()
+        self.outgoing = ssl.MemoryBIO()
+        self.tls = context.wrap_bio(self.incoming, self.outgoing, session=session)
+        self.bytes_out = 0
+        self.bytes_in = 0
+
+    def _flush(self):
+        data = self.outgoing.read()
+        if data:
+            self.sock.sendall(data)
+            self.bytes_out += len(data)
+
+    def _fill(self):
+        data = self.sock.recv(16384)
+        if not data:
+            raise ConnectionError("closed by the server")
+        self.incoming.write(data)
+        self.bytes_in += len(data)
+
+    def _call(self, fn, *args):
+        while True:
+            try:
+                result = fn(*args)
+                self._flush()
+                return result
+            except ssl.SSLWantReadError:
+                self._flush()
+                self._fill()
+
+    def handshake(self):
+        self._call(self.tls.do_handshake)
+
+    def send(self, data):
+        self._call(self.tls.write, data)
+
+    def recv(self, size):
+        return self._call(self.tls.read, size)
+
+    def close(self):
+        try:
+            self.tls.unwrap()
+        except ssl.SSLError:
+            pass
+        self._flush()
+        self.sock.close()
+
+
+def reconnect(host, port, context, session, creds):
+    """One connect, with the session to offer. Its figures and the session to offer next."""
+    start = time.perf_counter()
+    sock = socket.create_connection((host, port), timeout=10)
+    # Otherwise CONNECT waits on the delayed ACK of a resumed handshake's last flight
+    sock.setsockopt(socket.IPPROTO_TCP, socket.TCP_NODELAY, 1)
+    tcp_s = time.perf_counter() - start
+    conn = CountingTls(sock, context, session)
+    conn.handshake()
+    handshake_s = time.perf_counter() - start - tcp_s
+    handshake_bytes = (conn.bytes_out, conn.bytes_in)
+
+    conn.send(connect_packet(BENCH_CLIENT_ID, creds))
+    connack = b""
+    while len(connack) < 4:
+        connack += conn.recv(4 - len(connack))
+    total_s = time.perf_counter() - start
+    if connack[0] != 0x20 or connack[3] != 0:
+        raise ConnectionError(f"CONNACK {connack.hex()}")
+    # A TLS 1.3 ticket arrives after the handshake, take it before closing
+    next_session = conn.tls.session
+    reused = conn.tls.session_reused
+    conn.close()
+    return {
+        "reused": reused,
+        "handshake_ms": handshake_s * 1000,
+        "connect_ms": total_s * 1000,
+        "handshake_bytes_out": handshake_bytes[0],
+        "handshake_bytes_in": handshake_bytes[1],
+        "bytes_out": conn.bytes_out,
+        "bytes_in": conn.bytes_in,
+    }, next_session
+
+
+def run(host, port, context, creds, connects, resume):
+    results = []
+    session = None
+    for _ in range(connects):
+        result, next_session = reconnect(host, port, context, session if resume else None, creds)
+        results.append(result)
+        session = next_session
+    # The first connect has nothing to resume
+    steady = results[1:] if resume and len(results) > 1 else results
+
+    def median(key):
+        return statistics.median(r[key] for r in steady)
+
+    return {
+        "connects": len(results),
+        "reused": sum(r["reused"] for r in results),
+        "handshake_ms_median": round(median("handshake_ms"), 2),
+        "handshake_ms_max": round(max(r["handshake_ms"] for r in steady), 2),
+        "connect_ms_median": round(median("connect_ms"), 2),
+        "handshake_bytes_out": int(median("handshake_bytes_out")),
+        "handshake_bytes_in": int(median("handshake_bytes_in")),
+        "bytes_out": int(median("bytes_out")),
+        "bytes_in": int(median("bytes_in")),
+    }
+
+
+def make_local_certs(directory):
+    """A throwaway CA and a localhost server certificate signed by it."""
+
+    def openssl(*args):
+        subprocess.run(["openssl", *args], cwd=directory, check=True, capture_output=True)
+
+    openssl("req", "-x509", "-newkey", "rsa:2048", "-nodes", "-keyout", "ca.key", "-out", "ca.pem",
+            "-days", "1", "-subj", "/CN=bench_tls_resume CA")
+    openssl("req", "-newkey", "rsa:2048", "-nodes", "-keyout", "server.key", "-out", "server.csr",
+            "-subj", "/CN=localhost")
+    openssl("x509", "-req", "-in", "server.csr", "-CA", "ca.pem", "-CAkey", "ca.key", "-CAcreateserial",
+            "-out", "server.crt", "-days", "1")
+    return os.path.join(directory, "ca.pem"), os.path.join(directory, "server.crt"), os.path.join(directory, "server.key")
+
+
+def serve_local(certfile, keyfile):
+    """TLS server on localhost answering any CONNECT with a CONNACK. Its port."""
+    context = ssl.SSLContext(ssl.PROTOCOL_TLS_SERVER)
+    context.load_cert_chain(certfile, keyfile)
+    listener = socket.create_server(("127.0.0.1", 0))
+
+    def handle(raw):
+        raw.setsockopt(socket.IPPROTO_TCP, socket.TCP_NODELAY, 1)
+        try:
+            with context.wrap_socket(raw, server_side=True) as conn:
+                header = conn.recv(2)
+                length, shift, byte = header[1] & 0x7F, 7, header[1]
+                while byte & 0x80:
+                    byte = conn.recv(1)[0]
+                    length |= (byte & 0x7F) << shift
+                    shift += 7
+                while length > 0:
+                    length -= len(conn.recv(length))
+                conn.sendall(b"\x20\x02\x00\x00")
+                conn.recv(1)
+        except (OSError, ssl.SSLError, IndexError):
+            pass
+
+    def accept():
+        while True:
+            raw, _ = listener.accept()
+            threading.Thread(target=handle, args=(raw,), daemon=True).start()
+
+    threading.Thread(target=accept, daemon=True).start()
+    return listener.getsockname()[1]
+
+
+def main():
+    parser = argparse.ArgumentParser(description="MQTT over TLS reconnect cost, with and without session resumption")
+    parser.add_argument("--host", default=SERVER_HOST)
+    parser.add_argument("--port", type=int, default=SERVER_PORT)
+    parser.add_argument("--ca", default="cert.pem", help="CA the broker's certificate is signed by")
+    parser.add_argument("--user", nargs=2, metavar=("USER", "PASSWORD"))
+    parser.add_argument("--connects", type=int, default=50, help="per mode")
+    parser.add_argument("--tls13", action="store_true", help="allow TLS 1.3, the device only speaks 1.2")
+    parser.add_argument("--local", action="store_true", help="against a TLS server of its own on localhost")
+    args = parser.parse_args()
+
+    with tempfile.TemporaryDirectory() as directory:
+        host, port, ca = args.host, args.port, args.ca
+        if args.local:
+            ca, certfile, keyfile = make_local_certs(directory)
+            host, port = "127.0.0.1", serve_local(certfile, keyfile)
+
+        context = ssl.SSLContext(ssl.PROTOCOL_TLS_CLIENT)
+        # The device verifies the chain but not the common name either
+        context.check_hostname = False
+        context.load_verify_locations(ca)
+        if not args.tls13:
+            context.maximum_version = ssl.TLSVersion.TLSv1_2
+
+        creds = tuple(args.user) if args.user else USER_CREDS
+        results = {
+            "full": run(host, port, context, creds, args.connects, resume=False),
+            "resumed": run(host, port, context, creds, args.connects, resume=True),
+        }
+    print(json.dumps(results, indent=2))
+
+
+if __name__ == "__main__":
+    main()
@@ -0,0 +1,64 @@
+import argparse
+import json
+import random
+import time
+
+from commons import *
+from schema import parse_message
+
+REPORT_INTERVAL_S = 5
+# MQTT PUBLISH fixed header, topic length field and packet id (QoS1)
+PUBLISH_OVERHEAD = 2 + 2 + 2
+
+
+def device_messages(devices, duration_s, seed):
+    rng = random.Random(seed)
+    for tick in range(duration_s // REPORT_INTERVAL_S):
+        for i in range(devices):
+            device = f"sensor_{i}"
+            yield device, json.dumps({
+                "device": device, "version": "0.0.1", "ts": 1_700_000_000_000 + tick * REPORT_INTERVAL_S * 1000,
+                "data": {"avg_speed": round(rng.uniform(15, 100), 2), "max_speed": round(rng.uniform(100, 150), 2),
+                         "min_speed": round(rng.uniform(0, 15), 2), "num_cars": rng.randint(0, 10),
+                         "sensor_1_up": 1, "sensor_2_up": 1},
+            })
+
+
+def consume(messages, selected):
+    """What the dashboard does per message it is sent: parse it, keep the selected device's rows."""
+    start = time.process_time()
+    received_bytes = 0
+    kept = 0
+    for topic, payload in messages:
+        received_bytes += len(topic) + len(payload) + PUBLISH_OVERHEAD
+        row = parse_message(json.loads(payload))
+        kept += row["device"] == selected
+    return {"messages": len(messages), "bytes": received_bytes, "cpu_s": round(time.process_time() - start, 4), "rows_shown": kept}
+
+
+def main():
+    parser = argparse.ArgumentParser(description="Dashboard consumer load, fleet-wide topic versus per-device topics")
+    parser.add_argument("--devices", type=int, default=1000)
+    parser.add_argument("--duration", type=int, default=600, help="simulated seconds")
+    parser.add_argument("--seed", type=int, default=1)
+    args = parser.parse_args()
+
+    messages = list(device_messages(args.devices, args.duration, args.seed))
+    selected = "sensor_7"
+
+    # Before: one shared /device/data topic, the consumer gets the whole fleet
+    shared = [("/device/data", payload) for _, payload in messages]
+    # After: the broker only forwards the subscribed /device/<id>/data topic
+    targeted = [(device_topic(device, "data"), payload) for device, payload in messages if device == selected]
+
+    print(json.dumps({
+        "devices": args.devices,
+        "duration_s": args.duration,
+        "seed": args.seed,
+        "shared_topic": consume(shared, selected),
+        "per_device_topic": consume(targeted, selected),
+    }, indent=2))
+
+
+if __name__ == "__main__":
+    main()
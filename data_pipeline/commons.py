@@ -1,9 +1,50 @@
 SERVER_HOST = "mqtt.wow-iot.ie"
 SERVER_PORT = 8883
 USER_CREDS = ("data_ingestion", "mqtttest")
-SENSOR_FILE = "sensor_readings.parquet"
+INGEST_CLIENT_ID = "wow_ingest"
+SENSOR_FILE = "sensor_readings.parquet"  # Legacy single file, imported by compact.py
+HISTORY_DIR = "sensor_history"
+RAW_DIR = f"{HISTORY_DIR}/raw"
+ROLLUP_DIR = f"{HISTORY_DIR}/rollup"
+INGEST_FLUSH_ROWS = 500
+INGEST_FLUSH_S = 10
+RAW_RETENTION_DAYS = 30
+COMPACT_INTERVAL_S = 3600
+COMPACT_ROW_GROUP_ROWS = 128 * 1024
 UPDATE_INTERVAL = 5  # seconds
+LIVE_FEED_BUFFER = 1000  # Rows kept for dashboard sessions catching up
+HEALTH_FILE = f"{HISTORY_DIR}/health.json"  # Fleet health snapshot, rewritten by the ingester
+HEALTH_SILENT_S = 900  # Three default heartbeats without a message
+HEALTH_ALERTS_KEPT = 100
 DUMMY_CLIENTS = 8
+# Vehicle speed histogram of each report, must match device/speed_sensor/main/speed_hist.h
+SPEED_HIST_BUCKETS = 32
+SPEED_HIST_PER_OCTAVE = 8
+SPEED_HIST_BASE_CM_S = 300
+
+# Per-device topic tree: /device/<id>/data, /bump, /upgrade, /config, /state, /history
+DEVICE_DATA_TOPICS = "/device/+/data"
+SITE_BATCH_TOPICS = "/site/+/batch"
+
+
+def device_topic(device, leaf):
+    return f"/device/{device}/{leaf}"
+
+
+def topic_device(topic):
+    """Device id of a /device/<id>/... topic, None for anything else."""
+    parts = topic.split("/")
+    return parts[2] if len(parts) > 3 and parts[1] == "device" else None
+
+
+def site_topic(site, leaf):
+    return f"/site/{site}/{leaf}"
+
+
+def topic_site(topic):
+    """Site id of a /site/<id>/... topic, None for anything else."""
+    parts = topic.split("/")
+    return parts[2] if len(parts) > 3 and parts[1] == "site" else None
 
 SENSOR_VERSIONS = {
     "sensor_0": "",
@@ -18,6 +59,18 @@ SENSOR_VERSIONS = {
     "sensor_9": "",
 }
 
+# Devices behind each edge gateway. A gateway publishes as the user named
+# after its site (see mosquitto/acl), so it can only vouch for these; batch
+# rows for any other device are rejected
+SITE_DEVICES = {
+    "dublin_port": {"sensor_1", "sensor_6"},
+}
+
+
+def device_site(device):
+    """Site whose gateway batches a device's reports, None if it reports directly."""
+    return next((site for site, devices in SITE_DEVICES.items() if device in devices), None)
+
 SENSOR_LOCATIONS = {
     "sensor_0": {"lat": 53.353805, "lon": -6.260310, "label": "North of River Liffey"},
     "sensor_1": {"lat": 53.334103, "lon": -6.267493, "label": "Near Dublin Port"},
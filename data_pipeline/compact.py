@@ -0,0 +1,168 @@
+import argparse
+import json
+import os
+import shutil
+import time
+import uuid
+from datetime import datetime, timedelta
+
+import pandas as pd
+import pyarrow as pa
+import pyarrow.parquet as pq
+
+from commons import *
+from history import *
+from schema import conform, to_table
+
+# Low-cardinality columns, stored as dictionaries
+DICTIONARY_COLUMNS = ["device", "version"]
+ZSTD_LEVEL = 9
+# Names of the files a compacted file replaced, so a run that died before
+# removing them can tell they are already covered
+COMPACTED_FROM_KEY = b"wow_compacted_from"
+COMPACTED_PREFIX = "compacted-"
+
+
+def timed_scan():
+    start = time.perf_counter()
+    rows = len(load_history())
+    return rows, time.perf_counter() - start
+
+
+def import_legacy():
+    """Move the old single-file history into the partitioned layout, once."""
+    if not os.path.exists(SENSOR_FILE):
+        return
+    df = conform(pd.read_parquet(SENSOR_FILE))
+    for date, part in df.groupby(partition_dates(df)):
+        write_atomic(to_table(part), os.path.join(partition_dir(RAW_DIR, date), f"legacy-{uuid.uuid4().hex[:8]}.parquet"))
+    os.replace(SENSOR_FILE, SENSOR_FILE + ".imported")
+    print(f"Imported {len(df)} rows from {SENSOR_FILE}")
+
+
+def rollup(df):
+    """Daily per-device (and lane) summary, kept after the raw windows expire."""
+    df = df.copy()
+    df["speed_sum"] = df["avg_speed"] * df["num_cars"]
+    busy = df["num_cars"] > 0
+    df["min_speed"] = df["min_speed"].where(busy)
+    df["max_speed"] = df["max_speed"].where(busy)
+
+    out = df.groupby(["device", "lane"], as_index=False, observed=True).agg(
+        windows=("timestamp", "size"),
+        num_cars=("num_cars", "sum"),
+        speed_sum=("speed_sum", "sum"),
+        max_speed=("max_speed", "max"),
+        min_speed=("min_speed", "min"),
+        sensor_1_up=("sensor_1_up", "mean"),
+        sensor_2_up=("sensor_2_up", "mean"),
+        first_ts=("timestamp", "min"),
+        last_ts=("timestamp", "max"),
+    )
+    out["avg_speed"] = (out["speed_sum"] / out["num_cars"]).where(out["num_cars"] > 0)
+    return out.drop(columns="speed_sum")
+
+
+def compacted_from(path):
+    metadata = pq.read_schema(path).metadata or {}
+    return json.loads(metadata.get(COMPACTED_FROM_KEY, b"[]"))
+
+
+def remove_covered(files):
+    """
+    Remove the inputs of an earlier compaction that are still there because
+    it stopped before removing them, which would otherwise be counted twice.
+    Returns the files left.
+    """
+    covered = set()
+    for f in files:
+        if os.path.basename(f).startswith(COMPACTED_PREFIX):
+            covered.update(compacted_from(f))
+    stale = [f for f in files if os.path.basename(f) in covered]
+    for f in stale:
+        os.remove(f)
+    if stale:
+        print(f"Removed {len(stale)} files already compacted in {os.path.dirname(stale[0])}")
+    return [f for f in files if f not in stale]
+
+
+def compact_partition(date):
+    """
+    Merge a day's files into one sorted, zstd-compressed file. Only the files
+    listed here are replaced, anything the ingester writes meanwhile is left
+    for the next run, so writers are never blocked.
+
+    Safe to rerun after a crash at any point: the compacted file records its
+    inputs, and those still around are removed before compacting again.
+    """
+    files = remove_covered(list_part_files(RAW_DIR, date))
+    rollup_path = os.path.join(partition_dir(ROLLUP_DIR, date), "rollup.parquet")
+    done = len(files) == 1 and os.path.basename(files[0]).startswith(COMPACTED_PREFIX)
+    if not files or (done and os.path.exists(rollup_path)):
+        return False
+
+    df = pa.concat_tables([read_part(f) for f in files]).unify_dictionaries().to_pandas()
+    if done:
+        # Stopped before the rollup last time
+        write_atomic(pa.Table.from_pandas(rollup(df), preserve_index=False), rollup_path, compression="zstd")
+        return True
+
+    # Devices in name order, so each row group's device statistics cover a
+    # narrow range and query.py can skip it for other devices
+    df["device"] = df["device"].cat.reorder_categories(sorted(df["device"].cat.categories))
+    df = df.sort_values(["device", "timestamp"], kind="stable")
+    stamp = datetime.now().strftime("%Y%m%dT%H%M%S")
+    path = os.path.join(partition_dir(RAW_DIR, date), f"{COMPACTED_PREFIX}{stamp}-{uuid.uuid4().hex[:8]}.parquet")
+    table = to_table(df)
+    inputs = json.dumps([os.path.basename(f) for f in files]).encode()
+    table = table.replace_schema_metadata({**table.schema.metadata, COMPACTED_FROM_KEY: inputs})
+    write_atomic(table, path, compression="zstd", compression_level=ZSTD_LEVEL,
+                 row_group_size=COMPACT_ROW_GROUP_ROWS,
+                 use_dictionary=[c for c in DICTIONARY_COLUMNS if c in df.columns])
+    write_atomic(pa.Table.from_pandas(rollup(df), preserve_index=False), rollup_path, compression="zstd")
+    # Readers may briefly see both the new file and its inputs until these are gone
+    for f in files:
+        os.remove(f)
+    return True
+
+
+def enforce_retention(today):
+    cutoff = (today - timedelta(days=RAW_RETENTION_DAYS)).isoformat()
+    expired = [date for date in list_partitions(RAW_DIR) if date < cutoff]
+    for date in expired:
+        if not os.path.exists(os.path.join(partition_dir(ROLLUP_DIR, date), "rollup.parquet")):
+            compact_partition(date)
+        shutil.rmtree(partition_dir(RAW_DIR, date))
+    return expired
+
+
+def run_once():
+    bytes_before = dir_bytes(RAW_DIR) + (os.path.getsize(SENSOR_FILE) if os.path.exists(SENSOR_FILE) else 0)
+    import_legacy()
+    rows_before, scan_before = timed_scan()
+
+    compacted = [date for date in list_partitions(RAW_DIR) if compact_partition(date)]
+    expired = enforce_retention(datetime.now().date())
+
+    rows_after, scan_after = timed_scan()
+    bytes_after = dir_bytes(RAW_DIR)
+    print(f"Compacted {len(compacted)} partitions, expired {len(expired)}")
+    print(f"Raw bytes: {bytes_before} -> {bytes_after}")
+    print(f"Full scan: {rows_before} rows in {scan_before:.3f}s -> {rows_after} rows in {scan_after:.3f}s")
+
+
+def main():
+    parser = argparse.ArgumentParser(description="Compact, compress and expire the ingested sensor history")
+    parser.add_argument("--interval", type=int, default=0,
+                        help=f"keep running, every N seconds (e.g. {COMPACT_INTERVAL_S}); default runs once")
+    args = parser.parse_args()
+
+    while True:
+        run_once()
+        if not args.interval:
+            break
+        time.sleep(args.interval)
+
+
+if __name__ == "__main__":
+    main()
@@ -19,17 +19,17 @@ def publish_sensor_data(i, client):
             "device": f"sensor_{i}",
             "version": "1.0.1",
             "data": {
-                "avg_speed": str(round(random.uniform(15, 100), 2)),
-                "max_speed": str(round(random.uniform(120, 150), 2)),
-                "min_speed": str(round(random.uniform(0, 15), 2)),
-                "num_cars": str(random.randint(0, 10)),
-                "sensor_1_up": "1",
-                "sensor_2_up": "1"
+                "avg_speed": round(random.uniform(15, 100), 2),
+                "max_speed": round(random.uniform(120, 150), 2),
+                "min_speed": round(random.uniform(0, 15), 2),
+                "num_cars": random.randint(0, 10),
+                "sensor_1_up": 1,
+                "sensor_2_up": 1
             }
         }
         
         # Publishing the sensor data
-        client.publish("/device/data", json.dumps(sensor_data))
+        client.publish(device_topic(sensor_data["device"], "data"), json.dumps(sensor_data))
         print(f"{i} Published: {sensor_data}")
         
         # Wait for 5 seconds before next publish
@@ -0,0 +1,248 @@
+import time
+from array import array
+from collections import OrderedDict, deque
+
+from commons import *
+
+# Uptime is kept over trailing spans of window time, each a ring of buckets
+# with running totals, so updating or reading it costs the same whatever the
+# span. A report lands in the bucket of its timestamp, so a span is exact to
+# one bucket.
+UPTIME_SPANS = {"1h": (3600, 12), "24h": (24 * 3600, 24)}
+SENSORS = ("sensor_1_up", "sensor_2_up")
+
+
+class SlidingUptime:
+    """Seconds observed, and seconds each sensor was up, over a trailing span."""
+
+    __slots__ = ("bucket_s", "head", "seen", "up", "seen_total", "up_total")
+
+    def __init__(self, span_s, buckets):
+        self.bucket_s = span_s // buckets
+        self.head = None
+        self.seen = array("I", [0]) * buckets
+        self.up = [array("I", [0]) * buckets for _ in SENSORS]
+        self.seen_total = 0
+        self.up_total = [0] * len(SENSORS)
+
+    def add(self, ts_s, seconds, up):
+        buckets = len(self.seen)
+        bucket = ts_s // self.bucket_s
+        if self.head is None:
+            self.head = bucket
+        elif bucket > self.head:
+            # Expire what slid out, at most one full turn of the ring
+            for expired in range(self.head + 1, min(bucket, self.head + buckets) + 1):
+                i = expired % buckets
+                self.seen_total -= self.seen[i]
+                self.seen[i] = 0
+                for s in range(len(SENSORS)):
+                    self.up_total[s] -= self.up[s][i]
+                    self.up[s][i] = 0
+            self.head = bucket
+        elif bucket <= self.head - buckets:
+            return
+        i = bucket % buckets
+        self.seen[i] += seconds
+        self.seen_total += seconds
+        for s, is_up in enumerate(up):
+            if is_up:
+                self.up[s][i] += seconds
+                self.up_total[s] += seconds
+
+    def ratios(self):
+        return [round(up / self.seen_total, 4) if self.seen_total else None for up in self.up_total]
+
+
+class LaneHealth:
+    """Sensor state of one device lane, in window time."""
+
+    __slots__ = ("last_ts", "up", "down_since", "down_s", "longest_down_s", "missing_s", "uptime")
+
+    def __init__(self):
+        self.last_ts = None
+        self.up = [True] * len(SENSORS)
+        self.down_since = [None] * len(SENSORS)
+        self.down_s = [0] * len(SENSORS)        # Current run of down windows
+        self.longest_down_s = [0] * len(SENSORS)
+        self.missing_s = 0                      # Window time no report accounts for
+        self.uptime = {name: SlidingUptime(*span) for name, span in UPTIME_SPANS.items()}
+
+    def add(self, ts_s, window_s, quiet_s, up):
+        """Account a report and the quiet windows before it, return the sensors that changed."""
+        if self.last_ts is not None and window_s:
+            self.missing_s += max(0, ts_s - self.last_ts - window_s - quiet_s)
+        self.last_ts = ts_s
+        # Quiet windows are only held back while health is unchanged, so they
+        # carry the previous state
+        if quiet_s:
+            for uptime in self.uptime.values():
+                uptime.add(ts_s - window_s, quiet_s, self.up)
+        for uptime in self.uptime.values():
+            uptime.add(ts_s, window_s, up)
+
+        changed = []
+        for s, is_up in enumerate(up):
+            if not self.up[s]:
+                self.down_s[s] += quiet_s
+            if is_up and not self.up[s]:
+                self.longest_down_s[s] = max(self.longest_down_s[s], self.down_s[s])
+                changed.append(s)
+            elif not is_up:
+                if self.up[s]:
+                    self.down_since[s] = ts_s - window_s
+                    self.down_s[s] = 0
+                    changed.append(s)
+                self.down_s[s] += window_s
+            self.up[s] = is_up
+        return changed
+
+    def describe(self):
+        return {
+            "last_ts": self.last_ts,
+            "sensors": [{
+                "up": self.up[s],
+                "down_since": None if self.up[s] else self.down_since[s],
+                "down_s": 0 if self.up[s] else self.down_s[s],
+                "longest_down_s": max(self.longest_down_s[s], 0 if self.up[s] else self.down_s[s]),
+                **{f"uptime_{name}": uptime.ratios()[s] for name, uptime in self.uptime.items()},
+            } for s in range(len(SENSORS))],
+            "missing_s": self.missing_s,
+        }
+
+
+class DeviceHealth:
+    """Arrival of a device's messages, in ingester time, and its lanes."""
+
+    __slots__ = ("last_seen", "gap_s", "max_gap_s", "messages", "lanes")
+
+    def __init__(self):
+        self.last_seen = None
+        self.gap_s = 0.0
+        self.max_gap_s = 0.0
+        self.messages = 0
+        self.lanes = {}
+
+
+class FleetHealth:
+    """
+    Streaming health of every device from its reports: when it was last
+    heard from, gaps between messages, sensor up/down runs and uptime over
+    sliding spans. Each message costs O(1), a device goes silent on check()
+    without visiting the others, and snapshot() only walks what is unhealthy,
+    so the state of the fleet never needs a history scan.
+
+    Alerts are raised on transitions only: a sensor going down or coming
+    back, a device falling silent or reporting again.
+    """
+
+    def __init__(self, silent_after_s=HEALTH_SILENT_S, on_alert=None):
+        self.silent_after_s = silent_after_s
+        self.on_alert = on_alert
+        self.devices = {}
+        # Devices heard from, least recently first
+        self.by_last_seen = OrderedDict()
+        self.silent = set()
+        self.down = set()                       # (device, lane, sensor index)
+        self.alerts = deque(maxlen=HEALTH_ALERTS_KEPT)
+        self.fleet_uptime = {name: SlidingUptime(*span) for name, span in UPTIME_SPANS.items()}
+        self.messages = 0
+
+    def _alert(self, now, kind, device, **detail):
+        alert = {"ts": now, "kind": kind, "device": device, **detail}
+        self.alerts.append(alert)
+        if self.on_alert:
+            self.on_alert(alert)
+
+    def update(self, row, now=None):
+        """Account one typed report (see schema.parse_message), not older than the lane's last."""
+        now = time.time() if now is None else now
+        device = row["device"]
+        health = self.devices.get(device)
+        if health is None:
+            health = self.devices[device] = DeviceHealth()
+        elif health.last_seen is not None:
+            health.gap_s = now - health.last_seen
+            health.max_gap_s = max(health.max_gap_s, health.gap_s)
+        if device in self.silent:
+            self.silent.discard(device)
+            self._alert(now, "back", device, silent_s=round(health.gap_s))
+        health.last_seen = now
+        health.messages += 1
+        self.by_last_seen[device] = now
+        self.by_last_seen.move_to_end(device)
+        self.messages += 1
+
+        lane_id = row["lane"]
+        lane = health.lanes.get(lane_id)
+        if lane is None:
+            lane = health.lanes[lane_id] = LaneHealth()
+        ts_s = row["timestamp"].value // 1_000_000_000
+        if lane.last_ts is not None and ts_s <= lane.last_ts:
+            return
+        window_s = row.get("window_s")
+        if window_s:
+            quiet_s = window_s * (row.get("quiet_windows") or 0)
+        else:
+            # Older firmware and site batches, the report covers the time since the last
+            window_s = ts_s - lane.last_ts if lane.last_ts is not None else UPDATE_INTERVAL
+            quiet_s = 0
+        # A missing flag counts as up, as edge_gateway/aggregator.py does
+        up = [row.get(sensor) is not False for sensor in SENSORS]
+        for uptime in self.fleet_uptime.values():
+            if quiet_s:
+                uptime.add(ts_s - window_s, quiet_s, lane.up)
+            uptime.add(ts_s, window_s, up)
+
+        for s in lane.add(ts_s, window_s, quiet_s, up):
+            key = (device, lane_id, s)
+            if lane.up[s]:
+                self.down.discard(key)
+                self._alert(now, "sensor_up", device, lane=lane_id, sensor=s + 1, down_s=lane.down_s[s])
+            else:
+                self.down.add(key)
+                self._alert(now, "sensor_down", device, lane=lane_id, sensor=s + 1, since=lane.down_since[s])
+
+    def check(self, now=None):
+        """Mark devices not heard from for silent_after_s as silent."""
+        now = time.time() if now is None else now
+        while self.by_last_seen:
+            device, last_seen = next(iter(self.by_last_seen.items()))
+            if now - last_seen < self.silent_after_s:
+                break
+            del self.by_last_seen[device]
+            self.silent.add(device)
+            self._alert(now, "silent", device, last_seen=last_seen)
+
+    def device(self, device):
+        health = self.devices.get(device)
+        if health is None:
+            return None
+        return {
+            "device": device,
+            "silent": device in self.silent,
+            "last_seen": health.last_seen,
+            "gap_s": round(health.gap_s, 3),
+            "max_gap_s": round(health.max_gap_s, 3),
+            "messages": health.messages,
+            "lanes": {lane_id: lane.describe() for lane_id, lane in health.lanes.items()},
+        }
+
+    def snapshot(self, now=None):
+        """Fleet totals, and every silent device and down sensor."""
+        now = time.time() if now is None else now
+        down = []
+        for device, lane_id, s in sorted(self.down):
+            lane = self.devices[device].lanes[lane_id]
+            down.append({"device": device, "lane": lane_id, "sensor": s + 1,
+                         "since": lane.down_since[s], "down_s": lane.down_s[s]})
+        return {
+            "ts": now,
+            "devices": len(self.devices),
+            "online": len(self.devices) - len(self.silent),
+            "silent": [{"device": device, "last_seen": self.devices[device].last_seen} for device in sorted(self.silent)],
+            "sensors_down": down,
+            "uptime": {name: uptime.ratios() for name, uptime in self.fleet_uptime.items()},
+            "messages": self.messages,
+            "alerts": list(self.alerts),
+        }
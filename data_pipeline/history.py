@@ -0,0 +1,75 @@
+import os
+import uuid
+from datetime import datetime
+
+import pandas as pd
+import pyarrow as pa
+import pyarrow.parquet as pq
+
+from commons import *
+from schema import SCHEMA_VERSION, TELEMETRY_SCHEMA, file_schema_version, to_table
+
+# Readers skip files starting with "_" or ".", so half-written files stay invisible
+TMP_PREFIX = "_tmp-"
+
+
+def partition_dir(root, date):
+    return os.path.join(root, f"date={date}")
+
+
+def list_partitions(root):
+    if not os.path.isdir(root):
+        return []
+    return sorted(name[len("date="):] for name in os.listdir(root) if name.startswith("date="))
+
+
+def list_part_files(root, date):
+    directory = partition_dir(root, date)
+    return sorted(os.path.join(directory, name) for name in os.listdir(directory)
+                  if name.endswith(".parquet") and not name.startswith(("_", ".")))
+
+
+def dir_bytes(root):
+    total = 0
+    for directory, _, names in os.walk(root):
+        for name in names:
+            total += os.path.getsize(os.path.join(directory, name))
+    return total
+
+
+def write_atomic(table, path, **kwargs):
+    # Write under a hidden name and rename, so readers never see a partial file
+    directory, name = os.path.split(path)
+    os.makedirs(directory, exist_ok=True)
+    tmp_path = os.path.join(directory, TMP_PREFIX + name)
+    pq.write_table(table, tmp_path, **kwargs)
+    os.replace(tmp_path, path)
+
+
+def partition_dates(df):
+    return df["timestamp"].dt.tz_convert("UTC").dt.strftime("%Y-%m-%d")
+
+
+def write_ingest_batch(rows):
+    """Append typed rows as new small files, one per day, never touching existing files."""
+    df = pd.DataFrame(rows)
+    df["timestamp"] = pd.to_datetime(df["timestamp"], utc=True)
+    stamp = datetime.now().strftime("%Y%m%dT%H%M%S")
+    for date, part in df.groupby(partition_dates(df)):
+        path = os.path.join(partition_dir(RAW_DIR, date), f"ingest-{stamp}-{uuid.uuid4().hex[:8]}.parquet")
+        write_atomic(to_table(part), path)
+
+
+def read_part(path):
+    # Files from before the schema are converted on the fly until migrated
+    if file_schema_version(path) < SCHEMA_VERSION:
+        return to_table(pd.read_parquet(path))
+    return pq.read_table(path, schema=TELEMETRY_SCHEMA)
+
+
+def load_history(root=RAW_DIR):
+    tables = [read_part(path) for date in list_partitions(root) for path in list_part_files(root, date)]
+    if not tables:
+        return pd.DataFrame()
+    df = pa.concat_tables(tables).unify_dictionaries().to_pandas()
+    return df.sort_values("timestamp", kind="stable").reset_index(drop=True)
@@ -0,0 +1,123 @@
+import json
+import ssl
+from collections import Counter, deque
+from threading import Condition
+
+import paho.mqtt.client as mqtt
+import pandas as pd
+
+from commons import *
+from schema import SchemaError, parse_message, parse_site_batch
+
+
+def device_topics(device):
+    """Where a device's reports arrive: its own topic, and its site's batches if it is behind a gateway."""
+    site = device_site(device)
+    return [device_topic(device, "data")] + ([site_topic(site, "batch")] if site else [])
+
+
+class LiveFeed:
+    """
+    One MQTT connection shared by every dashboard session in the process.
+    It subscribes only to the devices some session is watching, and to the
+    batches of their sites, rather than the whole fleet, and keeps only their
+    rows. Sessions block in wait_since() and get only the rows of their
+    device they haven't seen, so nothing is re-read or re-rendered while its
+    street is quiet.
+
+    connect=False leaves out MQTT, rows are then fed with publish().
+    """
+
+    def __init__(self, connect=True):
+        self.condition = Condition()
+        self.seq = 0
+        self.events = deque(maxlen=LIVE_FEED_BUFFER)
+        self.device_seq = {}  # Seq of each watched device's latest row
+        self.watchers = Counter()
+        self.subscriptions = Counter()
+        self.client = None
+        if not connect:
+            return
+
+        self.client = mqtt.Client(mqtt.CallbackAPIVersion.VERSION2)
+        ssl_context = ssl.create_default_context()
+        ssl_context.load_verify_locations("cert.pem")
+        self.client.tls_set_context(ssl_context)
+        self.client.on_connect = self.on_connect
+        self.client.on_message = self.on_message
+        self.client.username_pw_set(*USER_CREDS)
+        self.client.connect(SERVER_HOST, SERVER_PORT, 60)
+        self.client.loop_start()
+
+    def on_connect(self, client, userdata, flags, rc, properties):
+        print(f"Live feed connected with result code {rc}")
+        with self.condition:
+            topics = list(self.subscriptions)
+        for topic in topics:
+            client.subscribe(topic, qos=0)
+
+    def watch(self, device):
+        with self.condition:
+            self.watchers[device] += 1
+            new = [topic for topic in device_topics(device) if self.subscriptions[topic] == 0]
+            self.subscriptions.update(device_topics(device))
+        for topic in new:
+            if self.client:
+                self.client.subscribe(topic, qos=0)
+
+    def unwatch(self, device):
+        with self.condition:
+            self.watchers[device] -= 1
+            if self.watchers[device] <= 0:
+                del self.watchers[device]
+                self.device_seq.pop(device, None)
+            self.subscriptions.subtract(device_topics(device))
+            gone = [topic for topic in device_topics(device) if self.subscriptions[topic] <= 0]
+            for topic in gone:
+                del self.subscriptions[topic]
+        for topic in gone:
+            if self.client:
+                self.client.unsubscribe(topic)
+
+    def on_message(self, client, userdata, msg):
+        try:
+            message = json.loads(msg.payload.decode())
+            rows = parse_site_batch(message) if msg.topic.startswith("/site/") else [parse_message(message)]
+        except (UnicodeDecodeError, json.JSONDecodeError, AttributeError, SchemaError):
+            # The ingester counts rejects, the dashboard just skips them
+            return
+        site = topic_site(msg.topic)
+        for row in rows:
+            # As the ingester, a gateway only vouches for its own site's devices
+            if site is None or row["device"] in SITE_DEVICES.get(site, ()):
+                self.publish(row)
+
+    def publish(self, row):
+        with self.condition:
+            # A site's batches carry its other devices too
+            if row["device"] not in self.watchers:
+                return
+            self.seq += 1
+            self.events.append((self.seq, row))
+            self.device_seq[row["device"]] = self.seq
+            self.condition.notify_all()
+
+    def wait_since(self, device, seq, timeout):
+        """A device's rows newer than seq, waiting up to timeout for the first one. Returns (rows, new seq)."""
+        with self.condition:
+            self.condition.wait_for(lambda: self.device_seq.get(device, 0) > seq, timeout)
+            rows = [row for event_seq, row in self.events if event_seq > seq and row["device"] == device]
+            return rows, self.seq
+
+
+def rows_to_frame(rows):
+    df = pd.DataFrame(rows)
+    if len(df):
+        df["timestamp"] = pd.to_datetime(df["timestamp"], utc=True)
+    return df
+
+
+def device_view(df, device, columns, points=60):
+    """A device's latest windows, and the frame each of its charts is drawn from."""
+    device_df = df[df["device"] == device].tail(points)
+    return device_df, {column: device_df.set_index("timestamp")[[column]] for column in columns}
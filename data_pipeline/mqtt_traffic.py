@@ -0,0 +1,295 @@
+import argparse
+import os
+import queue
+import ssl
+import struct
+import threading
+import time
+import zlib
+from collections import deque
+
+import paho.mqtt.client as mqtt
+
+from commons import *
+
+# Traffic log: a header, then one record per message, appended as they
+# arrive so a crash loses at most the unflushed tail.
+#
+#   header   b"WOWMQ1\n"
+#   record   u64 arrival time, us since the epoch
+#            u16 topic id, TOPIC_NEW to define the next id inline:
+#                u16 topic length, topic bytes
+#            u8  qos | retain << 2
+#            u32 payload length, payload bytes
+#
+# Topics repeat endlessly, so each is written once and referred to by id.
+# A truncated last record is ignored on read.
+LOG_MAGIC = b"WOWMQ1\n"
+RECORD = struct.Struct("<QHBI")
+TOPIC_LEN = struct.Struct("<H")
+TOPIC_NEW = 0xFFFF
+RECORDER_CLIENT_ID = "wow_recorder"
+FLUSH_INTERVAL_S = 1
+ACK_TIMEOUT_S = 30  # For the replay's last messages, after everything is published
+
+
+class TrafficLog:
+    """Append-only writer, reopening an existing log carries on its topic ids."""
+
+    def __init__(self, path):
+        topics = {}
+        end = 0
+        if os.path.exists(path) and os.path.getsize(path) > 0:
+            with open(path, "rb") as f:
+                for *_, end in _records(f, topics):
+                    pass
+                end = max(end, len(LOG_MAGIC))
+            # Drop a record cut short by a crash, appending after it would misalign the rest
+            os.truncate(path, end)
+        self.topics = {topic: i for i, topic in topics.items()}
+        self.file = open(path, "ab")
+        if self.file.tell() == 0:
+            self.file.write(LOG_MAGIC)
+        self.lock = threading.Lock()
+        self.records = 0
+        self.bytes = 0
+
+    def append(self, ts_us, topic, payload, qos=0, retain=False):
+        with self.lock:
+            topic_id = self.topics.get(topic)
+            if topic_id is None:
+                topic_id = len(self.topics)
+                self.topics[topic] = topic_id
+                encoded = topic.encode()
+                parts = [RECORD.pack(ts_us, TOPIC_NEW, qos | retain << 2, len(payload)), TOPIC_LEN.pack(len(encoded)), encoded]
+            else:
+                parts = [RECORD.pack(ts_us, topic_id, qos | retain << 2, len(payload))]
+            parts.append(payload)
+            for part in parts:
+                self.file.write(part)
+                self.bytes += len(part)
+            self.records += 1
+
+    def flush(self):
+        with self.lock:
+            self.file.flush()
+
+    def close(self):
+        with self.lock:
+            self.file.close()
+
+
+def _records(f, topics):
+    """Complete records of an open log, each with the file offset it ends at."""
+    if f.read(len(LOG_MAGIC)) != LOG_MAGIC:
+        raise ValueError(f"{f.name} is not a traffic log")
+    while True:
+        header = f.read(RECORD.size)
+        if len(header) < RECORD.size:
+            return
+        ts_us, topic_id, flags, length = RECORD.unpack(header)
+        topic = None
+        if topic_id == TOPIC_NEW:
+            raw = f.read(TOPIC_LEN.size)
+            if len(raw) < TOPIC_LEN.size:
+                return
+            encoded = f.read(TOPIC_LEN.unpack(raw)[0])
+            topic = encoded.decode(errors="replace")
+        elif topic_id in topics:
+            topic = topics[topic_id]
+        payload = f.read(length)
+        if topic is None or len(payload) < length:
+            return
+        if topic_id == TOPIC_NEW:
+            topics[len(topics)] = topic
+        yield topic, payload, flags & 3, bool(flags & 4), ts_us, f.tell()
+
+
+def read_log(path):
+    """Yield (topic, payload, qos, retain, ts_us) in recorded order."""
+    with open(path, "rb") as f:
+        for *message, _ in _records(f, {}):
+            yield tuple(message)
+
+
+def connect(host, port, tls, client_id="", creds=USER_CREDS, clean_session=True):
+    client = mqtt.Client(mqtt.CallbackAPIVersion.VERSION2, client_id=client_id, clean_session=clean_session)
+    if tls:
+        ssl_context = ssl.create_default_context()
+        ssl_context.load_verify_locations("cert.pem")
+        client.tls_set_context(ssl_context)
+    if creds:
+        client.username_pw_set(*creds)
+    # Replays queue far more than the default 20 in-flight QoS1 messages
+    client.max_inflight_messages_set(1000)
+    client.connect(host, port, 60)
+    return client
+
+
+def record(args):
+    log = TrafficLog(args.log)
+    start = time.time()
+
+    def on_connect(client, userdata, flags, rc, properties):
+        print(f"Recorder connected with result code {rc}")
+        for topic in args.topic:
+            client.subscribe(topic, qos=1)
+
+    def on_message(client, userdata, msg):
+        log.append(time.time_ns() // 1000, msg.topic, msg.payload, msg.qos, msg.retain)
+
+    client = connect(args.host, args.port, not args.no_tls, RECORDER_CLIENT_ID, tuple(args.user) if args.user else USER_CREDS)
+    client.on_connect = on_connect
+    client.on_message = on_message
+    client.loop_start()
+    try:
+        while args.duration == 0 or time.time() - start < args.duration:
+            time.sleep(FLUSH_INTERVAL_S)
+            log.flush()
+            print(f"\r{log.records} messages, {log.bytes} bytes, {len(log.topics)} topics", end="", flush=True)
+    except KeyboardInterrupt:
+        pass
+    finally:
+        client.loop_stop()
+        client.disconnect()
+        log.close()
+        print()
+
+
+def percentile(sorted_values, percent):
+    if not sorted_values:
+        return 0
+    return sorted_values[min(len(sorted_values) - 1, int(len(sorted_values) * percent / 100))]
+
+
+def replay_worker(client, messages, t0_us, start, speed, retain, lags, done, pending):
+    """
+    Publishes its share of the log. A message only counts as done once the
+    broker acknowledged it (QoS1/2) or it was written to the socket (QoS0);
+    the rest stay in pending, oldest first, for replay() to wait on.
+    """
+    for topic, payload, qos, recorded_retain, ts_us in iter(messages.get, None):
+        if speed > 0:
+            due = start + (ts_us - t0_us) / 1e6 / speed
+            delay = due - time.perf_counter()
+            if delay > 0:
+                time.sleep(delay)
+            lags.append(time.perf_counter() - due)
+        pending.append((client.publish(topic, payload, qos=qos, retain=retain and recorded_retain), len(payload)))
+        while pending and pending[0][0].is_published():
+            done.append(pending.popleft()[1])
+
+
+def wait_for_acks(pending, done, deadline):
+    """Move acknowledged messages to done, waiting for each until time.monotonic() passes deadline."""
+    for _ in range(len(pending)):
+        info, size = pending.popleft()
+        try:
+            info.wait_for_publish(max(deadline - time.monotonic(), 0))
+        except (RuntimeError, ValueError):
+            # Never queued, e.g. the connection was lost
+            pass
+        if info.is_published():
+            done.append(size)
+        else:
+            pending.append((info, size))
+
+
+def replay(args):
+    """
+    Republish a log in recorded order. Messages of one device always go
+    through the same client and in log order, so per-device ordering holds
+    with any number of clients.
+    """
+    creds = tuple(args.user) if args.user else None
+    clients = [connect(args.host, args.port, args.tls, creds=creds) for _ in range(args.clients)]
+    for client in clients:
+        client.loop_start()
+    queues = [queue.Queue(maxsize=10_000) for _ in clients]
+    lags = [[] for _ in clients]
+    done = [[] for _ in clients]
+    pending = [deque() for _ in clients]
+
+    records = read_log(args.log)
+    first = next(records, None)
+    if first is None:
+        print("Empty log")
+        return
+    t0_us = first[4]
+    start = time.perf_counter()
+    workers = [threading.Thread(target=replay_worker, daemon=True,
+                                args=(clients[i], queues[i], t0_us, start, args.speed, args.retain, lags[i], done[i], pending[i]))
+               for i in range(len(clients))]
+    for worker in workers:
+        worker.start()
+
+    def dispatch(message):
+        device = topic_device(message[0]) or message[0]
+        queues[zlib.crc32(device.encode()) % len(queues)].put(message)
+
+    dispatch(first)
+    last_us = t0_us
+    for message in records:
+        dispatch(message)
+        last_us = message[4]
+    for q in queues:
+        q.put(None)
+    for worker in workers:
+        worker.join()
+    # Everything is handed to the clients, but not necessarily at the broker yet
+    deadline = time.monotonic() + ACK_TIMEOUT_S
+    for i in range(len(clients)):
+        wait_for_acks(pending[i], done[i], deadline)
+    elapsed = time.perf_counter() - start
+    for client in clients:
+        client.disconnect()
+        client.loop_stop()
+
+    messages = sum(len(d) for d in done)
+    unacked = sum(len(p) for p in pending)
+    payload_bytes = sum(sum(d) for d in done)
+    all_lags = sorted(lag for per_client in lags for lag in per_client)
+    recorded_s = (last_us - t0_us) / 1e6
+    print(f"Replayed {messages} acknowledged messages, {payload_bytes} payload bytes, recorded over {recorded_s:.1f} s, in {elapsed:.1f} s "
+          f"({'max speed' if args.speed == 0 else f'{args.speed:g}x'}, achieved {recorded_s / elapsed if elapsed else 0:.1f}x)")
+    if unacked:
+        print(f"{unacked} messages not acknowledged within {ACK_TIMEOUT_S} s of the end")
+    print(f"Throughput: {messages / elapsed:.0f} msg/s, {payload_bytes / elapsed / 1e6:.2f} MB/s")
+    if all_lags:
+        print(f"Lag behind schedule: p50 {percentile(all_lags, 50) * 1000:.1f} ms, p99 {percentile(all_lags, 99) * 1000:.1f} ms, "
+              f"max {all_lags[-1] * 1000:.1f} ms")
+
+
+def main():
+    parser = argparse.ArgumentParser(description="Record MQTT traffic to a log file, or replay one at accelerated speed")
+    commands = parser.add_subparsers(dest="command", required=True)
+
+    rec = commands.add_parser("record", help="capture topics from the broker")
+    rec.add_argument("log")
+    rec.add_argument("--topic", action="append", default=None, help="topic filter, repeatable; default #")
+    rec.add_argument("--host", default=SERVER_HOST)
+    rec.add_argument("--port", type=int, default=SERVER_PORT)
+    rec.add_argument("--no-tls", action="store_true")
+    rec.add_argument("--user", nargs=2, metavar=("NAME", "PASSWORD"))
+    rec.add_argument("--duration", type=int, default=0, help="s, default until interrupted")
+
+    rep = commands.add_parser("replay", help="republish a log to a (local) broker")
+    rep.add_argument("log")
+    rep.add_argument("--host", default="localhost")
+    rep.add_argument("--port", type=int, default=1883)
+    rep.add_argument("--tls", action="store_true")
+    rep.add_argument("--user", nargs=2, metavar=("NAME", "PASSWORD"))
+    rep.add_argument("--speed", type=float, default=1, help="1 real time, N times faster, 0 as fast as possible")
+    rep.add_argument("--clients", type=int, default=4, help="publishing connections, devices are spread over them")
+    rep.add_argument("--retain", action="store_true", help="keep the retain flag of recorded messages")
+
+    args = parser.parse_args()
+    if args.command == "record":
+        args.topic = args.topic or ["#"]
+        record(args)
+    else:
+        replay(args)
+
+
+if __name__ == "__main__":
+    main()
@@ -0,0 +1,71 @@
+import argparse
+import ssl
+import struct
+
+import paho.mqtt.client as mqtt
+
+from commons import *
+
+# Must match POLICY_BLOB_FORMAT / layout in device/speed_sensor/main/policy.h
+POLICY_BLOB_FORMAT = 3
+POLICY_STRUCT = struct.Struct("<2sBBIHHHHHHh")
+
+
+def crc16_ccitt(data):
+    crc = 0xFFFF
+    for byte in data:
+        crc ^= byte << 8
+        for _ in range(8):
+            crc = ((crc << 1) ^ 0x1021) if crc & 0x8000 else (crc << 1)
+            crc &= 0xFFFF
+    return crc
+
+
+def encode_policy(version, speed_threshold_cm_s, max_distance_cm, sensor_distance_cm, poll_period_ms, report_interval_s,
+                  heartbeat_interval_s, temperature_c):
+    body = POLICY_STRUCT.pack(b"WP", POLICY_BLOB_FORMAT, 0, version, speed_threshold_cm_s,
+                              max_distance_cm, sensor_distance_cm, poll_period_ms, report_interval_s,
+                              heartbeat_interval_s, round(temperature_c * 10))
+    return body + struct.pack("<H", crc16_ccitt(body))
+
+
+def publish_policy(mqtt_client, device, blob):
+    # Retained, so a device picks up its current policy as soon as it (re)subscribes
+    return mqtt_client.publish(f"/device/{device}/config", blob, qos=1, retain=True)
+
+
+def main():
+    parser = argparse.ArgumentParser(description="Push a detection policy to a speed sensor")
+    parser.add_argument("device")
+    parser.add_argument("version", type=int)
+    parser.add_argument("--threshold", type=int, default=50, help="speed threshold, cm/s")
+    parser.add_argument("--max-distance", type=int, default=60, help="trigger distance, cm")
+    parser.add_argument("--sensor-distance", type=int, default=10, help="distance between sensors, cm")
+    parser.add_argument("--poll", type=int, default=20, help="poll period, ms")
+    parser.add_argument("--report", type=int, default=5, help="report interval, s")
+    parser.add_argument("--heartbeat", type=int, default=300,
+                        help="longest gap between reports while nothing changes, s; 0 reports every window")
+    parser.add_argument("--temperature", type=float, default=20,
+                        help="air temperature at the sensor, C, for the speed of sound; push a new version as it changes")
+    args = parser.parse_args()
+
+    blob = encode_policy(args.version, args.threshold, args.max_distance, args.sensor_distance, args.poll, args.report,
+                         args.heartbeat, args.temperature)
+
+    client = mqtt.Client(mqtt.CallbackAPIVersion.VERSION2)
+    ssl_context = ssl.create_default_context()
+    ssl_context.load_verify_locations("cert.pem")
+    client.tls_set_context(ssl_context)
+    client.username_pw_set(*USER_CREDS)
+    client.connect(SERVER_HOST, SERVER_PORT, 60)
+    client.loop_start()
+
+    publish_policy(client, args.device, blob).wait_for_publish()
+    print(f"Published policy v{args.version} to {args.device}: {blob.hex()}")
+
+    client.loop_stop()
+    client.disconnect()
+
+
+if __name__ == "__main__":
+    main()
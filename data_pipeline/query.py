@@ -0,0 +1,281 @@
+import argparse
+import os
+
+import numpy as np
+import pandas as pd
+import pyarrow as pa
+import pyarrow.acero as ac
+import pyarrow.compute as pc
+import pyarrow.dataset as ds
+
+from commons import *
+from history import list_partitions
+from schema import TELEMETRY_SCHEMA
+
+# Queries over the partitioned history that never load all of it: only the
+# date= partitions in range are opened, row groups whose statistics rule out
+# the devices or times asked for are skipped (compact.py sorts files by device
+# and time, so most are), only the columns used are decoded, and aggregation
+# streams over the scan on every core. Files must be at the current schema,
+# see schema.py --migrate.
+PARTITIONING = ds.partitioning(pa.schema([("date", pa.string())]), flavor="hive")
+DATASET_SCHEMA = TELEMETRY_SCHEMA.append(pa.field("date", pa.string()))
+PERIODS = ["minute", "hour", "day", "week", "month"]
+SPEED_QUANTILE = 0.85
+
+
+def history_dataset(root=RAW_DIR):
+    if not os.path.isdir(root):
+        return ds.dataset([], format="parquet", schema=DATASET_SCHEMA)
+    # Hidden and "_"-prefixed files are skipped, like load_history() does
+    return ds.dataset(root, format="parquet", partitioning=PARTITIONING, schema=DATASET_SCHEMA)
+
+
+def _utc(value):
+    ts = pd.Timestamp(value)
+    return ts.tz_localize("UTC") if ts.tzinfo is None else ts.tz_convert("UTC")
+
+
+def where(devices=None, start=None, end=None, lanes=None):
+    """Filter on device, lane and [start, end), None for everything."""
+    terms = []
+    if start is not None:
+        start = _utc(start)
+        terms.append(ds.field("date") >= start.strftime("%Y-%m-%d"))
+        terms.append(ds.field("timestamp") >= pa.scalar(start, pa.timestamp("ms", tz="UTC")))
+    if end is not None:
+        end = _utc(end)
+        # end is exclusive, midnight does not need the day it starts
+        terms.append(ds.field("date") <= (end - pd.Timedelta(milliseconds=1)).strftime("%Y-%m-%d"))
+        terms.append(ds.field("timestamp") < pa.scalar(end, pa.timestamp("ms", tz="UTC")))
+    if devices is not None:
+        terms.append(ds.field("device").isin(list(devices)))
+    if lanes is not None:
+        terms.append(ds.field("lane").isin(list(lanes)))
+    if not terms:
+        return None
+    predicate = terms[0]
+    for term in terms[1:]:
+        predicate = predicate & term
+    return predicate
+
+
+def _may_hold(piece, devices):
+    stats = piece.row_groups[0].statistics.get("device") if piece.row_groups[0].statistics else None
+    if not stats:
+        return True
+    return any(stats["min"] <= device <= stats["max"] for device in devices)
+
+
+def pruned(dataset, predicate, devices=None):
+    """
+    The row groups of dataset that may hold rows matching predicate. Arrow
+    skips row groups on time by their statistics but not on dictionary
+    columns like device, so the devices asked for are checked here.
+    """
+    if predicate is None:
+        return dataset
+    pieces = [piece for fragment in dataset.get_fragments(filter=predicate)
+              for piece in fragment.split_by_row_group(predicate, schema=dataset.schema)
+              if devices is None or _may_hold(piece, devices)]
+    return ds.FileSystemDataset(pieces, dataset.schema, dataset.format, dataset.filesystem)
+
+
+def scan(columns=None, devices=None, start=None, end=None, lanes=None, root=RAW_DIR):
+    """Matching rows as an Arrow table, in file order."""
+    columns = columns or TELEMETRY_SCHEMA.names
+    predicate = where(devices, start, end, lanes)
+    return pruned(history_dataset(root), predicate, devices).to_table(columns=columns, filter=predicate, use_threads=True)
+
+
+def device_history(device, columns=None, start=None, end=None, points=None, root=RAW_DIR):
+    """
+    One device's windows oldest first, what the dashboard draws instead of
+    filtering a full load. points keeps only the latest ones.
+    """
+    columns = list(dict.fromkeys(["device", "timestamp"] + (columns or TELEMETRY_SCHEMA.names)))
+    if points and start is None:
+        # The latest windows are almost always in the newest day, so walk back
+        # a day at a time rather than reading every day of the device
+        parts = []
+        found = 0
+        for date in reversed(list_partitions(root)):
+            day = _utc(date)
+            if end is not None and day >= _utc(end):
+                continue
+            next_day = day + pd.Timedelta(days=1)
+            table = scan(columns, [device], day, next_day if end is None else min(next_day, _utc(end)), root=root)
+            parts.append(table)
+            found += table.num_rows
+            if found >= points:
+                break
+        table = pa.concat_tables(parts[::-1]) if parts else history_dataset(root).schema.empty_table().select(columns)
+    else:
+        table = scan(columns, [device], start, end, root=root)
+    df = table.to_pandas().sort_values("timestamp", kind="stable").reset_index(drop=True)
+    return df.tail(points).reset_index(drop=True) if points else df
+
+
+def devices(root=RAW_DIR):
+    """Every device in the history, reading the device column only."""
+    table = history_dataset(root).to_table(columns=["device"], use_threads=True)
+    return sorted(pc.unique(table["device"].combine_chunks().dictionary_decode()).to_pylist()) if table.num_rows else []
+
+
+def _speed_hist_totals(dataset, predicate, devices, key_columns):
+    """
+    Vehicles per group and speed bucket, summed over the speed_hist of every
+    matching row a batch at a time, so only the totals are ever held.
+    """
+    keys = list(key_columns)
+    has_hist = pc.field("speed_hist").is_valid()
+    columns = {**key_columns, "speed_hist": pc.field("speed_hist")}
+    scanner = pruned(dataset, predicate, devices).scanner(
+        columns=columns, filter=has_hist if predicate is None else predicate & has_hist, use_threads=True)
+    parts = []
+    for batch in scanner.to_batches():
+        hists = batch.column("speed_hist")
+        lengths = pc.list_value_length(hists).to_numpy(zero_copy_only=False)
+        total = int(lengths.sum())
+        if total == 0:
+            continue
+        # Position of each count within its row's list is its bucket. Lists
+        # run up to the fastest vehicle, so most counts are zero
+        bucket = np.arange(total) - np.repeat(np.cumsum(lengths) - lengths, lengths)
+        counts = pc.list_flatten(hists).to_numpy()
+        nonzero = counts > 0
+        rows = pa.array(pc.list_parent_indices(hists).to_numpy()[nonzero])
+        part = pa.table({
+            **{key: _decoded(batch.column(key).take(rows)) for key in keys},
+            "bucket": pa.array(bucket[nonzero], pa.uint8()),
+            "count": pa.array(counts[nonzero], pa.uint64()),
+        })
+        parts.append(part.group_by(keys + ["bucket"]).aggregate([("count", "sum")]).rename_columns(keys + ["bucket", "count"]))
+    if not parts:
+        return pd.DataFrame(columns=keys + ["bucket", "count"])
+    totals = pa.concat_tables(parts).group_by(keys + ["bucket"]).aggregate([("count", "sum")])
+    return totals.rename_columns(keys + ["bucket", "count"]).to_pandas()
+
+
+def _decoded(array):
+    return array.dictionary_decode() if pa.types.is_dictionary(array.type) else array
+
+
+def _speed_hist_quantiles(totals, keys, quantile):
+    """
+    The quantile of each group's vehicle speeds, interpolated geometrically
+    within the bucket it falls in.
+    """
+    if not keys:
+        totals = totals.assign(group=0)
+        keys = ["group"]
+    totals = totals[totals["count"] > 0].sort_values(keys + ["bucket"])
+    grouped = totals.groupby(keys, sort=False)["count"]
+    seen = grouped.cumsum()
+    target = grouped.transform("sum") * quantile
+    # The first bucket reaching the target, and how far into it the target is
+    first = totals[(seen >= target)].groupby(keys, sort=False).head(1).index
+    counts = totals.loc[first, "count"]
+    fraction = ((target[first] - (seen[first] - counts)) / counts).clip(0, 1)
+    speed = SPEED_HIST_BASE_CM_S * 2 ** ((totals.loc[first, "bucket"] + fraction) / SPEED_HIST_PER_OCTAVE)
+    return totals.loc[first, keys].assign(speed_quantile=speed.astype("float32").to_numpy()).reset_index(drop=True)
+
+
+def summarize(by=("device",), every="hour", devices=None, start=None, end=None, lanes=None,
+              quantile=SPEED_QUANTILE, root=RAW_DIR):
+    """
+    Windows, cars, car-weighted average, extremes and a speed quantile per
+    group and period, like compact.rollup() but for any grouping. Speeds only
+    count windows with cars. The quantile is over vehicles, from the summed
+    speed_hist of the rows that have one (within the 9% width of a bucket);
+    groups with none get no quantile, and quantile=None skips reading the
+    histograms. every=None groups over the whole range.
+    """
+    busy = pc.field("num_cars") > 0
+    no_speed = pa.scalar(None, pa.float32())
+    names = list(by)
+    projection = [pc.field(name) for name in by]
+    if every is not None:
+        if every not in PERIODS:
+            raise ValueError(f"every must be one of {PERIODS}")
+        names.append("period")
+        # Flooring naive UTC is several times faster than through the time zone
+        naive = pc.field("timestamp").cast(pa.timestamp("ms"))
+        projection.append(pc.floor_temporal(naive, unit=every).cast(pa.timestamp("ms", tz="UTC")))
+    keys = list(names)
+    key_columns = dict(zip(keys, projection))
+    names += ["num_cars", "speed_sum", "busy_max", "busy_min", "sensor_1_up", "sensor_2_up"]
+    projection += [
+        pc.field("num_cars").cast(pa.uint64()),
+        pc.multiply(pc.field("avg_speed").cast(pa.float64()), pc.field("num_cars").cast(pa.float64())),
+        pc.if_else(busy, pc.field("max_speed"), no_speed),
+        pc.if_else(busy, pc.field("min_speed"), no_speed),
+        pc.field("sensor_1_up").cast(pa.float32()),
+        pc.field("sensor_2_up").cast(pa.float32()),
+    ]
+    prefix = "hash_" if keys else ""
+    aggregates = [
+        ("num_cars", prefix + "count", pc.CountOptions("all"), "windows"),
+        ("num_cars", prefix + "sum", None, "num_cars"),
+        ("speed_sum", prefix + "sum", None, "speed_sum"),
+        ("busy_max", prefix + "max", None, "max_speed"),
+        ("busy_min", prefix + "min", None, "min_speed"),
+        ("sensor_1_up", prefix + "mean", None, "sensor_1_up"),
+        ("sensor_2_up", prefix + "mean", None, "sensor_2_up"),
+    ]
+
+    # The scan prunes partitions and row groups, the filter drops what
+    # remains outside the predicate within a row group
+    dataset = history_dataset(root)
+    predicate = where(devices, start, end, lanes)
+    plan = [ac.Declaration("scan", ac.ScanNodeOptions(pruned(dataset, predicate, devices), filter=predicate))]
+    if predicate is not None:
+        plan.append(ac.Declaration("filter", ac.FilterNodeOptions(predicate)))
+    plan.append(ac.Declaration("project", ac.ProjectNodeOptions(projection, names)))
+    plan.append(ac.Declaration("aggregate", ac.AggregateNodeOptions(aggregates, keys=keys)))
+    df = ac.Declaration.from_sequence(plan).to_table(use_threads=True).to_pandas()
+
+    df["avg_speed"] = (df["speed_sum"] / df["num_cars"]).where(df["num_cars"] > 0)
+    df = df.drop(columns="speed_sum")
+    if quantile is None:
+        return df.sort_values(keys).reset_index(drop=True) if keys else df
+    quantiles = _speed_hist_quantiles(_speed_hist_totals(dataset, predicate, devices, key_columns), keys, quantile)
+    column = f"speed_p{round(quantile * 100)}"
+    if keys:
+        for key in keys:
+            quantiles[key] = quantiles[key].astype(df[key].dtype)
+        df = df.merge(quantiles, on=keys, how="left")
+    else:
+        df["speed_quantile"] = quantiles["speed_quantile"].iloc[0] if len(quantiles) else None
+    df = df.rename(columns={"speed_quantile": column})
+    return df.sort_values(keys).reset_index(drop=True) if keys else df
+
+
+def main():
+    parser = argparse.ArgumentParser(description="Query the sensor history without loading it")
+    parser.add_argument("--device", action="append", help="repeatable, default all")
+    parser.add_argument("--lane", type=int, action="append")
+    parser.add_argument("--start", help="e.g. 2024-05-01 or 2024-05-01T08:00, UTC unless a zone is given")
+    parser.add_argument("--end", help="exclusive")
+    parser.add_argument("--rows", action="store_true", help="print matching rows instead of a summary")
+    parser.add_argument("--columns", help="comma separated, with --rows")
+    parser.add_argument("--by", default="device", help="comma separated grouping columns, empty for none")
+    parser.add_argument("--every", choices=PERIODS + ["all"], default="hour")
+    parser.add_argument("--csv", help="write the result here instead of printing it")
+    args = parser.parse_args()
+
+    if args.rows:
+        columns = args.columns.split(",") if args.columns else None
+        df = scan(columns, args.device, args.start, args.end, args.lane).to_pandas()
+        df = df.sort_values("timestamp", kind="stable").reset_index(drop=True)
+    else:
+        by = [column for column in args.by.split(",") if column]
+        df = summarize(by, None if args.every == "all" else args.every, args.device, args.start, args.end, args.lane)
+    if args.csv:
+        df.to_csv(args.csv, index=False)
+    else:
+        print(df.to_string(index=False))
+
+
+if __name__ == "__main__":
+    main()
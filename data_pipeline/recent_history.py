@@ -0,0 +1,185 @@
+import argparse
+import json
+import queue
+import random
+import ssl
+import struct
+import sys
+import threading
+import time
+
+import pandas as pd
+import paho.mqtt.client as mqtt
+
+from commons import *
+
+# Must match the request and chunk formats in device/speed_sensor/main/history_ring.h
+HISTORY_REQUEST_FORMAT = 1
+REQUEST_STRUCT = struct.Struct("<2sBBHHIqq")
+CHUNK_STRUCT = struct.Struct("<2sBBHHHHIq")
+CHUNK_LAST = 0x01
+CHUNK_END = 0x02
+CHUNK_GAP = 0x04
+CHUNK_BOOT_TIME = 0x08
+KINDS = {1: "vehicle", 2: "trace", 3: "fault"}
+RESPONSE_TIMEOUT_S = 10
+RETRIES = 3
+
+
+def encode_request(request_id, cursor=0, kinds=(), start_ms=0, end_ms=0, max_chunks=0):
+    mask = 0
+    for kind in kinds:
+        mask |= 1 << next(code for code, name in KINDS.items() if name == kind)
+    return REQUEST_STRUCT.pack(b"WH", HISTORY_REQUEST_FORMAT, mask, request_id, max_chunks, cursor, start_ms, end_ms)
+
+
+def _varint(data, pos):
+    value = shift = 0
+    while True:
+        byte = data[pos]
+        pos += 1
+        value |= (byte & 0x7F) << shift
+        if not byte & 0x80:
+            return value, pos
+        shift += 7
+
+
+def decode_chunk(payload):
+    """Header fields and records of one response chunk, times in ms as the device sent them."""
+    magic, fmt, flags, request_id, chunk, count, _, next_cursor, base_ms = CHUNK_STRUCT.unpack_from(payload)
+    if magic != b"WR" or fmt != HISTORY_REQUEST_FORMAT:
+        raise ValueError("not a history chunk")
+    records = []
+    last_ms = base_ms
+    last_mm = {}
+    pos = CHUNK_STRUCT.size
+    for _ in range(count):
+        tag = payload[pos]
+        kind, index = tag & 0x03, tag >> 4
+        dt_ms, pos = _varint(payload, pos + 1)
+        last_ms += dt_ms
+        record = {"ts": last_ms, "kind": KINDS[kind]}
+        if kind == 1:
+            speed, pos = _varint(payload, pos)
+            record.update(lane=index, speed_cm_s=speed, deployed=bool(tag & 0x04))
+        elif kind == 2:
+            zigzag, pos = _varint(payload, pos)
+            last_mm[index] = (last_mm.get(index, 0) + ((zigzag >> 1) ^ -(zigzag & 1))) & 0xFFFF
+            record.update(sensor=index, distance_mm=last_mm[index])
+        else:
+            record.update(sensor=index)
+        records.append(record)
+    header = {"flags": flags, "request_id": request_id, "chunk": chunk, "next_cursor": next_cursor}
+    return header, records
+
+
+class HistoryClient:
+    """Asks a device for its recent history and pages through the responses."""
+
+    def __init__(self, device, host=SERVER_HOST, port=SERVER_PORT, creds=USER_CREDS, tls=True):
+        self.device = device
+        self.chunks = queue.Queue()
+        self.client = mqtt.Client(mqtt.CallbackAPIVersion.VERSION2)
+        if tls:
+            ssl_context = ssl.create_default_context()
+            ssl_context.load_verify_locations("cert.pem")
+            self.client.tls_set_context(ssl_context)
+        self.client.username_pw_set(*creds)
+        self.subscribed = threading.Event()
+        self.client.on_connect = self.on_connect
+        self.client.on_subscribe = lambda *args: self.subscribed.set()
+        self.client.on_message = lambda client, userdata, msg: self.chunks.put(msg.payload)
+        self.client.connect(host, port, 60)
+        self.client.loop_start()
+        # Responses are not kept for late subscribers, so only ask once subscribed
+        if not self.subscribed.wait(RESPONSE_TIMEOUT_S):
+            raise TimeoutError(f"Could not subscribe to {device_topic(device, 'history/response')}")
+        self.request_id = random.randrange(1 << 16)
+
+    def on_connect(self, client, userdata, flags, rc, properties):
+        client.subscribe(device_topic(self.device, "history/response"), qos=1)
+
+    def close(self):
+        self.client.loop_stop()
+        self.client.disconnect()
+
+    def page(self, cursor, kinds, start_ms, end_ms, max_chunks):
+        """One page of records, asked again on a timeout. Returns (records, last header)."""
+        for _ in range(RETRIES):
+            self.request_id = (self.request_id + 1) & 0xFFFF
+            self.client.publish(device_topic(self.device, "history"),
+                                encode_request(self.request_id, cursor, kinds, start_ms, end_ms, max_chunks), qos=1)
+            got = {}
+            last = None
+            deadline = time.monotonic() + RESPONSE_TIMEOUT_S
+            while last is None or len(got) <= last:
+                try:
+                    payload = self.chunks.get(timeout=max(deadline - time.monotonic(), 0))
+                except queue.Empty:
+                    break
+                header, records = decode_chunk(payload)
+                # Chunks of an abandoned earlier request may still arrive
+                if header["request_id"] != self.request_id:
+                    continue
+                got[header["chunk"]] = (header, records)
+                if header["flags"] & CHUNK_LAST:
+                    last = header["chunk"]
+            else:
+                return [r for i in range(last + 1) for r in got[i][1]], got[last][0]
+        raise TimeoutError(f"No complete answer from {self.device} after {RETRIES} requests")
+
+    def fetch(self, kinds=(), start_ms=0, end_ms=0, max_chunks=0, max_pages=None, cursor=0):
+        """Yield (records, header) page by page until the device has nothing more."""
+        pages = 0
+        while max_pages is None or pages < max_pages:
+            records, header = self.page(cursor, kinds, start_ms, end_ms, max_chunks)
+            pages += 1
+            yield records, header
+            if header["flags"] & CHUNK_END:
+                return
+            cursor = header["next_cursor"]
+
+
+def epoch_ms(value):
+    ts = pd.Timestamp(value)
+    return (ts.tz_localize("UTC") if ts.tzinfo is None else ts).value // 1_000_000
+
+
+def main():
+    parser = argparse.ArgumentParser(description="Fetch the recent history buffer of a speed sensor")
+    parser.add_argument("device")
+    parser.add_argument("--kind", action="append", choices=list(KINDS.values()), help="repeatable, default all")
+    parser.add_argument("--last", type=float, help="only the last N seconds")
+    parser.add_argument("--start", help="e.g. 2024-05-01T08:00, UTC unless a zone is given")
+    parser.add_argument("--end", help="exclusive")
+    parser.add_argument("--cursor", type=int, default=0, help="continue from an earlier fetch's next_cursor")
+    parser.add_argument("--chunks", type=int, default=0, help="chunks per page, default the device's")
+    parser.add_argument("--pages", type=int, help="stop after this many pages")
+    parser.add_argument("--host", default=SERVER_HOST)
+    parser.add_argument("--port", type=int, default=SERVER_PORT)
+    parser.add_argument("--no-tls", action="store_true")
+    parser.add_argument("--user", nargs=2, metavar=("NAME", "PASSWORD"))
+    args = parser.parse_args()
+
+    start_ms = epoch_ms(args.start) if args.start else 0
+    end_ms = epoch_ms(args.end) if args.end else 0
+    if args.last:
+        start_ms = int((time.time() - args.last) * 1000)
+
+    client = HistoryClient(args.device, args.host, args.port, tuple(args.user) if args.user else USER_CREDS, not args.no_tls)
+    total = 0
+    try:
+        for records, header in client.fetch(args.kind or (), start_ms, end_ms, args.chunks, args.pages, args.cursor):
+            for record in records:
+                print(json.dumps(record))
+            total += len(records)
+            if header["flags"] & CHUNK_GAP:
+                print("Records were evicted before they could be read", file=sys.stderr)
+    finally:
+        client.close()
+    boot = " (times since boot, the device clock is not synced)" if header["flags"] & CHUNK_BOOT_TIME else ""
+    print(f"{total} records, next cursor {header['next_cursor']}{boot}", file=sys.stderr)
+
+
+if __name__ == "__main__":
+    main()
@@ -0,0 +1,68 @@
+import csv
+import random
+import sys
+
+# Mirror of the device's report gate, device/speed_sensor/main/report_gate.c,
+# for bench_reporting.py. Kept in lockstep by the host tests: the build runs
+# this file to write a trace of windows with this mirror's decisions, and
+# host_test/test_report_gate replays it through the C gate.
+#
+#   python report_gate.py <trace.csv>
+HEALTH_FIELDS = ("window_s", "sensor_1_up", "sensor_2_up", "ota_active")
+TRACE_FIELDS = ["heartbeat_s", "window_s", "num_cars", "sensor_1_up", "sensor_2_up", "ota_active", "events_dropped",
+                "published", "quiet_windows"]
+
+
+class ReportGate:
+    """report_gate_window(): windows are dicts of the report_window_t fields."""
+
+    def __init__(self):
+        self.last = None
+        self.quiet_windows = 0
+        self.quiet_s = 0
+
+    def health_changed(self, window):
+        return any(window[k] != self.last[k] for k in HEALTH_FIELDS) or bool(window["events_dropped"])
+
+    def window(self, window, heartbeat_s):
+        """quiet_windows to report with this window, None if it is held back."""
+        quiet = self.last is not None and window["num_cars"] == 0 and not self.health_changed(window)
+        # The heartbeat counts the window itself, so a report goes out at least every heartbeat_s
+        if quiet and heartbeat_s > 0 and self.quiet_s + 2 * window["window_s"] <= heartbeat_s:
+            self.quiet_windows += 1
+            self.quiet_s += window["window_s"]
+            return None
+        quiet_windows, self.quiet_windows, self.quiet_s, self.last = self.quiet_windows, 0, 0, window
+        return quiet_windows
+
+
+def trace(rng, windows):
+    """Mostly quiet windows with every kind of change now and then, and the mirror's decisions."""
+    gate = ReportGate()
+    heartbeat_s = 300
+    window = {"window_s": 5, "num_cars": 0, "sensor_1_up": 1, "sensor_2_up": 1, "ota_active": 0, "events_dropped": 0}
+    for _ in range(windows):
+        window = dict(window)
+        if rng.random() < 0.002:
+            heartbeat_s = rng.choice([0, 7, 60, 300, 3600])
+        if rng.random() < 0.002:
+            window["window_s"] = rng.choice([1, 5, 10, 60, 300])
+        for flag in ("sensor_1_up", "sensor_2_up", "ota_active"):
+            if rng.random() < 0.001:
+                window[flag] ^= 1
+        window["events_dropped"] = int(rng.random() < 0.001)
+        window["num_cars"] = rng.randint(1, 5) if rng.random() < 0.05 else 0
+        quiet = gate.window(window, heartbeat_s)
+        yield {"heartbeat_s": heartbeat_s, **window, "published": int(quiet is not None), "quiet_windows": quiet or 0}
+
+
+def main():
+    path = sys.argv[1] if len(sys.argv) > 1 else "report_gate_trace.csv"
+    with open(path, "w", newline="") as f:
+        writer = csv.DictWriter(f, fieldnames=TRACE_FIELDS)
+        writer.writeheader()
+        writer.writerows(trace(random.Random(45), 100_000))
+
+
+if __name__ == "__main__":
+    main()
@@ -0,0 +1,124 @@
+import argparse
+import json
+import sys
+import time
+from collections import Counter
+
+import paho.mqtt.client as mqtt
+
+from commons import *
+from mqtt_traffic import connect, read_log
+
+# Persistent session, so windows published while this checker is down are
+# queued by the broker and checked on reconnect
+CHECK_CLIENT_ID = "restart_check"
+
+
+class GapChecker:
+    """
+    Checks each device lane's reports for loss across broker (or subscriber)
+    restarts: "seq" counts queued windows per lane from 1 at boot, and
+    consecutive "ts" are a window apart plus the quiet windows held back.
+    QoS1 may deliver a report twice, which is counted but is not a gap.
+    """
+
+    def __init__(self):
+        self.last = {}
+        self.counts = Counter()
+
+    def add(self, message):
+        """Problems found with this report, as printable strings."""
+        key = (message.get("device"), int(message.get("lane", 0)))
+        seq = message.get("seq")
+        ts = message.get("ts")
+        data = message.get("data") or {}
+        self.counts["received"] += 1
+        last = self.last.get(key)
+        self.last[key] = {"seq": seq, "ts": ts}
+        if last is None:
+            return []
+
+        problems = []
+        if seq is not None and last["seq"] is not None:
+            if seq <= last["seq"]:
+                if seq == 1:
+                    self.counts["restarts"] += 1
+                    return [f"restarted, {last['seq']} windows before"]
+                self.counts["duplicates"] += 1
+                self.last[key] = last
+                return []
+            if seq > last["seq"] + 1:
+                self.counts["missing"] += seq - last["seq"] - 1
+                problems.append(f"missing seq {last['seq'] + 1}..{seq - 1}")
+
+        # Unsynced devices send an age instead, nothing to compare against
+        if ts is None or last["ts"] is None:
+            return problems
+        if ts <= last["ts"]:
+            self.counts["out_of_order"] += 1
+            problems.append(f"ts {ts} not after the previous {last['ts']}")
+        elif data.get("window_s"):
+            window_ms = int(data["window_s"]) * 1000
+            expected_ms = window_ms * (int(data.get("quiet_windows", 0)) + 1)
+            if abs(ts - last["ts"] - expected_ms) > window_ms // 2:
+                self.counts["ts_gaps"] += 1
+                problems.append(f"{(ts - last['ts']) / 1000:.0f} s after the previous window, expected {expected_ms / 1000:.0f} s")
+        return problems
+
+    def failed(self):
+        return any(self.counts[k] for k in ("missing", "out_of_order", "ts_gaps"))
+
+    def summary(self):
+        return (f"{len(self.last)} lanes, {self.counts['received']} reports: {self.counts['missing']} missing, "
+                f"{self.counts['ts_gaps']} timestamp gaps, {self.counts['out_of_order']} out of order, "
+                f"{self.counts['duplicates']} redelivered, {self.counts['restarts']} device restarts")
+
+
+def check(checker, topic, payload):
+    if topic_device(topic) is None or not topic.endswith("/data"):
+        return
+    try:
+        message = json.loads(payload.decode("utf-8"))
+    except (UnicodeDecodeError, json.JSONDecodeError):
+        print(f"{topic}: not JSON")
+        return
+    for problem in checker.add(message):
+        print(f"{message.get('device')} lane {message.get('lane', 0)}: {problem}")
+
+
+def main():
+    parser = argparse.ArgumentParser(description="Check device reports for gaps across broker restarts")
+    parser.add_argument("--log", help="check a data_pipeline/mqtt_traffic.py log instead of the broker")
+    parser.add_argument("--host", default=SERVER_HOST)
+    parser.add_argument("--port", type=int, default=SERVER_PORT)
+    parser.add_argument("--no-tls", action="store_true")
+    parser.add_argument("--user", nargs=2, metavar=("NAME", "PASSWORD"))
+    parser.add_argument("--duration", type=int, default=0, help="s, default until interrupted")
+    args = parser.parse_args()
+
+    checker = GapChecker()
+    if args.log:
+        for topic, payload, *_ in read_log(args.log):
+            check(checker, topic, payload)
+    else:
+        client = connect(args.host, args.port, not args.no_tls, CHECK_CLIENT_ID,
+                         tuple(args.user) if args.user else USER_CREDS, clean_session=False)
+        client.on_connect = lambda client, userdata, flags, rc, properties: client.subscribe(DEVICE_DATA_TOPICS, qos=1)
+        client.on_message = lambda client, userdata, msg: check(checker, msg.topic, msg.payload)
+        client.loop_start()
+        start = time.time()
+        try:
+            while args.duration == 0 or time.time() - start < args.duration:
+                time.sleep(1)
+        except KeyboardInterrupt:
+            pass
+        finally:
+            client.loop_stop()
+            client.disconnect()
+
+    print(checker.summary())
+    sys.exit(1 if checker.failed() else 0)
+
+
+if __name__ == "__main__":
+    main()
@@ -0,0 +1,310 @@
+import argparse
+import os
+import time
+from datetime import datetime, timezone
+
+import pandas as pd
+import pyarrow as pa
+import pyarrow.parquet as pq
+
+from commons import *
+
+# Bump on any change to TELEMETRY_SCHEMA, and teach conform() about the old layout
+SCHEMA_VERSION = 7
+SCHEMA_VERSION_KEY = b"wow_schema_version"
+
+TELEMETRY_SCHEMA = pa.schema([
+    ("device", pa.dictionary(pa.int32(), pa.string())),
+    ("timestamp", pa.timestamp("ms", tz="UTC")),
+    ("version", pa.dictionary(pa.int32(), pa.string())),
+    ("lane", pa.uint8()),
+    ("avg_speed", pa.float32()),
+    ("max_speed", pa.float32()),
+    ("min_speed", pa.float32()),
+    # v2: 85th percentile of vehicle speed over the batch, from edge gateway
+    # batches only (the gateway's sketch of speed_hist)
+    ("speed_p85", pa.float32()),
+    ("num_cars", pa.uint16()),
+    ("sensor_1_up", pa.bool_()),
+    ("sensor_2_up", pa.bool_()),
+    # Device health, absent from older firmware and the dummy sensors
+    ("boot_measure_ms", pa.int32()),
+    ("boot_publish_ms", pa.int32()),
+    ("wifi_reconnects", pa.uint32()),
+    ("wifi_reconnect_ms", pa.uint32()),
+    ("wifi_reconnect_max_ms", pa.uint32()),
+    ("outbox_depth", pa.uint16()),
+    ("outbox_bytes", pa.uint32()),
+    ("outbox_spooled", pa.uint32()),
+    ("outbox_dropped", pa.uint32()),
+    ("mqtt_retransmits", pa.uint32()),
+    # v3: free heap, largest free block and steady-state allocation count
+    ("heap_free", pa.uint32()),
+    ("heap_largest", pa.uint32()),
+    ("heap_allocs", pa.uint32()),
+    # v4: measurement cycle start jitter, percentiles and the histogram
+    # counts behind them (bucket k below 32 << k us, the last one open)
+    ("jitter_p50_us", pa.uint32()),
+    ("jitter_p99_us", pa.uint32()),
+    ("jitter_max_us", pa.uint32()),
+    ("jitter_hist", pa.list_(pa.uint32())),
+    # v5: a firmware download was running during the window
+    ("ota_active", pa.bool_()),
+    # v6: report-on-change, window length and the zero-traffic windows held
+    # back before this one. Rows put back by expand_quiet_windows() have
+    # window_s but no quiet_windows
+    ("window_s", pa.uint16()),
+    ("quiet_windows", pa.uint32()),
+    # v7: vehicles per speed bucket (see SPEED_HIST_* in commons.py), trimmed
+    # after the last non-empty one; summed over the batch for gateway rows.
+    # query.summarize() takes speed percentiles from these
+    ("speed_hist", pa.list_(pa.uint32())),
+], metadata={SCHEMA_VERSION_KEY: str(SCHEMA_VERSION).encode()})
+
+PANDAS_INT_DTYPES = {
+    pa.uint8(): "UInt8",
+    pa.uint16(): "UInt16",
+    pa.uint32(): "UInt32",
+    pa.int32(): "Int32",
+}
+
+REQUIRED_FIELDS = ["avg_speed", "max_speed", "min_speed", "num_cars", "sensor_1_up", "sensor_2_up"]
+
+# Naive timestamps in files written before the schema are local time
+LOCAL_TZ = datetime.now().astimezone().tzinfo
+
+
+class SchemaError(ValueError):
+    def __init__(self, reason):
+        super().__init__(reason)
+        self.reason = reason
+
+
+def _range_checked(value, field, low, high):
+    if not low <= value <= high:
+        raise SchemaError(f"range:{field}")
+    return value
+
+
+def _parse_value(field, value):
+    kind = TELEMETRY_SCHEMA.field(field).type
+    if pa.types.is_list(kind):
+        if not isinstance(value, list):
+            raise SchemaError(f"type:{field}")
+        return [_parse_scalar(field, kind.value_type, v) for v in value]
+    return _parse_scalar(field, kind, value)
+
+
+def _parse_scalar(field, kind, value):
+    try:
+        if pa.types.is_boolean(kind):
+            if isinstance(value, str):
+                value = value.strip().lower()
+                if value in ("1", "true"):
+                    return True
+                if value in ("0", "false"):
+                    return False
+                raise ValueError(value)
+            return bool(int(value))
+        if pa.types.is_floating(kind):
+            value = float(value)
+            if value != value:
+                raise ValueError(value)
+            return value
+        value = int(float(value))
+    except (TypeError, ValueError):
+        raise SchemaError(f"type:{field}")
+    bits = kind.bit_width
+    if pa.types.is_signed_integer(kind):
+        return _range_checked(value, field, -(1 << (bits - 1)), (1 << (bits - 1)) - 1)
+    return _range_checked(value, field, 0, (1 << bits) - 1)
+
+
+def parse_message(message):
+    """
+    Turn one decoded /device/<id>/data message into a typed row. Values may be
+    strings (older firmware) or JSON numbers. Raises SchemaError naming the
+    first offending field.
+    """
+    device = message.get("device")
+    data = message.get("data")
+    if not isinstance(device, str) or not device:
+        raise SchemaError("missing:device")
+    if not isinstance(data, dict):
+        raise SchemaError("missing:data")
+
+    ts = message.get("ts")
+    if ts is None:
+        # Devices that gave up waiting for a time sync send the window's age instead
+        try:
+            age_ms = int(message.get("age_ms", 0))
+        except (TypeError, ValueError, OverflowError):
+            raise SchemaError("type:age_ms")
+        timestamp = pd.Timestamp.now(tz="UTC") - pd.Timedelta(max(age_ms, 0), unit="ms")
+    else:
+        try:
+            timestamp = pd.Timestamp(int(ts), unit="ms", tz="UTC")
+        except (TypeError, ValueError, OverflowError):
+            raise SchemaError("type:ts")
+
+    row = {
+        "device": device,
+        "timestamp": timestamp,
+        "version": str(message.get("version", "")),
+        "lane": _parse_value("lane", message.get("lane", 0)),
+    }
+    for field in REQUIRED_FIELDS:
+        if field not in data:
+            raise SchemaError(f"missing:{field}")
+    for field, value in data.items():
+        if value is not None and TELEMETRY_SCHEMA.get_field_index(field) >= 0 and field not in row:
+            row[field] = _parse_value(field, value)
+    return row
+
+
+def parse_site_batch(batch):
+    """
+    Expand an edge gateway batch (see edge_gateway/aggregator.py) into one
+    typed row per device and lane, stamped with its last window.
+    """
+    if not isinstance(batch, dict) or not isinstance(batch.get("devices"), list):
+        raise SchemaError("missing:devices")
+    rows = []
+    for entry in batch["devices"]:
+        if not isinstance(entry, dict):
+            raise SchemaError("type:devices")
+        cars = entry.get("num_cars", 0)
+        rows.append(parse_message({
+            "device": entry.get("device"),
+            "version": entry.get("version", ""),
+            "ts": entry.get("last_ts"),
+            "lane": entry.get("lane", 0),
+            "data": {
+                "avg_speed": entry.get("speed_sum", 0) / cars if cars else 0,
+                "max_speed": entry.get("max_speed") or 0,
+                "min_speed": entry.get("min_speed") or 0,
+                "num_cars": cars,
+                "sensor_1_up": entry.get("sensor_1_up"),
+                "sensor_2_up": entry.get("sensor_2_up"),
+                "speed_p85": entry.get("speed_p85"),
+                "speed_hist": entry.get("speed_hist"),
+            },
+        }))
+    return rows
+
+
+def expand_quiet_windows(row, previous=None):
+    """
+    A report followed by the zero-traffic windows held back right before it
+    (see device/speed_sensor/main/report_gate.h), oldest first. They are
+    window_s apart and carry the sensor state of the previous report, which
+    is what they were compared against on the device, or of this report when
+    the previous one isn't known. Device health is a snapshot and left empty.
+    """
+    quiet = row.get("quiet_windows") or 0
+    window_s = row.get("window_s")
+    if not quiet or not window_s:
+        return [row]
+    sensors = previous if previous is not None else row
+    rows = [{
+        "device": row["device"],
+        "timestamp": row["timestamp"] - pd.Timedelta(seconds=window_s * k),
+        "version": row["version"],
+        "lane": row["lane"],
+        "avg_speed": 0.0,
+        "max_speed": 0.0,
+        "min_speed": 0.0,
+        "num_cars": 0,
+        "sensor_1_up": sensors.get("sensor_1_up"),
+        "sensor_2_up": sensors.get("sensor_2_up"),
+        "window_s": window_s,
+    } for k in range(quiet, 0, -1)]
+    return rows + [row]
+
+
+def conform(df):
+    """Coerce a frame, typed or from before the schema, to TELEMETRY_SCHEMA."""
+    out = pd.DataFrame(index=df.index)
+    for field in TELEMETRY_SCHEMA:
+        column = df[field.name] if field.name in df else pd.Series(None, index=df.index, dtype=object)
+        if field.name == "timestamp":
+            column = pd.to_datetime(column)
+            if column.dt.tz is None:
+                column = column.dt.tz_localize(LOCAL_TZ)
+            column = column.dt.tz_convert("UTC").dt.floor("ms")
+        elif pa.types.is_dictionary(field.type):
+            column = column.astype("string").astype("category")
+        elif pa.types.is_boolean(field.type):
+            column = pd.to_numeric(column.map(lambda v: {"true": 1, "false": 0}.get(str(v).lower(), v)), errors="coerce")
+            column = column.astype("boolean")
+        elif pa.types.is_list(field.type):
+            column = column.map(lambda v: None if v is None or v is pd.NA or (isinstance(v, float) and v != v) else [int(x) for x in v])
+        elif pa.types.is_floating(field.type):
+            column = pd.to_numeric(column, errors="coerce").astype("float32")
+        else:
+            column = pd.to_numeric(column, errors="coerce").astype(PANDAS_INT_DTYPES[field.type])
+        out[field.name] = column
+    if "lane" in out:
+        out["lane"] = out["lane"].fillna(0)
+    return out
+
+
+def to_table(df):
+    return pa.Table.from_pandas(conform(df), schema=TELEMETRY_SCHEMA, preserve_index=False)
+
+
+def file_schema_version(path):
+    metadata = pq.read_schema(path).metadata or {}
+    return int(metadata.get(SCHEMA_VERSION_KEY, b"0"))
+
+
+def dashboard_query_seconds(load, coerce):
+    # What visualize.py does per refresh: load, pick a device, last 60 windows,
+    # which before the schema also meant parsing the numbers
+    start = time.perf_counter()
+    df = load()
+    if len(df):
+        recent = df[df["device"] == df["device"].iloc[0]].tail(60)
+        if coerce:
+            for column in ["avg_speed", "max_speed", "min_speed", "num_cars"]:
+                pd.to_numeric(recent[column], errors="coerce")
+    return time.perf_counter() - start
+
+
+def _load_untyped(root):
+    from history import list_part_files, list_partitions
+    parts = [pd.read_parquet(path) for date in list_partitions(root) for path in list_part_files(root, date)]
+    return pd.concat(parts, ignore_index=True) if parts else pd.DataFrame()
+
+
+def migrate_history(root):
+    """Rewrite every file older than SCHEMA_VERSION in place."""
+    from history import dir_bytes, list_part_files, list_partitions, load_history, write_atomic
+
+    bytes_before = dir_bytes(root)
+    query_before = dashboard_query_seconds(lambda: _load_untyped(root), coerce=True)
+    migrated = 0
+    for date in list_partitions(root):
+        for path in list_part_files(root, date):
+            if file_schema_version(path) < SCHEMA_VERSION:
+                write_atomic(to_table(pd.read_parquet(path)), path)
+                migrated += 1
+    query_after = dashboard_query_seconds(lambda: load_history(root), coerce=False)
+    print(f"Migrated {migrated} files to schema v{SCHEMA_VERSION}")
+    print(f"Bytes: {bytes_before} -> {dir_bytes(root)}")
+    print(f"Dashboard query: {query_before:.3f}s -> {query_after:.3f}s")
+
+
+def main():
+    parser = argparse.ArgumentParser(description="Telemetry schema tools")
+    parser.add_argument("--migrate", action="store_true", help=f"rewrite {RAW_DIR} to the current schema")
+    args = parser.parse_args()
+    if args.migrate:
+        migrate_history(RAW_DIR)
+    else:
+        print(f"Telemetry schema v{SCHEMA_VERSION}")
+        print(TELEMETRY_SCHEMA.remove_metadata())
+
+
+if __name__ == "__main__":
+    main()
@@ -1,31 +1,39 @@
-import json
 import paho.mqtt.client as mqtt
 import ssl
 
 import streamlit as st
 import pandas as pd
-import plotly.express as px
-from datetime import datetime
-import numpy as np
-import os
-import time
 import pydeck as pdk
 
 from commons import *
+from live_feed import LiveFeed, device_view, rows_to_frame
+from query import device_history, devices as history_devices
 
+CHART_COLUMNS = ['avg_speed', 'max_speed', 'min_speed', 'num_cars']
+CHART_POINTS = 60
+CHART_TITLES = {
+    'avg_speed': 'Avg Speed Over Time',
+    'max_speed': 'Max Speed Over Time',
+    'min_speed': 'Min Speed Over Time',
+    'num_cars': 'Cars Over Time',
+}
 
-def load_data():
-    mod_time = datetime.fromtimestamp(os.path.getmtime(SENSOR_FILE))
-    if 'df_last_modified' not in st.session_state or mod_time != st.session_state.df_last_modified:
-        st.session_state.df = pd.read_parquet(SENSOR_FILE)
-        st.session_state.df_last_modified = mod_time
-    return st.session_state.df
 
+@st.cache_resource
+def get_live_feed():
+    # Shared by all sessions of this server process
+    return LiveFeed()
 
-def plot_line_chart(df, x, y, title):
-    fig = px.line(df, x=x, y=y, title=title)
-    fig.update_layout(autosize=False, width=400, height=300)  # Set fixed size for plots
-    return fig
+
+def load_devices():
+    # Only the device column is read, each device's windows are queried when shown
+    if 'devices' not in st.session_state:
+        st.session_state.devices = history_devices()
+    return st.session_state.devices
+
+
+def chart_frame(device_df, column):
+    return device_df.set_index('timestamp')[[column]]
 
 
 def display_device_data(device):
@@ -39,35 +47,58 @@ def display_device_data(device):
     # Always use the placeholder to display the updated table
     st.session_state.device_info_placeholder.table(device_info)
     
-    device_df = st.session_state.df[st.session_state.df['device'] == device].copy().tail(60)
+    # Everything after this arrives from the live feed
+    history = device_history(device, ['version'] + CHART_COLUMNS, points=CHART_POINTS)
+    device_df, frames = device_view(history, device, CHART_COLUMNS, CHART_POINTS)
+
+    if len(device_df):
+        SENSOR_VERSIONS[device] = device_df["version"].iloc[-1]
+
+    st.session_state.shown_until = device_df['timestamp'].max() if len(device_df) else None
 
-    last_element_version = device_df["version"].iloc[-1]
-    SENSOR_VERSIONS[device] = last_element_version
+    # Drawn once, new points are appended with add_rows
+    st.session_state.charts = {}
+    for column in CHART_COLUMNS:
+        with st.session_state.chart_placeholders[column].container():
+            st.caption(CHART_TITLES[column])
+            st.session_state.charts[column] = st.line_chart(frames[column], height=250)
 
-    # Convert columns to numeric as necessary
-    for column in ['avg_speed', 'max_speed', 'min_speed', 'num_cars']:
-        device_df[column] = pd.to_numeric(device_df[column], errors='coerce')
 
-    # Update plots
-    st.session_state.avg_speed_plot.plotly_chart(plot_line_chart(device_df, 'timestamp', 'avg_speed', 'Avg Speed Over Time'), use_container_width=True)
-    st.session_state.max_speed_plot.plotly_chart(plot_line_chart(device_df, 'timestamp', 'max_speed', 'Max Speed Over Time'), use_container_width=True)
-    st.session_state.min_speed_plot.plotly_chart(plot_line_chart(device_df, 'timestamp', 'min_speed', 'Min Speed Over Time'), use_container_width=True)
-    st.session_state.num_cars_plot.plotly_chart(plot_line_chart(device_df, 'timestamp', 'num_cars', 'Cars Over Time'), use_container_width=True)
+def append_device_data(device, rows):
+    device_df = rows_to_frame(rows)
+    if len(device_df) and st.session_state.shown_until is not None:
+        # The feed buffer overlaps with what history already had on disk
+        device_df = device_df[device_df['timestamp'] > st.session_state.shown_until]
+    if not len(device_df):
+        return
+    st.session_state.shown_until = device_df['timestamp'].max()
 
+    version = device_df["version"].iloc[-1]
+    if version != SENSOR_VERSIONS[device]:
+        SENSOR_VERSIONS[device] = version
+        st.session_state.device_info_placeholder.table(pd.DataFrame({
+            "Device": [device],
+            "Label": [SENSOR_LOCATIONS[device]['label']],
+            "Version": [version]
+        }))
 
-def deploy_action(mqtt_client):
-    print("Deploy: MQTT topic: /device/deploy")
-    mqtt_client.publish("/device/bump", "deploy")
+    for column in CHART_COLUMNS:
+        st.session_state.charts[column].add_rows(chart_frame(device_df, column))
 
 
-def retract_action(mqtt_client):
-    print("Retract: MQTT topic: /device/deploy")
-    mqtt_client.publish("/device/bump", "retract")
+def deploy_action(mqtt_client, device):
+    print(f"Deploy: MQTT topic: {device_topic(device, 'bump')}")
+    mqtt_client.publish(device_topic(device, "bump"), "deploy")
 
 
-def upgrade_action(mqtt_client):
-    print("Upgrade: MQTT topic: /device/upgrade")
-    mqtt_client.publish("/device/upgrade", "speed_sensor.bin")
+def retract_action(mqtt_client, device):
+    print(f"Retract: MQTT topic: {device_topic(device, 'bump')}")
+    mqtt_client.publish(device_topic(device, "bump"), "retract")
+
+
+def upgrade_action(mqtt_client, device):
+    print(f"Upgrade: MQTT topic: {device_topic(device, 'upgrade')}")
+    mqtt_client.publish(device_topic(device, "upgrade"), "speed_sensor.bin")
 
 
 def on_mqtt_connect(client, userdata, flags, rc, properties):
@@ -93,14 +124,16 @@ def create_dashboard(mqtt_client):
     st.set_page_config(layout="wide")
     st.title("Speed Bump Controller Dashboard")
 
-    load_data()
-
-    devices = np.sort(st.session_state.df['device'].unique())
+    devices = load_devices()
     selected_device = st.sidebar.selectbox("Select a device", devices)
     
-    if 'avg_speed_plot' not in st.session_state:
+    if 'chart_placeholders' not in st.session_state:
         prepare_sidebar_placeholders()
 
+    # Replay whatever the feed still buffers, history on disk may lag behind it
+    feed = get_live_feed()
+    seq = 0
+
     display_device_data(selected_device)
 
     # Main body map
@@ -133,29 +166,31 @@ def create_dashboard(mqtt_client):
 
         with button1:
             if st.button("Upgrade"):
-                upgrade_action(mqtt_client)
+                upgrade_action(mqtt_client, selected_device)
 
         with button2:
             if st.button("Deploy"):
-                deploy_action(mqtt_client)
+                deploy_action(mqtt_client, selected_device)
         
         with button3:
             if st.button("Retract"):
-                retract_action(mqtt_client)
+                retract_action(mqtt_client, selected_device)
 
 
 
-    while True:
-        load_data()
-        display_device_data(selected_device)
-        time.sleep(UPDATE_INTERVAL)
+    # Only the selected device's topics are subscribed while this session shows it
+    feed.watch(selected_device)
+    try:
+        while True:
+            # Blocks until the feed has something new, no polling of the history
+            rows, seq = feed.wait_since(selected_device, seq, UPDATE_INTERVAL)
+            append_device_data(selected_device, rows)
+    finally:
+        feed.unwatch(selected_device)
 
 def prepare_sidebar_placeholders():
     st.session_state.device_info_placeholder = st.sidebar.empty()
-    st.session_state.avg_speed_plot = st.sidebar.empty()
-    st.session_state.max_speed_plot = st.sidebar.empty()
-    st.session_state.min_speed_plot = st.sidebar.empty()
-    st.session_state.num_cars_plot = st.sidebar.empty()
+    st.session_state.chart_placeholders = {column: st.sidebar.empty() for column in CHART_COLUMNS}
 
 
 def create_login():
@@ -1,44 +1,115 @@
-import os
 import paho.mqtt.client as mqtt
-import pandas as pd
 import json
+import os
 import ssl
-from datetime import datetime
+import time
+from collections import Counter
+from threading import Lock
 
 from commons import *
+from health import FleetHealth
+from history import TMP_PREFIX, write_ingest_batch
+from schema import SchemaError, expand_quiet_windows, parse_message, parse_site_batch
+
+# Rows waiting to be written as the next small file, see compact.py for merging
+PENDING = []
+PENDING_LOCK = Lock()
+# Last window timestamp per device lane, to drop QoS1 redeliveries
+LAST_TS = {}
+# Last report per device lane, the state held-back quiet windows are put back with
+LAST_ROW = {}
+# Malformed messages by reason, e.g. "type:num_cars"
+REJECTED = Counter()
+
+
+def print_alert(alert):
+    detail = ", ".join(f"{k}={v}" for k, v in alert.items() if k not in ("ts", "kind", "device"))
+    print(f"Health: {alert['device']} {alert['kind']}" + (f" ({detail})" if detail else ""))
+
 
-DF = None
+# Live state of every device, fed from the same stream
+HEALTH = FleetHealth(on_alert=print_alert)
 
 def on_mqtt_connect(client, userdata, flags, rc, properties):
     print("Connected with MQTT broker with status", str(rc))
 
-    client.subscribe("/device/data")
+    client.subscribe(DEVICE_DATA_TOPICS, qos=1)
+    # Sites behind an edge gateway arrive as pre-aggregated batches
+    client.subscribe(SITE_BATCH_TOPICS, qos=1)
 
 
-def on_mqtt_message(client, userdata, msg):
-    global DF
+def flush_pending():
+    with PENDING_LOCK:
+        rows = PENDING[:]
+        PENDING.clear()
+    if rows:
+        write_ingest_batch(rows)
 
-    sensor_readings = json.loads(msg.payload.decode())
-    data = sensor_readings.get("data")
-    device_id = sensor_readings.get("device")
-    version = sensor_readings.get("version")
-    timestamp = datetime.now().isoformat()
-    new_row = {"device": device_id, 'timestamp': timestamp, "version": version, **data}
-    DF = DF._append(new_row, ignore_index=True)
-    DF.to_parquet(SENSOR_FILE, index=False)
 
+def write_health():
+    with PENDING_LOCK:
+        HEALTH.check()
+        snapshot = HEALTH.snapshot()
+    directory, name = os.path.split(HEALTH_FILE)
+    os.makedirs(directory, exist_ok=True)
+    tmp_path = os.path.join(directory, TMP_PREFIX + name)
+    with open(tmp_path, "w") as f:
+        json.dump(snapshot, f)
+    os.replace(tmp_path, HEALTH_FILE)
 
-def main():
-    global DF
 
-    if os.path.exists(SENSOR_FILE):
-        DF = pd.read_parquet(SENSOR_FILE)
-        print("Loaded existing sensor data file.")
-    else:
-        DF = pd.DataFrame()
-        print("Initialized new DataFrame.")
+def on_mqtt_message(client, userdata, msg):
+    try:
+        sensor_readings = json.loads(msg.payload.decode())
+        if not isinstance(sensor_readings, dict):
+            raise SchemaError("json")
+        # Typed once here, everything downstream reads native columns
+        if msg.topic.startswith("/site/"):
+            # The broker ACL ties the topic to the publishing gateway, which
+            # may only report for the devices of its own site
+            allowed = SITE_DEVICES.get(topic_site(msg.topic), ())
+            new_rows = []
+            for row in parse_site_batch(sensor_readings):
+                if row["device"] in allowed:
+                    new_rows.append(row)
+                else:
+                    REJECTED["site:device"] += 1
+        else:
+            new_rows = [parse_message(sensor_readings)]
+            # The broker ACL ties the topic to the publishing device, the payload is not trusted
+            if new_rows[0]["device"] != topic_device(msg.topic):
+                raise SchemaError("topic:device")
+    except (UnicodeDecodeError, json.JSONDecodeError):
+        REJECTED["json"] += 1
+        return
+    except SchemaError as e:
+        REJECTED[e.reason] += 1
+        return
+
+    with PENDING_LOCK:
+        for new_row in new_rows:
+            # Multi-lane nodes send one report per lane for each window
+            key = (new_row["device"], new_row["lane"])
+            # Windows are stamped with wall-clock time, which may be well before
+            # arrival when a window was held back during boot. They are delivered
+            # in order at least once, so anything not newer is a duplicate
+            if key in LAST_TS and new_row["timestamp"] <= LAST_TS[key]:
+                continue
+            # Devices hold back quiet windows, put them back so rollups count every window
+            for row in expand_quiet_windows(new_row, LAST_ROW.get(key)):
+                if key not in LAST_TS or row["timestamp"] > LAST_TS[key]:
+                    PENDING.append(row)
+            LAST_TS[key] = new_row["timestamp"]
+            LAST_ROW[key] = new_row
+            HEALTH.update(new_row)
+        full = len(PENDING) >= INGEST_FLUSH_ROWS
+    if full:
+        flush_pending()
 
-    client = mqtt.Client(mqtt.CallbackAPIVersion.VERSION2)
+
+def main():
+    # Persistent session, so the broker queues QoS1 telemetry while we are down
+    client = mqtt.Client(mqtt.CallbackAPIVersion.VERSION2, client_id=INGEST_CLIENT_ID, clean_session=False)
 
     # Set up SSL/TLS connection
     ssl_context = ssl.create_default_context()
@@ -52,7 +123,18 @@ def main():
     client.username_pw_set(*USER_CREDS)
 
     client.connect(SERVER_HOST, SERVER_PORT, 60)
-    client.loop_forever()
+    client.loop_start()
+
+    try:
+        while True:
+            time.sleep(INGEST_FLUSH_S)
+            flush_pending()
+            write_health()
+            if REJECTED:
+                print("Rejected messages:", dict(REJECTED))
+    finally:
+        client.loop_stop()
+        flush_pending()
 
 
 
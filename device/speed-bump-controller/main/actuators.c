@@ -0,0 +1,118 @@
+#include <string.h>
+
+#include "actuators.h"
+
+
+// Wrap-safe "a is at or after b"
+static bool time_reached(uint32_t a, uint32_t b)
+{
+    return (int32_t)(a - b) >= 0;
+}
+
+
+void actuators_init(actuator_set_t *set, size_t count, const actuator_timing_t *timing, uint32_t now_ms)
+{
+    memset(set, 0, sizeof(*set));
+    set->count = count > ACTUATORS_MAX ? ACTUATORS_MAX : count;
+    set->timing = *timing;
+    for (size_t i = 0; i < set->count; i++) {
+        set->actuators[i].state = ACTUATOR_RETRACTED;
+        set->actuators[i].angle = ACTUATOR_RETRACTED_ANGLE;
+        // Don't hold the first command back by min_change_ms
+        set->actuators[i].last_change_ms = now_ms - timing->min_change_ms;
+    }
+}
+
+
+uint32_t actuators_mask(const actuator_set_t *set, uint8_t mask_byte)
+{
+    uint32_t all = (1u << set->count) - 1;
+    return mask_byte == 0 ? all : mask_byte & all;
+}
+
+
+static void start_move(actuator_t *actuator, bool deploy, uint32_t start_ms)
+{
+    actuator->state = deploy ? ACTUATOR_DEPLOYING : ACTUATOR_RETRACTING;
+    actuator->from_angle = actuator->angle;
+    actuator->move_start_ms = start_ms;
+}
+
+
+uint32_t actuators_command(actuator_set_t *set, uint32_t mask, bool deploy, uint32_t now_ms)
+{
+    uint32_t accepted = 0;
+    uint32_t start_ms = now_ms;
+    for (size_t i = 0; i < set->count; i++) {
+        actuator_t *actuator = &set->actuators[i];
+        if (!(mask & (1u << i))) {
+            continue;
+        }
+        bool there = deploy ? (actuator->state == ACTUATOR_DEPLOYING || actuator->state == ACTUATOR_DEPLOYED)
+                            : (actuator->state == ACTUATOR_RETRACTING || actuator->state == ACTUATOR_RETRACTED);
+        if (there || !time_reached(now_ms, actuator->last_change_ms + set->timing.min_change_ms)) {
+            continue;
+        }
+        start_move(actuator, deploy, start_ms);
+        actuator->last_change_ms = now_ms;
+        start_ms += set->timing.stagger_ms;
+        accepted |= 1u << i;
+    }
+    return accepted;
+}
+
+
+uint32_t actuators_update(actuator_set_t *set, uint32_t now_ms)
+{
+    uint32_t changed = 0;
+
+    // Expired deployments retract together, staggered like any other command
+    uint32_t expired = 0;
+    for (size_t i = 0; i < set->count; i++) {
+        actuator_t *actuator = &set->actuators[i];
+        if (actuator->state == ACTUATOR_DEPLOYED && time_reached(now_ms, actuator->deployed_ms + set->timing.auto_retract_ms)) {
+            expired |= 1u << i;
+        }
+    }
+    if (expired) {
+        actuators_command(set, expired, false, now_ms);
+    }
+
+    for (size_t i = 0; i < set->count; i++) {
+        actuator_t *actuator = &set->actuators[i];
+        if (actuator->state != ACTUATOR_DEPLOYING && actuator->state != ACTUATOR_RETRACTING) {
+            continue;
+        }
+        if (!time_reached(now_ms, actuator->move_start_ms)) {
+            continue;
+        }
+
+        bool deploying = actuator->state == ACTUATOR_DEPLOYING;
+        int32_t target = deploying ? ACTUATOR_DEPLOYED_ANGLE : ACTUATOR_RETRACTED_ANGLE;
+        int32_t travel = (int32_t)((uint64_t)(now_ms - actuator->move_start_ms) * set->timing.deg_per_s / 1000);
+        int32_t angle = deploying ? actuator->from_angle + travel : actuator->from_angle - travel;
+        if (deploying ? angle >= target : angle <= target) {
+            angle = target;
+            actuator->state = deploying ? ACTUATOR_DEPLOYED : ACTUATOR_RETRACTED;
+            if (deploying) {
+                actuator->deployed_ms = now_ms;
+            }
+        }
+        if (angle != actuator->angle) {
+            actuator->angle = angle;
+            changed |= 1u << i;
+        }
+    }
+    return changed;
+}
+
+
+bool actuators_moving(const actuator_set_t *set)
+{
+    for (size_t i = 0; i < set->count; i++) {
+        if (set->actuators[i].state == ACTUATOR_DEPLOYING || set->actuators[i].state == ACTUATOR_RETRACTING) {
+            return true;
+        }
+    }
+    return false;
+}
@@ -0,0 +1,96 @@
+#ifndef __ACTUATORS_H__
+#define __ACTUATORS_H__
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+/*
+ * Bookkeeping for the speed bump servos of one controller: what each one
+ * was told to do, where it is on its way there and when it may start moving.
+ * Motion is a function of time, so the caller only has to call
+ * actuators_update() periodically and push the angles that changed to the
+ * PWM comparators.
+ *
+ * Servos told to move together can be started stagger_ms apart, so their
+ * stall currents don't all land on the supply at once.
+ *
+ * Plain C with no ESP-IDF dependencies so it can be exercised on a host.
+ * Times are milliseconds from any free-running clock, wrapping is fine.
+ */
+#define ACTUATORS_MAX 6     // Two per MCPWM operator, three operators per group
+
+#define ACTUATOR_RETRACTED_ANGLE 0
+#define ACTUATOR_DEPLOYED_ANGLE 180
+
+typedef enum
+{
+    ACTUATOR_RETRACTED,
+    ACTUATOR_DEPLOYING,
+    ACTUATOR_DEPLOYED,
+    ACTUATOR_RETRACTING,
+} actuator_state_t;
+
+typedef struct
+{
+    uint16_t deg_per_s;         //!< Travel speed
+    uint32_t stagger_ms;        //!< Delay between servos starting together, 0 to move in sync
+    uint32_t min_change_ms;     //!< Commands closer together than this are ignored
+    uint32_t auto_retract_ms;   //!< Time spent deployed before retracting on its own
+} actuator_timing_t;
+
+typedef struct
+{
+    actuator_state_t state;
+    int16_t angle;              //!< Current commanded angle
+    int16_t from_angle;         //!< Angle the current move started from
+    uint32_t move_start_ms;     //!< Start of the current move, may be in the future
+    uint32_t last_change_ms;    //!< Last accepted command
+    uint32_t deployed_ms;       //!< When it finished deploying
+} actuator_t;
+
+typedef struct
+{
+    actuator_t actuators[ACTUATORS_MAX];
+    size_t count;
+    actuator_timing_t timing;
+} actuator_set_t;
+
+
+/**
+ * @brief Start with count actuators, all retracted
+ */
+void actuators_init(actuator_set_t *set, size_t count, const actuator_timing_t *timing, uint32_t now_ms);
+
+
+/**
+ * @brief Actuators addressed by a command's mask byte, where 0 means all of them
+ */
+uint32_t actuators_mask(const actuator_set_t *set, uint8_t mask_byte);
+
+
+/**
+ * @brief Deploy or retract the actuators in mask
+ *
+ * An actuator already in (or heading to) the requested position, or which
+ * accepted a command less than min_change_ms ago, is left alone.
+ *
+ * @return Mask of the actuators that accepted the command
+ */
+uint32_t actuators_command(actuator_set_t *set, uint32_t mask, bool deploy, uint32_t now_ms);
+
+
+/**
+ * @brief Advance motion and auto-retraction to now_ms
+ *
+ * @return Mask of the actuators whose angle changed
+ */
+uint32_t actuators_update(actuator_set_t *set, uint32_t now_ms);
+
+
+/**
+ * @brief Whether any actuator is moving or waiting for its staggered start
+ */
+bool actuators_moving(const actuator_set_t *set);
+
+#endif /* __ACTUATORS_H__ */
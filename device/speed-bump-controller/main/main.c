@@ -16,6 +16,9 @@
 #include "driver/mcpwm_prelude.h"
 #include <semaphore.h> 
 #include "esp_timer.h"
+#include <inttypes.h>
+
+#include "actuators.h"
 
 
 #define SERVO_MIN_PULSEWIDTH_US 500  // Minimum pulse width in microsecond
@@ -23,11 +26,24 @@
 #define SERVO_MIN_DEGREE        0   // Minimum angle
 #define SERVO_MAX_DEGREE        180    // Maximum angle
 
-#define SERVO_PULSE_GPIO             26        // GPIO connects to the PWM signal line
 #define SERVO_TIMEBASE_RESOLUTION_HZ 1000000  // 1MHz, 1us per tick
 #define SERVO_TIMEBASE_PERIOD        20000    // 20000 ticks, 20ms
-#define DEPLOYMENT_STATE_CHANGE_MIN_DELAY 5
-static mcpwm_cmpr_handle_t comparator = NULL;
+#define SERVO_DEG_PER_S              300      // usually 200ms/60degree rotation under 5V power supply
+#define DEPLOYMENT_STATE_CHANGE_MIN_DELAY_MS 50
+#define AUTO_RETRACT_MS              10000
+// Servos starting together are spread out by this much, so their stall
+// currents don't add up. 0 moves them in sync.
+#define ACTUATOR_STAGGER_MS          150
+
+// One servo per bump segment, bit i of the BLE mask byte addresses the i-th.
+// All share one MCPWM timer, two per operator.
+static const int actuator_gpios[] = { 26, 27 };
+#define ACTUATOR_COUNT (sizeof(actuator_gpios) / sizeof(actuator_gpios[0]))
+_Static_assert(ACTUATOR_COUNT <= ACTUATORS_MAX, "One MCPWM group drives at most ACTUATORS_MAX servos");
+
+static mcpwm_cmpr_handle_t comparators[ACTUATORS_MAX];
+static actuator_set_t actuator_set;
+static portMUX_TYPE actuator_mux = portMUX_INITIALIZER_UNLOCKED;
 //sem_t mutex_motor; 
 
 
@@ -48,56 +64,49 @@ static inline uint32_t example_angle_to_compare(int angle)
     return (angle - SERVO_MIN_DEGREE) * (SERVO_MAX_PULSEWIDTH_US - SERVO_MIN_PULSEWIDTH_US) / (SERVO_MAX_DEGREE - SERVO_MIN_DEGREE) + SERVO_MIN_PULSEWIDTH_US;
 }
 
-static bool is_deployed = false;
-static int last_bump_change = 0;
-
-static void deactivate_speed_bump(bool isBySignal) 
+static uint32_t now_ms(void)
 {
-    int current_tick_count = xTaskGetTickCount();
-    if(is_deployed && current_tick_count - last_bump_change > DEPLOYMENT_STATE_CHANGE_MIN_DELAY){
-        int angle = 180;
-        int step = -1;
-        while (!((angle + step) < 0)) {
-            ESP_LOGI(DEMO_TAG, "Angle of rotation: %d", angle);
-            ESP_ERROR_CHECK(mcpwm_comparator_set_compare_value(comparator, example_angle_to_compare(angle)));
-            //Add delay, since it takes time for servo to rotate, usually 200ms/60degree rotation under 5V power supply
-            vTaskDelay(pdMS_TO_TICKS(1));
-            angle += step;
-        }
-        is_deployed = false;
-    }
-    if(isBySignal) {
-        last_bump_change = xTaskGetTickCount();
-    }
+    return (uint32_t)(esp_timer_get_time() / 1000);
 }
 
-static void deactivate_speed_bump_automatic() {
-    vTaskDelay(pdMS_TO_TICKS(10000));
-    deactivate_speed_bump(false);
+// Called from the BT task, the servos are moved by actuator_task
+static void command_speed_bumps(uint8_t mask_byte, bool deploy)
+{
+    portENTER_CRITICAL(&actuator_mux);
+    uint32_t accepted = actuators_command(&actuator_set, actuators_mask(&actuator_set, mask_byte), deploy, now_ms());
+    portEXIT_CRITICAL(&actuator_mux);
+    if (accepted) {
+        ESP_LOGI(DEMO_TAG, "%s actuators 0x%02" PRIx32, deploy ? "Deploying" : "Retracting", accepted);
+    }
 }
 
-static void activate_speed_bump()
+static void actuator_task(void *pvParameters)
 {
-    int current_tick_count = xTaskGetTickCount();
-    if(!is_deployed && current_tick_count - last_bump_change > DEPLOYMENT_STATE_CHANGE_MIN_DELAY) {
-        int angle = 0;
-        int step = 1;
-        while (!((angle + step) > 180)) {
-            ESP_LOGI(DEMO_TAG, "Angle of rotation: %d", angle);
-            ESP_ERROR_CHECK(mcpwm_comparator_set_compare_value(comparator, example_angle_to_compare(angle)));
-            //Add delay, since it takes time for servo to rotate, usually 200ms/60degree rotation under 5V power supply
-            vTaskDelay(pdMS_TO_TICKS(1));
-            angle += step;
+    int angles[ACTUATORS_MAX];
+    TickType_t period = pdMS_TO_TICKS(SERVO_TIMEBASE_PERIOD / 1000);
+    TickType_t last_wake = xTaskGetTickCount();
+    while (true) {
+        portENTER_CRITICAL(&actuator_mux);
+        uint32_t changed = actuators_update(&actuator_set, now_ms());
+        for (size_t i = 0; i < actuator_set.count; i++) {
+            angles[i] = actuator_set.actuators[i].angle;
+        }
+        portEXIT_CRITICAL(&actuator_mux);
+
+        for (size_t i = 0; i < ACTUATOR_COUNT; i++) {
+            if (changed & (1u << i)) {
+                ESP_LOGD(DEMO_TAG, "Actuator %u angle %d", (unsigned)i, angles[i]);
+                ESP_ERROR_CHECK(mcpwm_comparator_set_compare_value(comparators[i], example_angle_to_compare(angles[i])));
+            }
         }
-        is_deployed = true;
-        xTaskCreate(&deactivate_speed_bump_automatic, "undeploy_speed_bump_task", 2048, NULL, 5, NULL);
+        // A new pulse width only takes effect once per PWM period anyway
+        xTaskDelayUntil(&last_wake, period > 0 ? period : 1);
     }
-    last_bump_change = xTaskGetTickCount();
 }
 
-static void setup_servo() 
+static void setup_servos()
 {
-        ESP_LOGI(DEMO_TAG, "Create timer and operator");
+    ESP_LOGI(DEMO_TAG, "Create the shared timer");
     mcpwm_timer_handle_t timer = NULL;
     mcpwm_timer_config_t timer_config = {
         .group_id = 0,
@@ -109,43 +118,52 @@ static void setup_servo()
     ESP_ERROR_CHECK(mcpwm_new_timer(&timer_config, &timer));
 
     mcpwm_oper_handle_t oper = NULL;
-    mcpwm_operator_config_t operator_config = {
-        .group_id = 0, // operator must be in the same group to the timer
-    };
-    ESP_ERROR_CHECK(mcpwm_new_operator(&operator_config, &oper));
-
-    ESP_LOGI(DEMO_TAG, "Connect timer and operator");
-    ESP_ERROR_CHECK(mcpwm_operator_connect_timer(oper, timer));
-
-    ESP_LOGI(DEMO_TAG, "Create comparator and generator from the operator");
+    for (size_t i = 0; i < ACTUATOR_COUNT; i++) {
+        // Each operator has two comparators and generators
+        if (i % 2 == 0) {
+            ESP_LOGI(DEMO_TAG, "Create operator %u and connect it to the timer", (unsigned)(i / 2));
+            mcpwm_operator_config_t operator_config = {
+                .group_id = 0, // operator must be in the same group to the timer
+            };
+            ESP_ERROR_CHECK(mcpwm_new_operator(&operator_config, &oper));
+            ESP_ERROR_CHECK(mcpwm_operator_connect_timer(oper, timer));
+        }
 
-    mcpwm_comparator_config_t comparator_config = {
-        .flags.update_cmp_on_tez = true,
-    };
-    ESP_ERROR_CHECK(mcpwm_new_comparator(oper, &comparator_config, &comparator));
+        ESP_LOGI(DEMO_TAG, "Create comparator and generator for actuator %u on GPIO %d", (unsigned)i, actuator_gpios[i]);
+        mcpwm_comparator_config_t comparator_config = {
+            .flags.update_cmp_on_tez = true,
+        };
+        ESP_ERROR_CHECK(mcpwm_new_comparator(oper, &comparator_config, &comparators[i]));
 
-    mcpwm_gen_handle_t generator = NULL;
-    mcpwm_generator_config_t generator_config = {
-        .gen_gpio_num = SERVO_PULSE_GPIO,
-    };
-    ESP_ERROR_CHECK(mcpwm_new_generator(oper, &generator_config, &generator));
+        mcpwm_gen_handle_t generator = NULL;
+        mcpwm_generator_config_t generator_config = {
+            .gen_gpio_num = actuator_gpios[i],
+        };
+        ESP_ERROR_CHECK(mcpwm_new_generator(oper, &generator_config, &generator));
 
-    // set the initial compare value, so that the servo will spin to the center position
-    ESP_ERROR_CHECK(mcpwm_comparator_set_compare_value(comparator, example_angle_to_compare(0)));
+        // start retracted
+        ESP_ERROR_CHECK(mcpwm_comparator_set_compare_value(comparators[i], example_angle_to_compare(ACTUATOR_RETRACTED_ANGLE)));
 
-    ESP_LOGI(DEMO_TAG, "Set generator action on timer and compare event");
-    // go high on counter empty
-    ESP_ERROR_CHECK(mcpwm_generator_set_action_on_timer_event(generator,
-                                                              MCPWM_GEN_TIMER_EVENT_ACTION(MCPWM_TIMER_DIRECTION_UP, MCPWM_TIMER_EVENT_EMPTY, MCPWM_GEN_ACTION_HIGH)));
-    // go low on compare threshold
-    ESP_ERROR_CHECK(mcpwm_generator_set_action_on_compare_event(generator,
-                                                                MCPWM_GEN_COMPARE_EVENT_ACTION(MCPWM_TIMER_DIRECTION_UP, comparator, MCPWM_GEN_ACTION_LOW)));
+        // go high on counter empty
+        ESP_ERROR_CHECK(mcpwm_generator_set_action_on_timer_event(generator,
+                                                                  MCPWM_GEN_TIMER_EVENT_ACTION(MCPWM_TIMER_DIRECTION_UP, MCPWM_TIMER_EVENT_EMPTY, MCPWM_GEN_ACTION_HIGH)));
+        // go low on compare threshold
+        ESP_ERROR_CHECK(mcpwm_generator_set_action_on_compare_event(generator,
+                                                                    MCPWM_GEN_COMPARE_EVENT_ACTION(MCPWM_TIMER_DIRECTION_UP, comparators[i], MCPWM_GEN_ACTION_LOW)));
+    }
 
     ESP_LOGI(DEMO_TAG, "Enable and start timer");
     ESP_ERROR_CHECK(mcpwm_timer_enable(timer));
     ESP_ERROR_CHECK(mcpwm_timer_start_stop(timer, MCPWM_TIMER_START_NO_STOP));
 
-    deactivate_speed_bump(false);
+    const actuator_timing_t timing = {
+        .deg_per_s = SERVO_DEG_PER_S,
+        .stagger_ms = ACTUATOR_STAGGER_MS,
+        .min_change_ms = DEPLOYMENT_STATE_CHANGE_MIN_DELAY_MS,
+        .auto_retract_ms = AUTO_RETRACT_MS,
+    };
+    actuators_init(&actuator_set, ACTUATOR_COUNT, &timing, now_ms());
+    xTaskCreate(&actuator_task, "actuator_task", 2048, NULL, 5, NULL);
 }
 
 static void esp_gap_cb(esp_gap_ble_cb_event_t event, esp_ble_gap_cb_param_t *param)
@@ -194,10 +212,11 @@ static void esp_gap_cb(esp_gap_ble_cb_event_t event, esp_ble_gap_cb_param_t *par
                         if (device_name_check) {
                             ESP_LOGI(DEMO_TAG, "Found speed bump controller");
                             ESP_LOGI(DEMO_TAG, "%02x %02x %02x %02x", adv_data[14], adv_data[15], adv_data[16], adv_data[17]);
+                            // adv_data[16] selects the actuators, 0 for all of them
                             if(adv_data[17] == 0x01) {
-                                activate_speed_bump();
+                                command_speed_bumps(adv_data[16], true);
                             } else if (adv_data[17] == 0x02) {
-                                deactivate_speed_bump(true);
+                                command_speed_bumps(adv_data[16], false);
                             }
                         }
                     }
@@ -236,7 +255,7 @@ void app_main(void)
     esp_bt_controller_init(&bt_cfg);
     esp_bt_controller_enable(ESP_BT_MODE_BLE);
 
-    setup_servo();
+    setup_servos();
     ble_setup();
     esp_ble_gap_set_scan_params(&ble_scan_params);
 }
\ No newline at end of file
@@ -0,0 +1,30 @@
+#ifndef __HOST_TEST_H__
+#define __HOST_TEST_H__
+
+#include <stdio.h>
+
+/*
+ * Minimal checks for the host tests: a failed CHECK reports where and carries
+ * on, the test exits non-zero if any failed.
+ */
+static int host_test_failures = 0;
+
+#define CHECK(cond) do { \
+        if (!(cond)) { \
+            fprintf(stderr, "%s:%d: CHECK(%s) failed\n", __FILE__, __LINE__, #cond); \
+            host_test_failures++; \
+        } \
+    } while (0)
+
+#define CHECK_EQ(actual, expected) do { \
+        long long actual_ = (long long)(actual); \
+        long long expected_ = (long long)(expected); \
+        if (actual_ != expected_) { \
+            fprintf(stderr, "%s:%d: %s is %lld, expected %lld\n", __FILE__, __LINE__, #actual, actual_, expected_); \
+            host_test_failures++; \
+        } \
+    } while (0)
+
+#define HOST_TEST_RESULT() (host_test_failures ? (fprintf(stderr, "%d checks failed\n", host_test_failures), 1) : 0)
+
+#endif /* __HOST_TEST_H__ */
@@ -0,0 +1,82 @@
+"""
+Generates the synthetic sensor traces test_range_filter replays, into the
+directory given (default traces/). The build runs it, and it is
+deterministic, so every build replays the same traces.
+
+One echo time per line as the measurement task feeds it to the filter (the
+echo window when nothing answered), sampled at the 20 ms default poll, and
+whether a vehicle was under the sensor. Vehicles are 4.5 m long, so one
+at v km/h stays in the beam for 810 / v samples.
+"""
+import os
+import random
+import sys
+
+ECHO_WINDOW_US = 5241  # The node's, 60 cm max_distance_cm + 30 cm margin at 20 C
+US_PER_MM = 1 / 0.1715
+POLL_S = 0.02
+VEHICLE_M = 4.5
+
+
+def echo_us(mm):
+    return min(int(mm * US_PER_MM), ECHO_WINDOW_US)
+
+
+def trace(rng, samples, vehicles_per_min, speeds_kmh, spurious, near_spurious, dropout, noise_mm, burst=0.0):
+    """
+    spurious: chance of a stray echo per sample, near_spurious of which land
+    inside the 60 cm trigger distance. burst: chance a stray echo repeats
+    on the next sample too.
+    """
+    rows = []
+    gap = 0
+    vehicle_left = 0
+    height_mm = 0
+    repeat = None
+    while len(rows) < samples:
+        present = vehicle_left > 0
+        if present:
+            time_us = echo_us(rng.gauss(height_mm, noise_mm))
+            vehicle_left -= 1
+        else:
+            time_us = ECHO_WINDOW_US
+            gap -= 1
+            if gap <= 0:
+                speed_kmh = rng.uniform(*speeds_kmh)
+                vehicle_left = max(1, round(VEHICLE_M / (speed_kmh / 3.6) / POLL_S))
+                height_mm = rng.uniform(300, 520)
+                gap = int(rng.expovariate(vehicles_per_min / 60 * POLL_S)) + 4
+        if repeat is not None:
+            time_us, repeat = repeat, None
+        elif rng.random() < spurious:
+            mm = rng.uniform(150, 600) if rng.random() < near_spurious else rng.uniform(600, 4000)
+            time_us = echo_us(mm)
+            if rng.random() < burst:
+                repeat = time_us
+        elif rng.random() < dropout:
+            time_us = ECHO_WINDOW_US
+        rows.append((time_us, int(present)))
+    return rows
+
+
+def write(directory, name, rows):
+    with open(os.path.join(directory, f"{name}.csv"), "w") as f:
+        f.write("time_us,vehicle\n")
+        for time_us, present in rows:
+            f.write(f"{time_us},{present}\n")
+
+
+def main():
+    directory = sys.argv[1] if len(sys.argv) > 1 else "traces"
+    os.makedirs(directory, exist_ok=True)
+    rng = random.Random(32)
+    # Residential street: light traffic, mostly below 60 km/h
+    write(directory, "street", trace(rng, 30000, 4, (15, 60), spurious=0.02, near_spurious=0.3, dropout=0.01, noise_mm=10))
+    # Busier and faster, vehicles at 140 km/h under six samples long
+    write(directory, "fast", trace(rng, 30000, 10, (30, 140), spurious=0.02, near_spurious=0.3, dropout=0.01, noise_mm=10))
+    # Rain: more stray echoes, some of them twice in a row
+    write(directory, "rain", trace(rng, 30000, 4, (15, 60), spurious=0.06, near_spurious=0.5, dropout=0.03, noise_mm=25, burst=0.3))
+
+
+if __name__ == "__main__":
+    main()
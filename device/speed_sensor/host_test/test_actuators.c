@@ -0,0 +1,130 @@
+#include <stdint.h>
+
+#include "actuators.h"
+#include "host_test.h"
+
+// As configured in the controller's main.c
+#define SERVOS 3
+#define STAGGER_MS 150
+#define DEG_PER_S 300
+#define MIN_CHANGE_MS 50
+#define AUTO_RETRACT_MS 10000
+#define TRAVEL_MS (1000 * ACTUATOR_DEPLOYED_ANGLE / DEG_PER_S)
+#define STEP_MS 10
+
+static const actuator_timing_t timing = {
+    .deg_per_s = DEG_PER_S,
+    .stagger_ms = STAGGER_MS,
+    .min_change_ms = MIN_CHANGE_MS,
+    .auto_retract_ms = AUTO_RETRACT_MS,
+};
+
+// The controller's clock, 4 s before the 32-bit ms counter wraps, so the
+// deployment, its auto-retraction or both straddle the wrap
+static const uint32_t starts_ms[] = { 0, 0xFFFFF000u, 0xFFFFFF00u, 0xFFFFD8F0u };
+
+
+// Time after t0 at which each servo first reached the given state, -1 if never
+static void run(actuator_set_t *set, uint32_t t0, uint32_t duration_ms, actuator_state_t state, long *reached_ms)
+{
+    for (int i = 0; i < SERVOS; i++) {
+        reached_ms[i] = -1;
+    }
+    for (uint32_t t = 0; t <= duration_ms; t += STEP_MS) {
+        actuators_update(set, t0 + t);
+        for (int i = 0; i < SERVOS; i++) {
+            if (reached_ms[i] < 0 && set->actuators[i].state == state) {
+                reached_ms[i] = t;
+            }
+        }
+    }
+}
+
+
+static void test_staggered_deploy(uint32_t t0)
+{
+    actuator_set_t set;
+    actuators_init(&set, SERVOS, &timing, t0);
+    CHECK_EQ(actuators_command(&set, actuators_mask(&set, 0), true, t0), 0x7);
+
+    // Each servo waits its turn, then travels at the configured speed
+    for (uint32_t t = 0; t < STAGGER_MS * SERVOS + TRAVEL_MS; t += STEP_MS) {
+        actuators_update(&set, t0 + t);
+        for (int i = 0; i < SERVOS; i++) {
+            long moving_ms = (long)t - i * STAGGER_MS;
+            long expected = moving_ms <= 0 ? 0 : moving_ms * DEG_PER_S / 1000;
+            CHECK_EQ(set.actuators[i].angle, expected > ACTUATOR_DEPLOYED_ANGLE ? ACTUATOR_DEPLOYED_ANGLE : expected);
+        }
+    }
+
+    // All up within a second of the command
+    actuators_init(&set, SERVOS, &timing, t0);
+    actuators_command(&set, actuators_mask(&set, 0), true, t0);
+    long deployed_ms[SERVOS];
+    run(&set, t0, 1000, ACTUATOR_DEPLOYED, deployed_ms);
+    for (int i = 0; i < SERVOS; i++) {
+        CHECK_EQ(deployed_ms[i], i * STAGGER_MS + TRAVEL_MS);
+        CHECK(deployed_ms[i] >= 0 && deployed_ms[i] <= 1000);
+    }
+    CHECK(!actuators_moving(&set));
+}
+
+
+static void test_auto_retract(uint32_t t0)
+{
+    actuator_set_t set;
+    actuators_init(&set, SERVOS, &timing, t0);
+    actuators_command(&set, actuators_mask(&set, 0), true, t0);
+
+    long deployed_ms[SERVOS];
+    run(&set, t0, 1000, ACTUATOR_DEPLOYED, deployed_ms);
+    // Each stays up for AUTO_RETRACT_MS from when it got there, not from the command
+    long retracting_ms[SERVOS];
+    uint32_t t1 = t0 + 1000;
+    run(&set, t1, AUTO_RETRACT_MS + 1000, ACTUATOR_RETRACTING, retracting_ms);
+    for (int i = 0; i < SERVOS; i++) {
+        CHECK_EQ(1000 + retracting_ms[i], deployed_ms[i] + AUTO_RETRACT_MS);
+    }
+    long retracted_ms[SERVOS];
+    run(&set, t1 + AUTO_RETRACT_MS + 1000, 1000, ACTUATOR_RETRACTED, retracted_ms);
+    for (int i = 0; i < SERVOS; i++) {
+        CHECK(retracted_ms[i] >= 0);
+        CHECK_EQ(set.actuators[i].angle, ACTUATOR_RETRACTED_ANGLE);
+    }
+    CHECK(!actuators_moving(&set));
+}
+
+
+static void test_reversal(uint32_t t0)
+{
+    actuator_set_t set;
+    actuators_init(&set, 1, &timing, t0);
+    actuators_command(&set, 0x1, true, t0);
+    actuators_update(&set, t0 + TRAVEL_MS / 2);
+    CHECK_EQ(set.actuators[0].angle, ACTUATOR_DEPLOYED_ANGLE / 2);
+
+    // Turns back from where it is, without jumping to either end
+    CHECK_EQ(actuators_command(&set, 0x1, false, t0 + TRAVEL_MS / 2), 0x1);
+    CHECK_EQ(set.actuators[0].state, ACTUATOR_RETRACTING);
+    actuators_update(&set, t0 + TRAVEL_MS / 2 + 100);
+    CHECK_EQ(set.actuators[0].angle, ACTUATOR_DEPLOYED_ANGLE / 2 - 100 * DEG_PER_S / 1000);
+    actuators_update(&set, t0 + TRAVEL_MS);
+    CHECK_EQ(set.actuators[0].angle, ACTUATOR_RETRACTED_ANGLE);
+    CHECK_EQ(set.actuators[0].state, ACTUATOR_RETRACTED);
+
+    // Commands closer together than MIN_CHANGE_MS are ignored
+    CHECK_EQ(actuators_command(&set, 0x1, true, t0 + TRAVEL_MS), 0x1);
+    CHECK_EQ(actuators_command(&set, 0x1, false, t0 + TRAVEL_MS + MIN_CHANGE_MS - 1), 0);
+    CHECK_EQ(actuators_command(&set, 0x1, false, t0 + TRAVEL_MS + MIN_CHANGE_MS), 0x1);
+}
+
+
+int main(void)
+{
+    for (size_t i = 0; i < sizeof(starts_ms) / sizeof(starts_ms[0]); i++) {
+        test_staggered_deploy(starts_ms[i]);
+        test_auto_retract(starts_ms[i]);
+        test_reversal(starts_ms[i]);
+    }
+    return HOST_TEST_RESULT();
+}
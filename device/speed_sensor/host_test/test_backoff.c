@@ -0,0 +1,106 @@
+#include <stdint.h>
+
+#include "backoff.h"
+#include "host_test.h"
+
+#define DRAWS 100000
+
+
+static void test_window_doubles_to_cap(void)
+{
+    backoff_t backoff;
+    backoff_init(&backoff, 250, 60000, 1);
+    uint32_t expected = 250;
+    for (int i = 0; i < 40; i++) {
+        CHECK_EQ(backoff_window_ms(&backoff), expected);
+        backoff_next_delay_ms(&backoff);
+        expected = expected * 2 < 60000 ? expected * 2 : 60000;
+    }
+
+    backoff_reset(&backoff);
+    CHECK_EQ(backoff.attempt, 0);
+    CHECK_EQ(backoff_window_ms(&backoff), 250);
+}
+
+
+static void test_no_overflow(void)
+{
+    backoff_t backoff;
+    backoff_init(&backoff, 1u << 31, UINT32_MAX, 1);
+    backoff_next_delay_ms(&backoff);
+    CHECK_EQ(backoff_window_ms(&backoff), UINT32_MAX);
+
+    // The shift saturates however long the outage
+    backoff.attempt = UINT32_MAX;
+    backoff_next_delay_ms(&backoff);
+    CHECK_EQ(backoff.attempt, UINT32_MAX);
+    CHECK_EQ(backoff_window_ms(&backoff), UINT32_MAX);
+}
+
+
+static void test_full_jitter(void)
+{
+    backoff_t backoff;
+    backoff_init(&backoff, 1000, 8000, 12345);
+    uint32_t window = 0;
+    for (int i = 0; i < 4; i++) {
+        window = backoff_window_ms(&backoff);
+        CHECK(backoff_next_delay_ms(&backoff) <= window);
+    }
+    CHECK_EQ(window, 8000);
+
+    // At the cap, delays spread over the whole window
+    uint32_t low = UINT32_MAX;
+    uint32_t high = 0;
+    uint64_t sum = 0;
+    uint32_t buckets[8] = { 0 };
+    for (int i = 0; i < DRAWS; i++) {
+        uint32_t delay = backoff_next_delay_ms(&backoff);
+        CHECK(delay <= 8000);
+        low = delay < low ? delay : low;
+        high = delay > high ? delay : high;
+        sum += delay;
+        buckets[delay * 8 / 8001]++;
+    }
+    CHECK(low < 80);
+    CHECK(high > 7920);
+    CHECK(sum / DRAWS > 3900 && sum / DRAWS < 4100);
+    for (int b = 0; b < 8; b++) {
+        CHECK(buckets[b] > DRAWS / 8 * 9 / 10 && buckets[b] < DRAWS / 8 * 11 / 10);
+    }
+}
+
+
+static void test_seeds(void)
+{
+    // A zero seed would leave xorshift stuck at 0
+    backoff_t backoff;
+    backoff_init(&backoff, 1000, 1000, 0);
+    CHECK(backoff.rng_state != 0);
+    int nonzero = 0;
+    for (int i = 0; i < 100; i++) {
+        nonzero += backoff_next_delay_ms(&backoff) != 0;
+    }
+    CHECK(nonzero > 90);
+
+    // Sensors that lost power together must not retry in lockstep
+    backoff_t a;
+    backoff_t b;
+    backoff_init(&a, 1000, 1000, 1);
+    backoff_init(&b, 1000, 1000, 2);
+    int same = 0;
+    for (int i = 0; i < 100; i++) {
+        same += backoff_next_delay_ms(&a) == backoff_next_delay_ms(&b);
+    }
+    CHECK(same < 5);
+}
+
+
+int main(void)
+{
+    test_window_doubles_to_cap();
+    test_no_overflow();
+    test_full_jitter();
+    test_seeds();
+    return HOST_TEST_RESULT();
+}
@@ -0,0 +1,298 @@
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "history_ring.h"
+#include "host_test.h"
+
+#define BLOCKS 64
+#define LANES 2
+#define POLL_MS 50
+#define POLLS (10 * 60 * 1000 / POLL_MS)
+#define START_MS 4294667296u            // Ring time wraps five minutes in
+#define NOW_OUT_MS 1700000000000LL      // Epoch ms of the last poll
+#define MAX_RECORDS 16384
+
+static history_block_t storage[BLOCKS];
+static history_ring_t ring;
+static history_pager_t pager;
+static uint8_t chunk[200];
+
+// Every record left in the ring, decoded straight from its blocks
+static history_record_t expected[MAX_RECORDS];
+static uint32_t expected_seq[MAX_RECORDS];
+static size_t expected_count;
+static uint32_t now_ms;
+
+
+static uint16_t get_u16(const uint8_t *p)
+{
+    return p[0] | p[1] << 8;
+}
+
+
+static uint32_t get_u32(const uint8_t *p)
+{
+    return get_u16(p) | (uint32_t)get_u16(p + 2) << 16;
+}
+
+
+static int64_t get_i64(const uint8_t *p)
+{
+    return (int64_t)(get_u32(p) | (uint64_t)get_u32(p + 4) << 32);
+}
+
+
+static bool copy_block(void *ctx, uint32_t seq, history_block_t *block)
+{
+    return history_ring_copy(ctx, seq, block);
+}
+
+
+static int64_t epoch_ms(uint32_t time_ms)
+{
+    return NOW_OUT_MS - (int32_t)(now_ms - time_ms);
+}
+
+
+// Ten minutes of two lanes, two sensors each, polled every 50 ms: an empty
+// road reads about 2500 mm, a vehicle 600 to 800 mm for half a second or more,
+// and sensor 3 fails for five seconds
+static void simulate(void)
+{
+    history_ring_init(&ring, storage, BLOCKS, 20, 1000);
+    srand(1);
+    unsigned passing[LANES] = { 0 };
+    for (uint32_t poll = 0; poll < POLLS; poll++) {
+        now_ms = START_MS + poll * POLL_MS;
+        for (uint8_t lane = 0; lane < LANES; lane++) {
+            if (passing[lane] == 0 && rand() % 200 == 0) {
+                passing[lane] = 10 + rand() % 20;
+            }
+            for (uint8_t sensor = lane * 2; sensor < lane * 2 + 2; sensor++) {
+                if (sensor == 3 && poll > 6000 && poll < 6100) {
+                    history_ring_fault(&ring, now_ms, sensor);
+                    continue;
+                }
+                uint32_t mm = passing[lane] ? 600 + rand() % 200 : 2500 + rand() % 15;
+                history_ring_trace(&ring, now_ms, sensor, mm);
+            }
+            if (passing[lane] && --passing[lane] == 0) {
+                history_ring_vehicle(&ring, now_ms, lane, 800 + rand() % 2000, rand() % 3 == 0);
+            }
+        }
+    }
+
+    history_block_t block;
+    uint32_t seq = 0;
+    while (history_ring_copy(&ring, seq, &block)) {
+        history_codec_t codec;
+        history_codec_init(&codec, block.data, block.used, block.first_ms);
+        history_record_t record;
+        while (expected_count < MAX_RECORDS && history_decode(&codec, &expected[expected_count])) {
+            expected_seq[expected_count++] = block.first_seq + codec.count - 1;
+        }
+        CHECK_EQ(codec.count, block.count);
+        CHECK(!history_decode(&codec, &record));
+        seq = block.first_seq + block.count;
+    }
+}
+
+
+// The ring wrapped and thinned, and what is left is consecutive up to the
+// newest record, with times in order across the clock wrap
+static void test_ring_contents(void)
+{
+    CHECK(ring.evicted > 0);
+    CHECK(ring.thinned > 0);
+    CHECK(expected_count > 0 && expected_count < MAX_RECORDS);
+    CHECK_EQ(expected_seq[0], ring.evicted + 1);
+    CHECK_EQ(expected_seq[expected_count - 1], ring.next_seq - 1);
+
+    size_t faults = 0;
+    size_t vehicles = 0;
+    for (size_t i = 0; i < expected_count; i++) {
+        if (i > 0) {
+            CHECK_EQ(expected_seq[i], expected_seq[i - 1] + 1);
+            CHECK((int32_t)(expected[i].time_ms - expected[i - 1].time_ms) >= 0);
+        }
+        faults += expected[i].kind == HISTORY_FAULT;
+        vehicles += expected[i].kind == HISTORY_VEHICLE;
+    }
+    CHECK(faults > 0);
+    CHECK(vehicles > 0);
+    // Kept from before the wrap
+    CHECK(expected[0].time_ms > now_ms);
+}
+
+
+// Reads a chunk back, checking its header and every record against the ring.
+// Returns its record count
+static size_t check_chunk(size_t len, uint16_t request_id, uint16_t index, size_t *next)
+{
+    CHECK(len > HISTORY_CHUNK_HEADER && len <= sizeof(chunk));
+    CHECK(chunk[0] == 'W' && chunk[1] == 'R');
+    CHECK_EQ(chunk[2], HISTORY_REQUEST_FORMAT);
+    CHECK_EQ(get_u16(chunk + 4), request_id);
+    CHECK_EQ(get_u16(chunk + 6), index);
+    uint16_t count = get_u16(chunk + 8);
+    int64_t base_ms = get_i64(chunk + 16);
+
+    history_codec_t codec;
+    history_codec_init(&codec, chunk + HISTORY_CHUNK_HEADER, len - HISTORY_CHUNK_HEADER, 0);
+    history_record_t record;
+    for (uint16_t i = 0; i < count; i++, (*next)++) {
+        CHECK(history_decode(&codec, &record));
+        CHECK(*next < expected_count);
+        if (*next >= expected_count) {
+            return count;
+        }
+        const history_record_t *want = &expected[*next];
+        CHECK_EQ(base_ms + record.time_ms, epoch_ms(want->time_ms));
+        CHECK_EQ(record.kind, want->kind);
+        CHECK_EQ(record.index, want->index);
+        CHECK_EQ(record.value, want->value);
+        CHECK_EQ(record.deployed, want->deployed);
+    }
+    CHECK(!history_decode(&codec, &record));
+    return count;
+}
+
+
+// Three chunks a page from cursor 0 until the device says it is done: every
+// record comes back once, in order, with epoch times
+static void test_page_everything(void)
+{
+    uint32_t cursor = 0;
+    size_t next = 0;
+    unsigned pages = 0;
+    uint8_t flags = 0;
+    while (!(flags & HISTORY_CHUNK_END) && pages <= expected_count) {
+        history_request_t request = { .request_id = 7, .max_chunks = 3, .cursor = cursor };
+        history_pager_init(&pager, &request, 8, now_ms, NOW_OUT_MS, false);
+        uint16_t chunks = 0;
+        size_t len;
+        while ((len = history_pager_next(&pager, copy_block, &ring, chunk, sizeof(chunk))) > 0) {
+            check_chunk(len, 7, chunks, &next);
+            flags = chunk[3];
+            CHECK(!(flags & (HISTORY_CHUNK_GAP | HISTORY_CHUNK_BOOT_TIME)));
+            CHECK_EQ(!!(flags & HISTORY_CHUNK_LAST), chunks == 2 || (flags & HISTORY_CHUNK_END));
+            cursor = get_u32(chunk + 12);
+            chunks++;
+        }
+        CHECK(chunks > 0 && chunks <= 3);
+        CHECK(flags & HISTORY_CHUNK_LAST);
+        pages++;
+    }
+    CHECK_EQ(next, expected_count);
+    CHECK(pages > 1);
+    CHECK_EQ(cursor, ring.next_seq);
+}
+
+
+// Vehicles only, from two minutes to one minute ago, in a single page
+static void test_kind_and_time_filter(void)
+{
+    size_t want = 0;
+    for (size_t i = 0; i < expected_count; i++) {
+        int64_t at = epoch_ms(expected[i].time_ms);
+        want += expected[i].kind == HISTORY_VEHICLE && at >= NOW_OUT_MS - 120000 && at < NOW_OUT_MS - 60000;
+    }
+    CHECK(want > 0);
+
+    history_request_t request = {
+        .kinds = HISTORY_KIND_BIT(HISTORY_VEHICLE), .request_id = 8,
+        .from_ms = NOW_OUT_MS - 120000, .to_ms = NOW_OUT_MS - 60000,
+    };
+    history_pager_init(&pager, &request, 8, now_ms, NOW_OUT_MS, false);
+    size_t got = 0;
+    uint8_t flags = 0;
+    size_t len;
+    history_record_t record;
+    while ((len = history_pager_next(&pager, copy_block, &ring, chunk, sizeof(chunk))) > 0) {
+        int64_t base_ms = get_i64(chunk + 16);
+        history_codec_t codec;
+        history_codec_init(&codec, chunk + HISTORY_CHUNK_HEADER, len - HISTORY_CHUNK_HEADER, 0);
+        while (history_decode(&codec, &record)) {
+            int64_t at = base_ms + record.time_ms;
+            CHECK_EQ(record.kind, HISTORY_VEHICLE);
+            CHECK(at >= NOW_OUT_MS - 120000 && at < NOW_OUT_MS - 60000);
+            got++;
+        }
+        flags = chunk[3];
+    }
+    CHECK_EQ(got, want);
+    CHECK(flags & HISTORY_CHUNK_END);
+}
+
+
+// A cursor into evicted records is answered from the oldest left, flagged
+static void test_evicted_cursor(void)
+{
+    history_request_t request = { .request_id = 9, .max_chunks = 1, .cursor = 1 };
+    history_pager_init(&pager, &request, 8, now_ms, NOW_OUT_MS, false);
+    size_t next = 0;
+    size_t len = history_pager_next(&pager, copy_block, &ring, chunk, sizeof(chunk));
+    check_chunk(len, 9, 0, &next);
+    CHECK(chunk[3] & HISTORY_CHUNK_GAP);
+    CHECK(chunk[3] & HISTORY_CHUNK_LAST);
+    CHECK_EQ(history_pager_next(&pager, copy_block, &ring, chunk, sizeof(chunk)), 0);
+}
+
+
+// Unsynced: times since boot and the bounds ignored
+static void test_boot_time(void)
+{
+    history_request_t request = { .request_id = 10, .max_chunks = 1, .from_ms = NOW_OUT_MS };
+    int64_t boot_ms = 600000;
+    history_pager_init(&pager, &request, 8, now_ms, boot_ms, true);
+    size_t len = history_pager_next(&pager, copy_block, &ring, chunk, sizeof(chunk));
+    CHECK(len > HISTORY_CHUNK_HEADER);
+    CHECK(chunk[3] & HISTORY_CHUNK_BOOT_TIME);
+    CHECK(get_u16(chunk + 8) > 0);
+
+    history_codec_t codec;
+    history_codec_init(&codec, chunk + HISTORY_CHUNK_HEADER, len - HISTORY_CHUNK_HEADER, 0);
+    history_record_t record;
+    CHECK(history_decode(&codec, &record));
+    CHECK_EQ(get_i64(chunk + 16) + record.time_ms, boot_ms - (int32_t)(now_ms - expected[0].time_ms));
+}
+
+
+static void test_request_decode(void)
+{
+    uint8_t raw[HISTORY_REQUEST_SIZE] = { 'W', 'H', HISTORY_REQUEST_FORMAT, 2, 5, 0, 3, 0, 9, 0, 0, 0 };
+    int64_t from_ms = 1700000000123LL;
+    int64_t to_ms = -1;
+    memcpy(raw + 12, &from_ms, sizeof(from_ms));
+    memcpy(raw + 20, &to_ms, sizeof(to_ms));
+
+    history_request_t request;
+    CHECK(history_request_decode(raw, sizeof(raw), &request));
+    CHECK_EQ(request.kinds, 2);
+    CHECK_EQ(request.request_id, 5);
+    CHECK_EQ(request.max_chunks, 3);
+    CHECK_EQ(request.cursor, 9);
+    CHECK_EQ(request.from_ms, from_ms);
+    CHECK_EQ(request.to_ms, -1);
+
+    CHECK(!history_request_decode(raw, sizeof(raw) - 1, &request));
+    raw[2] = HISTORY_REQUEST_FORMAT + 1;
+    CHECK(!history_request_decode(raw, sizeof(raw), &request));
+    raw[2] = HISTORY_REQUEST_FORMAT;
+    raw[1] = 'R';
+    CHECK(!history_request_decode(raw, sizeof(raw), &request));
+}
+
+
+int main(void)
+{
+    simulate();
+    test_ring_contents();
+    test_page_everything();
+    test_kind_and_time_filter();
+    test_evicted_cursor();
+    test_boot_time();
+    test_request_decode();
+    return HOST_TEST_RESULT();
+}
@@ -0,0 +1,139 @@
+#include <stdbool.h>
+#include <stdint.h>
+
+#include "host_test.h"
+#include "jitter_hist.h"
+#include "ping_scheduler.h"
+
+#define TICK_US 10000           // CONFIG_FREERTOS_HZ 100
+#define POLL_PERIOD_MS 20       // POLICY_DEFAULT_POLL_PERIOD_MS
+#define CYCLES 1000
+
+
+static void test_buckets(void)
+{
+    jitter_hist_t hist;
+    jitter_hist_init(&hist);
+    CHECK_EQ(jitter_hist_percentile_us(&hist, 50), 0);
+
+    // The first start only sets the reference
+    jitter_hist_record(&hist, 1000000, 50000);
+    CHECK_EQ(hist.samples, 0);
+
+    const uint32_t deviations[] = { 0, 31, 32, 63, 64, 1000, 65535, 1u << 20 };
+    const unsigned buckets[] = { 0, 0, 1, 1, 2, 5, 11, 11 };
+    for (unsigned i = 0; i < sizeof(deviations) / sizeof(deviations[0]); i++) {
+        // Late and early by the same amount count the same
+        for (int sign = -1; sign <= 1; sign += 2) {
+            jitter_hist_init(&hist);
+            jitter_hist_record(&hist, 2000000, 50000);
+            jitter_hist_record(&hist, 2000000 + 50000 + sign * (int64_t)deviations[i], 50000);
+            CHECK_EQ(hist.samples, 1);
+            CHECK_EQ(hist.counts[buckets[i]], 1);
+        }
+    }
+}
+
+
+static void test_percentiles_and_windows(void)
+{
+    jitter_hist_t hist;
+    jitter_hist_init(&hist);
+    int64_t start = 1;
+    jitter_hist_record(&hist, start, 50000);
+    for (int i = 0; i < 98; i++) {
+        start += 50000 + 10;
+        jitter_hist_record(&hist, start, 50000);
+    }
+    jitter_hist_t before = hist;
+    start += 50000 + 700;
+    jitter_hist_record(&hist, start, 50000);
+    start += 50000 + 5000;
+    jitter_hist_record(&hist, start, 50000);
+
+    CHECK_EQ(hist.samples, 100);
+    CHECK_EQ(jitter_hist_percentile_us(&hist, 50), 32);
+    CHECK_EQ(jitter_hist_percentile_us(&hist, 98), 32);
+    CHECK_EQ(jitter_hist_percentile_us(&hist, 99), 1024);
+    CHECK_EQ(jitter_hist_percentile_us(&hist, 100), 8192);
+
+    // A report window sees only its own cycles
+    jitter_hist_t window;
+    jitter_hist_delta(&hist, &before, &window);
+    CHECK_EQ(window.samples, 2);
+    CHECK_EQ(window.counts[5], 1);
+    CHECK_EQ(window.counts[8], 1);
+    CHECK_EQ(jitter_hist_percentile_us(&window, 50), 1024);
+
+    jitter_hist_t total;
+    jitter_hist_init(&total);
+    jitter_hist_add(&total, &window);
+    jitter_hist_add(&total, &window);
+    CHECK_EQ(total.samples, 4);
+    CHECK_EQ(total.counts[8], 2);
+
+    // Past the last bound, reported as its lower bound
+    jitter_hist_init(&hist);
+    jitter_hist_record(&hist, 1, 50000);
+    jitter_hist_record(&hist, 1 + 50000 + 200000, 50000);
+    CHECK_EQ(jitter_hist_percentile_us(&hist, 50), JITTER_HIST_BASE_US << (JITTER_HIST_BUCKETS - 2));
+}
+
+
+// The measurement loop of main.c on a 100 Hz tick with an ideal scheduler:
+// xTaskDelayUntil wakes on the tick the period ends on, or returns at once
+// if that has passed, and the loop then sleeps to the next tick. Without
+// stretch the poll period is used as asked, as before the cycle was checked
+static jitter_hist_t simulate_loop(uint32_t echo_window_us, bool stretch)
+{
+    const uint32_t conflicts[2] = { 1u << 1, 0 };
+    ping_schedule_t schedule;
+    ping_schedule_build(&schedule, conflicts, 2);
+    ping_timing_t timing = { .trigger_us = 14, .echo_window_us = echo_window_us, .guard_us = 2000 };
+    uint32_t period_ms = stretch ? ping_schedule_poll_period_ms(&schedule, &timing, POLL_PERIOD_MS) : POLL_PERIOD_MS;
+    uint32_t period_ticks = (period_ms * 1000 + TICK_US - 1) / TICK_US;
+    // Every echo times out on an empty road, so each cycle takes its worst case
+    uint32_t cycle_us = ping_schedule_cycle_us(&schedule, &timing);
+
+    jitter_hist_t hist;
+    jitter_hist_init(&hist);
+    int64_t last_wake = 1;
+    int64_t now_us = last_wake * TICK_US;
+    for (int i = 0; i < CYCLES; i++) {
+        jitter_hist_record(&hist, now_us, period_ticks * TICK_US);
+        now_us += cycle_us;
+        int64_t wake = last_wake + period_ticks;
+        last_wake = wake * TICK_US >= now_us ? wake : now_us / TICK_US + 1;
+        now_us = last_wake * TICK_US;
+    }
+    return hist;
+}
+
+
+// With the window sized for the 60 cm trigger distance every cycle starts on
+// time. Sized for 4 m, the 50.68 ms cycle overran the 20 ms poll every time
+// and the histogram only measured the tick the overrun cost, until the
+// period was stretched to fit
+static void test_cycle_budget(void)
+{
+    jitter_hist_t fits = simulate_loop(5241, true);
+    CHECK_EQ(fits.samples, CYCLES - 1);
+    CHECK_EQ(fits.counts[0], CYCLES - 1);
+
+    jitter_hist_t overran = simulate_loop(23324, false);
+    CHECK_EQ(overran.samples, CYCLES - 1);
+    CHECK_EQ(overran.counts[0], 0);
+    CHECK_EQ(jitter_hist_percentile_us(&overran, 50), 32768);
+
+    jitter_hist_t stretched = simulate_loop(23324, true);
+    CHECK_EQ(stretched.counts[0], CYCLES - 1);
+}
+
+
+int main(void)
+{
+    test_buckets();
+    test_percentiles_and_windows();
+    test_cycle_budget();
+    return HOST_TEST_RESULT();
+}
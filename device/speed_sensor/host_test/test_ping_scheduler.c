@@ -0,0 +1,194 @@
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "host_test.h"
+#include "ping_scheduler.h"
+#include "range_filter.h"
+
+// As lanes.h and policy.h, which need ESP-IDF
+#define LANE_ECHO_MARGIN_CM 30
+#define LANE_PING_GUARD_US 2000
+#define POLICY_DEFAULT_MAX_DISTANCE_CM 60
+#define POLICY_DEFAULT_POLL_PERIOD_MS 20
+
+// A 4 m round trip at 20 C, LANE_PING_GUARD_US after each slot
+static const ping_timing_t timing = { .trigger_us = 14, .echo_window_us = 23324, .guard_us = LANE_PING_GUARD_US };
+
+
+static void check_valid(const ping_schedule_t *schedule, const uint32_t *conflicts, size_t sensor_count)
+{
+    uint32_t seen = 0;
+    for (size_t s = 0; s < schedule->slot_count; s++) {
+        CHECK(schedule->slots[s] != 0);
+        CHECK((seen & schedule->slots[s]) == 0);
+        seen |= schedule->slots[s];
+        for (size_t i = 0; i < sensor_count; i++) {
+            // A conflict in either direction keeps two sensors apart
+            if (schedule->slots[s] & (1u << i)) {
+                CHECK((schedule->slots[s] & conflicts[i] & ~(1u << i)) == 0);
+            }
+        }
+    }
+    CHECK_EQ(seen, (1u << sensor_count) - 1);
+}
+
+
+// Entry and exit of a lane face the same spot, neighbouring lanes' sensors hear each other
+static void lane_conflicts(uint32_t *conflicts, size_t lanes, bool neighbours)
+{
+    for (size_t l = 0; l < lanes; l++) {
+        conflicts[2 * l] = 1u << (2 * l + 1);
+        conflicts[2 * l + 1] = 0;
+        if (neighbours && l + 1 < lanes) {
+            conflicts[2 * l] |= 1u << (2 * l + 2);
+            conflicts[2 * l + 1] |= 1u << (2 * l + 3);
+        }
+    }
+}
+
+
+static void test_shapes(void)
+{
+    ping_schedule_t schedule;
+    uint32_t conflicts[PING_SCHEDULER_MAX_SENSORS] = { 0 };
+
+    CHECK_EQ(ping_schedule_build(&schedule, conflicts, 0), -1);
+    CHECK_EQ(ping_schedule_build(&schedule, conflicts, PING_SCHEDULER_MAX_SENSORS + 1), -1);
+
+    // Nothing interferes: everything fires at once
+    CHECK_EQ(ping_schedule_build(&schedule, conflicts, PING_SCHEDULER_MAX_SENSORS), 0);
+    CHECK_EQ(schedule.slot_count, 1);
+
+    // Everything interferes: back to back
+    for (size_t i = 0; i < PING_SCHEDULER_MAX_SENSORS; i++) {
+        conflicts[i] = 0xFFFF;
+    }
+    CHECK_EQ(ping_schedule_build(&schedule, conflicts, PING_SCHEDULER_MAX_SENSORS), 0);
+    CHECK_EQ(schedule.slot_count, PING_SCHEDULER_MAX_SENSORS);
+    check_valid(&schedule, conflicts, PING_SCHEDULER_MAX_SENSORS);
+
+    // A one-sided conflict is enough
+    uint32_t one_sided[3] = { 0, 0, 1u << 0 };
+    CHECK_EQ(ping_schedule_build(&schedule, one_sided, 3), 0);
+    CHECK_EQ(schedule.slot_count, 2);
+    check_valid(&schedule, one_sided, 3);
+
+    // Lanes apart need two slots however many there are, neighbours hearing each other still only two
+    for (size_t lanes = 1; lanes <= PING_SCHEDULER_MAX_SENSORS / 2; lanes++) {
+        lane_conflicts(conflicts, lanes, false);
+        CHECK_EQ(ping_schedule_build(&schedule, conflicts, lanes * 2), 0);
+        CHECK_EQ(schedule.slot_count, 2);
+        check_valid(&schedule, conflicts, lanes * 2);
+
+        lane_conflicts(conflicts, lanes, true);
+        CHECK_EQ(ping_schedule_build(&schedule, conflicts, lanes * 2), 0);
+        CHECK_EQ(schedule.slot_count, 2);
+        check_valid(&schedule, conflicts, lanes * 2);
+    }
+}
+
+
+static void test_random_graphs(void)
+{
+    srand(31);
+    for (int round = 0; round < 10000; round++) {
+        size_t sensor_count = 1 + rand() % PING_SCHEDULER_MAX_SENSORS;
+        uint32_t conflicts[PING_SCHEDULER_MAX_SENSORS];
+        int max_degree = 0;
+        for (size_t i = 0; i < sensor_count; i++) {
+            conflicts[i] = (uint32_t)rand() & (uint32_t)rand() & ((1u << sensor_count) - 1);
+        }
+        for (size_t i = 0; i < sensor_count; i++) {
+            int degree = 0;
+            for (size_t j = 0; j < sensor_count; j++) {
+                degree += j != i && ((conflicts[i] >> j) & 1 || (conflicts[j] >> i) & 1);
+            }
+            max_degree = degree > max_degree ? degree : max_degree;
+        }
+        ping_schedule_t schedule;
+        CHECK_EQ(ping_schedule_build(&schedule, conflicts, sensor_count), 0);
+        check_valid(&schedule, conflicts, sensor_count);
+        // Greedy colouring never needs more than one slot over the highest degree
+        CHECK(schedule.slot_count <= (size_t)max_degree + 1);
+    }
+}
+
+
+static void test_throughput(void)
+{
+    uint32_t slot_us = timing.trigger_us + timing.echo_window_us + timing.guard_us;
+    uint32_t conflicts[PING_SCHEDULER_MAX_SENSORS];
+    printf("lanes  slots  cycle_us  pings/s  back-to-back pings/s\n");
+    for (size_t lanes = 1; lanes <= PING_SCHEDULER_MAX_SENSORS / 2; lanes++) {
+        size_t sensor_count = lanes * 2;
+        lane_conflicts(conflicts, lanes, true);
+        ping_schedule_t schedule;
+        ping_schedule_build(&schedule, conflicts, sensor_count);
+        ping_schedule_t sequential = { .slot_count = sensor_count };
+
+        uint32_t cycle_us = ping_schedule_cycle_us(&schedule, &timing);
+        uint32_t pings = ping_schedule_pings_per_s(&schedule, &timing, sensor_count);
+        uint32_t sequential_pings = ping_schedule_pings_per_s(&sequential, &timing, sensor_count);
+        printf("%5u  %5u  %8u  %7u  %20u\n", (unsigned)lanes, (unsigned)schedule.slot_count,
+               (unsigned)cycle_us, (unsigned)pings, (unsigned)sequential_pings);
+
+        CHECK_EQ(cycle_us, schedule.slot_count * slot_us);
+        CHECK_EQ(pings, (uint64_t)sensor_count * 1000000 / cycle_us);
+        // Back to back, adding lanes adds nothing, the schedule scales with them
+        CHECK_EQ(sequential_pings, 1000000 / slot_us);
+        CHECK_EQ(pings, (uint64_t)sensor_count * 1000000 / (2 * slot_us));
+    }
+
+    ping_schedule_t empty = { 0 };
+    CHECK_EQ(ping_schedule_pings_per_s(&empty, &timing, 0), 0);
+}
+
+
+// The node sizes the echo window from the policy's trigger distance, so the
+// default policy's cycle fits its poll period, two ticks. A window
+// for the full 4 m would not, and the period is stretched to the cycle
+static void test_poll_period(void)
+{
+    range_scale_t scale;
+    range_scale_init(&scale, 200);
+    uint32_t conflicts[PING_SCHEDULER_MAX_SENSORS];
+    ping_schedule_t schedule;
+    ping_timing_t node = {
+        .trigger_us = 14,
+        .echo_window_us = range_scale_mm_to_us(&scale, (POLICY_DEFAULT_MAX_DISTANCE_CM + LANE_ECHO_MARGIN_CM) * 10),
+        .guard_us = LANE_PING_GUARD_US,
+    };
+
+    for (size_t lanes = 1; lanes <= PING_SCHEDULER_MAX_SENSORS / 2; lanes++) {
+        lane_conflicts(conflicts, lanes, true);
+        ping_schedule_build(&schedule, conflicts, lanes * 2);
+        CHECK(ping_schedule_cycle_us(&schedule, &node) <= POLICY_DEFAULT_POLL_PERIOD_MS * 1000);
+        CHECK_EQ(ping_schedule_poll_period_ms(&schedule, &node, POLICY_DEFAULT_POLL_PERIOD_MS), POLICY_DEFAULT_POLL_PERIOD_MS);
+    }
+
+    lane_conflicts(conflicts, 1, false);
+    ping_schedule_build(&schedule, conflicts, 2);
+    CHECK_EQ(ping_schedule_cycle_us(&schedule, &timing), 50676);
+    CHECK_EQ(ping_schedule_poll_period_ms(&schedule, &timing, POLICY_DEFAULT_POLL_PERIOD_MS), 51);
+    CHECK_EQ(ping_schedule_poll_period_ms(&schedule, &timing, 10), 51);
+    CHECK_EQ(ping_schedule_poll_period_ms(&schedule, &timing, 51), 51);
+    CHECK_EQ(ping_schedule_poll_period_ms(&schedule, &timing, 1000), 1000);
+
+    // Largest policy distance, 5 m, with the coldest air
+    range_scale_init(&scale, -400);
+    node.echo_window_us = range_scale_mm_to_us(&scale, (500 + LANE_ECHO_MARGIN_CM) * 10);
+    uint32_t cycle_us = ping_schedule_cycle_us(&schedule, &node);
+    uint32_t period_ms = ping_schedule_poll_period_ms(&schedule, &node, 10);
+    CHECK(period_ms * 1000 >= cycle_us && (period_ms - 1) * 1000 < cycle_us);
+}
+
+
+int main(void)
+{
+    test_shapes();
+    test_random_graphs();
+    test_throughput();
+    test_poll_period();
+    return HOST_TEST_RESULT();
+}
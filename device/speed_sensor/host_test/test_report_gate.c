@@ -0,0 +1,196 @@
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+
+#include "host_test.h"
+#include "report_gate.h"
+
+#define WINDOW_S 5              // POLICY_DEFAULT_REPORT_INTERVAL_S
+#define HEARTBEAT_S 300         // POLICY_DEFAULT_HEARTBEAT_INTERVAL_S
+
+static const report_window_t quiet_window = { .window_s = WINDOW_S, .sensor_1_up = true, .sensor_2_up = true };
+
+
+// Windows until one is published, counting it. Checks what it carries
+static unsigned until_published(report_gate_t *gate, const report_window_t *window, uint16_t heartbeat_s, unsigned limit)
+{
+    uint32_t quiet_windows = UINT32_MAX;
+    for (unsigned n = 1; n <= limit; n++) {
+        if (report_gate_window(gate, window, heartbeat_s, &quiet_windows)) {
+            CHECK_EQ(quiet_windows, n - 1);
+            return n;
+        }
+    }
+    return 0;
+}
+
+
+// Published after it is set up with a first window and some quiet ones held back
+static bool after_quiet(const report_window_t *window, uint32_t *quiet_windows)
+{
+    report_gate_t gate;
+    report_gate_init(&gate);
+    report_gate_window(&gate, &quiet_window, HEARTBEAT_S, quiet_windows);
+    for (int i = 0; i < 3; i++) {
+        CHECK(!report_gate_window(&gate, &quiet_window, HEARTBEAT_S, quiet_windows));
+    }
+    return report_gate_window(&gate, window, HEARTBEAT_S, quiet_windows);
+}
+
+
+static void test_first_window(void)
+{
+    // Published even though nothing happened, with nothing held back
+    report_gate_t gate;
+    report_gate_init(&gate);
+    uint32_t quiet_windows = UINT32_MAX;
+    CHECK(report_gate_window(&gate, &quiet_window, HEARTBEAT_S, &quiet_windows));
+    CHECK_EQ(quiet_windows, 0);
+    CHECK(!report_gate_window(&gate, &quiet_window, HEARTBEAT_S, &quiet_windows));
+}
+
+
+static void test_heartbeat_floor(void)
+{
+    // A report at least every heartbeat_s, the held-back windows and the one sent filling it exactly
+    const uint16_t heartbeats[] = { HEARTBEAT_S, 60, 7, 10 };
+    for (unsigned h = 0; h < sizeof(heartbeats) / sizeof(heartbeats[0]); h++) {
+        report_gate_t gate;
+        report_gate_init(&gate);
+        uint32_t quiet_windows;
+        report_gate_window(&gate, &quiet_window, heartbeats[h], &quiet_windows);
+        unsigned every = heartbeats[h] / WINDOW_S > 0 ? heartbeats[h] / WINDOW_S : 1;
+        for (int i = 0; i < 5; i++) {
+            CHECK_EQ(until_published(&gate, &quiet_window, heartbeats[h], 10000), every);
+        }
+    }
+
+    // A heartbeat shorter than a window, or 0, publishes every window
+    const uint16_t every_window[] = { 0, 1, WINDOW_S };
+    for (unsigned h = 0; h < sizeof(every_window) / sizeof(every_window[0]); h++) {
+        report_gate_t gate;
+        report_gate_init(&gate);
+        for (int i = 0; i < 10; i++) {
+            CHECK_EQ(until_published(&gate, &quiet_window, every_window[h], 1), 1);
+        }
+    }
+}
+
+
+static void test_changes(void)
+{
+    uint32_t quiet_windows;
+    report_window_t window = quiet_window;
+    window.num_cars = 1;
+    CHECK(after_quiet(&window, &quiet_windows));
+    CHECK_EQ(quiet_windows, 3);
+
+    window = quiet_window;
+    window.sensor_1_up = false;
+    CHECK(after_quiet(&window, &quiet_windows));
+    CHECK_EQ(quiet_windows, 3);
+
+    window = quiet_window;
+    window.sensor_2_up = false;
+    CHECK(after_quiet(&window, &quiet_windows));
+
+    window = quiet_window;
+    window.ota_active = true;
+    CHECK(after_quiet(&window, &quiet_windows));
+
+    window = quiet_window;
+    window.events_dropped = true;
+    CHECK(after_quiet(&window, &quiet_windows));
+
+    // Nothing changed
+    CHECK(!after_quiet(&quiet_window, &quiet_windows));
+
+    // A fault is reported when it starts and when it clears, and is quiet in between
+    report_gate_t gate;
+    report_gate_init(&gate);
+    report_gate_window(&gate, &quiet_window, HEARTBEAT_S, &quiet_windows);
+    window = quiet_window;
+    window.sensor_1_up = false;
+    CHECK(report_gate_window(&gate, &window, HEARTBEAT_S, &quiet_windows));
+    CHECK(!report_gate_window(&gate, &window, HEARTBEAT_S, &quiet_windows));
+    CHECK(report_gate_window(&gate, &quiet_window, HEARTBEAT_S, &quiet_windows));
+    CHECK_EQ(quiet_windows, 1);
+
+    // Lost events are reported for every window they happen in, not just the first
+    window = quiet_window;
+    window.events_dropped = true;
+    CHECK(report_gate_window(&gate, &window, HEARTBEAT_S, &quiet_windows));
+    CHECK(report_gate_window(&gate, &window, HEARTBEAT_S, &quiet_windows));
+    CHECK_EQ(quiet_windows, 0);
+}
+
+
+static void test_window_length_change(void)
+{
+    // Held-back windows are all of the last reported length, so a new length goes out at once
+    uint32_t quiet_windows;
+    report_window_t window = quiet_window;
+    window.window_s = 10;
+    CHECK(after_quiet(&window, &quiet_windows));
+    CHECK_EQ(quiet_windows, 3);
+
+    // And the heartbeat then counts in the new length
+    report_gate_t gate;
+    report_gate_init(&gate);
+    report_gate_window(&gate, &quiet_window, HEARTBEAT_S, &quiet_windows);
+    window.window_s = 60;
+    CHECK(report_gate_window(&gate, &window, HEARTBEAT_S, &quiet_windows));
+    CHECK_EQ(until_published(&gate, &window, HEARTBEAT_S, 100), HEARTBEAT_S / 60);
+}
+
+
+// The decisions of report_gate.py's mirror, which bench_reporting.py uses,
+// for the same windows
+static void test_python_mirror(const char *path)
+{
+    FILE *f = fopen(path, "r");
+    CHECK(f != NULL);
+    if (f == NULL) {
+        return;
+    }
+    char line[128];
+    fgets(line, sizeof(line), f);
+    report_gate_t gate;
+    report_gate_init(&gate);
+    unsigned heartbeat_s, window_s, num_cars, sensor_1_up, sensor_2_up, ota_active, events_dropped, published, expected_quiet;
+    unsigned windows = 0;
+    unsigned mismatches = 0;
+    unsigned reports = 0;
+    while (fscanf(f, "%u,%u,%u,%u,%u,%u,%u,%u,%u", &heartbeat_s, &window_s, &num_cars, &sensor_1_up, &sensor_2_up,
+                  &ota_active, &events_dropped, &published, &expected_quiet) == 9) {
+        report_window_t window = {
+            .window_s = window_s, .num_cars = num_cars, .sensor_1_up = sensor_1_up, .sensor_2_up = sensor_2_up,
+            .ota_active = ota_active, .events_dropped = events_dropped,
+        };
+        uint32_t quiet_windows = 0;
+        bool sent = report_gate_window(&gate, &window, heartbeat_s, &quiet_windows);
+        if (sent != (bool)published || (sent && quiet_windows != expected_quiet)) {
+            if (mismatches++ == 0) {
+                fprintf(stderr, "Window %u: C gate %s with %u quiet, mirror %s with %u\n", windows,
+                        sent ? "published" : "held", (unsigned)quiet_windows, published ? "published" : "held", expected_quiet);
+            }
+        }
+        reports += sent;
+        windows++;
+    }
+    fclose(f);
+    printf("%u windows, %u reports, %u decisions differ from the Python mirror\n", windows, reports, mismatches);
+    CHECK(windows > 0);
+    CHECK_EQ(mismatches, 0);
+}
+
+
+int main(int argc, char **argv)
+{
+    test_first_window();
+    test_heartbeat_floor();
+    test_changes();
+    test_window_length_change();
+    test_python_mirror(argc > 1 ? argv[1] : "report_gate_trace.csv");
+    return HOST_TEST_RESULT();
+}
@@ -0,0 +1,230 @@
+#include <inttypes.h>
+#include <malloc.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "host_test.h"
+#include "jitter_hist.h"
+#include "outbox.h"
+#include "report_gate.h"
+#include "speed_hist.h"
+
+/*
+ * Soak of the reporting path: many report windows through the report gate,
+ * the per-window histograms, the report formatting of main.c and the
+ * telemetry outbox with its drop-oldest overflow and acknowledgements as
+ * telemetry.c drives them, with the broker going away now and then so the
+ * outbox fills. Every allocation goes through a counting shim over glibc's
+ * malloc. After the first window none may be made, and the heap must end as
+ * it was then, the same bytes in use and free.
+ */
+#define WINDOWS 200000
+#define LANES 2
+#define WINDOW_S 5              // POLICY_DEFAULT_REPORT_INTERVAL_S
+#define HEARTBEAT_S 300         // POLICY_DEFAULT_HEARTBEAT_INTERVAL_S
+#define POLL_US 20000           // POLICY_DEFAULT_POLL_PERIOD_MS
+#define OUTBOX_BYTES 4096       // CONFIG_TELEMETRY_OUTBOX_BYTES
+#define MAX_MESSAGE 1024        // TELEMETRY_MAX_MESSAGE
+#define OUTAGE_EVERY 5000       // Windows between broker outages
+#define OUTAGE_WINDOWS 200
+
+extern void *__libc_malloc(size_t size);
+extern void *__libc_calloc(size_t count, size_t size);
+extern void *__libc_realloc(void *ptr, size_t size);
+extern void __libc_free(void *ptr);
+
+static bool counting = false;
+static uint32_t allocs = 0;
+
+
+void *malloc(size_t size)
+{
+    allocs += counting;
+    return __libc_malloc(size);
+}
+
+
+void *calloc(size_t count, size_t size)
+{
+    allocs += counting;
+    return __libc_calloc(count, size);
+}
+
+
+void *realloc(void *ptr, size_t size)
+{
+    allocs += counting;
+    return __libc_realloc(ptr, size);
+}
+
+
+void free(void *ptr)
+{
+    __libc_free(ptr);
+}
+
+
+// Static, as in main.c and telemetry.c
+static uint8_t outbox_storage[OUTBOX_BYTES];
+static outbox_t outbox;
+static char report_message[MAX_MESSAGE];
+static char tx_buf[MAX_MESSAGE];
+static report_gate_t gates[LANES];
+static jitter_hist_t cycle_jitter;
+static jitter_hist_t last_jitter;
+
+static uint32_t seq[LANES];
+static uint32_t published;
+static uint32_t dropped;
+static uint32_t acked;
+static uint32_t last_acked_seq[LANES];
+
+
+// The outbox side of telemetry_enqueue() with the drop-oldest policy
+static void enqueue(const char *msg, size_t len)
+{
+    while (outbox_free(&outbox) < len + OUTBOX_HEADER_SIZE && outbox.count > 0) {
+        outbox_pop(&outbox);
+        dropped++;
+    }
+    CHECK(outbox_push(&outbox, msg, len));
+}
+
+
+// The oldest message handed to the broker and acknowledged, in order per lane
+static void deliver(void)
+{
+    while (outbox.count > 0) {
+        size_t len = outbox_peek(&outbox, tx_buf, sizeof(tx_buf) - 1);
+        CHECK(len > 0);
+        tx_buf[len] = '\0';
+        int lane;
+        unsigned message_seq;
+        CHECK(sscanf(strstr(tx_buf, "\"lane\""), "\"lane\": %d, \"seq\": %u", &lane, &message_seq) == 2);
+        if (lane >= 0 && lane < LANES) {
+            CHECK(message_seq > last_acked_seq[lane]);
+            last_acked_seq[lane] = message_seq;
+        }
+        outbox_pop(&outbox);
+        acked++;
+    }
+}
+
+
+static void report_window(uint32_t window, int lane, int64_t *now_us)
+{
+    // A window of measurement cycles, a few late
+    jitter_hist_t window_jitter;
+    for (int i = 0; i < WINDOW_S * 1000000 / POLL_US / LANES; i++) {
+        *now_us += POLL_US + (rand() % 50 == 0 ? rand() % 3000 : 0);
+        jitter_hist_record(&cycle_jitter, *now_us, POLL_US);
+    }
+    jitter_hist_delta(&cycle_jitter, &last_jitter, &window_jitter);
+    last_jitter = cycle_jitter;
+
+    // Mostly empty windows at night, busier by day
+    speed_hist_t speeds;
+    speed_hist_init(&speeds);
+    uint32_t num_cars = (window / 720) % 2 ? rand() % 12 : rand() % 8 == 0;
+    float avg_speed = 0;
+    float max_speed = 0;
+    float min_speed = 0;
+    for (uint32_t i = 0; i < num_cars; i++) {
+        float speed = 500 + rand() % 2500;
+        speed_hist_record(&speeds, speed);
+        avg_speed += speed / num_cars;
+        max_speed = speed > max_speed ? speed : max_speed;
+        min_speed = i == 0 || speed < min_speed ? speed : min_speed;
+    }
+
+    report_window_t gate_window = {
+        .window_s = WINDOW_S, .num_cars = num_cars,
+        .sensor_1_up = window % 977 != 0, .sensor_2_up = true,
+    };
+    uint32_t quiet_windows;
+    if (!report_gate_window(&gates[lane], &gate_window, HEARTBEAT_S, &quiet_windows)) {
+        return;
+    }
+
+    // As publish_pending_reports()
+    char jitter_counts[JITTER_HIST_BUCKETS * 6];
+    int jitter_len = 0;
+    for (int i = 0; i < JITTER_HIST_BUCKETS; i++) {
+        jitter_len += snprintf(jitter_counts + jitter_len, sizeof(jitter_counts) - jitter_len, "%s%" PRIu32, i ? "," : "", window_jitter.counts[i]);
+    }
+    char speed_counts[SPEED_HIST_BUCKETS * 4];
+    int speed_len = 0;
+    speed_counts[0] = '\0';
+    for (unsigned i = 0; i < speed_hist_used(&speeds); i++) {
+        speed_len += snprintf(speed_counts + speed_len, sizeof(speed_counts) - speed_len, "%s%u", i ? "," : "", speeds.counts[i]);
+    }
+    int len = snprintf(report_message, sizeof(report_message),
+                       "{\"device\": \"%s\", \"version\": \"%s\", \"ts\": %lld, \"lane\": %d, \"seq\": %" PRIu32 ", \"data\": {\"avg_speed\": %.2f, \"max_speed\": %.2f, \"min_speed\": %.2f, \"num_cars\": %" PRIu32 ", \"sensor_1_up\": %d, \"sensor_2_up\": %d, \"jitter_p50_us\": %" PRIu32 ", \"jitter_p99_us\": %" PRIu32 ", \"jitter_hist\": [%s], \"speed_hist\": [%s], \"window_s\": %u, \"quiet_windows\": %" PRIu32 "}}",
+                       "sensor_1", "0.0.1", 1700000000000LL + *now_us / 1000, lane, ++seq[lane], avg_speed, max_speed, min_speed,
+                       num_cars, gate_window.sensor_1_up, gate_window.sensor_2_up,
+                       jitter_hist_percentile_us(&window_jitter, 50), jitter_hist_percentile_us(&window_jitter, 99),
+                       jitter_counts, speed_counts, gate_window.window_s, quiet_windows);
+    CHECK(len > 0 && len < (int)sizeof(report_message));
+    enqueue(report_message, len);
+    published++;
+}
+
+
+static void run_window(uint32_t window, int64_t *now_us)
+{
+    for (int lane = 0; lane < LANES; lane++) {
+        report_window(window, lane, now_us);
+    }
+    if (window % OUTAGE_EVERY >= OUTAGE_WINDOWS) {
+        deliver();
+    }
+}
+
+
+int main(void)
+{
+    // The shim sees allocations
+    counting = true;
+    void *volatile probe = malloc(16);
+    free(probe);
+    counting = false;
+    CHECK_EQ(allocs, 1);
+    allocs = 0;
+
+    srand(39);
+    outbox_init(&outbox, outbox_storage, sizeof(outbox_storage));
+    jitter_hist_init(&cycle_jitter);
+    last_jitter = cycle_jitter;
+    for (int lane = 0; lane < LANES; lane++) {
+        report_gate_init(&gates[lane]);
+    }
+
+    // Armed once the first window is out, as heap_guard_arm() on the device
+    int64_t now_us = 1;
+    run_window(0, &now_us);
+    struct mallinfo2 armed = mallinfo2();
+    counting = true;
+    for (uint32_t window = 1; window < WINDOWS; window++) {
+        run_window(window, &now_us);
+    }
+    counting = false;
+    deliver();
+    struct mallinfo2 end = mallinfo2();
+
+    printf("%u windows, %" PRIu32 " reports published, %" PRIu32 " acked, %" PRIu32 " dropped in outages, "
+           "%" PRIu32 " allocations after the first window, heap in use %zu -> %zu bytes, free %zu -> %zu bytes\n",
+           (unsigned)WINDOWS * LANES, published, acked, dropped, allocs, armed.uordblks, end.uordblks, armed.fordblks, end.fordblks);
+
+    CHECK_EQ(allocs, 0);
+    CHECK_EQ(end.uordblks, armed.uordblks);
+    CHECK_EQ(end.fordblks, armed.fordblks);
+    CHECK_EQ(end.arena, armed.arena);
+    CHECK_EQ(acked + dropped, published);
+    // The outages overflowed the outbox, and the gate held quiet windows back
+    CHECK(dropped > 0);
+    CHECK(published < WINDOWS * LANES);
+    return HOST_TEST_RESULT();
+}
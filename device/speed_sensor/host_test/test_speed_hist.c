@@ -0,0 +1,58 @@
+#include <math.h>
+#include <stdint.h>
+
+#include "host_test.h"
+#include "speed_hist.h"
+
+
+static double lower_bound(unsigned bucket)
+{
+    return SPEED_HIST_BASE_CM_S * pow(2.0, (double)bucket / SPEED_HIST_PER_OCTAVE);
+}
+
+
+static void test_bucket_bounds(void)
+{
+    CHECK_EQ(speed_hist_bucket(0), 0);
+    CHECK_EQ(speed_hist_bucket(-5), 0);
+    CHECK_EQ(speed_hist_bucket(NAN), 0);
+    CHECK_EQ(speed_hist_bucket(SPEED_HIST_BASE_CM_S), 0);
+    CHECK_EQ(speed_hist_bucket(1e9f), SPEED_HIST_BUCKETS - 1);
+
+    // Just inside either end of every bucket, as the gateway computes them
+    for (unsigned k = 1; k < SPEED_HIST_BUCKETS; k++) {
+        CHECK_EQ(speed_hist_bucket(lower_bound(k) * 1.001), k);
+        CHECK_EQ(speed_hist_bucket(lower_bound(k) * 0.999), k - 1);
+    }
+}
+
+
+static void test_record_and_trim(void)
+{
+    speed_hist_t hist;
+    speed_hist_init(&hist);
+    CHECK_EQ(speed_hist_used(&hist), 0);
+
+    speed_hist_record(&hist, 1389);     // 50 km/h
+    speed_hist_record(&hist, 1389);
+    speed_hist_record(&hist, 100);
+    CHECK_EQ(hist.samples, 3);
+    CHECK_EQ(hist.counts[0], 1);
+    CHECK_EQ(hist.counts[speed_hist_bucket(1389)], 2);
+    CHECK_EQ(speed_hist_used(&hist), speed_hist_bucket(1389) + 1);
+
+    for (int i = 0; i < 300; i++) {
+        speed_hist_record(&hist, 1e9f);
+    }
+    CHECK_EQ(hist.counts[SPEED_HIST_BUCKETS - 1], UINT8_MAX);
+    CHECK_EQ(hist.samples, 303);
+    CHECK_EQ(speed_hist_used(&hist), SPEED_HIST_BUCKETS);
+}
+
+
+int main(void)
+{
+    test_bucket_bounds();
+    test_record_and_trim();
+    return HOST_TEST_RESULT();
+}
@@ -0,0 +1,189 @@
+#include <string.h>
+
+#include "host_test.h"
+#include "topic_router.h"
+
+#define MATCHES(pattern, topic) topic_matches(pattern, strlen(pattern), topic, strlen(topic))
+
+typedef struct
+{
+    int calls;
+    size_t bytes;
+    size_t last_offset;
+} route_log_t;
+
+
+static void log_fragment(void *ctx, const topic_fragment_t *fragment)
+{
+    route_log_t *log = ctx;
+    log->calls++;
+    log->bytes += fragment->len;
+    log->last_offset = fragment->offset;
+}
+
+
+static topic_router_result_t dispatch(topic_router_t *router, const char *topic, const char *data,
+                                      size_t offset, size_t total_len)
+{
+    return topic_router_dispatch(router, topic, topic ? strlen(topic) : 0, data, strlen(data), offset, total_len);
+}
+
+
+static void test_matches(void)
+{
+    CHECK(MATCHES("/device/a/bump", "/device/a/bump"));
+    CHECK(MATCHES("/device/+/bump", "/device/a/bump"));
+    CHECK(MATCHES("/device/+/bump", "/device//bump"));
+    CHECK(MATCHES("/device/#", "/device/a/bump"));
+    CHECK(MATCHES("/device/#", "/device"));
+    CHECK(MATCHES("#", "/device/a"));
+    CHECK(MATCHES("+/+", "a/b"));
+
+    // Prefixes and extensions of a level don't match
+    CHECK(!MATCHES("/device/a/bump", "/device/a/bum"));
+    CHECK(!MATCHES("/device/a/bump", "/device/a/bumpy"));
+    CHECK(!MATCHES("/device/a/bump", "/device/a/bump/x"));
+    CHECK(!MATCHES("/device/a", "/device/ab"));
+    CHECK(!MATCHES("/device/+/bump", "/device/a/b/bump"));
+    CHECK(!MATCHES("/device/+", "/device/a/bump"));
+    CHECK(!MATCHES("/device/a/#", "/device/ab"));
+    CHECK(!MATCHES("+/+", "a"));
+
+    // Wildcards stay away from broker topics
+    CHECK(!MATCHES("#", "$SYS/broker/uptime"));
+    CHECK(!MATCHES("+/broker/uptime", "$SYS/broker/uptime"));
+    CHECK(MATCHES("$SYS/#", "$SYS/broker/uptime"));
+}
+
+
+static void test_routing(void)
+{
+    topic_router_t router;
+    route_log_t exact = { 0 };
+    route_log_t wildcard = { 0 };
+    topic_router_init(&router);
+    // The wildcard is registered first, the exact route still wins for its topic
+    CHECK(topic_router_add(&router, "/device/+/bump", log_fragment, &wildcard));
+    CHECK(topic_router_add(&router, "/device/a/bump", log_fragment, &exact));
+    CHECK(!topic_router_add(&router, "/device/a/bump", log_fragment, &exact));
+
+    CHECK_EQ(dispatch(&router, "/device/a/bump", "deploy", 0, 6), TOPIC_ROUTER_DISPATCHED);
+    CHECK_EQ(exact.calls, 1);
+    CHECK_EQ(wildcard.calls, 0);
+    CHECK_EQ(dispatch(&router, "/device/b/bump", "deploy", 0, 6), TOPIC_ROUTER_DISPATCHED);
+    CHECK_EQ(wildcard.calls, 1);
+    CHECK_EQ(dispatch(&router, "/device/a/bumpy", "deploy", 0, 6), TOPIC_ROUTER_NO_ROUTE);
+    CHECK_EQ(dispatch(&router, "/device/a/bum", "deploy", 0, 6), TOPIC_ROUTER_NO_ROUTE);
+    CHECK_EQ(exact.calls + wildcard.calls, 2);
+
+    char patterns[TOPIC_ROUTER_MAX_ROUTES][16];
+    for (size_t i = router.route_count; i < TOPIC_ROUTER_MAX_ROUTES; i++) {
+        snprintf(patterns[i], sizeof(patterns[i]), "/t/%u", (unsigned)i);
+        CHECK(topic_router_add(&router, patterns[i], log_fragment, &exact));
+    }
+    CHECK(!topic_router_add(&router, "/one/more", log_fragment, &exact));
+    for (size_t i = 2; i < TOPIC_ROUTER_MAX_ROUTES; i++) {
+        CHECK_EQ(dispatch(&router, patterns[i], "x", 0, 1), TOPIC_ROUTER_DISPATCHED);
+    }
+}
+
+
+static void test_fragments(void)
+{
+    topic_router_t router;
+    route_log_t log = { 0 };
+    topic_router_init(&router);
+    topic_router_add(&router, "/device/a/config", log_fragment, &log);
+
+    // Continuations carry no topic and follow the first fragment's route
+    CHECK_EQ(dispatch(&router, "/device/a/config", "abcd", 0, 10), TOPIC_ROUTER_DISPATCHED);
+    CHECK_EQ(dispatch(&router, NULL, "efg", 4, 10), TOPIC_ROUTER_DISPATCHED);
+    CHECK_EQ(dispatch(&router, NULL, "hij", 7, 10), TOPIC_ROUTER_DISPATCHED);
+    CHECK_EQ(log.calls, 3);
+    CHECK_EQ(log.bytes, 10);
+    CHECK_EQ(log.last_offset, 7);
+
+    // The payload is complete, nothing more belongs to it
+    CHECK_EQ(dispatch(&router, NULL, "k", 10, 11), TOPIC_ROUTER_OUT_OF_SEQUENCE);
+
+    // A continuation whose first fragment never arrived
+    topic_router_init(&router);
+    topic_router_add(&router, "/device/a/config", log_fragment, &log);
+    CHECK_EQ(dispatch(&router, NULL, "efg", 4, 10), TOPIC_ROUTER_OUT_OF_SEQUENCE);
+
+    // A gap drops the rest of the payload
+    log.calls = 0;
+    CHECK_EQ(dispatch(&router, "/device/a/config", "abcd", 0, 10), TOPIC_ROUTER_DISPATCHED);
+    CHECK_EQ(dispatch(&router, NULL, "hij", 7, 10), TOPIC_ROUTER_OUT_OF_SEQUENCE);
+    CHECK_EQ(dispatch(&router, NULL, "efg", 4, 10), TOPIC_ROUTER_OUT_OF_SEQUENCE);
+    CHECK_EQ(log.calls, 1);
+
+    // An unrouted first fragment takes its continuations with it
+    CHECK_EQ(dispatch(&router, "/device/b/config", "abcd", 0, 10), TOPIC_ROUTER_NO_ROUTE);
+    CHECK_EQ(dispatch(&router, NULL, "efg", 4, 10), TOPIC_ROUTER_OUT_OF_SEQUENCE);
+}
+
+
+static topic_collect_result_t collect(topic_collector_t *collector, const char *data, size_t offset, size_t total_len)
+{
+    topic_fragment_t fragment = { .data = data, .len = strlen(data), .offset = offset, .total_len = total_len };
+    return topic_collect(collector, &fragment);
+}
+
+
+static void test_collect(void)
+{
+    // One byte past the capacity must never be written
+    char buf[9];
+    memset(buf, '#', sizeof(buf));
+    topic_collector_t collector = { .buf = buf, .capacity = 8 };
+
+    CHECK_EQ(collect(&collector, "dep", 0, 6), TOPIC_COLLECT_PARTIAL);
+    CHECK_EQ(collect(&collector, "lo", 3, 6), TOPIC_COLLECT_PARTIAL);
+    CHECK_EQ(collect(&collector, "y", 5, 6), TOPIC_COLLECT_COMPLETE);
+    CHECK_EQ(collector.len, 6);
+    CHECK(memcmp(buf, "deploy", 6) == 0);
+
+    CHECK_EQ(collect(&collector, "retract", 0, 7), TOPIC_COLLECT_COMPLETE);
+    CHECK_EQ(collector.len, 7);
+    CHECK(memcmp(buf, "retract", 7) == 0);
+
+    // A continuation without its first fragment, at an offset that would
+    // have run past the buffer
+    CHECK_EQ(collect(&collector, "xyz", 7, 10), TOPIC_COLLECT_OUT_OF_SEQUENCE);
+    CHECK_EQ(buf[8], '#');
+    collector = (topic_collector_t){ .buf = buf, .capacity = 8 };
+    CHECK_EQ(collect(&collector, "xyz", 3, 6), TOPIC_COLLECT_OUT_OF_SEQUENCE);
+
+    // A gap abandons the payload
+    CHECK_EQ(collect(&collector, "dep", 0, 6), TOPIC_COLLECT_PARTIAL);
+    CHECK_EQ(collect(&collector, "y", 5, 6), TOPIC_COLLECT_OUT_OF_SEQUENCE);
+    CHECK_EQ(collect(&collector, "lo", 3, 6), TOPIC_COLLECT_OUT_OF_SEQUENCE);
+
+    // Oversized payloads are reported once, on their last fragment
+    CHECK_EQ(collect(&collector, "abcde", 0, 12), TOPIC_COLLECT_PARTIAL);
+    CHECK_EQ(collect(&collector, "fghi", 5, 12), TOPIC_COLLECT_PARTIAL);
+    CHECK_EQ(collect(&collector, "jkl", 9, 12), TOPIC_COLLECT_OVERFLOW);
+    CHECK_EQ(collector.len, 0);
+    CHECK_EQ(collect(&collector, "abcdefghi", 0, 9), TOPIC_COLLECT_OVERFLOW);
+    CHECK_EQ(buf[8], '#');
+
+    // Fragments running past a total_len that fit
+    CHECK_EQ(collect(&collector, "abcde", 0, 6), TOPIC_COLLECT_PARTIAL);
+    CHECK_EQ(collect(&collector, "fghi", 5, 6), TOPIC_COLLECT_OVERFLOW);
+    CHECK_EQ(buf[8], '#');
+
+    // and the next payload is collected as usual
+    CHECK_EQ(collect(&collector, "deploy", 0, 6), TOPIC_COLLECT_COMPLETE);
+    CHECK(memcmp(buf, "deploy", 6) == 0);
+}
+
+
+int main(void)
+{
+    test_matches();
+    test_routing();
+    test_fragments();
+    test_collect();
+    return HOST_TEST_RESULT();
+}
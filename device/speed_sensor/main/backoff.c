@@ -0,0 +1,50 @@
+#include "backoff.h"
+
+// Past this many doublings every realistic base has reached the cap
+#define BACKOFF_MAX_SHIFT 20
+
+
+static uint32_t xorshift32(uint32_t *state)
+{
+    uint32_t x = *state;
+    x ^= x << 13;
+    x ^= x >> 17;
+    x ^= x << 5;
+    *state = x;
+    return x;
+}
+
+
+void backoff_init(backoff_t *backoff, uint32_t base_ms, uint32_t cap_ms, uint32_t seed)
+{
+    backoff->base_ms = base_ms;
+    backoff->cap_ms = cap_ms;
+    backoff->attempt = 0;
+    backoff->rng_state = seed ? seed : 0x9E3779B9;
+}
+
+
+uint32_t backoff_window_ms(const backoff_t *backoff)
+{
+    uint32_t shift = backoff->attempt < BACKOFF_MAX_SHIFT ? backoff->attempt : BACKOFF_MAX_SHIFT;
+    uint64_t window = (uint64_t)backoff->base_ms << shift;
+    return window < backoff->cap_ms ? (uint32_t)window : backoff->cap_ms;
+}
+
+
+uint32_t backoff_next_delay_ms(backoff_t *backoff)
+{
+    uint32_t window = backoff_window_ms(backoff);
+    if (backoff->attempt < UINT32_MAX) {
+        backoff->attempt++;
+    }
+    uint32_t draw = xorshift32(&backoff->rng_state);
+    // window + 1 would wrap to 0 with a cap of UINT32_MAX
+    return window == UINT32_MAX ? draw : draw % (window + 1);
+}
+
+
+void backoff_reset(backoff_t *backoff)
+{
+    backoff->attempt = 0;
+}
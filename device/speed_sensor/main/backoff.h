@@ -0,0 +1,39 @@
+#ifndef __BACKOFF_H__
+#define __BACKOFF_H__
+
+#include <stdint.h>
+
+/*
+ * Exponential backoff with full jitter: the n-th delay is drawn uniformly from
+ * [0, min(cap, base * 2^n)]. Spreading retries over the whole window keeps a
+ * street of sensors that lost power together from reconnecting in lockstep.
+ *
+ * Plain C with no ESP-IDF dependencies so the policy can be exercised on a host.
+ */
+typedef struct
+{
+    uint32_t base_ms;
+    uint32_t cap_ms;
+    uint32_t attempt;
+    uint32_t rng_state; //!< xorshift32 state, never 0
+} backoff_t;
+
+
+void backoff_init(backoff_t *backoff, uint32_t base_ms, uint32_t cap_ms, uint32_t seed);
+
+
+/**
+ * @brief Delay before the next attempt, advancing the attempt counter
+ */
+uint32_t backoff_next_delay_ms(backoff_t *backoff);
+
+
+/**
+ * @brief Upper bound of the window the next delay will be drawn from
+ */
+uint32_t backoff_window_ms(const backoff_t *backoff);
+
+
+void backoff_reset(backoff_t *backoff);
+
+#endif /* __BACKOFF_H__ */
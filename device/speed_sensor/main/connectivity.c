@@ -1,8 +1,8 @@
+#include <string.h>
 #include <time.h>
 
 #include "esp_wifi.h"
 #include "mqtt_client.h"
-#include "esp_crt_bundle.h"
 
 #include "esp_sntp.h"
 #include "esp_log.h"
@@ -15,16 +15,37 @@
 #include "esp_bt_defs.h"
 
 #include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+#include "freertos/event_groups.h"
+#include "esp_timer.h"
 
 #include "esp_bt_main.h"
 
+#include "connectivity.h"
+#include "mqtt_tls.h"
+#include "wifi_reconnect.h"
+
+
+EventGroupHandle_t connectivity_events = NULL;
+
+// Wall-clock time minus esp_timer time, valid once TIME_SYNCED_BIT is set. Written
+// by the SNTP task and read from others; 64 bits don't load or store atomically
+static int64_t epoch_offset_us = 0;
+static portMUX_TYPE epoch_offset_mux = portMUX_INITIALIZER_UNLOCKED;
+
+
+void initialize_connectivity_events(void)
+{
+	connectivity_events = xEventGroupCreate();
+}
 
 
 void initialize_wifi(const char *ssid, const char *pass, esp_event_handler_t wifi_event_handler)
 {
 	esp_netif_init();
 	esp_event_loop_create_default();
-	esp_netif_create_default_wifi_sta();
+	esp_netif_t *sta_netif = esp_netif_create_default_wifi_sta();
+	wifi_reconnect_init(sta_netif);
 	wifi_init_config_t wifi_initiation = WIFI_INIT_CONFIG_DEFAULT();
 	esp_wifi_init(&wifi_initiation);
 
@@ -40,6 +61,7 @@ void initialize_wifi(const char *ssid, const char *pass, esp_event_handler_t wif
 	};
 	strcpy((char*)wifi_configuration.sta.ssid, ssid);
 	strcpy((char*)wifi_configuration.sta.password, pass);
+	wifi_reconnect_configure(&wifi_configuration);
 	esp_wifi_set_config(ESP_IF_WIFI_STA, &wifi_configuration);
 	esp_wifi_start();
 	esp_wifi_set_mode(WIFI_MODE_STA);
@@ -48,15 +70,22 @@ void initialize_wifi(const char *ssid, const char *pass, esp_event_handler_t wif
 }
 
 
-esp_mqtt_client_handle_t initialize_mqtt(const char *uri, const char *user, const char *password, esp_event_handler_t mqtt_event_handler)
+esp_mqtt_client_handle_t initialize_mqtt(const char *uri, const char *user, const char *password, const char *client_id, esp_event_handler_t mqtt_event_handler)
 {
 	esp_mqtt_client_config_t mqtt_cfg = {
         .broker.address.uri = uri,
-		.broker.verification.crt_bundle_attach = esp_crt_bundle_attach,
 		.credentials.username = user,
+		.credentials.client_id = client_id,
 		.credentials.authentication.password = password,
-		.broker.verification.skip_cert_common_name_check = true
+		// Persistent session: the broker keeps our subscriptions and queued
+		// QoS1 messages across reconnects, keyed on the stable client id
+		.session.disable_clean_session = true,
 	};
+	// Our own TLS transport, verifying against only our own CA and resuming
+	// the last TLS session on reconnect. Plain mqtt:// for local testing
+	if (strncmp(uri, "mqtts://", 8) == 0) {
+		mqtt_cfg.network.transport = mqtt_tls_transport_init(server_ca_pem_start);
+	}
 
 	esp_mqtt_client_handle_t client = esp_mqtt_client_init(&mqtt_cfg); //sending struct as a parameter in init client function
 	esp_mqtt_client_register_event(client, ESP_EVENT_ANY_ID, mqtt_event_handler, NULL);
@@ -66,9 +95,23 @@ esp_mqtt_client_handle_t initialize_mqtt(const char *uri, const char *user, cons
 }
 
 
+static void time_sync_notification_cb(struct timeval *tv)
+{
+    int64_t offset_us = (int64_t)tv->tv_sec * 1000000 + tv->tv_usec - esp_timer_get_time();
+    taskENTER_CRITICAL(&epoch_offset_mux);
+    epoch_offset_us = offset_us;
+    taskEXIT_CRITICAL(&epoch_offset_mux);
+    if (!(xEventGroupGetBits(connectivity_events) & TIME_SYNCED_BIT)) {
+        ESP_LOGI("SNTP", "Time synchronized after %lld ms", esp_timer_get_time() / 1000);
+    }
+    xEventGroupSetBits(connectivity_events, TIME_SYNCED_BIT);
+}
+
+
 void initialize_sntp(void) {
     ESP_LOGI("SNTP", "Initializing SNTP");
     esp_sntp_setoperatingmode(SNTP_OPMODE_POLL);
+    sntp_set_time_sync_notification_cb(time_sync_notification_cb);
 
     // Set the server by name
     // The server can be "pool.ntp.org", "time.nist.gov", or any other NTP server
@@ -79,21 +122,16 @@ void initialize_sntp(void) {
 }
 
 
-void wait_for_time_sync(void) {
-    // Wait for time to be set
-    int retry = 0;
-    const int retry_count = 30; // Maximum retries
-    while (sntp_get_sync_status() == SNTP_SYNC_STATUS_RESET && ++retry < retry_count) {
-        ESP_LOGI("SNTP", "Waiting for system time to be set... (%d/%d)", retry, retry_count);
-        vTaskDelay(2000 / portTICK_PERIOD_MS);
-    }
-
-    if (retry == retry_count) {
-        ESP_LOGW("SNTP", "Could not synchronize time");
-    } else {
-        ESP_LOGI("SNTP", "Time synchronized");
-        // Now you can call functions like 'localtime()' to get the current time
+bool monotonic_to_epoch_ms(int64_t monotonic_us, int64_t *epoch_ms)
+{
+    if (!(xEventGroupGetBits(connectivity_events) & TIME_SYNCED_BIT)) {
+        return false;
     }
+    taskENTER_CRITICAL(&epoch_offset_mux);
+    int64_t offset_us = epoch_offset_us;
+    taskEXIT_CRITICAL(&epoch_offset_mux);
+    *epoch_ms = (monotonic_us + offset_us) / 1000;
+    return true;
 }
 
 
@@ -151,7 +189,7 @@ void advertise_idle()
 }
 
 
-void advertise_deploy_speed_bump()
+void advertise_deploy_speed_bump(uint8_t actuator_mask)
 {
     uint8_t deploy_message[] = {
     /*-- device name --*/
@@ -160,16 +198,16 @@ void advertise_deploy_speed_bump()
     'S','p','e','e','d',' ','B','u','m','p', // Device name (10)
     0x05, // length of custom data
     0xff, // custom type
-    0x00,0x00,0x00,0x01
+    0x00,0x00,actuator_mask,0x01
     };
     esp_ble_gap_config_adv_data_raw(deploy_message, sizeof(deploy_message));
-    ESP_LOGI("BLE", "Advertise deploy");
+    ESP_LOGI("BLE", "Advertise deploy 0x%02x", actuator_mask);
     vTaskDelay(2000 /portTICK_PERIOD_MS);
     advertise_idle();
 }
 
 
-void advertise_retract_speed_bump()
+void advertise_retract_speed_bump(uint8_t actuator_mask)
 {
     uint8_t retract_message[] = {
     /*-- device name --*/
@@ -178,10 +216,10 @@ void advertise_retract_speed_bump()
     'S','p','e','e','d',' ','B','u','m','p', // Device name (10)
     0x05, // length of custom data
     0xff, // custom type
-    0x00,0x00,0x00,0x02
+    0x00,0x00,actuator_mask,0x02
     };
     esp_ble_gap_config_adv_data_raw(retract_message, sizeof(retract_message));
-    ESP_LOGI("BLE", "Advertise retract");
+    ESP_LOGI("BLE", "Advertise retract 0x%02x", actuator_mask);
     vTaskDelay(2000 /portTICK_PERIOD_MS);
     advertise_idle();
 }
\ No newline at end of file
@@ -1,6 +1,22 @@
+#include <stdbool.h>
+#include <stdint.h>
+
 #include "mqtt_client.h"
 #include "esp_http_client.h"
 #include "esp_gap_ble_api.h"
+#include "freertos/FreeRTOS.h"
+#include "freertos/event_groups.h"
+
+
+// Startup progress, set from the Wi-Fi, SNTP and MQTT event handlers
+#define WIFI_CONNECTED_BIT BIT0
+#define TIME_SYNCED_BIT    BIT1
+#define MQTT_CONNECTED_BIT BIT2
+
+extern EventGroupHandle_t connectivity_events;
+
+// WoW CA from certificates/cert.pem, embedded by EMBED_TXTFILES (NUL terminated)
+extern const char server_ca_pem_start[] asm("_binary_cert_pem_start");
 
 
 static esp_ble_adv_params_t ble_adv_params = {
@@ -13,16 +29,20 @@ static esp_ble_adv_params_t ble_adv_params = {
 };
 
 
+void initialize_connectivity_events(void);
+
+
 void initialize_wifi(const char *ssid, const char *pass, esp_event_handler_t wifi_event_handler);
 
 
-esp_mqtt_client_handle_t initialize_mqtt(const char *uri, const char *user, const char *password, esp_event_handler_t mqtt_event_handler);
+esp_mqtt_client_handle_t initialize_mqtt(const char *uri, const char *user, const char *password, const char *client_id, esp_event_handler_t mqtt_event_handler);
 
 
 void initialize_sntp(void);
 
 
-void wait_for_time_sync(void);
+// Convert an esp_timer timestamp to wall-clock time, false until SNTP has synced
+bool monotonic_to_epoch_ms(int64_t monotonic_us, int64_t *epoch_ms);
 
 
 void print_current_time();
@@ -34,7 +54,12 @@ void initialize_ble(esp_gap_ble_cb_t esp_gap_cb);
 void advertise_idle();
 
 
-void advertise_deploy_speed_bump();
+/**
+ * @brief Advertise a command for the speed bump controllers for 2 s
+ *
+ * @param actuator_mask Bit i selects the controller's i-th actuator, 0 all of them
+ */
+void advertise_deploy_speed_bump(uint8_t actuator_mask);
 
 
-void advertise_retract_speed_bump();
\ No newline at end of file
+void advertise_retract_speed_bump(uint8_t actuator_mask);
\ No newline at end of file
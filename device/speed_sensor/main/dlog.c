@@ -0,0 +1,108 @@
+#include <stdatomic.h>
+#include <string.h>
+
+#include "dlog.h"
+
+#define DLOG_RING_MASK (DLOG_RING_SIZE - 1)
+
+_Static_assert((DLOG_RING_SIZE & DLOG_RING_MASK) == 0, "DLOG_RING_SIZE must be a power of two");
+
+// Each cell's sequence number says whose turn it is: equal to the write
+// position when free, one past it once filled, a lap ahead once drained
+typedef struct
+{
+    atomic_uint seq;
+    dlog_record_t record;
+} dlog_cell_t;
+
+static dlog_cell_t ring[DLOG_RING_SIZE];
+static atomic_uint write_pos;
+static uint32_t read_pos;
+static atomic_uint dropped;
+
+
+void dlog_init(void)
+{
+    for (uint32_t i = 0; i < DLOG_RING_SIZE; i++) {
+        atomic_store_explicit(&ring[i].seq, i, memory_order_relaxed);
+    }
+    atomic_store_explicit(&write_pos, 0, memory_order_relaxed);
+    atomic_store_explicit(&dropped, 0, memory_order_relaxed);
+    read_pos = 0;
+}
+
+
+bool dlog_write(uint8_t level, const char *fmt, uint32_t time_us, uint8_t nargs, const uint32_t *args)
+{
+    unsigned int pos = atomic_load_explicit(&write_pos, memory_order_relaxed);
+    dlog_cell_t *cell;
+    while (true) {
+        cell = &ring[pos & DLOG_RING_MASK];
+        int32_t diff = (int32_t)(atomic_load_explicit(&cell->seq, memory_order_acquire) - pos);
+        if (diff == 0) {
+            if (atomic_compare_exchange_weak_explicit(&write_pos, &pos, pos + 1, memory_order_relaxed, memory_order_relaxed)) {
+                break;
+            }
+        } else if (diff < 0) {
+            // Full, the drain task hasn't caught up
+            atomic_fetch_add_explicit(&dropped, 1, memory_order_relaxed);
+            return false;
+        } else {
+            pos = atomic_load_explicit(&write_pos, memory_order_relaxed);
+        }
+    }
+
+    cell->record.fmt = (uint32_t)(uintptr_t)fmt;
+    cell->record.time_us = time_us;
+    cell->record.level = level;
+    cell->record.nargs = nargs > DLOG_MAX_ARGS ? DLOG_MAX_ARGS : nargs;
+    memcpy(cell->record.args, args, cell->record.nargs * sizeof(uint32_t));
+    atomic_store_explicit(&cell->seq, pos + 1, memory_order_release);
+    return true;
+}
+
+
+bool dlog_read(dlog_record_t *record)
+{
+    dlog_cell_t *cell = &ring[read_pos & DLOG_RING_MASK];
+    int32_t diff = (int32_t)(atomic_load_explicit(&cell->seq, memory_order_acquire) - (read_pos + 1));
+    if (diff < 0) {
+        // Drained, so whatever was dropped came after everything already read
+        uint32_t lost = atomic_exchange_explicit(&dropped, 0, memory_order_relaxed);
+        if (lost == 0) {
+            return false;
+        }
+        memset(record, 0, sizeof(*record));
+        record->level = DLOG_LEVEL_WARN;
+        record->nargs = 1;
+        record->args[0] = lost;
+        return true;
+    }
+    *record = cell->record;
+    atomic_store_explicit(&cell->seq, read_pos + DLOG_RING_SIZE, memory_order_release);
+    read_pos++;
+    return true;
+}
+
+
+static uint8_t *put_u32(uint8_t *p, uint32_t v)
+{
+    p[0] = v & 0xFF;
+    p[1] = (v >> 8) & 0xFF;
+    p[2] = (v >> 16) & 0xFF;
+    p[3] = v >> 24;
+    return p + 4;
+}
+
+
+size_t dlog_encode(const dlog_record_t *record, uint8_t *frame)
+{
+    uint8_t *p = put_u32(frame, record->fmt);
+    p = put_u32(p, record->time_us);
+    *p++ = record->level;
+    *p++ = record->nargs;
+    for (uint8_t i = 0; i < record->nargs; i++) {
+        p = put_u32(p, record->args[i]);
+    }
+    return p - frame;
+}
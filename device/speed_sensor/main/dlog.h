@@ -0,0 +1,118 @@
+#ifndef __DLOG_H__
+#define __DLOG_H__
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+/*
+ * Deferred binary logging. A log call stores the address of its format
+ * string and up to DLOG_MAX_ARGS raw 32-bit arguments in a RAM ring and
+ * returns; no formatting, no UART. A low-priority task drains the ring
+ * (see dlog_drain.h) and tools/dlog_decode.py rebuilds the text from the
+ * format strings in the firmware ELF.
+ *
+ * The ring is a bounded lock-free queue: any number of tasks may log, one
+ * task drains. When it is full new records are dropped and counted.
+ *
+ * Arguments must fit 32 bits. Floats are stored as float, other integers
+ * are truncated; %s only works for strings in flash (literals, tags),
+ * whose address the decoder can look up. Plain C, the ESP-IDF timestamp
+ * is only pulled in on target.
+ */
+#define DLOG_MAX_ARGS 4
+#define DLOG_RING_SIZE 256  // Records, power of two
+
+#define DLOG_LEVEL_ERROR 1
+#define DLOG_LEVEL_WARN  2
+#define DLOG_LEVEL_INFO  3
+
+typedef struct
+{
+    uint32_t fmt;               //!< Format string address, 0 for a drop notice
+    uint32_t time_us;           //!< Low 32 bits of esp_timer time
+    uint8_t level;
+    uint8_t nargs;
+    uint32_t args[DLOG_MAX_ARGS];
+} dlog_record_t;
+
+// Encoded frame: fmt, time_us, level, nargs, then nargs args, little endian
+#define DLOG_FRAME_MAX (4 + 4 + 1 + 1 + 4 * DLOG_MAX_ARGS)
+
+
+void dlog_init(void);
+
+
+/**
+ * @brief Queue one record, never blocks
+ *
+ * @return false if the ring was full and the record was dropped
+ */
+bool dlog_write(uint8_t level, const char *fmt, uint32_t time_us, uint8_t nargs, const uint32_t *args);
+
+
+/**
+ * @brief Take the oldest record, from the single draining task only
+ *
+ * Once the ring is empty, a drop notice (fmt 0, args[0] records lost) is
+ * returned if any records were dropped since the last one.
+ */
+bool dlog_read(dlog_record_t *record);
+
+
+/**
+ * @brief Serialise a record for a sink
+ *
+ * @return Bytes written to frame, at most DLOG_FRAME_MAX
+ */
+size_t dlog_encode(const dlog_record_t *record, uint8_t *frame);
+
+
+static inline uint32_t dlog_float_bits(double value)
+{
+    union { float f; uint32_t u; } bits = { .f = (float)value };
+    return bits.u;
+}
+
+static inline uint32_t dlog_int_bits(long long value)
+{
+    return (uint32_t)value;
+}
+
+static inline uint32_t dlog_ptr_bits(const void *value)
+{
+    return (uint32_t)(uintptr_t)value;
+}
+
+#define DLOG_ARG(x) _Generic((x),                   \
+    float: dlog_float_bits,                         \
+    double: dlog_float_bits,                        \
+    char *: dlog_ptr_bits,                          \
+    const char *: dlog_ptr_bits,                    \
+    default: dlog_int_bits)(x)
+
+#define DLOG_NARGS(...) DLOG_NARGS_(0, ##__VA_ARGS__, 4, 3, 2, 1, 0)
+#define DLOG_NARGS_(_0, _1, _2, _3, _4, n, ...) n
+
+#define DLOG_ARGS_0() 0
+#define DLOG_ARGS_1(a) DLOG_ARG(a)
+#define DLOG_ARGS_2(a, b) DLOG_ARG(a), DLOG_ARG(b)
+#define DLOG_ARGS_3(a, b, c) DLOG_ARG(a), DLOG_ARG(b), DLOG_ARG(c)
+#define DLOG_ARGS_4(a, b, c, d) DLOG_ARG(a), DLOG_ARG(b), DLOG_ARG(c), DLOG_ARG(d)
+#define DLOG_ARGS_N(n) DLOG_ARGS_##n
+#define DLOG_ARGS(n, ...) DLOG_ARGS_N(n)(__VA_ARGS__)
+
+#ifdef ESP_PLATFORM
+#include "esp_timer.h"
+#define DLOG_NOW_US() ((uint32_t)esp_timer_get_time())
+#endif
+
+#define DLOG(level, fmt, ...)                                                           \
+    dlog_write(level, fmt, DLOG_NOW_US(), DLOG_NARGS(__VA_ARGS__),                      \
+               (const uint32_t[DLOG_MAX_ARGS + 1]){ DLOG_ARGS(DLOG_NARGS(__VA_ARGS__), ##__VA_ARGS__) })
+
+#define DLOGE(fmt, ...) DLOG(DLOG_LEVEL_ERROR, fmt, ##__VA_ARGS__)
+#define DLOGW(fmt, ...) DLOG(DLOG_LEVEL_WARN, fmt, ##__VA_ARGS__)
+#define DLOGI(fmt, ...) DLOG(DLOG_LEVEL_INFO, fmt, ##__VA_ARGS__)
+
+#endif /* __DLOG_H__ */
@@ -0,0 +1,129 @@
+#include <stdio.h>
+#include <string.h>
+#include <stdbool.h>
+
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+#include "esp_log.h"
+#include "esp_timer.h"
+#include "sdkconfig.h"
+
+#include "dlog.h"
+#include "dlog_drain.h"
+
+#define DLOG_DRAIN_IDLE_MS 20
+#define DLOG_MQTT_BATCH 512
+#define DLOG_MQTT_FLUSH_US 1000000
+
+static const char *DLOG_TAG = "DLOG";
+
+static const char *drain_topic = NULL;
+static esp_mqtt_client_handle_t drain_client = NULL;
+
+
+#if CONFIG_DLOG_SINK_MQTT
+static uint8_t batch[DLOG_MQTT_BATCH];
+static size_t batch_len = 0;
+static int64_t batch_started_us = 0;
+
+
+static void flush_batch(void)
+{
+    if (batch_len > 0 && drain_client != NULL) {
+        // Fire and forget, the debug stream is best effort
+        esp_mqtt_client_publish(drain_client, drain_topic, (const char *)batch, batch_len, 0, false);
+    }
+    batch_len = 0;
+}
+
+
+static void emit(const uint8_t *frame, size_t len)
+{
+    if (batch_len + len > sizeof(batch)) {
+        flush_batch();
+    }
+    if (batch_len == 0) {
+        batch_started_us = esp_timer_get_time();
+    }
+    memcpy(batch + batch_len, frame, len);
+    batch_len += len;
+}
+#else
+static void emit(const uint8_t *frame, size_t len)
+{
+    static const char hex[] = "0123456789abcdef";
+    char line[3 + DLOG_FRAME_MAX * 2 + 2];
+    size_t n = 0;
+    line[n++] = '#';
+    line[n++] = 'D';
+    line[n++] = ' ';
+    for (size_t i = 0; i < len; i++) {
+        line[n++] = hex[frame[i] >> 4];
+        line[n++] = hex[frame[i] & 0xF];
+    }
+    line[n++] = '\n';
+    fwrite(line, 1, n, stdout);
+}
+#endif
+
+
+static void dlog_drain_task(void *pvParameters)
+{
+    dlog_record_t record;
+    uint8_t frame[DLOG_FRAME_MAX];
+    while (true) {
+        while (dlog_read(&record)) {
+            emit(frame, dlog_encode(&record, frame));
+        }
+#if CONFIG_DLOG_SINK_MQTT
+        if (batch_len > 0 && esp_timer_get_time() - batch_started_us >= DLOG_MQTT_FLUSH_US) {
+            flush_batch();
+        }
+#else
+        fflush(stdout);
+#endif
+        vTaskDelay(pdMS_TO_TICKS(DLOG_DRAIN_IDLE_MS));
+    }
+}
+
+
+void dlog_drain_start(const char *debug_topic, UBaseType_t priority, BaseType_t core)
+{
+    drain_topic = debug_topic;
+    dlog_init();
+#if CONFIG_DLOG_SINK_MQTT
+    ESP_LOGI(DLOG_TAG, "Deferred log drained to %s", drain_topic);
+#else
+    ESP_LOGI(DLOG_TAG, "Deferred log drained to the console");
+#endif
+    xTaskCreatePinnedToCore(&dlog_drain_task, "dlog_drain", 2560, NULL, priority, NULL, core);
+}
+
+
+void dlog_drain_set_client(esp_mqtt_client_handle_t client)
+{
+    drain_client = client;
+}
+
+
+void dlog_benchmark(void)
+{
+#if CONFIG_DLOG_BENCHMARK
+    const int calls = 100;
+    float speed = 123.45f;
+
+    int64_t start_us = esp_timer_get_time();
+    for (int i = 0; i < calls; i++) {
+        DLOGI("Lane %u speed of passing car: %0.02f cm/s", (unsigned)i, speed);
+    }
+    int64_t dlog_us = esp_timer_get_time() - start_us;
+
+    start_us = esp_timer_get_time();
+    for (int i = 0; i < calls; i++) {
+        ESP_LOGI(DLOG_TAG, "Lane %u speed of passing car: %0.02f cm/s", (unsigned)i, speed);
+    }
+    int64_t esp_log_us = esp_timer_get_time() - start_us;
+
+    ESP_LOGI(DLOG_TAG, "Per call: DLOGI %lld ns, ESP_LOGI %lld ns", dlog_us * 1000 / calls, esp_log_us * 1000 / calls);
+#endif
+}
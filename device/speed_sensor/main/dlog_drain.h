@@ -0,0 +1,34 @@
+#ifndef __DLOG_DRAIN_H__
+#define __DLOG_DRAIN_H__
+
+#include "freertos/FreeRTOS.h"
+#include "mqtt_client.h"
+
+/*
+ * Low-priority task emptying the dlog ring into the sink chosen in
+ * menuconfig: "#D <hex frame>" lines on the console UART, or batches of
+ * binary frames published QoS0 to /device/<id>/debug. Either way
+ * tools/dlog_decode.py turns them back into text.
+ */
+
+
+/**
+ * @brief Initialise the ring and start the drain task
+ *
+ * @param debug_topic Used by the MQTT sink, must outlive the task
+ */
+void dlog_drain_start(const char *debug_topic, UBaseType_t priority, BaseType_t core);
+
+
+/**
+ * @brief Client for the MQTT sink, records are discarded until it is set and connected
+ */
+void dlog_drain_set_client(esp_mqtt_client_handle_t client);
+
+
+/**
+ * @brief Log the cost of a DLOGI call against the same ESP_LOGI
+ */
+void dlog_benchmark(void);
+
+#endif /* __DLOG_DRAIN_H__ */
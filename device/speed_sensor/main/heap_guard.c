@@ -0,0 +1,187 @@
+#include <inttypes.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+#include "esp_attr.h"
+#include "esp_cpu.h"
+#include "esp_debug_helpers.h"
+#include "esp_heap_caps.h"
+#include "esp_log.h"
+#include "esp_rom_sys.h"
+#include "sdkconfig.h"
+
+#include "heap_guard.h"
+
+#if CONFIG_HEAP_GUARD
+#define HEAP_GUARD_BACKTRACE_DEPTH 8
+
+static const char *HEAP_GUARD_TAG = "HEAP_GUARD";
+
+static TaskHandle_t watched_tasks[HEAP_GUARD_MAX_TASKS];
+static volatile int exempt_depth[HEAP_GUARD_MAX_TASKS];
+static volatile int watched_count = 0;
+static volatile bool armed = false;
+
+// The hook runs on whichever core allocates, the reporter reads on its own
+static portMUX_TYPE counter_mux = portMUX_INITIALIZER_UNLOCKED;
+static uint32_t alloc_count = 0;
+static uint32_t alloc_bytes = 0;
+static uint32_t reported_allocs = 0;
+// Caller of the first allocation since the last check, for addr2line
+static uint32_t first_backtrace[HEAP_GUARD_BACKTRACE_DEPTH];
+static volatile int first_backtrace_len = 0;
+static uint32_t first_size = 0;
+
+
+static int IRAM_ATTR watched_slot(TaskHandle_t task)
+{
+    for (int i = 0; i < watched_count; i++) {
+        if (watched_tasks[i] == task) {
+            return i;
+        }
+    }
+    return -1;
+}
+
+
+#if !CONFIG_HEAP_GUARD_ABORT
+static int IRAM_ATTR take_backtrace(uint32_t *pcs)
+{
+    int len = 0;
+#if CONFIG_IDF_TARGET_ARCH_XTENSA
+    esp_backtrace_frame_t frame;
+    esp_backtrace_get_start(&frame.pc, &frame.sp, &frame.next_pc);
+    // Starts in this hook, the heap component and malloc() come next
+    while (len < HEAP_GUARD_BACKTRACE_DEPTH) {
+        pcs[len++] = esp_cpu_process_stack_pc(frame.pc);
+        if (frame.next_pc == 0 || !esp_backtrace_get_next_frame(&frame)) {
+            break;
+        }
+    }
+#endif
+    return len;
+}
+#endif
+
+
+// Called by the heap component on every allocation (CONFIG_HEAP_USE_HOOKS),
+// on the allocating task, so its stack is the culprit's
+void IRAM_ATTR esp_heap_trace_alloc_hook(void *ptr, size_t size, uint32_t caps)
+{
+    if (!armed) {
+        return;
+    }
+    int slot = watched_slot(xTaskGetCurrentTaskHandle());
+    if (slot < 0 || exempt_depth[slot] != 0) {
+        return;
+    }
+#if CONFIG_HEAP_GUARD_ABORT
+    esp_rom_printf("HEAP_GUARD: steady-state allocation of %u bytes\n", (unsigned)size);
+    abort();
+#else
+    uint32_t pcs[HEAP_GUARD_BACKTRACE_DEPTH];
+    // Unlocked peek, so only the first allocation pays for the walk
+    int len = first_backtrace_len == 0 ? take_backtrace(pcs) : 0;
+    portENTER_CRITICAL_SAFE(&counter_mux);
+    alloc_count++;
+    alloc_bytes += size;
+    if (first_backtrace_len == 0 && len > 0) {
+        memcpy(first_backtrace, pcs, len * sizeof(pcs[0]));
+        first_backtrace_len = len;
+        first_size = size;
+    }
+    portEXIT_CRITICAL_SAFE(&counter_mux);
+#endif
+}
+
+
+void IRAM_ATTR esp_heap_trace_free_hook(void *ptr)
+{
+}
+#endif
+
+
+void heap_guard_watch_current_task(void)
+{
+#if CONFIG_HEAP_GUARD
+    if (watched_count < HEAP_GUARD_MAX_TASKS) {
+        watched_tasks[watched_count] = xTaskGetCurrentTaskHandle();
+        watched_count++;
+    }
+#endif
+}
+
+
+void heap_guard_arm(void)
+{
+#if CONFIG_HEAP_GUARD
+    if (!armed) {
+        ESP_LOGI(HEAP_GUARD_TAG, "Armed for %d tasks, %u bytes free", watched_count,
+                 (unsigned)heap_caps_get_free_size(MALLOC_CAP_8BIT));
+        armed = true;
+    }
+#endif
+}
+
+
+void heap_guard_exempt_begin(void)
+{
+#if CONFIG_HEAP_GUARD
+    int slot = watched_slot(xTaskGetCurrentTaskHandle());
+    if (slot >= 0) {
+        exempt_depth[slot]++;
+    }
+#endif
+}
+
+
+void heap_guard_exempt_end(void)
+{
+#if CONFIG_HEAP_GUARD
+    int slot = watched_slot(xTaskGetCurrentTaskHandle());
+    if (slot >= 0 && exempt_depth[slot] > 0) {
+        exempt_depth[slot]--;
+    }
+#endif
+}
+
+
+void heap_guard_check(heap_guard_stats_t *stats)
+{
+    stats->free_bytes = heap_caps_get_free_size(MALLOC_CAP_8BIT);
+    stats->largest_block = heap_caps_get_largest_free_block(MALLOC_CAP_8BIT);
+    stats->min_free_bytes = heap_caps_get_minimum_free_size(MALLOC_CAP_8BIT);
+#if CONFIG_HEAP_GUARD
+    uint32_t pcs[HEAP_GUARD_BACKTRACE_DEPTH];
+    int len;
+    uint32_t size;
+    taskENTER_CRITICAL(&counter_mux);
+    stats->allocs = alloc_count;
+    stats->bytes = alloc_bytes;
+    len = first_backtrace_len;
+    size = first_size;
+    memcpy(pcs, first_backtrace, sizeof(pcs));
+    first_backtrace_len = 0;
+    taskEXIT_CRITICAL(&counter_mux);
+
+    if (stats->allocs != reported_allocs) {
+        ESP_LOGE(HEAP_GUARD_TAG, "%u steady-state allocations (%u bytes)", (unsigned)stats->allocs, (unsigned)stats->bytes);
+        reported_allocs = stats->allocs;
+    }
+    if (len > 0) {
+        char backtrace[HEAP_GUARD_BACKTRACE_DEPTH * 11 + 1];
+        int pos = 0;
+        for (int i = 0; i < len; i++) {
+            pos += snprintf(backtrace + pos, sizeof(backtrace) - pos, " 0x%08" PRIx32, pcs[i]);
+        }
+        ESP_LOGE(HEAP_GUARD_TAG, "First of them, %u bytes, backtrace:%s", (unsigned)size, backtrace);
+    }
+#else
+    stats->allocs = 0;
+    stats->bytes = 0;
+#endif
+}
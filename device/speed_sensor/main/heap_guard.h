@@ -0,0 +1,54 @@
+#ifndef __HEAP_GUARD_H__
+#define __HEAP_GUARD_H__
+
+#include <stdint.h>
+
+/*
+ * Steady-state allocation check. With CONFIG_HEAP_GUARD the heap hooks count
+ * every allocation made by the watched tasks once the guard is armed, which
+ * should stay at zero: their buffers are all static and sized at compile time.
+ * Without it the functions do nothing.
+ */
+#define HEAP_GUARD_MAX_TASKS 4
+
+typedef struct
+{
+    uint32_t allocs;            //!< Allocations by watched tasks since arming
+    uint32_t bytes;             //!< Bytes requested by those allocations
+    uint32_t free_bytes;        //!< Free 8-bit capable heap
+    uint32_t largest_block;     //!< Largest free block, falls with fragmentation
+    uint32_t min_free_bytes;    //!< Low-water mark since boot
+} heap_guard_stats_t;
+
+
+/**
+ * @brief Watch the calling task
+ */
+void heap_guard_watch_current_task(void);
+
+
+/**
+ * @brief Start counting, once boot-time allocations are done
+ */
+void heap_guard_arm(void);
+
+
+/**
+ * @brief Don't count allocations made by libraries on the calling task's
+ *        behalf until heap_guard_exempt_end(), e.g. the MQTT client's copy of
+ *        an in-flight QoS1 message, which it frees on the ack
+ */
+void heap_guard_exempt_begin(void);
+void heap_guard_exempt_end(void);
+
+
+/**
+ * @brief Current counters, logging any new steady-state allocation with the
+ *        backtrace of the first one since the previous check
+ *
+ * With CONFIG_HEAP_GUARD_ABORT the allocation hook aborts instead, on the
+ * allocating task, so the panic backtrace shows the caller.
+ */
+void heap_guard_check(heap_guard_stats_t *stats);
+
+#endif /* __HEAP_GUARD_H__ */
@@ -0,0 +1,446 @@
+#include <stddef.h>
+#include <string.h>
+
+#include "history_ring.h"
+
+// How far from now a time bound may be, so ring times compare without wrapping
+#define HISTORY_BOUND_LIMIT_MS (1 << 30)
+
+_Static_assert(sizeof(history_block_t) == HISTORY_BLOCK_BYTES, "history_block_t must fill HISTORY_BLOCK_BYTES");
+
+
+static inline bool before(uint32_t a_ms, uint32_t b_ms)
+{
+    return (int32_t)(a_ms - b_ms) < 0;
+}
+
+
+static size_t put_varint(uint8_t *p, uint32_t value)
+{
+    size_t n = 0;
+    while (value >= 0x80) {
+        p[n++] = (value & 0x7F) | 0x80;
+        value >>= 7;
+    }
+    p[n++] = value;
+    return n;
+}
+
+
+static bool get_varint(history_codec_t *codec, uint32_t *value)
+{
+    uint32_t result = 0;
+    for (int shift = 0; shift < 35; shift += 7) {
+        if (codec->used >= codec->capacity) {
+            return false;
+        }
+        uint8_t byte = codec->buf[codec->used++];
+        result |= (uint32_t)(byte & 0x7F) << shift;
+        if (!(byte & 0x80)) {
+            *value = result;
+            return true;
+        }
+    }
+    return false;
+}
+
+
+static void put_u16(uint8_t *p, uint16_t value)
+{
+    p[0] = value;
+    p[1] = value >> 8;
+}
+
+
+static void put_u32(uint8_t *p, uint32_t value)
+{
+    put_u16(p, value);
+    put_u16(p + 2, value >> 16);
+}
+
+
+static uint16_t get_u16(const uint8_t *p)
+{
+    return p[0] | (p[1] << 8);
+}
+
+
+static uint32_t get_u32(const uint8_t *p)
+{
+    return get_u16(p) | ((uint32_t)get_u16(p + 2) << 16);
+}
+
+
+void history_codec_init(history_codec_t *codec, uint8_t *buf, size_t capacity, uint32_t base_ms)
+{
+    memset(codec, 0, sizeof(*codec));
+    codec->buf = buf;
+    codec->capacity = capacity;
+    codec->last_ms = base_ms;
+}
+
+
+bool history_encode(history_codec_t *codec, const history_record_t *record)
+{
+    if (record->kind < HISTORY_VEHICLE || record->kind > HISTORY_FAULT || record->index >= HISTORY_MAX_SENSORS) {
+        return false;
+    }
+    uint8_t encoded[HISTORY_RECORD_MAX];
+    size_t n = 0;
+    encoded[n++] = record->kind | (record->deployed ? 0x04 : 0) | (record->index << 4);
+    n += put_varint(encoded + n, record->time_ms - codec->last_ms);
+    if (record->kind == HISTORY_VEHICLE) {
+        n += put_varint(encoded + n, record->value);
+    } else if (record->kind == HISTORY_TRACE) {
+        int32_t delta = (int32_t)(uint16_t)record->value - codec->last_mm[record->index];
+        n += put_varint(encoded + n, ((uint32_t)delta << 1) ^ (uint32_t)(delta >> 31));
+    }
+    if (codec->used + n > codec->capacity) {
+        return false;
+    }
+
+    memcpy(codec->buf + codec->used, encoded, n);
+    codec->used += n;
+    codec->count++;
+    codec->last_ms = record->time_ms;
+    if (record->kind == HISTORY_TRACE) {
+        codec->last_mm[record->index] = record->value;
+    }
+    return true;
+}
+
+
+bool history_decode(history_codec_t *codec, history_record_t *record)
+{
+    if (codec->used >= codec->capacity) {
+        return false;
+    }
+    uint8_t tag = codec->buf[codec->used++];
+    uint32_t dt_ms;
+    record->kind = tag & 0x03;
+    record->deployed = tag & 0x04;
+    record->index = tag >> 4;
+    record->value = 0;
+    if (record->kind == 0 || !get_varint(codec, &dt_ms)) {
+        return false;
+    }
+    record->time_ms = codec->last_ms + dt_ms;
+    if (record->kind == HISTORY_VEHICLE) {
+        if (!get_varint(codec, &record->value)) {
+            return false;
+        }
+    } else if (record->kind == HISTORY_TRACE) {
+        uint32_t zigzag;
+        if (!get_varint(codec, &zigzag)) {
+            return false;
+        }
+        record->value = (uint16_t)(codec->last_mm[record->index] + (int32_t)((zigzag >> 1) ^ -(zigzag & 1)));
+        codec->last_mm[record->index] = record->value;
+    }
+    codec->last_ms = record->time_ms;
+    codec->count++;
+    return true;
+}
+
+
+void history_ring_init(history_ring_t *ring, history_block_t *storage, size_t block_count,
+                       uint16_t deadband_mm, uint32_t keepalive_ms)
+{
+    memset(ring, 0, sizeof(*ring));
+    ring->blocks = storage;
+    ring->block_count = block_count;
+    ring->next_seq = 1;
+    ring->deadband_mm = deadband_mm;
+    ring->keepalive_ms = keepalive_ms;
+}
+
+
+static history_block_t *newest_block(history_ring_t *ring)
+{
+    return &ring->blocks[(ring->oldest + ring->filled - 1) % ring->block_count];
+}
+
+
+static void append(history_ring_t *ring, const history_record_t *record)
+{
+    if (ring->block_count == 0) {
+        return;
+    }
+    if (ring->filled == 0 || !history_encode(&ring->writer, record)) {
+        // Start a block, over the oldest one once the ring is full
+        if (ring->filled == ring->block_count) {
+            ring->evicted += ring->blocks[ring->oldest].count;
+            ring->oldest = (ring->oldest + 1) % ring->block_count;
+            ring->filled--;
+        }
+        ring->filled++;
+        history_block_t *block = newest_block(ring);
+        block->first_seq = ring->next_seq;
+        block->first_ms = record->time_ms;
+        history_codec_init(&ring->writer, block->data, sizeof(block->data), record->time_ms);
+        if (!history_encode(&ring->writer, record)) {
+            ring->filled--;
+            return;
+        }
+    }
+    history_block_t *block = newest_block(ring);
+    block->count = ring->writer.count;
+    block->used = ring->writer.used;
+    block->last_ms = record->time_ms;
+    ring->next_seq++;
+}
+
+
+void history_ring_vehicle(history_ring_t *ring, uint32_t time_ms, uint8_t lane, uint32_t speed_cm_s, bool deployed)
+{
+    history_record_t record = {
+        .kind = HISTORY_VEHICLE,
+        .index = lane,
+        .deployed = deployed,
+        .time_ms = time_ms,
+        .value = speed_cm_s,
+    };
+    append(ring, &record);
+}
+
+
+static bool keepalive_due(const history_ring_t *ring, const history_sensor_t *sensor, uint32_t time_ms)
+{
+    return ring->keepalive_ms > 0 && time_ms - sensor->ms >= ring->keepalive_ms;
+}
+
+
+bool history_ring_trace(history_ring_t *ring, uint32_t time_ms, uint8_t sensor, uint32_t distance_mm)
+{
+    if (sensor >= HISTORY_MAX_SENSORS) {
+        return false;
+    }
+    history_sensor_t *state = &ring->sensors[sensor];
+    uint16_t mm = distance_mm > UINT16_MAX ? UINT16_MAX : distance_mm;
+    uint16_t change = mm > state->mm ? mm - state->mm : state->mm - mm;
+    // Against the last stored sample, so a slow drift still shows
+    if (state->stored && !state->faulty && change < ring->deadband_mm && !keepalive_due(ring, state, time_ms)) {
+        ring->thinned++;
+        return false;
+    }
+
+    history_record_t record = { .kind = HISTORY_TRACE, .index = sensor, .time_ms = time_ms, .value = mm };
+    append(ring, &record);
+    state->mm = mm;
+    state->ms = time_ms;
+    state->stored = true;
+    state->faulty = false;
+    return true;
+}
+
+
+bool history_ring_fault(history_ring_t *ring, uint32_t time_ms, uint8_t sensor)
+{
+    if (sensor >= HISTORY_MAX_SENSORS) {
+        return false;
+    }
+    history_sensor_t *state = &ring->sensors[sensor];
+    if (state->stored && state->faulty && !keepalive_due(ring, state, time_ms)) {
+        ring->thinned++;
+        return false;
+    }
+
+    history_record_t record = { .kind = HISTORY_FAULT, .index = sensor, .time_ms = time_ms };
+    append(ring, &record);
+    state->ms = time_ms;
+    state->stored = true;
+    state->faulty = true;
+    return true;
+}
+
+
+bool history_ring_copy(const history_ring_t *ring, uint32_t seq, history_block_t *block)
+{
+    // Blocks hold consecutive sequence numbers oldest first, find the first
+    // one ending after seq
+    uint32_t lo = 0;
+    uint32_t hi = ring->filled;
+    while (lo < hi) {
+        uint32_t mid = (lo + hi) / 2;
+        const history_block_t *candidate = &ring->blocks[(ring->oldest + mid) % ring->block_count];
+        if ((int32_t)(candidate->first_seq + candidate->count - seq) <= 0) {
+            lo = mid + 1;
+        } else {
+            hi = mid;
+        }
+    }
+    if (lo == ring->filled) {
+        return false;
+    }
+    // Only the bytes in use, this runs with the writer held off
+    const history_block_t *found = &ring->blocks[(ring->oldest + lo) % ring->block_count];
+    memcpy(block, found, offsetof(history_block_t, data) + found->used);
+    return true;
+}
+
+
+bool history_request_decode(const uint8_t *data, size_t len, history_request_t *request)
+{
+    if (len < HISTORY_REQUEST_SIZE || data[0] != 'W' || data[1] != 'H' || data[2] != HISTORY_REQUEST_FORMAT) {
+        return false;
+    }
+    request->kinds = data[3];
+    request->request_id = get_u16(data + 4);
+    request->max_chunks = get_u16(data + 6);
+    request->cursor = get_u32(data + 8);
+    request->from_ms = (int64_t)((uint64_t)get_u32(data + 12) | (uint64_t)get_u32(data + 16) << 32);
+    request->to_ms = (int64_t)((uint64_t)get_u32(data + 20) | (uint64_t)get_u32(data + 24) << 32);
+    return true;
+}
+
+
+static uint32_t to_ring_ms(const history_pager_t *pager, int64_t out_ms)
+{
+    int64_t ago_ms = pager->now_out_ms - out_ms;
+    if (ago_ms > HISTORY_BOUND_LIMIT_MS) {
+        ago_ms = HISTORY_BOUND_LIMIT_MS;
+    } else if (ago_ms < -HISTORY_BOUND_LIMIT_MS) {
+        ago_ms = -HISTORY_BOUND_LIMIT_MS;
+    }
+    return pager->now_ms - (uint32_t)(int32_t)ago_ms;
+}
+
+
+static int64_t from_ring_ms(const history_pager_t *pager, uint32_t ring_ms)
+{
+    return pager->now_out_ms - (int32_t)(pager->now_ms - ring_ms);
+}
+
+
+void history_pager_init(history_pager_t *pager, const history_request_t *request, uint16_t default_chunks,
+                        uint32_t now_ms, int64_t now_out_ms, bool boot_time)
+{
+    memset(pager, 0, sizeof(*pager));
+    pager->request = *request;
+    if (pager->request.kinds == 0) {
+        pager->request.kinds = HISTORY_ALL_KINDS;
+    }
+    if (pager->request.max_chunks == 0) {
+        pager->request.max_chunks = default_chunks;
+    }
+    pager->now_ms = now_ms;
+    pager->now_out_ms = now_out_ms;
+    pager->flags = boot_time ? HISTORY_CHUNK_BOOT_TIME : 0;
+    pager->has_from = !boot_time && request->from_ms != 0;
+    pager->has_to = !boot_time && request->to_ms != 0;
+    pager->from_ms = to_ring_ms(pager, request->from_ms);
+    pager->to_ms = to_ring_ms(pager, request->to_ms);
+    pager->cursor = request->cursor;
+}
+
+
+// Next record matching the request, false once there are none
+static bool next_record(history_pager_t *pager, history_copy_fn copy, void *ctx, history_record_t *record, uint32_t *seq)
+{
+    while (true) {
+        if (!pager->have_block || pager->block_seq == pager->block.first_seq + pager->block.count) {
+            pager->have_block = false;
+            if (!copy(ctx, pager->cursor, &pager->block)) {
+                return false;
+            }
+            if (pager->cursor == 0) {
+                pager->cursor = pager->block.first_seq;
+            } else if ((int32_t)(pager->block.first_seq - pager->cursor) > 0) {
+                pager->flags |= HISTORY_CHUNK_GAP;
+                pager->cursor = pager->block.first_seq;
+            }
+            if (pager->has_to && !before(pager->block.first_ms, pager->to_ms)) {
+                return false;
+            }
+            if (pager->has_from && before(pager->block.last_ms, pager->from_ms)) {
+                pager->cursor = pager->block.first_seq + pager->block.count;
+                continue;
+            }
+            history_codec_init(&pager->reader, pager->block.data, pager->block.used, pager->block.first_ms);
+            pager->block_seq = pager->block.first_seq;
+            pager->have_block = true;
+        }
+
+        if (!history_decode(&pager->reader, record)) {
+            // Cannot happen with the writer held off, move on rather than spin
+            pager->cursor = pager->block.first_seq + pager->block.count;
+            pager->have_block = false;
+            continue;
+        }
+        uint32_t record_seq = pager->block_seq++;
+        if ((int32_t)(record_seq - pager->cursor) < 0) {
+            continue;
+        }
+        if (pager->has_to && !before(record->time_ms, pager->to_ms)) {
+            pager->cursor = record_seq;
+            return false;
+        }
+        pager->cursor = record_seq + 1;
+        if (pager->has_from && before(record->time_ms, pager->from_ms)) {
+            continue;
+        }
+        if (pager->request.kinds & HISTORY_KIND_BIT(record->kind)) {
+            *seq = record_seq;
+            return true;
+        }
+    }
+}
+
+
+size_t history_pager_next(history_pager_t *pager, history_copy_fn copy, void *ctx, uint8_t *buf, size_t capacity)
+{
+    if (pager->done || capacity < HISTORY_CHUNK_HEADER + HISTORY_RECORD_MAX) {
+        return 0;
+    }
+
+    history_codec_t codec;
+    history_codec_init(&codec, buf + HISTORY_CHUNK_HEADER, capacity - HISTORY_CHUNK_HEADER, 0);
+    bool started = false;
+    bool end = false;
+    uint32_t base_ms = 0;
+    while (true) {
+        history_record_t record;
+        uint32_t seq;
+        if (pager->have_pending) {
+            record = pager->pending;
+            seq = pager->pending_seq;
+            pager->have_pending = false;
+        } else if (!next_record(pager, copy, ctx, &record, &seq)) {
+            end = true;
+            break;
+        }
+        if (!started) {
+            // Each chunk decodes on its own, from its first record
+            base_ms = codec.last_ms = record.time_ms;
+            started = true;
+        }
+        if (!history_encode(&codec, &record)) {
+            pager->pending = record;
+            pager->pending_seq = seq;
+            pager->have_pending = true;
+            break;
+        }
+    }
+
+    uint8_t flags = pager->flags;
+    if (end) {
+        flags |= HISTORY_CHUNK_LAST | HISTORY_CHUNK_END;
+    } else if (pager->chunk + 1 >= pager->request.max_chunks) {
+        flags |= HISTORY_CHUNK_LAST;
+    }
+    pager->done = flags & HISTORY_CHUNK_LAST;
+    int64_t out_base_ms = started ? from_ring_ms(pager, base_ms) : pager->now_out_ms;
+
+    buf[0] = 'W';
+    buf[1] = 'R';
+    buf[2] = HISTORY_REQUEST_FORMAT;
+    buf[3] = flags;
+    put_u16(buf + 4, pager->request.request_id);
+    put_u16(buf + 6, pager->chunk++);
+    put_u16(buf + 8, codec.count);
+    put_u16(buf + 10, 0);
+    put_u32(buf + 12, pager->have_pending ? pager->pending_seq : pager->cursor);
+    put_u32(buf + 16, (uint32_t)out_base_ms);
+    put_u32(buf + 20, (uint32_t)((uint64_t)out_base_ms >> 32));
+    return HISTORY_CHUNK_HEADER + codec.used;
+}
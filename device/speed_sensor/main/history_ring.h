@@ -0,0 +1,248 @@
+#ifndef __HISTORY_RING_H__
+#define __HISTORY_RING_H__
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+/*
+ * Recent history of the sensor: every vehicle, raw distance traces and
+ * sensor faults, kept in a fixed ring of blocks and served page by page on
+ * request (see recent_history.h).
+ *
+ * Records are delta encoded against the previous one in their block: a tag
+ * byte, the ms since the previous record as a varint, then a varint speed
+ * for a vehicle, or for a trace the zigzag varint change from the sensor's
+ * previous distance. A vehicle takes 3 to 5 bytes, a trace sample 2 to 5.
+ * Traces are thinned as they are written: a sample is only kept once it
+ * moves by the deadband or the keepalive has passed, so an empty road costs
+ * one sample per sensor and keepalive. When the ring is full the oldest
+ * block is dropped as a whole.
+ *
+ * Records carry a sequence number, consecutive from 1, which is the paging
+ * cursor. Times are ms since boot modulo 2^32 and are compared wrap-safely.
+ *
+ * Single writer, no locking: a reader on another task must hold off the
+ * writer around history_ring_copy(). Plain C with no ESP-IDF dependencies
+ * so it can be exercised on a host.
+ */
+#define HISTORY_BLOCK_BYTES 256
+#define HISTORY_MAX_SENSORS 16  // 4 bits of the tag byte
+#define HISTORY_RECORD_MAX  11  // Tag, dt and value varints
+
+typedef enum
+{
+    HISTORY_VEHICLE = 1,    //!< lane, value speed in cm/s, deployed
+    HISTORY_TRACE = 2,      //!< sensor, value raw distance in mm
+    HISTORY_FAULT = 3,      //!< sensor failed to measure
+} history_kind_t;
+
+#define HISTORY_KIND_BIT(kind) (1u << (kind))
+#define HISTORY_ALL_KINDS (HISTORY_KIND_BIT(HISTORY_VEHICLE) | HISTORY_KIND_BIT(HISTORY_TRACE) | HISTORY_KIND_BIT(HISTORY_FAULT))
+
+typedef struct
+{
+    uint8_t kind;
+    uint8_t index;          //!< Lane for a vehicle, sensor otherwise
+    bool deployed;          //!< The speed bump was raised for this vehicle
+    uint32_t time_ms;
+    uint32_t value;
+} history_record_t;
+
+/*
+ * Delta encoder/decoder state over one buffer: a ring block, or a response
+ * chunk, which starts over from its own base.
+ */
+typedef struct
+{
+    uint8_t *buf;
+    size_t capacity;        //!< Bytes available, or encoded bytes when decoding
+    size_t used;
+    uint16_t count;
+    uint32_t last_ms;
+    uint16_t last_mm[HISTORY_MAX_SENSORS];
+} history_codec_t;
+
+typedef struct
+{
+    uint32_t first_seq;
+    uint32_t first_ms;
+    uint32_t last_ms;
+    uint16_t count;
+    uint16_t used;
+    uint8_t data[HISTORY_BLOCK_BYTES - 16];
+} history_block_t;
+
+typedef struct
+{
+    uint16_t mm;
+    uint32_t ms;
+    bool stored;
+    bool faulty;
+} history_sensor_t;
+
+typedef struct
+{
+    history_block_t *blocks;
+    uint32_t block_count;
+    uint32_t oldest;        //!< Index of the oldest block
+    uint32_t filled;        //!< Blocks in use, the newest is being written
+    uint32_t next_seq;
+    history_codec_t writer; //!< Over the newest block
+    uint16_t deadband_mm;
+    uint32_t keepalive_ms;
+    history_sensor_t sensors[HISTORY_MAX_SENSORS];
+    uint32_t thinned;       //!< Trace samples not stored
+    uint32_t evicted;       //!< Records dropped with their block
+} history_ring_t;
+
+
+void history_codec_init(history_codec_t *codec, uint8_t *buf, size_t capacity, uint32_t base_ms);
+
+
+/**
+ * @brief Append a record, in time order
+ *
+ * @return false if it does not fit, the codec is left unchanged
+ */
+bool history_encode(history_codec_t *codec, const history_record_t *record);
+
+
+/**
+ * @return false once every encoded byte has been read, or on a corrupt record
+ */
+bool history_decode(history_codec_t *codec, history_record_t *record);
+
+
+/**
+ * @param storage Blocks for the ring, all of it is used
+ * @param keepalive_ms Longest gap between stored samples of a sensor, 0 for none
+ */
+void history_ring_init(history_ring_t *ring, history_block_t *storage, size_t block_count,
+                       uint16_t deadband_mm, uint32_t keepalive_ms);
+
+
+void history_ring_vehicle(history_ring_t *ring, uint32_t time_ms, uint8_t lane, uint32_t speed_cm_s, bool deployed);
+
+
+/**
+ * @return true if the sample was stored, false if the deadband thinned it out
+ */
+bool history_ring_trace(history_ring_t *ring, uint32_t time_ms, uint8_t sensor, uint32_t distance_mm);
+
+
+/**
+ * @brief Record a failed measurement, repeats are thinned like a steady trace
+ */
+bool history_ring_fault(history_ring_t *ring, uint32_t time_ms, uint8_t sensor);
+
+
+/**
+ * @brief Copy out the oldest block holding records from seq on
+ *
+ * The copy may start after seq if those records have been evicted.
+ *
+ * @return false if there are no records from seq on
+ */
+bool history_ring_copy(const history_ring_t *ring, uint32_t seq, history_block_t *block);
+
+
+/*
+ * Wire format of a request (little endian, 28 bytes):
+ *
+ *   0  'W' 'H'      magic
+ *   2  u8  format   HISTORY_REQUEST_FORMAT
+ *   3  u8  kinds    HISTORY_KIND_BIT() mask, 0 for all
+ *   4  u16 request_id, echoed in every chunk of the response
+ *   6  u16 max_chunks  chunks in this page, 0 for the device default
+ *   8  u32 cursor   first sequence number, 0 for the oldest record
+ *  12  i64 from_ms  epoch ms, 0 for no lower bound
+ *  20  i64 to_ms    epoch ms, exclusive, 0 for no upper bound
+ *
+ * Each response chunk (little endian, 24 byte header, then records encoded
+ * as in the ring from base_ms on):
+ *
+ *   0  'W' 'R'      magic
+ *   2  u8  format   HISTORY_REQUEST_FORMAT
+ *   3  u8  flags    HISTORY_CHUNK_*
+ *   4  u16 request_id
+ *   6  u16 chunk    index within the page
+ *   8  u16 records
+ *  10  u16 reserved 0
+ *  12  u32 next_cursor  cursor to ask for the next page with
+ *  16  i64 base_ms  epoch ms, or ms since boot with HISTORY_CHUNK_BOOT_TIME
+ */
+#define HISTORY_REQUEST_FORMAT 1
+#define HISTORY_REQUEST_SIZE   28
+#define HISTORY_CHUNK_HEADER   24
+
+#define HISTORY_CHUNK_LAST      0x01 //!< Last chunk of the page
+#define HISTORY_CHUNK_END       0x02 //!< Nothing more matches, no need for another page
+#define HISTORY_CHUNK_GAP       0x04 //!< Records from the cursor on were evicted before being read
+#define HISTORY_CHUNK_BOOT_TIME 0x08 //!< Clock not synced, times are since boot and bounds are ignored
+
+typedef struct
+{
+    uint8_t kinds;
+    uint16_t request_id;
+    uint16_t max_chunks;
+    uint32_t cursor;
+    int64_t from_ms;
+    int64_t to_ms;
+} history_request_t;
+
+
+/**
+ * @return false if the payload is not a request in a known format
+ */
+bool history_request_decode(const uint8_t *data, size_t len, history_request_t *request);
+
+
+typedef bool (*history_copy_fn)(void *ctx, uint32_t seq, history_block_t *block);
+
+/*
+ * Walks the ring for one page of a request, a chunk at a time. Blocks are
+ * copied out through copy, which does the locking, and blocks entirely
+ * outside the time range are skipped without decoding.
+ */
+typedef struct
+{
+    history_request_t request;
+    uint8_t flags;          //!< Sticky HISTORY_CHUNK_GAP and HISTORY_CHUNK_BOOT_TIME
+    bool has_from;
+    bool has_to;
+    uint32_t from_ms;       //!< Bounds in ring time
+    uint32_t to_ms;
+    uint32_t now_ms;        //!< Ring time of now_out_ms, to convert record times
+    int64_t now_out_ms;
+    uint32_t cursor;        //!< Next record to look at
+    uint16_t chunk;
+    bool done;
+    bool have_block;
+    uint32_t block_seq;     //!< Sequence number of the next record in reader
+    history_block_t block;
+    history_codec_t reader;
+    bool have_pending;      //!< Matched, but did not fit the previous chunk
+    uint32_t pending_seq;
+    history_record_t pending;
+} history_pager_t;
+
+
+/**
+ * @param now_ms Ring time now
+ * @param now_out_ms The same instant in response time: epoch ms, or ms since
+ *                   boot when boot_time, in which case the bounds are ignored
+ */
+void history_pager_init(history_pager_t *pager, const history_request_t *request, uint16_t default_chunks,
+                        uint32_t now_ms, int64_t now_out_ms, bool boot_time);
+
+
+/**
+ * @brief Fill the next chunk of the page into buf
+ *
+ * @param capacity At least HISTORY_CHUNK_HEADER + HISTORY_RECORD_MAX
+ * @return Chunk length, 0 once the page is complete
+ */
+size_t history_pager_next(history_pager_t *pager, history_copy_fn copy, void *ctx, uint8_t *buf, size_t capacity);
+
+#endif /* __HISTORY_RING_H__ */
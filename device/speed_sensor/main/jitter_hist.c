@@ -0,0 +1,72 @@
+#include <string.h>
+
+#include "jitter_hist.h"
+
+
+void jitter_hist_init(jitter_hist_t *hist)
+{
+    memset(hist, 0, sizeof(*hist));
+}
+
+
+static unsigned bucket_of(uint32_t deviation_us)
+{
+    unsigned bucket = 0;
+    uint32_t bound = JITTER_HIST_BASE_US;
+    while (bucket < JITTER_HIST_BUCKETS - 1 && deviation_us >= bound) {
+        bound <<= 1;
+        bucket++;
+    }
+    return bucket;
+}
+
+
+void jitter_hist_record(jitter_hist_t *hist, int64_t start_us, uint32_t period_us)
+{
+    if (hist->last_start_us != 0) {
+        int64_t deviation = start_us - hist->last_start_us - period_us;
+        if (deviation < 0) {
+            deviation = -deviation;
+        }
+        hist->counts[bucket_of(deviation > UINT32_MAX ? UINT32_MAX : (uint32_t)deviation)]++;
+        hist->samples++;
+    }
+    hist->last_start_us = start_us;
+}
+
+
+void jitter_hist_delta(const jitter_hist_t *now, const jitter_hist_t *before, jitter_hist_t *out)
+{
+    for (unsigned i = 0; i < JITTER_HIST_BUCKETS; i++) {
+        out->counts[i] = now->counts[i] - before->counts[i];
+    }
+    out->samples = now->samples - before->samples;
+    out->last_start_us = now->last_start_us;
+}
+
+
+void jitter_hist_add(jitter_hist_t *total, const jitter_hist_t *other)
+{
+    for (unsigned i = 0; i < JITTER_HIST_BUCKETS; i++) {
+        total->counts[i] += other->counts[i];
+    }
+    total->samples += other->samples;
+}
+
+
+uint32_t jitter_hist_percentile_us(const jitter_hist_t *hist, unsigned percent)
+{
+    if (hist->samples == 0) {
+        return 0;
+    }
+    // Smallest bucket covering at least percent of the samples
+    uint64_t needed = ((uint64_t)hist->samples * percent + 99) / 100;
+    uint64_t seen = 0;
+    for (unsigned i = 0; i < JITTER_HIST_BUCKETS - 1; i++) {
+        seen += hist->counts[i];
+        if (seen >= needed) {
+            return JITTER_HIST_BASE_US << i;
+        }
+    }
+    return JITTER_HIST_BASE_US << (JITTER_HIST_BUCKETS - 2);
+}
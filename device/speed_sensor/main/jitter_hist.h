@@ -0,0 +1,57 @@
+#ifndef __JITTER_HIST_H__
+#define __JITTER_HIST_H__
+
+#include <stdint.h>
+
+/*
+ * Histogram of how far each measurement cycle started from where the poll
+ * period said it should, in power-of-two buckets: bucket 0 holds deviations
+ * under JITTER_HIST_BASE_US, bucket k those under JITTER_HIST_BASE_US << k,
+ * and the last bucket everything beyond.
+ *
+ * Counts only ever grow, so the reporter takes per-window figures as the
+ * difference of two snapshots. Plain C with no ESP-IDF dependencies.
+ */
+#define JITTER_HIST_BUCKETS 12
+#define JITTER_HIST_BASE_US 32
+
+typedef struct
+{
+    uint32_t counts[JITTER_HIST_BUCKETS];
+    uint32_t samples;
+    int64_t last_start_us;      //!< Previous cycle start, 0 before the first
+} jitter_hist_t;
+
+
+/**
+ * @brief Clear the histogram
+ */
+void jitter_hist_init(jitter_hist_t *hist);
+
+
+/**
+ * @brief Record the start of a cycle that should follow the previous one by period_us
+ */
+void jitter_hist_record(jitter_hist_t *hist, int64_t start_us, uint32_t period_us);
+
+
+/**
+ * @brief Counts added between two snapshots of the same histogram
+ */
+void jitter_hist_delta(const jitter_hist_t *now, const jitter_hist_t *before, jitter_hist_t *out);
+
+
+/**
+ * @brief Accumulate the counts of another histogram into total
+ */
+void jitter_hist_add(jitter_hist_t *total, const jitter_hist_t *other);
+
+
+/**
+ * @brief Upper bound of the bucket holding the given percentile, 0 if empty
+ *
+ * The open last bucket reports its lower bound.
+ */
+uint32_t jitter_hist_percentile_us(const jitter_hist_t *hist, unsigned percent);
+
+#endif /* __JITTER_HIST_H__ */
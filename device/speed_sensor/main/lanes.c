@@ -0,0 +1,25 @@
+#include "lanes.h"
+
+const lane_config_t lane_configs[] = {
+    // Lane 0
+    {
+        .entry = { .trigger_pin = 5, .echo_pin = 18 },
+        .exit = { .trigger_pin = 19, .echo_pin = 21 },
+    },
+    // Further lanes or the opposite direction, e.g.
+    // {
+    //     .entry = { .trigger_pin = 22, .echo_pin = 23 },
+    //     .exit = { .trigger_pin = 25, .echo_pin = 26 },
+    // },
+};
+
+const size_t lane_count = sizeof(lane_configs) / sizeof(lane_configs[0]);
+
+_Static_assert(sizeof(lane_configs) / sizeof(lane_configs[0]) <= MAX_LANES, "Too many lanes");
+
+const uint32_t lane_sensor_conflicts[MAX_LANES * 2] = {
+    // With a second lane mounted alongside lane 0, e.g. entries hear each other:
+    // [LANE_SENSOR_ENTRY(0)] = 1u << LANE_SENSOR_ENTRY(1),
+    // [LANE_SENSOR_EXIT(0)] = 1u << LANE_SENSOR_EXIT(1),
+    0
+};
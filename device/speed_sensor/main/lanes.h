@@ -0,0 +1,42 @@
+#ifndef __LANES_H__
+#define __LANES_H__
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include "ultrasonic.h"
+
+#define MAX_LANES 8
+
+// Echo timeout past the policy's max_distance_cm, beyond which a ping counts
+// as "nothing there". Keeps an empty road's reading clear of the trigger
+// distance by more than the range filter's gate
+#define LANE_ECHO_MARGIN_CM 30
+// Quiet time after each firing slot for stray echoes to die down
+#define LANE_PING_GUARD_US 2000
+
+/*
+ * A lane is a pair of rangefinders a vehicle passes one after the other.
+ * Sensors are numbered lane * 2 for the entry and lane * 2 + 1 for the exit
+ * sensor of each lane.
+ */
+typedef struct
+{
+    ultrasonic_sensor_t entry;
+    ultrasonic_sensor_t exit;
+} lane_config_t;
+
+extern const lane_config_t lane_configs[];
+extern const size_t lane_count;
+
+/*
+ * Per sensor, bitmask of the other sensors whose pings it can hear. The two
+ * sensors of a lane always conflict and need not be listed.
+ */
+extern const uint32_t lane_sensor_conflicts[];
+
+#define LANE_SENSOR_ENTRY(lane) ((lane) * 2)
+#define LANE_SENSOR_EXIT(lane)  ((lane) * 2 + 1)
+#define LANE_OF_SENSOR(sensor)  ((sensor) / 2)
+
+#endif /* __LANES_H__ */
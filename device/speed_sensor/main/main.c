@@ -6,6 +6,7 @@
 
 #include "freertos/FreeRTOS.h"
 #include "freertos/task.h"
+#include "freertos/queue.h"
 #include "esp_system.h"
 #include "esp_wifi.h"
 #include "esp_log.h"
@@ -19,9 +20,6 @@
 
 #include "mqtt_client.h"
 #include "connectivity.h"
-#include "esp_http_client.h"
-#include "esp_https_ota.h"
-#include "esp_crt_bundle.h"
 #include "sdkconfig.h"
 #include "esp_bt.h"
 #include "esp_gap_ble_api.h"
@@ -31,56 +29,244 @@
 #include "esp_bt_defs.h"
 
 #include "esp_timer.h"
+#include "esp_rom_sys.h"
 
 #include <ultrasonic.h>
 #include <esp_err.h>
+#include "policy.h"
+#include "wifi_reconnect.h"
+#include "topic_router.h"
+#include "telemetry.h"
+#include "lanes.h"
+#include "ping_scheduler.h"
+#include "range_filter.h"
+#include "heap_guard.h"
+#include "jitter_hist.h"
+#include "speed_hist.h"
+#include "ota_update.h"
+#include "report_gate.h"
+#include "task_layout.h"
+#include "dlog.h"
+#include "dlog_drain.h"
+#include "recent_history.h"
 
 #define MAX_SAMPLES 100
+#define MAX_PENDING_REPORTS (16 * MAX_LANES) // Windows held back until time is synced
 
-char *device_firmware_version = CONFIG_DEVICE_FIRMWARE_VERSION;
+// Largest jump in echo time the range filter accepts at once, about 20 cm
+#define RANGE_FILTER_GATE_US 1200
 
-char *MQTT_DEVICE_UPGRADE_TOPIC = "/device/upgrade";
-char *MQTT_BUMP_CONTROLLER_TOPIC = "/device/bump";
+char *device_firmware_version = CONFIG_DEVICE_FIRMWARE_VERSION;
+const char *device_id = CONFIG_DEVICE_ID;
+
+// Everything lives under /device/<id>/ so the broker ACL can confine each
+// device to its own subtree and consumers subscribe only to what they need
+char mqtt_upgrade_topic[64];
+char mqtt_bump_topic[64];
+char mqtt_config_topic[64];
+char mqtt_config_ack_topic[64];
+char mqtt_state_topic[64];
+char mqtt_telemetry_topic[64];
+char mqtt_debug_topic[64];
+char mqtt_history_topic[64];
+char mqtt_history_response_topic[64];
 const char *wifi_ssid = CONFIG_WIFI_SSID;
 const char *wifi_pass = CONFIG_WIFI_PASSWORD;
 const char *firmware_url = CONFIG_FIRMWARE_UPGRADE_URL;
-char* firmware_binary = NULL;
+char firmware_binary[64];
 const char *mqtt_broker_uri = CONFIG_MQTT_BROKER_URI;
-const char *mqtt_broker_user = CONFIG_MQTT_BROKER_USER;
 const char *mqtt_broker_pass = CONFIG_MQTT_BROKER_PASSWORD;
 static const char *MQTT_TAG = "MQTT";
-static const char *HTTP_TAG = "HTTP";
 
-#define MAX_DISTANCE_CM 60 // 5m max
-#define SENSOR_DISTANCE_CM 10 // Distance between sensors in cm
+// Global MQTT client handle
+esp_mqtt_client_handle_t mqtt_client = NULL;
 
-#define TRIGGER_GPIO_1 5
-#define ECHO_GPIO_1 18
+// Reporter side, fed from lane_event_queue
+typedef struct {
+    float speed_samples[MAX_SAMPLES];
+    int sample_count;
+    speed_hist_t speeds; // The same samples, bucketed for the report
+    bool sensor_1_up; // Entry sensor
+    bool sensor_2_up; // Exit sensor
+} lane_state_t;
+
+static lane_state_t lane_states[MAX_LANES];
+
+// Measurement side
+static int64_t lane_start_time_us[MAX_LANES]; // When the entry sensor last fired, 0 if it hasn't
+static range_filter_t sensor_filters[MAX_LANES * 2];
+static range_scale_t range_scale;
+static jitter_hist_t cycle_jitter;
+// Lanes with a running timer and when the latest one started, read by the OTA download
+static volatile uint32_t lanes_in_transit = 0;
+static volatile uint32_t transit_started_ms = 0;
+
+// A timer older than this is a missed exit, not a vehicle still passing
+#define TRANSIT_TIMEOUT_MS 3000
+
+typedef enum {
+    LANE_EVENT_SPEED,
+    LANE_EVENT_ENTRY_DOWN,
+    LANE_EVENT_EXIT_DOWN,
+} lane_event_type_t;
+
+typedef struct {
+    uint8_t lane;
+    uint8_t type;
+    float speed;
+} lane_event_t;
+
+typedef enum {
+    ACTUATE_DEPLOY,
+    ACTUATE_RETRACT,
+} actuation_t;
+
+typedef struct {
+    uint8_t command;
+    uint8_t actuator_mask; // Bit i for the controller's i-th actuator, 0 for all
+} actuation_request_t;
+
+// Each lane's speed bump is the actuator with the lane's index
+#define LANE_ACTUATOR_MASK(lane) (1u << (lane))
+#define ALL_ACTUATORS 0
+
+static QueueHandle_t lane_event_queue;
+static QueueHandle_t actuation_queue;
+static QueueHandle_t jitter_queue; // One slot, overwritten every measurement cycle
+static volatile uint32_t lane_events_dropped = 0; // Only written by the measurement task
+
+typedef struct {
+    int64_t window_end_us; // esp_timer time, converted to wall-clock time on publish
+    int lane;
+    uint32_t seq; // Per lane from 1 at boot, a gap means windows were lost on the way
+    float avg_speed;
+    float max_speed;
+    float min_speed;
+    int num_cars;
+    bool sensor_1_up;
+    bool sensor_2_up;
+    // Measurement cycle start jitter since the previous report, shared by all lanes
+    uint32_t jitter_p50_us;
+    uint32_t jitter_p99_us;
+    uint32_t jitter_max_us;
+    uint16_t jitter_counts[JITTER_HIST_BUCKETS];
+    uint8_t speed_counts[SPEED_HIST_BUCKETS];
+    uint8_t speed_buckets; // Up to the last vehicle's bucket
+    bool ota_active; // A firmware download ran during the window
+    uint16_t window_s;
+    uint32_t quiet_windows; // Zero-traffic windows held back right before this one
+} window_report_t;
+
+static window_report_t pending_reports[MAX_PENDING_REPORTS];
+static int pending_head = 0;
+static int pending_count = 0;
+static int dropped_reports = 0;
+static uint32_t report_seq[MAX_LANES];
+
+// Startup metric, -1 until the event has happened
+static int64_t boot_to_first_measurement_ms = -1;
+
+static char report_message[TELEMETRY_MAX_MESSAGE];
+static int64_t last_state_publish_us = 0;
+static jitter_hist_t jitter_window_start;
+static jitter_hist_t jitter_reported; // Reports cover the cycles since the previous one
+static report_gate_t report_gates[MAX_LANES];
+static jitter_hist_t jitter_idle;       // Windows without a download running
+static jitter_hist_t jitter_during_ota; // Windows with one
+
+
+void add_speed_sample(lane_state_t *lane, float speed) {
+    if (lane->sample_count < MAX_SAMPLES) {
+        lane->speed_samples[lane->sample_count++] = speed;
+        speed_hist_record(&lane->speeds, speed);
+    }
+}
 
-#define TRIGGER_GPIO_2 19 // Example GPIO for second sensor
-#define ECHO_GPIO_2 21   // Example GPIO for second sensor
 
-// Global MQTT client handle
-esp_mqtt_client_handle_t mqtt_client = NULL;
+// Never blocks the measurement task, a full queue drops the event
+static void send_lane_event(size_t lane, lane_event_type_t type, float speed)
+{
+    lane_event_t event = { .lane = lane, .type = type, .speed = speed };
+    if (xQueueSend(lane_event_queue, &event, 0) != pdTRUE) {
+        lane_events_dropped++;
+    }
+}
 
-float speed_samples[MAX_SAMPLES];
-int sample_count = 0;
-bool sensor_1_up = true;
-bool sensor_2_up = true;
+
+static void apply_lane_event(const lane_event_t *event)
+{
+    lane_state_t *lane = &lane_states[event->lane];
+    switch (event->type) {
+    case LANE_EVENT_SPEED:
+        add_speed_sample(lane, event->speed);
+        break;
+    case LANE_EVENT_ENTRY_DOWN:
+        lane->sensor_1_up = false;
+        break;
+    case LANE_EVENT_EXIT_DOWN:
+        lane->sensor_2_up = false;
+        break;
+    }
+}
 
 
-void add_speed_sample(float speed) {
-    if (sample_count < MAX_SAMPLES) {
-        speed_samples[sample_count++] = speed;
+static void request_actuation(actuation_t command, uint8_t actuator_mask)
+{
+    actuation_request_t request = { .command = command, .actuator_mask = actuator_mask };
+    if (xQueueSend(actuation_queue, &request, 0) != pdTRUE) {
+        DLOGW("Actuation queue full, dropping command %d", command);
     }
 }
 
 
+// Holds each advertisement for its duration without stalling the caller
+static void actuate_speed_bump_task(void *pvParameters)
+{
+    actuation_request_t request;
+    while (true) {
+        if (xQueueReceive(actuation_queue, &request, portMAX_DELAY) != pdTRUE) {
+            continue;
+        }
+        if (request.command == ACTUATE_DEPLOY) {
+            advertise_deploy_speed_bump(request.actuator_mask);
+        }
+        else {
+            advertise_retract_speed_bump(request.actuator_mask);
+        }
+    }
+}
+
+
+#if CONFIG_MQTT_FLOOD_TEST
+// Network load for jitter comparisons, the broker ACL discards what arrives
+static void mqtt_flood_task(void *pvParameters)
+{
+    static char payload[256];
+    char topic[64];
+    memset(payload, 'x', sizeof(payload));
+    snprintf(topic, sizeof(topic), "/device/%s/flood", device_id);
+    TickType_t period = pdMS_TO_TICKS(1000 / CONFIG_MQTT_FLOOD_RATE);
+    if (period == 0) {
+        period = 1;
+    }
+    while (true) {
+        if (mqtt_client != NULL && (xEventGroupGetBits(connectivity_events) & MQTT_CONNECTED_BIT)) {
+            esp_mqtt_client_publish(mqtt_client, topic, payload, sizeof(payload), 0, false);
+        }
+        vTaskDelay(period);
+    }
+}
+#endif
+
+
 float generate_random_float(float min, float max) {
     return min + ((float)rand() / RAND_MAX) * (max - min);
 }
 
 
+static void mqtt_event_handler(void *handler_args, esp_event_base_t base, int32_t event_id, void *event_data);
+
+
 static void log_error_if_nonzero(const char *message, int error_code)
 {
     if (error_code != 0) {
@@ -97,127 +283,352 @@ static void wifi_event_handler(void *event_handler_arg, esp_event_base_t event_b
 	else if (event_id == WIFI_EVENT_STA_CONNECTED)
 	{
 		printf("WiFi CONNECTED\n");
+		wifi_reconnect_on_connected(event_data);
 	}
 	else if (event_id == WIFI_EVENT_STA_DISCONNECTED)
 	{
 		printf("WiFi lost connection\n");
-		int retry_num = 0;
-
-		if (retry_num < 5)
-		{
-			esp_wifi_connect();
-			retry_num++;
-			printf("Retrying to Connect...\n");
-		}
+		xEventGroupClearBits(connectivity_events, WIFI_CONNECTED_BIT);
+		// Retries forever with jittered exponential backoff
+		wifi_reconnect_on_disconnected(event_data);
 	}
-	else if (event_id == IP_EVENT_STA_GOT_IP)
+	else if (event_base == IP_EVENT && event_id == IP_EVENT_STA_GOT_IP)
 	{
 		printf("Wifi got IP...\n\n");
+		wifi_reconnect_on_got_ip(event_data);
+		xEventGroupSetBits(connectivity_events, WIFI_CONNECTED_BIT);
+
+		// Start MQTT as soon as we have an address, SNTP runs in parallel
+		if (mqtt_client == NULL) {
+			mqtt_client = initialize_mqtt(
+				mqtt_broker_uri,
+				device_id, // Each device is its own broker user, see mosquitto/acl
+				mqtt_broker_pass,
+				device_id,
+				mqtt_event_handler
+			);
+			telemetry_set_client(mqtt_client);
+			dlog_drain_set_client(mqtt_client);
+			recent_history_set_client(mqtt_client);
+		}
 	}
 }
 
 
-esp_err_t http_event_handler(esp_http_client_event_t *evt)
+static void queue_window_report(const window_report_t *report)
 {
-    switch (evt->event_id) {
-    case HTTP_EVENT_ERROR:
-        ESP_LOGD(HTTP_TAG, "HTTP_EVENT_ERROR");
-        break;
-    case HTTP_EVENT_ON_CONNECTED:
-        ESP_LOGD(HTTP_TAG, "HTTP_EVENT_ON_CONNECTED");
-        break;
-    case HTTP_EVENT_HEADER_SENT:
-        ESP_LOGD(HTTP_TAG, "HTTP_EVENT_HEADER_SENT");
-        break;
-    case HTTP_EVENT_ON_HEADER:
-        ESP_LOGD(HTTP_TAG, "HTTP_EVENT_ON_HEADER, key=%s, value=%s", evt->header_key, evt->header_value);
-        break;
-    case HTTP_EVENT_ON_DATA:
-        ESP_LOGD(HTTP_TAG, "HTTP_EVENT_ON_DATA, len=%d", evt->data_len);
-        break;
-    case HTTP_EVENT_ON_FINISH:
-        ESP_LOGD(HTTP_TAG, "HTTP_EVENT_ON_FINISH");
-        break;
-    case HTTP_EVENT_DISCONNECTED:
-        ESP_LOGD(HTTP_TAG, "HTTP_EVENT_DISCONNECTED");
-        break;
-    case HTTP_EVENT_REDIRECT:
-        ESP_LOGD(HTTP_TAG, "HTTP_EVENT_REDIRECT");
-        break;
+    if (pending_count == MAX_PENDING_REPORTS) {
+        // Drop the oldest window rather than block the reporter
+        pending_head = (pending_head + 1) % MAX_PENDING_REPORTS;
+        pending_count--;
+        dropped_reports++;
     }
-    return ESP_OK;
+    window_report_t *queued = &pending_reports[(pending_head + pending_count) % MAX_PENDING_REPORTS];
+    *queued = *report;
+    queued->seq = ++report_seq[report->lane];
+    pending_count++;
 }
 
 
-void upgrade_firmware_task(void *pvParameters) {
-    ESP_LOGI("UPGRADE", "Starting OTA Upgrade task");
+static void publish_pending_reports()
+{
+    // Hold windows until they can be back-filled with wall-clock timestamps, but
+    // not forever: without NTP the ring would only ever drop, and a new image
+    // would never get the acknowledged report it needs to be kept
+    if (!(xEventGroupGetBits(connectivity_events) & TIME_SYNCED_BIT) &&
+        esp_timer_get_time() < (int64_t)CONFIG_TIME_SYNC_WAIT_S * 1000000) {
+        return;
+    }
 
-    char* firmware_complete_url = malloc(150 * sizeof(char));
-    snprintf(firmware_complete_url, 100, "%s/%s", firmware_url, firmware_binary);
+    while (pending_count > 0) {
+        window_report_t *report = &pending_reports[pending_head];
+        int64_t timestamp_ms;
+        char time_fields[64];
+        if (monotonic_to_epoch_ms(report->window_end_us, &timestamp_ms)) {
+            snprintf(time_fields, sizeof(time_fields), "\"ts\": %lld", timestamp_ms);
+        }
+        else {
+            // The ingester places the window at its arrival minus the age
+            snprintf(time_fields, sizeof(time_fields), "\"time_synced\": false, \"age_ms\": %lld",
+                     (esp_timer_get_time() - report->window_end_us) / 1000);
+        }
 
-    esp_http_client_config_t config = {
-        .url = firmware_complete_url,
-        .crt_bundle_attach = esp_crt_bundle_attach,
-        .event_handler = http_event_handler,
-        .keep_alive_enable = true,
-    };
-    config.skip_cert_common_name_check = true;
+        wifi_reconnect_stats_t wifi_stats;
+        wifi_reconnect_get_stats(&wifi_stats);
+        telemetry_stats_t outbox_stats;
+        telemetry_get_stats(&outbox_stats);
+        heap_guard_stats_t heap_stats;
+        heap_guard_check(&heap_stats);
+
+        char jitter_counts[JITTER_HIST_BUCKETS * 6];
+        int jitter_len = 0;
+        for (int i = 0; i < JITTER_HIST_BUCKETS; i++) {
+            jitter_len += snprintf(jitter_counts + jitter_len, sizeof(jitter_counts) - jitter_len, "%s%u", i ? "," : "", report->jitter_counts[i]);
+        }
+        char speed_counts[SPEED_HIST_BUCKETS * 4];
+        int speed_len = 0;
+        speed_counts[0] = '\0';
+        for (unsigned i = 0; i < report->speed_buckets; i++) {
+            speed_len += snprintf(speed_counts + speed_len, sizeof(speed_counts) - speed_len, "%s%u", i ? "," : "", report->speed_counts[i]);
+        }
 
-    esp_https_ota_config_t ota_config = {
-        .http_config = &config,
-    };
+        int len = snprintf(report_message, sizeof(report_message), "{\"device\": \"%s\", \"version\": \"%s\", %s, \"lane\": %d, \"seq\": %" PRIu32 ", \"data\": {\"avg_speed\": %.2f, \"max_speed\": %.2f, \"min_speed\": %.2f, \"num_cars\": %d, \"sensor_1_up\": %d, \"sensor_2_up\": %d, \"boot_measure_ms\": %lld, \"boot_publish_ms\": %lld, \"wifi_reconnects\": %" PRIu32 ", \"wifi_reconnect_ms\": %" PRIu32 ", \"wifi_reconnect_max_ms\": %" PRIu32 ", \"outbox_depth\": %" PRIu32 ", \"outbox_bytes\": %" PRIu32 ", \"outbox_spooled\": %" PRIu32 ", \"outbox_dropped\": %" PRIu32 ", \"mqtt_retransmits\": %" PRIu32 ", \"heap_free\": %" PRIu32 ", \"heap_largest\": %" PRIu32 ", \"heap_allocs\": %" PRIu32 ", \"jitter_p50_us\": %" PRIu32 ", \"jitter_p99_us\": %" PRIu32 ", \"jitter_max_us\": %" PRIu32 ", \"jitter_hist\": [%s], \"speed_hist\": [%s], \"ota_active\": %d, \"window_s\": %u, \"quiet_windows\": %" PRIu32 "}}",
+                 device_id, device_firmware_version, time_fields, report->lane, report->seq, report->avg_speed, report->max_speed, report->min_speed, report->num_cars, report->sensor_1_up, report->sensor_2_up, boot_to_first_measurement_ms, outbox_stats.first_ack_ms,
+                 wifi_stats.reconnects, wifi_stats.last_duration_ms, wifi_stats.max_duration_ms,
+                 outbox_stats.depth, outbox_stats.bytes, outbox_stats.spooled_bytes, outbox_stats.dropped, outbox_stats.retransmits,
+                 heap_stats.free_bytes, heap_stats.largest_block, heap_stats.allocs,
+                 report->jitter_p50_us, report->jitter_p99_us, report->jitter_max_us, jitter_counts, speed_counts, report->ota_active,
+                 report->window_s, report->quiet_windows);
+        if (len >= (int)sizeof(report_message)) {
+            ESP_LOGE("ANALYZE", "Report truncated (%d bytes)", len);
+            len = sizeof(report_message) - 1;
+        }
+        // QoS1 through the bounded outbox, which applies the overflow policy
+        telemetry_enqueue(report_message, len);
+
+        // Retained last state only at a low rate, so the broker isn't rewriting it every window
+        int64_t now_us = esp_timer_get_time();
+        if (last_state_publish_us == 0 || now_us - last_state_publish_us >= (int64_t)CONFIG_LAST_STATE_INTERVAL_S * 1000000) {
+            telemetry_publish_state(mqtt_state_topic, report_message, len);
+            last_state_publish_us = now_us;
+        }
+
+        pending_head = (pending_head + 1) % MAX_PENDING_REPORTS;
+        pending_count--;
+    }
 
-    ESP_LOGI("UPGRADE", "Attempting to download update from %s", config.url);
-    esp_err_t ret = esp_https_ota(&ota_config);
-    if (ret == ESP_OK) {
-        ESP_LOGI("UPGRADE", "OTA Succeed, Rebooting...");
-        free(firmware_complete_url);
-        esp_restart();
-    } else {
-        ESP_LOGE("UPGRADE", "Firmware upgrade failed");
-        free(firmware_complete_url);
-        free(firmware_binary);
-        firmware_binary = NULL;
-		vTaskDelete(NULL);
+    if (dropped_reports > 0) {
+        ESP_LOGW("ANALYZE", "Dropped %d windows while offline", dropped_reports);
+        dropped_reports = 0;
     }
 }
 
 
 void analyze_samples_send_over_mqtt() {
+    detection_policy_t policy;
+    heap_guard_watch_current_task();
+    for (size_t l = 0; l < lane_count; l++) {
+        lane_states[l].sensor_1_up = true;
+        lane_states[l].sensor_2_up = true;
+    }
+    uint32_t lane_events_dropped_reported = 0;
+    for (size_t l = 0; l < lane_count; l++) {
+        report_gate_init(&report_gates[l]);
+    }
+    TickType_t window_start = xTaskGetTickCount();
     while (true) {
-        vTaskDelay(pdMS_TO_TICKS(5000)); // Wait for 5 seconds
-
-        float max_speed = 0;
-        float min_speed = 0;
-        float sum_speed = 0;
-        float average_speed = 0;
-
-        if (sample_count > 0) {
-            max_speed = speed_samples[0];
-            min_speed = speed_samples[0];
-            sum_speed = 0;
-            for (int i = 0; i < sample_count; i++) {
-                if (speed_samples[i] > max_speed) max_speed = speed_samples[i];
-                if (speed_samples[i] < min_speed) min_speed = speed_samples[i];
-                sum_speed += speed_samples[i];
+        policy_get(&policy);
+        TickType_t window = pdMS_TO_TICKS(policy.report_interval_s * 1000);
+
+        // Collect what the measurement task saw until the window closes
+        lane_event_t event;
+        TickType_t elapsed;
+        while ((elapsed = xTaskGetTickCount() - window_start) < window) {
+            if (xQueueReceive(lane_event_queue, &event, window - elapsed) == pdTRUE) {
+                apply_lane_event(&event);
             }
-            average_speed = sum_speed / sample_count;
         }
+        window_start = xTaskGetTickCount();
 
-        char* mqtt_message = malloc(250 * sizeof(char));
-        sprintf(mqtt_message, "{\"device\": \"sensor_1\", \"version\": \"%s\", \"data\": {\"avg_speed\": \"%.2f\", \"max_speed\": \"%.2f\", \"min_speed\": \"%.2f\", \"num_cars\": \"%d\", \"sensor_1_up\": \"%d\", \"sensor_2_up\": \"%d\"}}", device_firmware_version, average_speed, max_speed, min_speed, sample_count, sensor_1_up, sensor_2_up);
-        esp_mqtt_client_publish(mqtt_client, "/device/data", mqtt_message, 0, 0, true);
-        // ESP_LOGI("ANALYZE", "Max Speed: %0.02f cm/s, Min Speed: %0.02f cm/s, Average Speed: %0.02f cm/s, Total Cars: %d", max_speed, min_speed, average_speed, sample_count);
-        free(mqtt_message);
+        int64_t window_end_us = esp_timer_get_time();
+        jitter_hist_t jitter_now, window_jitter, report_jitter;
+        if (xQueuePeek(jitter_queue, &jitter_now, 0) != pdTRUE) {
+            jitter_hist_init(&jitter_now);
+        }
+        jitter_hist_delta(&jitter_now, &jitter_window_start, &window_jitter);
+        jitter_window_start = jitter_now;
+        jitter_hist_delta(&jitter_now, &jitter_reported, &report_jitter);
+
+        ota_update_stats_t ota_stats;
+        ota_update_get_stats(&ota_stats);
+        jitter_hist_add(ota_stats.active ? &jitter_during_ota : &jitter_idle, &window_jitter);
+        if (ota_stats.active) {
+            ESP_LOGI("UPGRADE", "%" PRIu32 "/%" PRIu32 " bytes, %" PRIu32 " ms paused, cycle jitter p99 %" PRIu32 " us (idle %" PRIu32 " us)",
+                     ota_stats.bytes_read, ota_stats.image_size, ota_stats.paused_ms,
+                     jitter_hist_percentile_us(&jitter_during_ota, 99), jitter_hist_percentile_us(&jitter_idle, 99));
+        }
+        uint32_t events_dropped = lane_events_dropped;
+        bool dropped_this_window = events_dropped != lane_events_dropped_reported;
+        if (dropped_this_window) {
+            ESP_LOGW("ANALYZE", "Dropped %" PRIu32 " lane events", events_dropped - lane_events_dropped_reported);
+            lane_events_dropped_reported = events_dropped;
+        }
+        bool reported = false;
+        for (size_t l = 0; l < lane_count; l++) {
+            lane_state_t *lane = &lane_states[l];
+            float max_speed = 0;
+            float min_speed = 0;
+            float sum_speed = 0;
+            float average_speed = 0;
+
+            if (lane->sample_count > 0) {
+                max_speed = lane->speed_samples[0];
+                min_speed = lane->speed_samples[0];
+                for (int i = 0; i < lane->sample_count; i++) {
+                    if (lane->speed_samples[i] > max_speed) max_speed = lane->speed_samples[i];
+                    if (lane->speed_samples[i] < min_speed) min_speed = lane->speed_samples[i];
+                    sum_speed += lane->speed_samples[i];
+                }
+                average_speed = sum_speed / lane->sample_count;
+            }
 
-        // Reset the list
-        sample_count = 0;
-        sensor_1_up = true;
-        sensor_2_up = true;
+            // Quiet windows with unchanged health only go out as a heartbeat
+            report_window_t gate_window = {
+                .window_s = policy.report_interval_s,
+                .num_cars = lane->sample_count,
+                .sensor_1_up = lane->sensor_1_up,
+                .sensor_2_up = lane->sensor_2_up,
+                .ota_active = ota_stats.active,
+                .events_dropped = dropped_this_window,
+            };
+            uint32_t quiet_windows = 0;
+            bool publish = report_gate_window(&report_gates[l], &gate_window, policy.heartbeat_interval_s, &quiet_windows);
+
+            window_report_t report = {
+                .window_end_us = window_end_us,
+                .lane = l,
+                .avg_speed = average_speed,
+                .max_speed = max_speed,
+                .min_speed = min_speed,
+                .num_cars = lane->sample_count,
+                .sensor_1_up = lane->sensor_1_up,
+                .sensor_2_up = lane->sensor_2_up,
+                .jitter_p50_us = jitter_hist_percentile_us(&report_jitter, 50),
+                .jitter_p99_us = jitter_hist_percentile_us(&report_jitter, 99),
+                .jitter_max_us = jitter_hist_percentile_us(&report_jitter, 100),
+                .ota_active = ota_stats.active,
+                .window_s = policy.report_interval_s,
+                .quiet_windows = quiet_windows,
+            };
+            for (int i = 0; i < JITTER_HIST_BUCKETS; i++) {
+                report.jitter_counts[i] = report_jitter.counts[i] > UINT16_MAX ? UINT16_MAX : report_jitter.counts[i];
+            }
+            report.speed_buckets = speed_hist_used(&lane->speeds);
+            memcpy(report.speed_counts, lane->speeds.counts, sizeof(report.speed_counts));
+            if (publish) {
+                queue_window_report(&report);
+                reported = true;
+            }
+
+            // Reset the list
+            lane->sample_count = 0;
+            speed_hist_init(&lane->speeds);
+            lane->sensor_1_up = true;
+            lane->sensor_2_up = true;
+        }
+        if (reported) {
+            jitter_reported = jitter_now;
+        }
+        publish_pending_reports();
+
+        // A new image is kept once it has measured and had a report acknowledged
+        telemetry_stats_t outbox_stats;
+        telemetry_get_stats(&outbox_stats);
+        ota_update_report_health(boot_to_first_measurement_ms >= 0 && outbox_stats.first_ack_ms >= 0);
+
+        // Everything after the first published window must run without allocating;
+        // connecting, time sync and the first formatted floats are all behind us here
+        if (pending_count == 0 && (xEventGroupGetBits(connectivity_events) & (MQTT_CONNECTED_BIT | TIME_SYNCED_BIT)) == (MQTT_CONNECTED_BIT | TIME_SYNCED_BIT)) {
+            heap_guard_arm();
+        }
+    }
+}
+
+
+static void handle_policy_message(esp_mqtt_client_handle_t client, const char *data, int data_len)
+{
+    esp_err_t err = policy_apply_blob((const uint8_t *)data, data_len);
+
+    detection_policy_t policy;
+    policy_get(&policy);
+
+    const char *status = "applied";
+    if (err == ESP_ERR_POLICY_STALE) {
+        status = "unchanged";
+    } else if (err != ESP_OK) {
+        status = "rejected";
     }
+
+    char ack[128];
+    int len = snprintf(ack, sizeof(ack), "{\"device\": \"%s\", \"policy_version\": %" PRIu32 ", \"status\": \"%s\"}",
+                       device_id, policy.version, status);
+    esp_mqtt_client_publish(client, mqtt_config_ack_topic, ack, len, 1, false);
 }
 
 
+static topic_router_t mqtt_router;
+
+// Fixed buffers the small command payloads are reassembled into
+static char bump_command[8];
+static topic_collector_t bump_collector = { .buf = bump_command, .capacity = sizeof(bump_command) };
+static topic_collector_t upgrade_collector = { .buf = firmware_binary, .capacity = sizeof(firmware_binary) - 1 };
+static uint8_t policy_blob[POLICY_BLOB_SIZE];
+static topic_collector_t policy_collector = { .buf = (char *)policy_blob, .capacity = sizeof(policy_blob) };
+
+
+static void handle_bump_command(void *ctx, const topic_fragment_t *fragment)
+{
+    topic_collect_result_t collected = topic_collect(&bump_collector, fragment);
+    if (collected == TOPIC_COLLECT_OVERFLOW) {
+        ESP_LOGW("BUMP", "Ignoring a %u byte command", (unsigned)fragment->total_len);
+    }
+    if (collected != TOPIC_COLLECT_COMPLETE) {
+        return;
+    }
+    if (bump_collector.len == strlen("deploy") && memcmp(bump_command, "deploy", bump_collector.len) == 0) {
+        request_actuation(ACTUATE_DEPLOY, ALL_ACTUATORS);
+    }
+    else if (bump_collector.len == strlen("retract") && memcmp(bump_command, "retract", bump_collector.len) == 0) {
+        request_actuation(ACTUATE_RETRACT, ALL_ACTUATORS);
+    }
+}
+
+
+static void handle_upgrade_command(void *ctx, const topic_fragment_t *fragment)
+{
+    if (ota_update_in_progress()) {
+        if (topic_fragment_is_first(fragment)) {
+            ESP_LOGW("UPGRADE", "Upgrade already in progress, ignoring request");
+        }
+        return;
+    }
+    topic_collect_result_t collected = topic_collect(&upgrade_collector, fragment);
+    if (collected == TOPIC_COLLECT_OVERFLOW) {
+        ESP_LOGE("UPGRADE", "Firmware name of %u bytes is longer than %u, ignoring request",
+                 (unsigned)fragment->total_len, (unsigned)upgrade_collector.capacity);
+    }
+    if (collected != TOPIC_COLLECT_COMPLETE) {
+        return;
+    }
+    firmware_binary[upgrade_collector.len] = '\0';
+
+    char url[sizeof(CONFIG_FIRMWARE_UPGRADE_URL) + sizeof(firmware_binary) + 1];
+    snprintf(url, sizeof(url), "%s/%s", firmware_url, firmware_binary);
+    esp_err_t err = ota_update_start(url, UPGRADE_TASK_PRIORITY, NETWORK_TASK_CORE);
+    if (err != ESP_OK) {
+        ESP_LOGE("UPGRADE", "Cannot start upgrade: %s", esp_err_to_name(err));
+    }
+}
+
+
+static void handle_policy_fragment(void *ctx, const topic_fragment_t *fragment)
+{
+    topic_collect_result_t collected = topic_collect(&policy_collector, fragment);
+    if (collected == TOPIC_COLLECT_COMPLETE) {
+        handle_policy_message(mqtt_client, (const char *)policy_blob, policy_collector.len);
+    }
+    else if (collected == TOPIC_COLLECT_OVERFLOW) {
+        // Passed on with length 0 so it gets rejected and acked
+        ESP_LOGW("POLICY", "Policy of %u bytes, expected %u", (unsigned)fragment->total_len, (unsigned)sizeof(policy_blob));
+        handle_policy_message(mqtt_client, (const char *)policy_blob, 0);
+    }
+}
+
+
+static int64_t mqtt_connect_start_us = 0;
+static uint32_t mqtt_connect_heap_before = 0;
+
+
 static void mqtt_event_handler(void *handler_args, esp_event_base_t base, int32_t event_id, void *event_data)
 {
     ESP_LOGD(MQTT_TAG, "Event dispatched from event loop base=%s, event_id=%" PRIi32 "", base, event_id);
@@ -225,16 +636,35 @@ static void mqtt_event_handler(void *handler_args, esp_event_base_t base, int32_
     esp_mqtt_client_handle_t client = event->client;
     int msg_id;
     switch ((esp_mqtt_event_id_t)event_id) {
+    case MQTT_EVENT_BEFORE_CONNECT:
+        mqtt_connect_start_us = esp_timer_get_time();
+        mqtt_connect_heap_before = esp_get_free_heap_size();
+        break;
     case MQTT_EVENT_CONNECTED:
-        ESP_LOGI(MQTT_TAG, "MQTT_EVENT_CONNECTED");
-        msg_id = esp_mqtt_client_subscribe(client, MQTT_DEVICE_UPGRADE_TOPIC, 0);
+        // TCP + TLS handshake + MQTT CONNECT, and the heap it took
+        ESP_LOGI(MQTT_TAG, "MQTT_EVENT_CONNECTED in %lld ms, heap %" PRIu32 " -> %" PRIu32 " (min %" PRIu32 ")",
+                 (esp_timer_get_time() - mqtt_connect_start_us) / 1000, mqtt_connect_heap_before,
+                 esp_get_free_heap_size(), esp_get_minimum_free_heap_size());
+        xEventGroupSetBits(connectivity_events, MQTT_CONNECTED_BIT);
+        wifi_reconnect_on_broker_connected();
+        telemetry_on_connected();
+        msg_id = esp_mqtt_client_subscribe(client, mqtt_upgrade_topic, 0);
+        ESP_LOGI(MQTT_TAG, "sent subscribe successful, msg_id=%d", msg_id);
+
+		msg_id = esp_mqtt_client_subscribe(client, mqtt_bump_topic, 0);
         ESP_LOGI(MQTT_TAG, "sent subscribe successful, msg_id=%d", msg_id);
 
-		msg_id = esp_mqtt_client_subscribe(client, MQTT_BUMP_CONTROLLER_TOPIC, 0);
+        msg_id = esp_mqtt_client_subscribe(client, mqtt_config_topic, 1);
+        ESP_LOGI(MQTT_TAG, "sent subscribe successful, msg_id=%d", msg_id);
+
+        // QoS0, a request that is lost times out and is asked again
+        msg_id = esp_mqtt_client_subscribe(client, mqtt_history_topic, 0);
         ESP_LOGI(MQTT_TAG, "sent subscribe successful, msg_id=%d", msg_id);
         break;
     case MQTT_EVENT_DISCONNECTED:
         ESP_LOGI(MQTT_TAG, "MQTT_EVENT_DISCONNECTED");
+        xEventGroupClearBits(connectivity_events, MQTT_CONNECTED_BIT);
+        telemetry_on_disconnected();
         break;
 
     case MQTT_EVENT_SUBSCRIBED:
@@ -245,30 +675,23 @@ static void mqtt_event_handler(void *handler_args, esp_event_base_t base, int32_
         break;
     case MQTT_EVENT_PUBLISHED:
         ESP_LOGI(MQTT_TAG, "MQTT_EVENT_PUBLISHED, msg_id=%d", event->msg_id);
+        telemetry_on_published(event->msg_id);
         break;
     case MQTT_EVENT_DATA:
         ESP_LOGI(MQTT_TAG, "MQTT_EVENT_DATA");
-        printf("TOPIC=%.*s\r\n", event->topic_len, event->topic);
-        printf("DATA=%.*s\r\n", event->data_len, event->data);
-        
-        // handle device bump deploy topic
-        if (strncmp(event->topic, MQTT_BUMP_CONTROLLER_TOPIC, event->topic_len) == 0) {
-            if (strncmp(event->data, "deploy", event->data_len) == 0){
-                advertise_deploy_speed_bump();
-            }
-            else if (strncmp(event->data, "retract", event->data_len) == 0){
-                advertise_retract_speed_bump();
-            }
+        if (event->current_data_offset == 0) {
+            printf("TOPIC=%.*s\r\n", event->topic_len, event->topic);
         }
+        printf("DATA=%.*s\r\n", event->data_len, event->data);
 
-		// handle device upgrade topic
-		if (strncmp(event->topic, MQTT_DEVICE_UPGRADE_TOPIC, event->topic_len) == 0) {
-            firmware_binary = malloc(event->data_len + 1);
-            memcpy(firmware_binary, event->data, event->data_len);
-            firmware_binary[event->data_len] = '\0';
-			xTaskCreate(&upgrade_firmware_task, "upgrade_firmware", 8192, NULL, 5, NULL);
-		}
-
+        // Payloads larger than the receive buffer arrive over several events,
+        // only the first of which carries the topic
+        topic_router_result_t routed = topic_router_dispatch(&mqtt_router, event->topic, event->topic_len,
+                                                             event->data, event->data_len,
+                                                             event->current_data_offset, event->total_data_len);
+        if (routed != TOPIC_ROUTER_DISPATCHED) {
+            ESP_LOGW(MQTT_TAG, "Unrouted MQTT data (%d)", routed);
+        }
         break;
     case MQTT_EVENT_ERROR:
         ESP_LOGI(MQTT_TAG, "MQTT_EVENT_ERROR");
@@ -319,74 +742,189 @@ static void esp_gap_cb(esp_gap_ble_cb_event_t event, esp_ble_gap_cb_param_t *par
 }
 
 
-void ultrasonic_sensor_data()
+static void handle_sensor_reading(size_t sensor, esp_err_t res, uint32_t time_us, uint32_t echo_window_us, int64_t now_us, const detection_policy_t *policy)
 {
-    ultrasonic_sensor_t sensor1 = {
-        .trigger_pin = TRIGGER_GPIO_1,
-        .echo_pin = ECHO_GPIO_1
-    };
+    size_t l = LANE_OF_SENSOR(sensor);
+    bool is_entry = sensor == LANE_SENSOR_ENTRY(l);
 
-    ultrasonic_sensor_t sensor2 = {
-        .trigger_pin = TRIGGER_GPIO_2,
-        .echo_pin = ECHO_GPIO_2
-    };
+    if (res == ESP_ERR_ULTRASONIC_ECHO_TIMEOUT) {
+        // Nothing within range, which the filter sees as the far end of the window
+        time_us = echo_window_us;
+        res = ESP_OK;
+    }
 
-    ultrasonic_init(&sensor1);
-    ultrasonic_init(&sensor2);
+    if (res != ESP_OK)
+    {
+        recent_history_fault(now_us, sensor);
+        if (is_entry) {
+            send_lane_event(l, LANE_EVENT_ENTRY_DOWN, 0);
+        }
+        else {
+            send_lane_event(l, LANE_EVENT_EXIT_DOWN, 0);
+            // Dummy data
+            float chance = generate_random_float(0, 100);
+            if (chance < 10) {
+                send_lane_event(l, LANE_EVENT_SPEED, generate_random_float(0.0, 200.0));
+            }
+        }
+        return;
+    }
 
-    TickType_t start_time = 0;
+    // The raw reading goes to the recent history, spurious echoes and all
+    recent_history_trace(now_us, sensor, range_scale_us_to_mm(&range_scale, time_us));
 
-    while (true)
+    // A single stray echo must not start or stop the timer
+    uint32_t distance_mm = range_scale_us_to_mm(&range_scale, range_filter_update(&sensor_filters[sensor], time_us));
+    if (distance_mm >= (uint32_t)policy->max_distance_cm * 10) {
+        return;
+    }
+    float distance = distance_mm / 10.0f;
+
+    if (is_entry)
     {
-        float distance1, distance2;
-        esp_err_t res1 = ultrasonic_measure(&sensor1, MAX_DISTANCE_CM, &distance1);
-        esp_err_t res2 = ultrasonic_measure(&sensor2, MAX_DISTANCE_CM, &distance2);
+        lane_start_time_us[l] = now_us;
+        transit_started_ms = now_us / 1000;
+        lanes_in_transit |= 1u << l;
+        DLOGI("Lane %u distance from entry sensor: %0.02f cm", (unsigned)l, distance);
+        return;
+    }
 
-        if (res1 != ESP_OK)
-        {
-            // printf("Error on Sensor 1: %d: ", res1);
-            sensor_1_up = false;
-            // Handle errors for sensor 1
+    DLOGI("Lane %u distance from exit sensor: %0.02f cm", (unsigned)l, distance);
+    if (lane_start_time_us[l] != 0) // If the timer was started
+    {
+        float time_taken = (float)(now_us - lane_start_time_us[l]) / 1000000; // Calculate time taken in seconds
+        float speed = policy->sensor_distance_cm / time_taken; // Calculate speed of passing car
+        DLOGI("Lane %u speed of passing car: %0.02f cm/s", (unsigned)l, speed);
+        lane_start_time_us[l] = 0; // Reset the timer
+        lanes_in_transit &= ~(1u << l);
+        send_lane_event(l, LANE_EVENT_SPEED, speed);
+        recent_history_vehicle(now_us, l, speed, speed > policy->speed_threshold_cm_s);
+        if (speed > policy->speed_threshold_cm_s){
+            DLOGI("Too fast");
+            request_actuation(ACTUATE_DEPLOY, LANE_ACTUATOR_MASK(l));
         }
-        else if (distance1 * 100 < MAX_DISTANCE_CM)
-        {
-            start_time = xTaskGetTickCount();
-            printf("Distance from Sensor 1: %0.04f cm\n", distance1 * 100);
+        else {
+            DLOGI("Too slow");
         }
+    }
+}
 
-        if (res2 != ESP_OK)
-        {
-            // printf("Error on Sensor 2: %d: ", res2);
-            sensor_2_up = false;
-            // Handle errors for sensor 2
-            // Dummy data
-            float chance = generate_random_float(0, 100);
-            if (chance < 10) {
-                add_speed_sample(generate_random_float(0.0, 200.0));
-            }
+
+// Busy callback for the OTA download, which holds off while a lane is timing a vehicle
+static bool vehicle_in_transit(void)
+{
+    uint32_t elapsed_ms = (uint32_t)(esp_timer_get_time() / 1000) - transit_started_ms;
+    return lanes_in_transit != 0 && elapsed_ms < TRANSIT_TIMEOUT_MS;
+}
+
+
+// Round trip to just past the trigger distance, nothing further is of interest
+static uint32_t echo_window_us(uint16_t max_distance_cm)
+{
+    return range_scale_mm_to_us(&range_scale, ((uint32_t)max_distance_cm + LANE_ECHO_MARGIN_CM) * 10);
+}
+
+
+void ultrasonic_sensor_data()
+{
+    heap_guard_watch_current_task();
+    size_t sensor_count = lane_count * 2;
+    ultrasonic_sensor_t sensors[MAX_LANES * 2];
+    uint32_t conflicts[MAX_LANES * 2];
+
+    for (size_t l = 0; l < lane_count; l++) {
+        sensors[LANE_SENSOR_ENTRY(l)] = lane_configs[l].entry;
+        sensors[LANE_SENSOR_EXIT(l)] = lane_configs[l].exit;
+        // The two sensors of a lane face the same spot
+        conflicts[LANE_SENSOR_ENTRY(l)] = lane_sensor_conflicts[LANE_SENSOR_ENTRY(l)] | (1u << LANE_SENSOR_EXIT(l));
+        conflicts[LANE_SENSOR_EXIT(l)] = lane_sensor_conflicts[LANE_SENSOR_EXIT(l)];
+    }
+    detection_policy_t policy;
+    policy_get(&policy);
+    range_scale_init(&range_scale, policy.temperature_dc);
+    for (size_t i = 0; i < sensor_count; i++) {
+        ultrasonic_init(&sensors[i]);
+        range_filter_init(&sensor_filters[i], RANGE_FILTER_GATE_US);
+    }
+
+    ping_schedule_t schedule;
+    if (ping_schedule_build(&schedule, conflicts, sensor_count) != 0) {
+        ESP_LOGE("MAIN", "Cannot schedule %u sensors", (unsigned)sensor_count);
+        vTaskDelete(NULL);
+    }
+
+    ping_timing_t timing = {
+        .trigger_us = 14,
+        .echo_window_us = echo_window_us(policy.max_distance_cm),
+        .guard_us = LANE_PING_GUARD_US,
+    };
+    uint16_t window_distance_cm = policy.max_distance_cm;
+    uint32_t clamped_period_ms = 0;
+    ping_schedule_t sequential = { .slot_count = sensor_count };
+    ESP_LOGI("MAIN", "%u lanes in %u slots: %" PRIu32 " us cycle for %u cm, %" PRIu32 " pings/s (back to back: %" PRIu32 ")",
+             (unsigned)lane_count, (unsigned)schedule.slot_count,
+             ping_schedule_cycle_us(&schedule, &timing), (unsigned)window_distance_cm,
+             ping_schedule_pings_per_s(&schedule, &timing, sensor_count),
+             ping_schedule_pings_per_s(&sequential, &timing, sensor_count));
+
+    ultrasonic_sensor_t group[MAX_LANES * 2];
+    size_t group_sensor[MAX_LANES * 2];
+    uint32_t time_us[MAX_LANES * 2];
+    esp_err_t results[MAX_LANES * 2];
+    TickType_t last_wake = xTaskGetTickCount();
+
+    while (true)
+    {
+        policy_get(&policy);
+        if (policy.temperature_dc != range_scale.temperature_dc || policy.max_distance_cm != window_distance_cm) {
+            // Sound is about 0.18% faster per degree, which moves both distances and the echo window
+            range_scale_set_temperature(&range_scale, policy.temperature_dc);
+            timing.echo_window_us = echo_window_us(policy.max_distance_cm);
+            window_distance_cm = policy.max_distance_cm;
         }
-        else if (distance2 * 100 < MAX_DISTANCE_CM)
+        // A policy asking for a shorter period than the cycle takes would overrun every cycle
+        uint32_t poll_period_ms = ping_schedule_poll_period_ms(&schedule, &timing, policy.poll_period_ms);
+        if (poll_period_ms != policy.poll_period_ms && poll_period_ms != clamped_period_ms) {
+            ESP_LOGW("MAIN", "Poll period %u ms is shorter than the %" PRIu32 " us cycle, polling every %" PRIu32 " ms",
+                     policy.poll_period_ms, ping_schedule_cycle_us(&schedule, &timing), poll_period_ms);
+        }
+        clamped_period_ms = poll_period_ms != policy.poll_period_ms ? poll_period_ms : 0;
+        // Rounded up to whole ticks, truncating could make the period shorter than the cycle
+        TickType_t period_ticks = pdMS_TO_TICKS(poll_period_ms + portTICK_PERIOD_MS - 1);
+        // Against the period actually waited for, so tick rounding is not counted as jitter
+        jitter_hist_record(&cycle_jitter, esp_timer_get_time(), period_ticks * portTICK_PERIOD_MS * 1000);
+        xQueueOverwrite(jitter_queue, &cycle_jitter);
+
+        for (size_t slot = 0; slot < schedule.slot_count; slot++)
         {
-            printf("Distance from Sensor 2: %0.04f cm\n", distance2 * 100);
-            if (start_time != 0) // If the timer was started
-            {
-                TickType_t end_time = xTaskGetTickCount(); // Get the current time
-                float time_taken = ((float)(end_time - start_time)) * portTICK_PERIOD_MS / 1000; // Calculate time taken in seconds
-                float speed = SENSOR_DISTANCE_CM / time_taken; // Calculate speed of passing car
-                printf("Speed of passing car: %0.02f cm/s\n", speed);
-                start_time = 0; // Reset the timer
-                add_speed_sample(speed);
-                if (speed > 50){
-                    ESP_LOGI("TAG", "%s", "Too fast");
-                    advertise_deploy_speed_bump();
+            size_t group_count = 0;
+            for (size_t i = 0; i < sensor_count; i++) {
+                if (schedule.slots[slot] & (1u << i)) {
+                    group_sensor[group_count] = i;
+                    group[group_count++] = sensors[i];
                 }
-                else {  
-                    ESP_LOGI("TAG", "%s", "Too slow");
+            }
+
+            ultrasonic_measure_raw_group(group, group_count, timing.echo_window_us, time_us, results);
+            int64_t now_us = esp_timer_get_time();
+
+            for (size_t k = 0; k < group_count; k++) {
+                if (boot_to_first_measurement_ms < 0 && (results[k] == ESP_OK || results[k] == ESP_ERR_ULTRASONIC_ECHO_TIMEOUT)) {
+                    boot_to_first_measurement_ms = now_us / 1000;
+                    ESP_LOGI("MAIN", "First measurement %lld ms after boot", boot_to_first_measurement_ms);
                 }
+                handle_sensor_reading(group_sensor[k], results[k], time_us[k], timing.echo_window_us, now_us, &policy);
             }
+
+            // Let stray echoes die down before the next slot fires
+            esp_rom_delay_us(timing.guard_us);
         }
 
-        vTaskDelay(pdMS_TO_TICKS(50));
+        if (xTaskDelayUntil(&last_wake, period_ticks) == pdFALSE) {
+            // Cycle overran the poll period, still let lower priority tasks run
+            vTaskDelay(1);
+            last_wake = xTaskGetTickCount();
+        }
     }
 }
 
@@ -402,25 +940,54 @@ void app_main(void)
     }
     ESP_ERROR_CHECK(ret);
 
+    policy_init();
+    ota_update_init(vehicle_in_transit);
+    snprintf(mqtt_telemetry_topic, sizeof(mqtt_telemetry_topic), "/device/%s/data", device_id);
+    snprintf(mqtt_bump_topic, sizeof(mqtt_bump_topic), "/device/%s/bump", device_id);
+    snprintf(mqtt_upgrade_topic, sizeof(mqtt_upgrade_topic), "/device/%s/upgrade", device_id);
+    snprintf(mqtt_config_topic, sizeof(mqtt_config_topic), "/device/%s/config", device_id);
+    snprintf(mqtt_config_ack_topic, sizeof(mqtt_config_ack_topic), "/device/%s/config/ack", device_id);
+    snprintf(mqtt_state_topic, sizeof(mqtt_state_topic), "/device/%s/state", device_id);
+    snprintf(mqtt_debug_topic, sizeof(mqtt_debug_topic), "/device/%s/debug", device_id);
+    snprintf(mqtt_history_topic, sizeof(mqtt_history_topic), "/device/%s/history", device_id);
+    snprintf(mqtt_history_response_topic, sizeof(mqtt_history_response_topic), "/device/%s/history/response", device_id);
+    telemetry_init(mqtt_telemetry_topic);
+
+    topic_router_init(&mqtt_router);
+    topic_router_add(&mqtt_router, mqtt_bump_topic, handle_bump_command, NULL);
+    topic_router_add(&mqtt_router, mqtt_upgrade_topic, handle_upgrade_command, NULL);
+    topic_router_add(&mqtt_router, mqtt_config_topic, handle_policy_fragment, NULL);
+    topic_router_add(&mqtt_router, mqtt_history_topic, recent_history_handle_request, NULL);
+
+    initialize_connectivity_events();
+
     initialize_ble(esp_gap_cb);
     ESP_LOGI("BLE", "Configuring payload");
     advertise_idle();
 
+    // Hot paths log through the deferred ring, drained at the lowest priority
+    dlog_drain_start(mqtt_debug_topic, DLOG_TASK_PRIORITY, NETWORK_TASK_CORE);
+    dlog_benchmark();
+
+    // Before measuring starts, the measurement task records into its ring
+    recent_history_start(mqtt_history_response_topic, HISTORY_TASK_PRIORITY, NETWORK_TASK_CORE);
+
+    // Queues first, the tasks below start using them straight away
+    lane_event_queue = xQueueCreate(LANE_EVENT_QUEUE_LENGTH, sizeof(lane_event_t));
+    actuation_queue = xQueueCreate(ACTUATION_QUEUE_LENGTH, sizeof(actuation_request_t));
+    jitter_queue = xQueueCreate(1, sizeof(jitter_hist_t));
+
+    // Sense straight away on local monotonic time, reports are back-filled
+    // with wall-clock timestamps once SNTP has synced. Core and priority of
+    // each task are laid out in task_layout.h
+    xTaskCreatePinnedToCore(&ultrasonic_sensor_data, "ultrasonic_sensor_data", 3072, NULL, MEASURE_TASK_PRIORITY, NULL, MEASURE_TASK_CORE);
+    xTaskCreatePinnedToCore(&actuate_speed_bump_task, "actuate_speed_bump", 2560, NULL, ACTUATE_TASK_PRIORITY, NULL, NETWORK_TASK_CORE);
+    xTaskCreatePinnedToCore(&analyze_samples_send_over_mqtt, "analyze_samples_send_over_mqtt", 3072, NULL, REPORT_TASK_PRIORITY, NULL, NETWORK_TASK_CORE);
+#if CONFIG_MQTT_FLOOD_TEST
+    xTaskCreatePinnedToCore(&mqtt_flood_task, "mqtt_flood", 2560, NULL, ACTUATE_TASK_PRIORITY, NULL, NETWORK_TASK_CORE);
+#endif
+
+	// MQTT is started from wifi_event_handler on IP_EVENT_STA_GOT_IP
 	initialize_wifi(wifi_ssid, wifi_pass, wifi_event_handler);
-	
-	ESP_LOGI("MAIN", "5s delay to connect to Wifi.");
-	vTaskDelay(5000 /portTICK_PERIOD_MS);
-
     initialize_sntp();
-    wait_for_time_sync();
-	
-	mqtt_client = initialize_mqtt(
-		mqtt_broker_uri,
-		mqtt_broker_user,
-		mqtt_broker_pass,
-		mqtt_event_handler
-	);
-
-    xTaskCreate(&ultrasonic_sensor_data, "ultrasonic_sensor_data", 2048, NULL, 5, NULL);
-    xTaskCreate(&analyze_samples_send_over_mqtt, "analyze_samples_send_over_mqtt", 2048, NULL, 5, NULL);    
 }
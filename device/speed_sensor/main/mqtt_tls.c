@@ -0,0 +1,200 @@
+#include <errno.h>
+#include <inttypes.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/select.h>
+
+#include "esp_log.h"
+#include "esp_timer.h"
+#include "esp_tls.h"
+#include "sdkconfig.h"
+
+#include "mqtt_tls.h"
+
+#define MQTT_TLS_DEFAULT_PORT 8883
+
+static const char *MQTT_TLS_TAG = "MQTT_TLS";
+
+typedef struct
+{
+    const char *ca_pem;
+    esp_tls_t *tls;
+#ifdef CONFIG_MQTT_TLS_RESUME
+    esp_tls_client_session_t *session; //!< Of the last connection, NULL until one completes
+#endif
+} mqtt_tls_t;
+
+static mqtt_tls_stats_t stats;
+
+
+static int tls_poll(esp_transport_handle_t t, int timeout_ms, bool write)
+{
+    mqtt_tls_t *ctx = esp_transport_get_context_data(t);
+    int fd;
+    if (ctx->tls == NULL || esp_tls_get_conn_sockfd(ctx->tls, &fd) != ESP_OK) {
+        return -1;
+    }
+    // Already decrypted, the socket has nothing more to say about it
+    if (!write && esp_tls_get_bytes_avail(ctx->tls) > 0) {
+        return 1;
+    }
+    fd_set fds;
+    fd_set errors;
+    FD_ZERO(&fds);
+    FD_ZERO(&errors);
+    FD_SET(fd, &fds);
+    FD_SET(fd, &errors);
+    struct timeval timeout = { .tv_sec = timeout_ms / 1000, .tv_usec = (timeout_ms % 1000) * 1000 };
+    int ret = select(fd + 1, write ? NULL : &fds, write ? &fds : NULL, &errors, timeout_ms < 0 ? NULL : &timeout);
+    if (ret > 0 && FD_ISSET(fd, &errors)) {
+        return -1;
+    }
+    return ret;
+}
+
+
+static int tls_poll_read(esp_transport_handle_t t, int timeout_ms)
+{
+    return tls_poll(t, timeout_ms, false);
+}
+
+
+static int tls_poll_write(esp_transport_handle_t t, int timeout_ms)
+{
+    return tls_poll(t, timeout_ms, true);
+}
+
+
+static int tls_close(esp_transport_handle_t t)
+{
+    mqtt_tls_t *ctx = esp_transport_get_context_data(t);
+    if (ctx->tls != NULL) {
+        esp_tls_conn_destroy(ctx->tls);
+        ctx->tls = NULL;
+    }
+    return 0;
+}
+
+
+static int tls_connect(esp_transport_handle_t t, const char *host, int port, int timeout_ms)
+{
+    mqtt_tls_t *ctx = esp_transport_get_context_data(t);
+    tls_close(t);
+    esp_tls_cfg_t cfg = {
+        .cacert_buf = (const unsigned char *)ctx->ca_pem,
+        .cacert_bytes = strlen(ctx->ca_pem) + 1,
+        .skip_common_name = true,
+        .timeout_ms = timeout_ms,
+    };
+#ifdef CONFIG_MQTT_TLS_RESUME
+    cfg.client_session = ctx->session;
+#endif
+
+    ctx->tls = esp_tls_init();
+    if (ctx->tls == NULL) {
+        stats.failures++;
+        return -1;
+    }
+    int64_t start_us = esp_timer_get_time();
+    if (esp_tls_conn_new_sync(host, strlen(host), port, &cfg, ctx->tls) <= 0) {
+        ESP_LOGW(MQTT_TLS_TAG, "Connecting to %s:%d failed", host, port);
+        tls_close(t);
+        stats.failures++;
+        return -1;
+    }
+    uint32_t handshake_ms = (esp_timer_get_time() - start_us) / 1000;
+
+    stats.handshakes++;
+#ifdef CONFIG_MQTT_TLS_RESUME
+    stats.offered += ctx->session != NULL;
+    // The ticket the broker just issued replaces the one used
+    esp_tls_client_session_t *session = esp_tls_get_client_session(ctx->tls);
+    if (session != NULL) {
+        if (ctx->session != NULL) {
+            esp_tls_free_client_session(ctx->session);
+        }
+        ctx->session = session;
+    }
+#endif
+    stats.last_handshake_ms = handshake_ms;
+    stats.max_handshake_ms = handshake_ms > stats.max_handshake_ms ? handshake_ms : stats.max_handshake_ms;
+    ESP_LOGI(MQTT_TLS_TAG, "Handshake in %" PRIu32 " ms, %s", handshake_ms,
+#ifdef CONFIG_MQTT_TLS_RESUME
+             cfg.client_session != NULL ? "session offered" : "full");
+#else
+             "resumption off");
+#endif
+    return 0;
+}
+
+
+static int tls_read(esp_transport_handle_t t, char *buffer, int len, int timeout_ms)
+{
+    mqtt_tls_t *ctx = esp_transport_get_context_data(t);
+    int poll = tls_poll_read(t, timeout_ms);
+    if (poll <= 0) {
+        return poll;
+    }
+    int ret = esp_tls_conn_read(ctx->tls, buffer, len);
+    if (ret == ESP_TLS_ERR_SSL_WANT_READ || ret == ESP_TLS_ERR_SSL_TIMEOUT) {
+        return ERR_TCP_TRANSPORT_CONNECTION_TIMEOUT;
+    }
+    if (ret == 0) {
+        return ERR_TCP_TRANSPORT_CONNECTION_CLOSED_BY_FIN;
+    }
+    return ret;
+}
+
+
+static int tls_write(esp_transport_handle_t t, const char *buffer, int len, int timeout_ms)
+{
+    mqtt_tls_t *ctx = esp_transport_get_context_data(t);
+    int poll = tls_poll_write(t, timeout_ms);
+    if (poll <= 0) {
+        return poll;
+    }
+    int ret = esp_tls_conn_write(ctx->tls, buffer, len);
+    if (ret < 0) {
+        ESP_LOGW(MQTT_TLS_TAG, "Write failed: -0x%x, errno %d", -ret, errno);
+    }
+    return ret;
+}
+
+
+static int tls_destroy(esp_transport_handle_t t)
+{
+    mqtt_tls_t *ctx = esp_transport_get_context_data(t);
+    tls_close(t);
+#ifdef CONFIG_MQTT_TLS_RESUME
+    if (ctx->session != NULL) {
+        esp_tls_free_client_session(ctx->session);
+    }
+#endif
+    free(ctx);
+    return 0;
+}
+
+
+esp_transport_handle_t mqtt_tls_transport_init(const char *ca_pem)
+{
+    mqtt_tls_t *ctx = calloc(1, sizeof(*ctx));
+    esp_transport_handle_t t = esp_transport_init();
+    if (ctx == NULL || t == NULL) {
+        free(ctx);
+        if (t != NULL) {
+            esp_transport_destroy(t);
+        }
+        return NULL;
+    }
+    ctx->ca_pem = ca_pem;
+    esp_transport_set_context_data(t, ctx);
+    esp_transport_set_func(t, tls_connect, tls_read, tls_write, tls_close, tls_poll_read, tls_poll_write, tls_destroy);
+    esp_transport_set_default_port(t, MQTT_TLS_DEFAULT_PORT);
+    return t;
+}
+
+
+void mqtt_tls_get_stats(mqtt_tls_stats_t *stats_out)
+{
+    *stats_out = stats;
+}
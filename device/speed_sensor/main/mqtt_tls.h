@@ -0,0 +1,41 @@
+#ifndef __MQTT_TLS_H__
+#define __MQTT_TLS_H__
+
+#include <stdint.h>
+
+#include "esp_transport.h"
+
+/*
+ * TLS transport for the MQTT client that keeps the session of its last
+ * connection and offers it on the next, so a reconnect after a broker
+ * restart or a Wi-Fi drop resumes with a session ticket instead of a full
+ * handshake: no certificate chain over the air and no public key operations
+ * on the device. esp-mqtt's own SSL transport drops the session on close.
+ *
+ * The broker is verified against the given CA only, without checking its
+ * common name. Resumption is on with CONFIG_MQTT_TLS_RESUME, off gives a
+ * full handshake on every connect for comparison.
+ */
+typedef struct
+{
+    uint32_t handshakes;        //!< Completed TLS handshakes since boot
+    uint32_t offered;           //!< Of which offered a saved session
+    uint32_t failures;          //!< Connects that failed
+    uint32_t last_handshake_ms; //!< TCP connect and TLS handshake of the last one
+    uint32_t max_handshake_ms;
+} mqtt_tls_stats_t;
+
+
+/**
+ * @brief Create the transport, to pass as the client's network.transport
+ *
+ * The client owns it and destroys it with itself.
+ *
+ * @param ca_pem NUL terminated PEM, kept by reference
+ */
+esp_transport_handle_t mqtt_tls_transport_init(const char *ca_pem);
+
+
+void mqtt_tls_get_stats(mqtt_tls_stats_t *stats);
+
+#endif /* __MQTT_TLS_H__ */
@@ -0,0 +1,336 @@
+#include <inttypes.h>
+#include <stdio.h>
+#include <string.h>
+
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+#include "esp_log.h"
+#include "esp_timer.h"
+#include "esp_system.h"
+#include "esp_ota_ops.h"
+#include "esp_app_desc.h"
+#include "esp_partition.h"
+#include "esp_http_client.h"
+#include "esp_https_ota.h"
+#include "sdkconfig.h"
+#include "cJSON.h"
+
+#include "connectivity.h"
+#include "ota_update.h"
+
+#define OTA_URL_MAX 256
+#define OTA_HTTP_BUFFER 1024    // Bytes fetched and written to flash per step
+#define OTA_PAUSE_POLL_MS 50
+#define OTA_MANIFEST_SUFFIX ".manifest"
+#define OTA_MANIFEST_MAX 512
+#define OTA_SHA256_LEN 32
+
+static const char *OTA_TAG = "UPGRADE";
+static const char *HTTP_TAG = "HTTP";
+
+static char ota_url[OTA_URL_MAX];
+static ota_busy_fn_t ota_busy = NULL;
+static volatile bool in_progress = false;
+static volatile uint32_t bytes_read = 0;
+static volatile uint32_t image_size = 0;
+static volatile uint32_t paused_ms = 0;
+
+static char manifest_body[OTA_MANIFEST_MAX + 1];
+
+static bool pending_verify = false;
+static int64_t verify_deadline_us = 0;
+
+
+static esp_err_t http_event_handler(esp_http_client_event_t *evt)
+{
+    switch (evt->event_id) {
+    case HTTP_EVENT_ERROR:
+        ESP_LOGD(HTTP_TAG, "HTTP_EVENT_ERROR");
+        break;
+    case HTTP_EVENT_ON_CONNECTED:
+        ESP_LOGD(HTTP_TAG, "HTTP_EVENT_ON_CONNECTED");
+        break;
+    case HTTP_EVENT_HEADER_SENT:
+        ESP_LOGD(HTTP_TAG, "HTTP_EVENT_HEADER_SENT");
+        break;
+    case HTTP_EVENT_ON_HEADER:
+        ESP_LOGD(HTTP_TAG, "HTTP_EVENT_ON_HEADER, key=%s, value=%s", evt->header_key, evt->header_value);
+        break;
+    case HTTP_EVENT_ON_DATA:
+        ESP_LOGD(HTTP_TAG, "HTTP_EVENT_ON_DATA, len=%d", evt->data_len);
+        break;
+    case HTTP_EVENT_ON_FINISH:
+        ESP_LOGD(HTTP_TAG, "HTTP_EVENT_ON_FINISH");
+        break;
+    case HTTP_EVENT_DISCONNECTED:
+        ESP_LOGD(HTTP_TAG, "HTTP_EVENT_DISCONNECTED");
+        break;
+    case HTTP_EVENT_REDIRECT:
+        ESP_LOGD(HTTP_TAG, "HTTP_EVENT_REDIRECT");
+        break;
+    }
+    return ESP_OK;
+}
+
+
+static void hex_encode(const uint8_t *in, size_t len, char *out)
+{
+    for (size_t i = 0; i < len; i++) {
+        sprintf(out + i * 2, "%02x", in[i]);
+    }
+}
+
+
+// Compare the server's manifest for the image with what is running before
+// transferring anything. The running image's SHA-256 is sent as
+// If-None-Match, so re-issuing an upgrade to a device that already has it
+// costs a 304 rather than the image. Returns ESP_ERR_INVALID_STATE when
+// there is nothing to do, expected_size is 0 if the server has no manifest.
+static esp_err_t check_manifest(const esp_http_client_config_t *config, uint32_t *expected_size)
+{
+    *expected_size = 0;
+
+    char url[OTA_URL_MAX + sizeof(OTA_MANIFEST_SUFFIX)];
+    snprintf(url, sizeof(url), "%s" OTA_MANIFEST_SUFFIX, ota_url);
+
+    uint8_t sha[OTA_SHA256_LEN];
+    char running_sha[OTA_SHA256_LEN * 2 + 1];
+    char etag[sizeof(running_sha) + 2];
+    esp_err_t err = esp_partition_get_sha256(esp_ota_get_running_partition(), sha);
+    if (err != ESP_OK) {
+        return err;
+    }
+    hex_encode(sha, sizeof(sha), running_sha);
+    snprintf(etag, sizeof(etag), "\"%s\"", running_sha);
+
+    esp_http_client_config_t manifest_config = *config;
+    manifest_config.url = url;
+    esp_http_client_handle_t client = esp_http_client_init(&manifest_config);
+    if (client == NULL) {
+        return ESP_ERR_NO_MEM;
+    }
+    esp_http_client_set_header(client, "If-None-Match", etag);
+
+    int status = 0;
+    int len = 0;
+    err = esp_http_client_open(client, 0);
+    if (err == ESP_OK) {
+        esp_http_client_fetch_headers(client);
+        status = esp_http_client_get_status_code(client);
+        if (status == 200) {
+            len = esp_http_client_read_response(client, manifest_body, OTA_MANIFEST_MAX);
+        }
+    }
+    esp_http_client_close(client);
+    esp_http_client_cleanup(client);
+    if (err != ESP_OK) {
+        return err;
+    }
+
+    if (status == 304) {
+        ESP_LOGI(OTA_TAG, "Server image matches the running one, nothing to download");
+        return ESP_ERR_INVALID_STATE;
+    }
+    if (status != 200 || len <= 0) {
+        // Older server without manifests
+        ESP_LOGW(OTA_TAG, "No manifest (HTTP %d), downloading unconditionally", status);
+        return ESP_OK;
+    }
+    manifest_body[len] = '\0';
+
+    cJSON *manifest = cJSON_Parse(manifest_body);
+    const cJSON *version = cJSON_GetObjectItem(manifest, "version");
+    const cJSON *size = cJSON_GetObjectItem(manifest, "size");
+    const cJSON *sha256 = cJSON_GetObjectItem(manifest, "sha256");
+    const cJSON *chip_id = cJSON_GetObjectItem(manifest, "chip_id");
+    const cJSON *project = cJSON_GetObjectItem(manifest, "project");
+    const esp_partition_t *target = esp_ota_get_next_update_partition(NULL);
+
+    if (!cJSON_IsString(version) || !cJSON_IsNumber(size) || !cJSON_IsString(sha256)) {
+        ESP_LOGE(OTA_TAG, "Malformed manifest");
+        err = ESP_ERR_INVALID_RESPONSE;
+    } else if (strcmp(sha256->valuestring, running_sha) == 0 || strcmp(version->valuestring, CONFIG_DEVICE_FIRMWARE_VERSION) == 0) {
+        ESP_LOGI(OTA_TAG, "Already running %s, skipping %d byte download", version->valuestring, size->valueint);
+        err = ESP_ERR_INVALID_STATE;
+    } else if ((cJSON_IsNumber(chip_id) && chip_id->valueint != CONFIG_IDF_FIRMWARE_CHIP_ID) ||
+               (cJSON_IsString(project) && strcmp(project->valuestring, esp_app_get_description()->project_name) != 0)) {
+        ESP_LOGE(OTA_TAG, "Image %s is not built for this hardware", version->valuestring);
+        err = ESP_ERR_NOT_SUPPORTED;
+    } else if (target == NULL || size->valueint <= 0 || (uint32_t)size->valueint > target->size) {
+        ESP_LOGE(OTA_TAG, "Image of %d bytes doesn't fit the OTA slot", size->valueint);
+        err = ESP_ERR_INVALID_SIZE;
+    } else {
+        ESP_LOGI(OTA_TAG, "Updating %s -> %s (%d bytes)", CONFIG_DEVICE_FIRMWARE_VERSION, version->valuestring, size->valueint);
+        *expected_size = size->valueint;
+    }
+    cJSON_Delete(manifest);
+    return err;
+}
+
+
+// Hold off while a vehicle is being timed, returns how long we waited
+static int64_t wait_until_idle(void)
+{
+    int64_t start_us = esp_timer_get_time();
+    while (ota_busy != NULL && ota_busy()) {
+        vTaskDelay(pdMS_TO_TICKS(OTA_PAUSE_POLL_MS));
+    }
+    int64_t waited_us = esp_timer_get_time() - start_us;
+    paused_ms += waited_us / 1000;
+    return waited_us;
+}
+
+
+static esp_err_t download(esp_https_ota_handle_t handle)
+{
+    // Byte budget runs from here, pauses don't count against it
+    int64_t budget_start_us = esp_timer_get_time();
+    while (true) {
+        budget_start_us += wait_until_idle();
+
+        esp_err_t err = esp_https_ota_perform(handle);
+        if (err != ESP_ERR_HTTPS_OTA_IN_PROGRESS) {
+            return err;
+        }
+        int len = esp_https_ota_get_image_len_read(handle);
+        bytes_read = len > 0 ? len : 0;
+
+        // Sleep until this many bytes are within CONFIG_OTA_MAX_KBPS, and at
+        // least a tick so each flash write is followed by a gap
+        int64_t due_us = budget_start_us + (int64_t)bytes_read * 1000000 / (CONFIG_OTA_MAX_KBPS * 1024);
+        int64_t ahead_ms = (due_us - esp_timer_get_time()) / 1000;
+        TickType_t delay = ahead_ms > 0 ? pdMS_TO_TICKS(ahead_ms) : 0;
+        vTaskDelay(delay > 0 ? delay : 1);
+    }
+}
+
+
+static void ota_update_task(void *pvParameters)
+{
+    esp_http_client_config_t config = {
+        .url = ota_url,
+        .cert_pem = server_ca_pem_start,
+        .event_handler = http_event_handler,
+        .keep_alive_enable = true,
+        .buffer_size = OTA_HTTP_BUFFER,
+#if CONFIG_ESP_TLS_CLIENT_SESSION_TICKETS
+        // Resume rather than renegotiate when the download reconnects
+        .save_client_session = true,
+#endif
+    };
+    config.skip_cert_common_name_check = true;
+
+    esp_https_ota_config_t ota_config = {
+        .http_config = &config,
+        // Erase sector by sector as the image arrives, not the whole slot up front
+        .bulk_flash_erase = false,
+    };
+
+    uint32_t expected_size;
+    esp_err_t err = check_manifest(&config, &expected_size);
+    if (err == ESP_ERR_INVALID_STATE) {
+        in_progress = false;
+        vTaskDelete(NULL);
+    }
+
+    int64_t start_us = esp_timer_get_time();
+    esp_https_ota_handle_t handle = NULL;
+    if (err == ESP_OK) {
+        ESP_LOGI(OTA_TAG, "Downloading update from %s at up to %d kB/s", ota_url, CONFIG_OTA_MAX_KBPS);
+        err = esp_https_ota_begin(&ota_config, &handle);
+    }
+    if (err == ESP_OK) {
+        int size = esp_https_ota_get_image_size(handle);
+        image_size = size > 0 ? size : 0;
+        // The image changed on the server since the manifest was read
+        if (expected_size != 0 && image_size != expected_size) {
+            err = ESP_ERR_INVALID_SIZE;
+        } else {
+            err = download(handle);
+        }
+        if (err == ESP_OK && !esp_https_ota_is_complete_data_received(handle)) {
+            err = ESP_ERR_INVALID_SIZE;
+        }
+        if (err == ESP_OK) {
+            err = esp_https_ota_finish(handle);
+        } else {
+            esp_https_ota_abort(handle);
+        }
+    }
+
+    if (err == ESP_OK) {
+        ESP_LOGI(OTA_TAG, "OTA Succeed, %" PRIu32 " bytes in %lld s (%" PRIu32 " ms paused), Rebooting...",
+                 bytes_read, (esp_timer_get_time() - start_us) / 1000000, paused_ms);
+        esp_restart();
+    }
+    ESP_LOGE(OTA_TAG, "Firmware upgrade failed: %s", esp_err_to_name(err));
+    in_progress = false;
+    vTaskDelete(NULL);
+}
+
+
+void ota_update_init(ota_busy_fn_t busy)
+{
+    ota_busy = busy;
+
+    esp_ota_img_states_t state;
+    const esp_partition_t *running = esp_ota_get_running_partition();
+    if (esp_ota_get_state_partition(running, &state) == ESP_OK && state == ESP_OTA_IMG_PENDING_VERIFY) {
+        pending_verify = true;
+        verify_deadline_us = esp_timer_get_time() + (int64_t)CONFIG_OTA_HEALTH_TIMEOUT_S * 1000000;
+        ESP_LOGW(OTA_TAG, "New image on %s, pending health check", running->label);
+    }
+}
+
+
+esp_err_t ota_update_start(const char *url, UBaseType_t priority, BaseType_t core)
+{
+    if (in_progress) {
+        return ESP_ERR_INVALID_STATE;
+    }
+    if (strlen(url) >= sizeof(ota_url)) {
+        return ESP_ERR_INVALID_ARG;
+    }
+    strcpy(ota_url, url);
+    in_progress = true;
+    bytes_read = 0;
+    image_size = 0;
+    paused_ms = 0;
+    // TLS and the HTTP client need the deep stack
+    if (xTaskCreatePinnedToCore(&ota_update_task, "upgrade_firmware", 8192, NULL, priority, NULL, core) != pdPASS) {
+        in_progress = false;
+        return ESP_ERR_NO_MEM;
+    }
+    return ESP_OK;
+}
+
+
+bool ota_update_in_progress(void)
+{
+    return in_progress;
+}
+
+
+void ota_update_report_health(bool healthy)
+{
+    if (!pending_verify) {
+        return;
+    }
+    if (healthy) {
+        ESP_LOGI(OTA_TAG, "Health check passed, keeping the new image");
+        esp_ota_mark_app_valid_cancel_rollback();
+        pending_verify = false;
+    } else if (esp_timer_get_time() >= verify_deadline_us) {
+        ESP_LOGE(OTA_TAG, "Health check failed for %d s, rolling back", CONFIG_OTA_HEALTH_TIMEOUT_S);
+        esp_ota_mark_app_invalid_rollback_and_reboot();
+    }
+}
+
+
+void ota_update_get_stats(ota_update_stats_t *stats)
+{
+    stats->active = in_progress;
+    stats->bytes_read = bytes_read;
+    stats->image_size = image_size;
+    stats->paused_ms = paused_ms;
+}
@@ -0,0 +1,62 @@
+#ifndef __OTA_UPDATE_H__
+#define __OTA_UPDATE_H__
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#include "freertos/FreeRTOS.h"
+#include "esp_err.h"
+
+/*
+ * Background firmware download into the inactive OTA slot. The image is
+ * fetched and written a chunk at a time at low priority, paced to
+ * CONFIG_OTA_MAX_KBPS, and held while the busy callback says a vehicle is
+ * being timed, so sensing carries on at full rate.
+ *
+ * Before any of the image is transferred, <url>.manifest is fetched from
+ * the server and compared with the running image's version, SHA-256 and
+ * hardware, so a re-issued upgrade is skipped by devices that have it.
+ *
+ * A new image boots pending verification and is only kept once
+ * ota_update_report_health() has seen it healthy. Otherwise it is rolled
+ * back after CONFIG_OTA_HEALTH_TIMEOUT_S.
+ */
+typedef bool (*ota_busy_fn_t)(void);
+
+typedef struct
+{
+    bool active;                //!< Download in progress
+    uint32_t bytes_read;        //!< Image bytes written so far
+    uint32_t image_size;        //!< 0 until known
+    uint32_t paused_ms;         //!< Time spent held by the busy callback
+} ota_update_stats_t;
+
+
+/**
+ * @brief Check whether this boot is a new image on probation
+ */
+void ota_update_init(ota_busy_fn_t busy);
+
+
+/**
+ * @brief Start downloading url in the background
+ *
+ * @return ESP_ERR_INVALID_STATE if a download is already running
+ */
+esp_err_t ota_update_start(const char *url, UBaseType_t priority, BaseType_t core);
+
+
+bool ota_update_in_progress(void);
+
+
+/**
+ * @brief Confirm or, past the deadline, roll back an image on probation
+ *
+ * Call periodically, does nothing once the image is confirmed.
+ */
+void ota_update_report_health(bool healthy);
+
+
+void ota_update_get_stats(ota_update_stats_t *stats);
+
+#endif /* __OTA_UPDATE_H__ */
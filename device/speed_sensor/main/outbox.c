@@ -0,0 +1,87 @@
+#include <string.h>
+
+#include "outbox.h"
+
+
+static void ring_write(outbox_t *outbox, size_t offset, const uint8_t *data, size_t len)
+{
+    offset %= outbox->capacity;
+    size_t first = outbox->capacity - offset;
+    if (first > len) {
+        first = len;
+    }
+    memcpy(outbox->buf + offset, data, first);
+    memcpy(outbox->buf, data + first, len - first);
+}
+
+
+static void ring_read(const outbox_t *outbox, size_t offset, uint8_t *data, size_t len)
+{
+    offset %= outbox->capacity;
+    size_t first = outbox->capacity - offset;
+    if (first > len) {
+        first = len;
+    }
+    memcpy(data, outbox->buf + offset, first);
+    memcpy(data + first, outbox->buf, len - first);
+}
+
+
+static size_t head_len(const outbox_t *outbox)
+{
+    uint8_t header[OUTBOX_HEADER_SIZE];
+    ring_read(outbox, outbox->head, header, sizeof(header));
+    return header[0] | (header[1] << 8);
+}
+
+
+void outbox_init(outbox_t *outbox, uint8_t *buf, size_t capacity)
+{
+    outbox->buf = buf;
+    outbox->capacity = capacity;
+    outbox->head = 0;
+    outbox->used = 0;
+    outbox->count = 0;
+}
+
+
+bool outbox_push(outbox_t *outbox, const void *msg, size_t len)
+{
+    if (len > UINT16_MAX || len + OUTBOX_HEADER_SIZE > outbox_free(outbox)) {
+        return false;
+    }
+
+    uint8_t header[OUTBOX_HEADER_SIZE] = { len & 0xFF, len >> 8 };
+    size_t tail = outbox->head + outbox->used;
+    ring_write(outbox, tail, header, sizeof(header));
+    ring_write(outbox, tail + OUTBOX_HEADER_SIZE, msg, len);
+    outbox->used += len + OUTBOX_HEADER_SIZE;
+    outbox->count++;
+    return true;
+}
+
+
+size_t outbox_peek(const outbox_t *outbox, void *out, size_t out_capacity)
+{
+    if (outbox->count == 0) {
+        return 0;
+    }
+    size_t len = head_len(outbox);
+    if (len > out_capacity) {
+        return 0;
+    }
+    ring_read(outbox, outbox->head + OUTBOX_HEADER_SIZE, out, len);
+    return len;
+}
+
+
+void outbox_pop(outbox_t *outbox)
+{
+    if (outbox->count == 0) {
+        return;
+    }
+    size_t len = head_len(outbox) + OUTBOX_HEADER_SIZE;
+    outbox->head = (outbox->head + len) % outbox->capacity;
+    outbox->used -= len;
+    outbox->count--;
+}
@@ -0,0 +1,52 @@
+#ifndef __OUTBOX_H__
+#define __OUTBOX_H__
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+/*
+ * FIFO of variable-length messages in a fixed, caller-provided byte buffer.
+ * Each message costs its length plus a 2 byte header. What to do when a
+ * message doesn't fit is left to the caller.
+ *
+ * Plain C with no ESP-IDF dependencies so it can be exercised on a host.
+ */
+#define OUTBOX_HEADER_SIZE 2
+
+typedef struct
+{
+    uint8_t *buf;
+    size_t capacity;
+    size_t head;    //!< Offset of the oldest message
+    size_t used;    //!< Bytes in use, headers included
+    size_t count;   //!< Messages queued
+} outbox_t;
+
+
+void outbox_init(outbox_t *outbox, uint8_t *buf, size_t capacity);
+
+
+/**
+ * @return false if the message does not fit in the free space
+ */
+bool outbox_push(outbox_t *outbox, const void *msg, size_t len);
+
+
+/**
+ * @brief Copy the oldest message without removing it
+ *
+ * @return Length of the message, 0 if the outbox is empty or it doesn't fit in `out`
+ */
+size_t outbox_peek(const outbox_t *outbox, void *out, size_t out_capacity);
+
+
+void outbox_pop(outbox_t *outbox);
+
+
+static inline size_t outbox_free(const outbox_t *outbox)
+{
+    return outbox->capacity - outbox->used;
+}
+
+#endif /* __OUTBOX_H__ */
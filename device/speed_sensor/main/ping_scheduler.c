@@ -0,0 +1,84 @@
+#include <string.h>
+
+#include "ping_scheduler.h"
+
+
+static int popcount32(uint32_t x)
+{
+    int count = 0;
+    while (x) {
+        x &= x - 1;
+        count++;
+    }
+    return count;
+}
+
+
+int ping_schedule_build(ping_schedule_t *schedule, const uint32_t *conflicts, size_t sensor_count)
+{
+    if (sensor_count == 0 || sensor_count > PING_SCHEDULER_MAX_SENSORS) {
+        return -1;
+    }
+
+    // Symmetric adjacency, without self loops
+    uint32_t adjacency[PING_SCHEDULER_MAX_SENSORS] = { 0 };
+    for (size_t i = 0; i < sensor_count; i++) {
+        for (size_t j = 0; j < sensor_count; j++) {
+            if (i != j && (conflicts[i] & (1u << j))) {
+                adjacency[i] |= 1u << j;
+                adjacency[j] |= 1u << i;
+            }
+        }
+    }
+
+    // Welsh-Powell: colour the most constrained sensors first
+    size_t order[PING_SCHEDULER_MAX_SENSORS];
+    for (size_t i = 0; i < sensor_count; i++) {
+        order[i] = i;
+    }
+    for (size_t i = 1; i < sensor_count; i++) {
+        size_t sensor = order[i];
+        size_t j = i;
+        while (j > 0 && popcount32(adjacency[order[j - 1]]) < popcount32(adjacency[sensor])) {
+            order[j] = order[j - 1];
+            j--;
+        }
+        order[j] = sensor;
+    }
+
+    memset(schedule, 0, sizeof(*schedule));
+    for (size_t i = 0; i < sensor_count; i++) {
+        size_t sensor = order[i];
+        size_t slot = 0;
+        while (slot < schedule->slot_count && (schedule->slots[slot] & adjacency[sensor])) {
+            slot++;
+        }
+        if (slot == schedule->slot_count) {
+            schedule->slot_count++;
+        }
+        schedule->slots[slot] |= 1u << sensor;
+    }
+
+    return 0;
+}
+
+
+uint32_t ping_schedule_cycle_us(const ping_schedule_t *schedule, const ping_timing_t *timing)
+{
+    // Every slot waits for the slowest echo in it, which is the full window at worst
+    return schedule->slot_count * (timing->trigger_us + timing->echo_window_us + timing->guard_us);
+}
+
+
+uint32_t ping_schedule_pings_per_s(const ping_schedule_t *schedule, const ping_timing_t *timing, size_t sensor_count)
+{
+    uint32_t cycle_us = ping_schedule_cycle_us(schedule, timing);
+    return cycle_us ? (uint32_t)((uint64_t)sensor_count * 1000000 / cycle_us) : 0;
+}
+
+
+uint32_t ping_schedule_poll_period_ms(const ping_schedule_t *schedule, const ping_timing_t *timing, uint32_t requested_ms)
+{
+    uint32_t cycle_ms = (ping_schedule_cycle_us(schedule, timing) + 999) / 1000;
+    return requested_ms < cycle_ms ? cycle_ms : requested_ms;
+}
@@ -0,0 +1,65 @@
+#ifndef __PING_SCHEDULER_H__
+#define __PING_SCHEDULER_H__
+
+#include <stddef.h>
+#include <stdint.h>
+
+/*
+ * Groups rangefinders into firing slots so that no two sensors whose beams
+ * can interfere are ever pinged together, with as few slots as possible.
+ * Sensors in the same slot are triggered at once and their echoes timed in
+ * parallel, so the cycle time is the number of slots rather than sensors.
+ *
+ * Plain C with no ESP-IDF dependencies so the schedule and its throughput
+ * can be evaluated on a host.
+ */
+#define PING_SCHEDULER_MAX_SENSORS 16
+
+typedef struct
+{
+    size_t slot_count;
+    uint32_t slots[PING_SCHEDULER_MAX_SENSORS]; //!< Bitmask of sensors fired in each slot
+} ping_schedule_t;
+
+/*
+ * Timing model of one ping: the echo window (round trip at maximum range)
+ * plus a guard time for stray echoes to die down before the next slot.
+ */
+typedef struct
+{
+    uint32_t trigger_us;
+    uint32_t echo_window_us;
+    uint32_t guard_us;
+} ping_timing_t;
+
+
+/**
+ * @brief Build a conflict-free schedule
+ *
+ * @param conflicts Per sensor, bitmask of the sensors it interferes with.
+ *                  Need not be symmetric, a conflict in either direction counts.
+ * @return 0 on success, -1 if sensor_count is out of range
+ */
+int ping_schedule_build(ping_schedule_t *schedule, const uint32_t *conflicts, size_t sensor_count);
+
+
+/**
+ * @brief Worst-case duration of one cycle through all slots
+ */
+uint32_t ping_schedule_cycle_us(const ping_schedule_t *schedule, const ping_timing_t *timing);
+
+
+/**
+ * @brief Worst-case aggregate pings per second over all sensors
+ */
+uint32_t ping_schedule_pings_per_s(const ping_schedule_t *schedule, const ping_timing_t *timing, size_t sensor_count);
+
+
+/**
+ * @brief Poll period the cycle fits in
+ *
+ * @return requested_ms, or the cycle time rounded up to whole ms if that is longer
+ */
+uint32_t ping_schedule_poll_period_ms(const ping_schedule_t *schedule, const ping_timing_t *timing, uint32_t requested_ms);
+
+#endif /* __PING_SCHEDULER_H__ */
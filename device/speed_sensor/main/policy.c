@@ -0,0 +1,193 @@
+#include <string.h>
+#include <stdbool.h>
+#include <inttypes.h>
+
+#include "freertos/FreeRTOS.h"
+#include "esp_log.h"
+#include "nvs.h"
+
+#include "policy.h"
+
+#define POLICY_NVS_NAMESPACE "policy"
+#define POLICY_NVS_KEY "active"
+
+static const char *POLICY_TAG = "POLICY";
+
+static portMUX_TYPE policy_mux = portMUX_INITIALIZER_UNLOCKED;
+static detection_policy_t active_policy = {
+    .version = 0,
+    .speed_threshold_cm_s = POLICY_DEFAULT_SPEED_THRESHOLD_CM_S,
+    .max_distance_cm = POLICY_DEFAULT_MAX_DISTANCE_CM,
+    .sensor_distance_cm = POLICY_DEFAULT_SENSOR_DISTANCE_CM,
+    .poll_period_ms = POLICY_DEFAULT_POLL_PERIOD_MS,
+    .report_interval_s = POLICY_DEFAULT_REPORT_INTERVAL_S,
+    .heartbeat_interval_s = POLICY_DEFAULT_HEARTBEAT_INTERVAL_S,
+    .temperature_dc = POLICY_DEFAULT_TEMPERATURE_DC,
+};
+
+
+static uint16_t crc16_ccitt(const uint8_t *data, size_t len)
+{
+    uint16_t crc = 0xFFFF;
+    for (size_t i = 0; i < len; i++) {
+        crc ^= (uint16_t)data[i] << 8;
+        for (int bit = 0; bit < 8; bit++) {
+            crc = (crc & 0x8000) ? (crc << 1) ^ 0x1021 : crc << 1;
+        }
+    }
+    return crc;
+}
+
+
+static uint16_t get_u16(const uint8_t *p)
+{
+    return p[0] | (p[1] << 8);
+}
+
+
+static void put_u16(uint8_t *p, uint16_t v)
+{
+    p[0] = v & 0xFF;
+    p[1] = v >> 8;
+}
+
+
+static bool in_range(uint16_t value, uint16_t min, uint16_t max)
+{
+    return value >= min && value <= max;
+}
+
+
+esp_err_t policy_decode(const uint8_t *blob, size_t len, detection_policy_t *out)
+{
+    bool v1 = len == POLICY_BLOB_V1_SIZE && blob[2] == 1;
+    bool v2 = len == POLICY_BLOB_V2_SIZE && blob[2] == 2;
+    if (len < 3 || blob[0] != 'W' || blob[1] != 'P' || !(v1 || v2 || (len == POLICY_BLOB_SIZE && blob[2] == POLICY_BLOB_FORMAT))) {
+        return ESP_ERR_POLICY_FORMAT;
+    }
+    if (crc16_ccitt(blob, len - 2) != get_u16(&blob[len - 2])) {
+        return ESP_ERR_POLICY_CRC;
+    }
+
+    detection_policy_t policy = {
+        .version = blob[4] | (blob[5] << 8) | (blob[6] << 16) | ((uint32_t)blob[7] << 24),
+        .speed_threshold_cm_s = get_u16(&blob[8]),
+        .max_distance_cm = get_u16(&blob[10]),
+        .sensor_distance_cm = get_u16(&blob[12]),
+        .poll_period_ms = get_u16(&blob[14]),
+        .report_interval_s = get_u16(&blob[16]),
+        .heartbeat_interval_s = v1 ? POLICY_DEFAULT_HEARTBEAT_INTERVAL_S : get_u16(&blob[18]),
+        .temperature_dc = v1 || v2 ? POLICY_DEFAULT_TEMPERATURE_DC : (int16_t)get_u16(&blob[20]),
+    };
+    if (v1 && policy.heartbeat_interval_s < policy.report_interval_s) {
+        policy.heartbeat_interval_s = policy.report_interval_s;
+    }
+
+    if (!in_range(policy.speed_threshold_cm_s, 1, 10000) ||
+        !in_range(policy.max_distance_cm, 2, 500) ||
+        !in_range(policy.sensor_distance_cm, 1, 1000) ||
+        !in_range(policy.poll_period_ms, 10, 1000) ||
+        !in_range(policy.report_interval_s, 1, 3600) ||
+        (policy.heartbeat_interval_s != 0 && policy.heartbeat_interval_s < policy.report_interval_s) ||
+        policy.temperature_dc < -400 || policy.temperature_dc > 600) {
+        return ESP_ERR_POLICY_RANGE;
+    }
+
+    *out = policy;
+    return ESP_OK;
+}
+
+
+void policy_encode(const detection_policy_t *policy, uint8_t *blob)
+{
+    blob[0] = 'W';
+    blob[1] = 'P';
+    blob[2] = POLICY_BLOB_FORMAT;
+    blob[3] = 0;
+    blob[4] = policy->version & 0xFF;
+    blob[5] = (policy->version >> 8) & 0xFF;
+    blob[6] = (policy->version >> 16) & 0xFF;
+    blob[7] = policy->version >> 24;
+    put_u16(&blob[8], policy->speed_threshold_cm_s);
+    put_u16(&blob[10], policy->max_distance_cm);
+    put_u16(&blob[12], policy->sensor_distance_cm);
+    put_u16(&blob[14], policy->poll_period_ms);
+    put_u16(&blob[16], policy->report_interval_s);
+    put_u16(&blob[18], policy->heartbeat_interval_s);
+    put_u16(&blob[20], (uint16_t)policy->temperature_dc);
+    put_u16(&blob[22], crc16_ccitt(blob, POLICY_BLOB_SIZE - 2));
+}
+
+
+void policy_init(void)
+{
+    nvs_handle_t nvs;
+    if (nvs_open(POLICY_NVS_NAMESPACE, NVS_READONLY, &nvs) != ESP_OK) {
+        ESP_LOGI(POLICY_TAG, "No stored policy, using defaults");
+        return;
+    }
+
+    uint8_t blob[POLICY_BLOB_SIZE];
+    size_t len = sizeof(blob);
+    detection_policy_t policy;
+    if (nvs_get_blob(nvs, POLICY_NVS_KEY, blob, &len) == ESP_OK && policy_decode(blob, len, &policy) == ESP_OK) {
+        portENTER_CRITICAL(&policy_mux);
+        active_policy = policy;
+        portEXIT_CRITICAL(&policy_mux);
+        ESP_LOGI(POLICY_TAG, "Loaded policy v%" PRIu32 " from NVS", policy.version);
+    } else {
+        ESP_LOGW(POLICY_TAG, "Stored policy invalid, using defaults");
+    }
+    nvs_close(nvs);
+}
+
+
+void policy_get(detection_policy_t *out)
+{
+    portENTER_CRITICAL(&policy_mux);
+    *out = active_policy;
+    portEXIT_CRITICAL(&policy_mux);
+}
+
+
+esp_err_t policy_apply_blob(const uint8_t *blob, size_t len)
+{
+    detection_policy_t policy;
+    esp_err_t err = policy_decode(blob, len, &policy);
+    if (err != ESP_OK) {
+        ESP_LOGW(POLICY_TAG, "Rejected policy blob: 0x%x", err);
+        return err;
+    }
+
+    portENTER_CRITICAL(&policy_mux);
+    if (policy.version <= active_policy.version) {
+        err = ESP_ERR_POLICY_STALE;
+    } else {
+        active_policy = policy;
+    }
+    portEXIT_CRITICAL(&policy_mux);
+
+    if (err != ESP_OK) {
+        return err;
+    }
+
+    ESP_LOGI(POLICY_TAG, "Applied policy v%" PRIu32 ": threshold=%u cm/s max=%u cm gap=%u cm poll=%u ms report=%u s heartbeat=%u s temperature=%.1f C",
+             policy.version, policy.speed_threshold_cm_s, policy.max_distance_cm,
+             policy.sensor_distance_cm, policy.poll_period_ms, policy.report_interval_s, policy.heartbeat_interval_s,
+             policy.temperature_dc / 10.0);
+
+    nvs_handle_t nvs;
+    err = nvs_open(POLICY_NVS_NAMESPACE, NVS_READWRITE, &nvs);
+    if (err == ESP_OK) {
+        err = nvs_set_blob(nvs, POLICY_NVS_KEY, blob, len);
+        if (err == ESP_OK) {
+            err = nvs_commit(nvs);
+        }
+        nvs_close(nvs);
+    }
+    if (err != ESP_OK) {
+        // Still running with the new policy, it just won't survive a reboot
+        ESP_LOGE(POLICY_TAG, "Failed to persist policy: %s", esp_err_to_name(err));
+    }
+    return ESP_OK;
+}
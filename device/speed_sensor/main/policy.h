@@ -0,0 +1,104 @@
+#ifndef __POLICY_H__
+#define __POLICY_H__
+
+#include <stdint.h>
+#include <stddef.h>
+#include <esp_err.h>
+
+#include "sdkconfig.h"
+
+// Compile-time defaults, used until a policy has been received over MQTT
+#define POLICY_DEFAULT_SPEED_THRESHOLD_CM_S 50
+#define POLICY_DEFAULT_MAX_DISTANCE_CM      60
+#define POLICY_DEFAULT_SENSOR_DISTANCE_CM   10 // Distance between sensors in cm
+#define POLICY_DEFAULT_POLL_PERIOD_MS       20
+#define POLICY_DEFAULT_REPORT_INTERVAL_S    5
+#define POLICY_DEFAULT_HEARTBEAT_INTERVAL_S 300
+#define POLICY_DEFAULT_TEMPERATURE_DC       (CONFIG_AMBIENT_TEMPERATURE_C * 10)
+
+/*
+ * Wire format of the policy blob (little endian, 24 bytes):
+ *
+ *   0  'W' 'P'                  magic
+ *   2  u8   format              POLICY_BLOB_FORMAT
+ *   3  u8   reserved            0
+ *   4  u32  version             monotonically increasing policy version
+ *   8  u16  speed_threshold_cm_s
+ *  10  u16  max_distance_cm
+ *  12  u16  sensor_distance_cm
+ *  14  u16  poll_period_ms
+ *  16  u16  report_interval_s
+ *  18  u16  heartbeat_interval_s  quiet windows are held back up to this long,
+ *                               0 reports every window
+ *  20  i16  temperature_dc      air temperature in tenths of a degree C, for
+ *                               the speed of sound
+ *  22  u16  crc                 CRC-16/CCITT-FALSE over bytes 0..21
+ *
+ * Format 2 blobs (22 bytes, no temperature_dc, crc at 20) and format 1 blobs
+ * (20 bytes, no heartbeat_interval_s either, crc at 18) are still accepted
+ * and get the defaults for what they lack.
+ */
+#define POLICY_BLOB_FORMAT 3
+#define POLICY_BLOB_SIZE   24
+#define POLICY_BLOB_V2_SIZE 22
+#define POLICY_BLOB_V1_SIZE 20
+
+#define ESP_ERR_POLICY_FORMAT   0x300
+#define ESP_ERR_POLICY_CRC      0x301
+#define ESP_ERR_POLICY_RANGE    0x302
+#define ESP_ERR_POLICY_STALE    0x303
+
+typedef struct
+{
+    uint32_t version;
+    uint16_t speed_threshold_cm_s;
+    uint16_t max_distance_cm;
+    uint16_t sensor_distance_cm;
+    uint16_t poll_period_ms;
+    uint16_t report_interval_s;
+    uint16_t heartbeat_interval_s;
+    int16_t temperature_dc;
+} detection_policy_t;
+
+
+/**
+ * @brief Decode and validate a policy blob, without applying it
+ *
+ * @return `ESP_OK` on success, otherwise one of the `ESP_ERR_POLICY_*` codes
+ */
+esp_err_t policy_decode(const uint8_t *blob, size_t len, detection_policy_t *out);
+
+
+/**
+ * @brief Encode a policy into its wire format
+ *
+ * @param[out] blob Buffer of at least POLICY_BLOB_SIZE bytes
+ */
+void policy_encode(const detection_policy_t *policy, uint8_t *blob);
+
+
+/**
+ * @brief Load the persisted policy from NVS, falling back to the defaults
+ */
+void policy_init(void);
+
+
+/**
+ * @brief Copy the active policy
+ *
+ * Tasks call this once per iteration, so a new policy takes effect on their
+ * next loop without restarting them.
+ */
+void policy_get(detection_policy_t *out);
+
+
+/**
+ * @brief Validate a received blob, apply it atomically and persist it in NVS
+ *
+ * Blobs with a version not newer than the active one are rejected with
+ * ESP_ERR_POLICY_STALE, so a retained message redelivered on reconnect is a
+ * no-op.
+ */
+esp_err_t policy_apply_blob(const uint8_t *blob, size_t len);
+
+#endif /* __POLICY_H__ */
@@ -0,0 +1,118 @@
+#include <string.h>
+
+#include "range_filter.h"
+
+// Speed of sound is 331.4 m/s at 0 C and rises by 0.6 m/s per degree
+#define SOUND_MM_S_AT_0C 331400
+#define SOUND_MM_S_PER_DC 60
+
+// Tracker gains, Q8
+#define ALPHA_Q8 128
+#define BETA_Q8 32
+
+
+void range_scale_init(range_scale_t *scale, int16_t temperature_dc)
+{
+    scale->mm_per_us_q16 = 0;
+    scale->temperature_dc = temperature_dc + 1;
+    range_scale_set_temperature(scale, temperature_dc);
+}
+
+
+void range_scale_set_temperature(range_scale_t *scale, int16_t temperature_dc)
+{
+    if (temperature_dc == scale->temperature_dc && scale->mm_per_us_q16 != 0) {
+        return;
+    }
+    int64_t sound_mm_s = SOUND_MM_S_AT_0C + (int64_t)SOUND_MM_S_PER_DC * temperature_dc;
+    // Halved for the round trip
+    scale->mm_per_us_q16 = (uint32_t)((sound_mm_s << 16) / 2000000);
+    scale->temperature_dc = temperature_dc;
+}
+
+
+void range_filter_init(range_filter_t *filter, uint16_t gate_us)
+{
+    memset(filter, 0, sizeof(*filter));
+    filter->gate_us = gate_us;
+}
+
+
+static uint32_t window_median(const range_filter_t *filter)
+{
+    // Insertion sort of at most RANGE_FILTER_WINDOW values
+    uint16_t sorted[RANGE_FILTER_WINDOW];
+    for (uint8_t i = 0; i < filter->filled; i++) {
+        uint16_t value = filter->window[i];
+        uint8_t j = i;
+        while (j > 0 && sorted[j - 1] > value) {
+            sorted[j] = sorted[j - 1];
+            j--;
+        }
+        sorted[j] = value;
+    }
+    return sorted[filter->filled / 2];
+}
+
+
+static uint32_t window_max(const range_filter_t *filter)
+{
+    uint16_t highest = 0;
+    for (uint8_t i = 0; i < filter->filled; i++) {
+        highest = filter->window[i] > highest ? filter->window[i] : highest;
+    }
+    return highest;
+}
+
+
+uint32_t range_filter_update(range_filter_t *filter, uint32_t time_us)
+{
+    if (time_us > UINT16_MAX) {
+        time_us = UINT16_MAX;
+    }
+    filter->window[filter->next] = time_us;
+    filter->next = (filter->next + 1) % RANGE_FILTER_WINDOW;
+    if (filter->filled < RANGE_FILTER_WINDOW) {
+        filter->filled++;
+    }
+
+    int32_t z_q4 = (int32_t)window_median(filter) << 4;
+    if (!filter->tracking) {
+        filter->x_q4 = z_q4;
+        filter->v_q4 = 0;
+        filter->tracking = true;
+        return z_q4 >> 4;
+    }
+
+    int32_t predicted_q4 = filter->x_q4 + filter->v_q4;
+    int32_t residual_q4 = z_q4 - predicted_q4;
+    int32_t deviation_q4 = residual_q4 < 0 ? -residual_q4 : residual_q4;
+
+    int32_t gate_q4 = (int32_t)filter->gate_us << 4;
+    if (deviation_q4 > gate_q4) {
+        bool reacquire;
+        if (residual_q4 < 0) {
+            // Closer: take it once every reading in the window is, so a
+            // vehicle shows as soon as the median can, and a stray echo or
+            // two, which never fill the window, are never taken
+            reacquire = ((int32_t)window_max(filter) << 4) < predicted_q4 - gate_q4;
+        } else {
+            reacquire = ++filter->gated >= RANGE_FILTER_REACQUIRE;
+        }
+        if (!reacquire) {
+            // Coast on the prediction until the jump proves real
+            filter->x_q4 = predicted_q4;
+            return predicted_q4 < 0 ? 0 : predicted_q4 >> 4;
+        }
+        // A vehicle arrived or left, restart from the new range
+        filter->x_q4 = z_q4;
+        filter->v_q4 = 0;
+        filter->gated = 0;
+        return z_q4 >> 4;
+    }
+
+    filter->gated = 0;
+    filter->x_q4 = predicted_q4 + ((residual_q4 * ALPHA_Q8) >> 8);
+    filter->v_q4 += (residual_q4 * BETA_Q8) >> 8;
+    return filter->x_q4 < 0 ? 0 : filter->x_q4 >> 4;
+}
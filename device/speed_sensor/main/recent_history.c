@@ -0,0 +1,161 @@
+#include <inttypes.h>
+#include <string.h>
+
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+#include "freertos/queue.h"
+#include "esp_attr.h"
+#include "esp_log.h"
+#include "esp_timer.h"
+#include "sdkconfig.h"
+
+#include "connectivity.h"
+#include "history_ring.h"
+#include "recent_history.h"
+
+#define HISTORY_BLOCKS (CONFIG_HISTORY_RING_KB * 1024 / HISTORY_BLOCK_BYTES)
+#define HISTORY_REQUEST_QUEUE_LENGTH 2
+
+#if CONFIG_HISTORY_RING_RTC
+// RTC slow memory is 8 KB, shared with anything else kept there
+_Static_assert(CONFIG_HISTORY_RING_KB <= 4, "At most 4 KB of recent history fit in RTC slow memory");
+#define HISTORY_RING_ATTR RTC_DATA_ATTR
+#else
+#define HISTORY_RING_ATTR
+#endif
+
+static const char *HISTORY_TAG = "HISTORY";
+
+static HISTORY_RING_ATTR history_block_t ring_blocks[HISTORY_BLOCKS];
+static history_ring_t ring;
+static portMUX_TYPE ring_mux = portMUX_INITIALIZER_UNLOCKED;
+
+static const char *history_response_topic = NULL;
+static esp_mqtt_client_handle_t history_client = NULL;
+static QueueHandle_t request_queue = NULL;
+
+static uint8_t request_blob[HISTORY_REQUEST_SIZE];
+static topic_collector_t request_collector = { .buf = (char *)request_blob, .capacity = sizeof(request_blob) };
+
+// Large, so kept off the task stack
+static history_pager_t pager;
+static uint8_t chunk[CONFIG_HISTORY_CHUNK_BYTES];
+
+
+static inline uint32_t ring_ms(int64_t now_us)
+{
+    return (uint32_t)(now_us / 1000);
+}
+
+
+void recent_history_vehicle(int64_t now_us, size_t lane, float speed_cm_s, bool deployed)
+{
+    uint32_t speed = speed_cm_s <= 0 ? 0 : speed_cm_s >= UINT32_MAX ? UINT32_MAX : (uint32_t)(speed_cm_s + 0.5f);
+    taskENTER_CRITICAL(&ring_mux);
+    history_ring_vehicle(&ring, ring_ms(now_us), lane, speed, deployed);
+    taskEXIT_CRITICAL(&ring_mux);
+}
+
+
+void recent_history_trace(int64_t now_us, size_t sensor, uint32_t distance_mm)
+{
+    taskENTER_CRITICAL(&ring_mux);
+    history_ring_trace(&ring, ring_ms(now_us), sensor, distance_mm);
+    taskEXIT_CRITICAL(&ring_mux);
+}
+
+
+void recent_history_fault(int64_t now_us, size_t sensor)
+{
+    taskENTER_CRITICAL(&ring_mux);
+    history_ring_fault(&ring, ring_ms(now_us), sensor);
+    taskEXIT_CRITICAL(&ring_mux);
+}
+
+
+static bool copy_block(void *ctx, uint32_t seq, history_block_t *block)
+{
+    taskENTER_CRITICAL(&ring_mux);
+    bool found = history_ring_copy(&ring, seq, block);
+    taskEXIT_CRITICAL(&ring_mux);
+    return found;
+}
+
+
+void recent_history_handle_request(void *ctx, const topic_fragment_t *fragment)
+{
+    topic_collect_result_t collected = topic_collect(&request_collector, fragment);
+    if (collected == TOPIC_COLLECT_OVERFLOW) {
+        ESP_LOGW(HISTORY_TAG, "Ignoring a %u byte request", (unsigned)fragment->total_len);
+    }
+    if (collected != TOPIC_COLLECT_COMPLETE) {
+        return;
+    }
+    history_request_t request;
+    if (!history_request_decode(request_blob, request_collector.len, &request)) {
+        ESP_LOGW(HISTORY_TAG, "Ignoring malformed request");
+        return;
+    }
+    // Never holds up the MQTT task, a request that doesn't fit is dropped
+    if (xQueueSend(request_queue, &request, 0) != pdTRUE) {
+        ESP_LOGW(HISTORY_TAG, "Busy, dropping request %u", request.request_id);
+    }
+}
+
+
+static void answer(const history_request_t *request)
+{
+    int64_t now_us = esp_timer_get_time();
+    int64_t now_epoch_ms;
+    bool synced = monotonic_to_epoch_ms(now_us, &now_epoch_ms);
+    history_pager_init(&pager, request, CONFIG_HISTORY_PAGE_CHUNKS, ring_ms(now_us),
+                       synced ? now_epoch_ms : now_us / 1000, !synced);
+
+    size_t chunks = 0;
+    size_t bytes = 0;
+    size_t len;
+    while ((len = history_pager_next(&pager, copy_block, NULL, chunk, sizeof(chunk))) > 0) {
+        // Blocks until the chunk is in the outbox, which paces a page
+        if (esp_mqtt_client_publish(history_client, history_response_topic, (const char *)chunk, len, 1, false) < 0) {
+            ESP_LOGW(HISTORY_TAG, "Request %u: chunk %u not queued, abandoning the page",
+                     request->request_id, (unsigned)chunks);
+            return;
+        }
+        chunks++;
+        bytes += len;
+    }
+    ESP_LOGI(HISTORY_TAG, "Request %u: %u chunks, %u bytes, next cursor %" PRIu32 " (ring %" PRIu32 " thinned, %" PRIu32 " evicted)",
+             request->request_id, (unsigned)chunks, (unsigned)bytes,
+             pager.have_pending ? pager.pending_seq : pager.cursor, ring.thinned, ring.evicted);
+}
+
+
+static void recent_history_task(void *pvParameters)
+{
+    history_request_t request;
+    while (true) {
+        if (xQueueReceive(request_queue, &request, portMAX_DELAY) != pdTRUE) {
+            continue;
+        }
+        if (history_client == NULL || !(xEventGroupGetBits(connectivity_events) & MQTT_CONNECTED_BIT)) {
+            continue;
+        }
+        answer(&request);
+    }
+}
+
+
+void recent_history_start(const char *response_topic, UBaseType_t priority, BaseType_t core)
+{
+    history_response_topic = response_topic;
+    history_ring_init(&ring, ring_blocks, HISTORY_BLOCKS, CONFIG_HISTORY_TRACE_DEADBAND_MM, CONFIG_HISTORY_TRACE_KEEPALIVE_MS);
+    request_queue = xQueueCreate(HISTORY_REQUEST_QUEUE_LENGTH, sizeof(history_request_t));
+    ESP_LOGI(HISTORY_TAG, "%u byte ring, answering on %s", (unsigned)sizeof(ring_blocks), history_response_topic);
+    xTaskCreatePinnedToCore(&recent_history_task, "recent_history", 3072, NULL, priority, NULL, core);
+}
+
+
+void recent_history_set_client(esp_mqtt_client_handle_t client)
+{
+    history_client = client;
+}
@@ -0,0 +1,58 @@
+#ifndef __RECENT_HISTORY_H__
+#define __RECENT_HISTORY_H__
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#include "freertos/FreeRTOS.h"
+#include "mqtt_client.h"
+#include "topic_router.h"
+
+/*
+ * The last few minutes of vehicles, raw distance traces and sensor faults,
+ * kept on the device in a history_ring of CONFIG_HISTORY_RING_KB (in RTC
+ * slow memory with CONFIG_HISTORY_RING_RTC) instead of being streamed.
+ *
+ * A request on /device/<id>/history (see history_ring.h for the format) is
+ * answered by a low-priority task with a page of chunks on
+ * /device/<id>/history/response, QoS1, each at most CONFIG_HISTORY_CHUNK_BYTES.
+ * data_pipeline/recent_history.py asks for, pages through and decodes them.
+ *
+ * The measurement task records without blocking; the ring is only locked
+ * for an append or a copy of one block.
+ */
+
+
+/**
+ * @brief Set up the ring and start the task answering requests
+ *
+ * @param response_topic Must outlive the task
+ */
+void recent_history_start(const char *response_topic, UBaseType_t priority, BaseType_t core);
+
+
+/**
+ * @brief Client to publish responses with, requests are ignored until it is set
+ */
+void recent_history_set_client(esp_mqtt_client_handle_t client);
+
+
+void recent_history_vehicle(int64_t now_us, size_t lane, float speed_cm_s, bool deployed);
+
+
+/**
+ * @brief A raw reading, before the range filter, thinned by the deadband
+ */
+void recent_history_trace(int64_t now_us, size_t sensor, uint32_t distance_mm);
+
+
+void recent_history_fault(int64_t now_us, size_t sensor);
+
+
+/**
+ * @brief topic_router handler for the request topic
+ */
+void recent_history_handle_request(void *ctx, const topic_fragment_t *fragment);
+
+#endif /* __RECENT_HISTORY_H__ */
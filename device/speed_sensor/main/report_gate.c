@@ -0,0 +1,38 @@
+#include <string.h>
+
+#include "report_gate.h"
+
+
+void report_gate_init(report_gate_t *gate)
+{
+    memset(gate, 0, sizeof(*gate));
+}
+
+
+static bool health_changed(const report_window_t *last, const report_window_t *window)
+{
+    return window->window_s != last->window_s ||
+           window->sensor_1_up != last->sensor_1_up ||
+           window->sensor_2_up != last->sensor_2_up ||
+           window->ota_active != last->ota_active ||
+           window->events_dropped;
+}
+
+
+bool report_gate_window(report_gate_t *gate, const report_window_t *window, uint16_t heartbeat_s, uint32_t *quiet_windows)
+{
+    bool quiet = gate->reported && window->num_cars == 0 && !health_changed(&gate->last, window);
+    // The heartbeat counts the window itself, so a report goes out at least every heartbeat_s
+    if (quiet && heartbeat_s > 0 && gate->quiet_s + 2u * window->window_s <= heartbeat_s) {
+        gate->quiet_windows++;
+        gate->quiet_s += window->window_s;
+        return false;
+    }
+
+    *quiet_windows = gate->quiet_windows;
+    gate->reported = true;
+    gate->last = *window;
+    gate->quiet_windows = 0;
+    gate->quiet_s = 0;
+    return true;
+}
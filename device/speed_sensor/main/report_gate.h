@@ -0,0 +1,50 @@
+#ifndef __REPORT_GATE_H__
+#define __REPORT_GATE_H__
+
+#include <stdbool.h>
+#include <stdint.h>
+
+/*
+ * Report-on-change for one lane's window reports. A window with vehicles,
+ * or whose health differs from the last published one, is always sent. A
+ * quiet window is held back until heartbeat_s of windows have passed since
+ * the last report, and the next report carries how many were held back, so
+ * the ingester can put the zero-traffic windows back.
+ *
+ * Held-back windows directly precede the report that counts them, window_s
+ * apart, so a change of window length is always reported straight away.
+ *
+ * Plain C with no ESP-IDF dependencies so the policy can be exercised on a host.
+ */
+typedef struct
+{
+    uint16_t window_s;
+    uint32_t num_cars;
+    bool sensor_1_up;
+    bool sensor_2_up;
+    bool ota_active;
+    bool events_dropped;        //!< Lane events were lost during the window
+} report_window_t;
+
+typedef struct
+{
+    bool reported;              //!< false until the first report
+    report_window_t last;       //!< Last published window
+    uint32_t quiet_windows;     //!< Held back since then
+    uint32_t quiet_s;
+} report_gate_t;
+
+
+void report_gate_init(report_gate_t *gate);
+
+
+/**
+ * @brief Decide whether a closed window is published
+ *
+ * @param heartbeat_s Longest run of held-back windows, 0 publishes every window
+ * @param[out] quiet_windows Windows held back right before this one, when published
+ * @return true to publish the window
+ */
+bool report_gate_window(report_gate_t *gate, const report_window_t *window, uint16_t heartbeat_s, uint32_t *quiet_windows);
+
+#endif /* __REPORT_GATE_H__ */
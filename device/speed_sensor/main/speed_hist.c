@@ -0,0 +1,40 @@
+#include <math.h>
+#include <string.h>
+
+#include "speed_hist.h"
+
+
+void speed_hist_init(speed_hist_t *hist)
+{
+    memset(hist, 0, sizeof(*hist));
+}
+
+
+unsigned speed_hist_bucket(float speed_cm_s)
+{
+    if (!(speed_cm_s > SPEED_HIST_BASE_CM_S)) {
+        return 0;
+    }
+    float bucket = floorf(SPEED_HIST_PER_OCTAVE * log2f(speed_cm_s / SPEED_HIST_BASE_CM_S));
+    return bucket >= SPEED_HIST_BUCKETS - 1 ? SPEED_HIST_BUCKETS - 1 : (unsigned)bucket;
+}
+
+
+void speed_hist_record(speed_hist_t *hist, float speed_cm_s)
+{
+    uint8_t *count = &hist->counts[speed_hist_bucket(speed_cm_s)];
+    if (*count < UINT8_MAX) {
+        (*count)++;
+    }
+    hist->samples++;
+}
+
+
+unsigned speed_hist_used(const speed_hist_t *hist)
+{
+    unsigned used = SPEED_HIST_BUCKETS;
+    while (used > 0 && hist->counts[used - 1] == 0) {
+        used--;
+    }
+    return used;
+}
@@ -0,0 +1,54 @@
+#ifndef __SPEED_HIST_H__
+#define __SPEED_HIST_H__
+
+#include <stdint.h>
+
+/*
+ * Vehicle speeds of one report window in geometric buckets, eight per octave
+ * (about 9% wide): bucket k holds speeds from SPEED_HIST_BASE_CM_S * 2^(k/8)
+ * up to the next bucket, bucket 0 everything slower and the last bucket
+ * everything faster. 300 cm/s to 4400 cm/s is 11 to 158 km/h.
+ *
+ * Reports carry the counts so percentiles such as p85 can be taken over
+ * vehicles, merged across windows and devices, rather than over window
+ * averages. Must match SPEED_HIST_* in edge_gateway/aggregator.py and
+ * data_pipeline/commons.py.
+ * Plain C with no ESP-IDF dependencies.
+ */
+#define SPEED_HIST_BUCKETS 32
+#define SPEED_HIST_PER_OCTAVE 8
+#define SPEED_HIST_BASE_CM_S 300
+
+typedef struct
+{
+    uint8_t counts[SPEED_HIST_BUCKETS];     //!< Saturate at UINT8_MAX, a window holds far fewer vehicles
+    uint32_t samples;
+} speed_hist_t;
+
+
+/**
+ * @brief Clear the histogram
+ */
+void speed_hist_init(speed_hist_t *hist);
+
+
+/**
+ * @brief Bucket a speed falls into
+ */
+unsigned speed_hist_bucket(float speed_cm_s);
+
+
+/**
+ * @brief Count one vehicle
+ */
+void speed_hist_record(speed_hist_t *hist, float speed_cm_s);
+
+
+/**
+ * @brief Buckets up to and including the last non-empty one, 0 if empty
+ *
+ * Reports leave out the empty buckets at the fast end.
+ */
+unsigned speed_hist_used(const speed_hist_t *hist);
+
+#endif /* __SPEED_HIST_H__ */
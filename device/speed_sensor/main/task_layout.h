@@ -0,0 +1,55 @@
+#ifndef __TASK_LAYOUT_H__
+#define __TASK_LAYOUT_H__
+
+#include "freertos/FreeRTOS.h"
+#include "sdkconfig.h"
+
+/*
+ * Task topology
+ *
+ *   APP core (1)  measure    high priority, nothing else pinned here, so a
+ *                            ping cycle is only ever preempted by interrupts
+ *   PRO core (0)  Wi-Fi, lwIP, BT controller and Bluedroid, MQTT, esp_timer
+ *                            (pinned there through sdkconfig.defaults)
+ *                 actuate    BLE advertising, holds each command for its duration
+ *                 report     window statistics and publishing
+ *                 upgrade    OTA download
+ *                 history    answers recent history requests, lowest
+ *                 dlog       deferred log drain, lowest
+ *
+ * Measurement never blocks on the others: speed samples and sensor faults
+ * go to the reporter over lane_event_queue, bump commands to the actuator
+ * over actuation_queue, both sent without waiting. The jitter histogram is
+ * overwritten into a one-slot queue every cycle for the reporter to peek.
+ *
+ * With CONFIG_TASK_LAYOUT_PINNED off, every task is created unpinned at the
+ * old common priority, to compare jitter against.
+ */
+#if CONFIG_TASK_LAYOUT_PINNED && !CONFIG_FREERTOS_UNICORE
+#define MEASURE_TASK_CORE       1
+#define NETWORK_TASK_CORE       0
+#else
+#define MEASURE_TASK_CORE       tskNO_AFFINITY
+#define NETWORK_TASK_CORE       tskNO_AFFINITY
+#endif
+
+#if CONFIG_TASK_LAYOUT_PINNED
+#define MEASURE_TASK_PRIORITY   10
+#define ACTUATE_TASK_PRIORITY   6
+#define REPORT_TASK_PRIORITY    3
+#define UPGRADE_TASK_PRIORITY   2
+#define DLOG_TASK_PRIORITY      1
+#define HISTORY_TASK_PRIORITY   1
+#else
+#define MEASURE_TASK_PRIORITY   5
+#define ACTUATE_TASK_PRIORITY   5
+#define REPORT_TASK_PRIORITY    5
+#define UPGRADE_TASK_PRIORITY   5
+#define DLOG_TASK_PRIORITY      5
+#define HISTORY_TASK_PRIORITY   5
+#endif
+
+#define LANE_EVENT_QUEUE_LENGTH 32
+#define ACTUATION_QUEUE_LENGTH  4
+
+#endif /* __TASK_LAYOUT_H__ */
@@ -0,0 +1,365 @@
+#include <stdio.h>
+#include <string.h>
+#include <stdbool.h>
+
+#include "freertos/FreeRTOS.h"
+#include "freertos/semphr.h"
+#include "esp_log.h"
+#include "esp_timer.h"
+#include "sdkconfig.h"
+#if CONFIG_TELEMETRY_OVERFLOW_SPOOL
+#include "esp_spiffs.h"
+#endif
+
+#include "outbox.h"
+#include "telemetry.h"
+#include "heap_guard.h"
+
+// Republish if the broker hasn't acknowledged within this time, e.g. because
+// the client's own outbox expired the message during a long outage
+#define TELEMETRY_ACK_TIMEOUT_US (10 * 1000 * 1000)
+
+#define SPOOL_BASE_PATH "/spool"
+#define SPOOL_FILE SPOOL_BASE_PATH "/telemetry.bin"
+
+static const char *TELEMETRY_TAG = "TELEMETRY";
+
+static uint8_t outbox_storage[CONFIG_TELEMETRY_OUTBOX_BYTES];
+static outbox_t outbox;
+static char tx_buf[TELEMETRY_MAX_MESSAGE];
+#if CONFIG_TELEMETRY_OVERFLOW_SPOOL
+static char spool_buf[TELEMETRY_MAX_MESSAGE];
+#endif
+
+static SemaphoreHandle_t telemetry_lock = NULL;
+static esp_mqtt_client_handle_t mqtt_client = NULL;
+static const char *telemetry_topic = NULL;
+static bool connected = false;
+
+#define IN_FLIGHT_NONE    -1
+#define IN_FLIGHT_SENDING -2 // Publish call in progress
+
+// Only one message is in flight at a time, which keeps delivery in order
+// and the MQTT client's own outbox down to a single telemetry message
+static int in_flight_msg_id = IN_FLIGHT_NONE;
+static int early_ack_msg_id = IN_FLIGHT_NONE;
+static int64_t in_flight_since_us = 0;
+static size_t in_flight_len = 0;
+static bool in_flight_from_spool = false;
+static bool in_flight_evicted = false; // Dropped from the outbox while in flight
+
+static telemetry_stats_t stats = { .first_ack_ms = -1 };
+
+#if CONFIG_TELEMETRY_OVERFLOW_SPOOL
+static size_t spool_size = 0;
+static size_t spool_read_offset = 0;
+
+
+static void spool_append(const uint8_t *msg, size_t len)
+{
+    if (spool_size + len + OUTBOX_HEADER_SIZE > CONFIG_TELEMETRY_SPOOL_BYTES) {
+        stats.dropped++;
+        return;
+    }
+    FILE *f = fopen(SPOOL_FILE, "ab");
+    if (f == NULL) {
+        stats.dropped++;
+        return;
+    }
+    uint8_t header[OUTBOX_HEADER_SIZE] = { len & 0xFF, len >> 8 };
+    if (fwrite(header, 1, sizeof(header), f) == sizeof(header) && fwrite(msg, 1, len, f) == len) {
+        spool_size += len + OUTBOX_HEADER_SIZE;
+    } else {
+        stats.dropped++;
+    }
+    fclose(f);
+}
+
+
+static size_t spool_read(char *out, size_t out_capacity)
+{
+    FILE *f = fopen(SPOOL_FILE, "rb");
+    if (f == NULL) {
+        return 0;
+    }
+    uint8_t header[OUTBOX_HEADER_SIZE];
+    size_t len = 0;
+    if (fseek(f, spool_read_offset, SEEK_SET) == 0 && fread(header, 1, sizeof(header), f) == sizeof(header)) {
+        len = header[0] | (header[1] << 8);
+        if (len > out_capacity || fread(out, 1, len, f) != len) {
+            len = 0;
+        }
+    }
+    fclose(f);
+    return len;
+}
+
+
+static void spool_consume(size_t len)
+{
+    spool_read_offset += len + OUTBOX_HEADER_SIZE;
+    if (spool_read_offset >= spool_size) {
+        // Fully replayed, start over with an empty file
+        FILE *f = fopen(SPOOL_FILE, "wb");
+        if (f != NULL) {
+            fclose(f);
+        }
+        spool_size = 0;
+        spool_read_offset = 0;
+    }
+}
+
+
+static void spool_init(void)
+{
+    esp_vfs_spiffs_conf_t conf = {
+        .base_path = SPOOL_BASE_PATH,
+        .partition_label = "storage",
+        .max_files = 2,
+        .format_if_mount_failed = true,
+    };
+    esp_err_t err = esp_vfs_spiffs_register(&conf);
+    if (err != ESP_OK) {
+        ESP_LOGE(TELEMETRY_TAG, "Failed to mount spool: %s", esp_err_to_name(err));
+        return;
+    }
+
+    // Whatever survived a reboot is replayed from the start (at-least-once)
+    FILE *f = fopen(SPOOL_FILE, "rb");
+    if (f != NULL) {
+        fseek(f, 0, SEEK_END);
+        spool_size = ftell(f);
+        fclose(f);
+        ESP_LOGI(TELEMETRY_TAG, "%u spooled bytes to replay", (unsigned)spool_size);
+    }
+}
+#endif
+
+
+static bool head_in_flight(void)
+{
+    return in_flight_msg_id != IN_FLIGHT_NONE && !in_flight_from_spool && !in_flight_evicted;
+}
+
+
+// Call with telemetry_lock held
+static void make_room(size_t len)
+{
+    while (outbox_free(&outbox) < len + OUTBOX_HEADER_SIZE && outbox.count > 0) {
+        if (head_in_flight()) {
+            // Already handed to the MQTT client, which delivers its own copy
+            in_flight_evicted = true;
+        } else {
+#if CONFIG_TELEMETRY_OVERFLOW_SPOOL
+            size_t oldest_len = outbox_peek(&outbox, spool_buf, sizeof(spool_buf));
+            spool_append((const uint8_t *)spool_buf, oldest_len);
+#else
+            stats.dropped++;
+#endif
+        }
+        outbox_pop(&outbox);
+    }
+}
+
+
+// Call with telemetry_lock held
+static void complete_in_flight(void)
+{
+#if CONFIG_TELEMETRY_OVERFLOW_SPOOL
+    if (in_flight_from_spool) {
+        spool_consume(in_flight_len);
+    } else
+#endif
+    if (!in_flight_evicted) {
+        outbox_pop(&outbox);
+    }
+    in_flight_msg_id = IN_FLIGHT_NONE;
+    in_flight_evicted = false;
+    if (stats.first_ack_ms < 0) {
+        stats.first_ack_ms = esp_timer_get_time() / 1000;
+    }
+}
+
+
+// Call with telemetry_lock held. Returns the length of the next message in tx_buf, 0 if none
+static size_t select_next(void)
+{
+    size_t len = 0;
+    in_flight_from_spool = false;
+    in_flight_evicted = false;
+#if CONFIG_TELEMETRY_OVERFLOW_SPOOL
+    if (spool_read_offset < spool_size) {
+        // Spooled messages are older than anything still in RAM
+        len = spool_read(tx_buf, sizeof(tx_buf));
+        if (len == 0) {
+            ESP_LOGE(TELEMETRY_TAG, "Corrupt spool, discarding %u bytes", (unsigned)(spool_size - spool_read_offset));
+            spool_read_offset = spool_size;
+            spool_consume(0);
+        } else {
+            in_flight_from_spool = true;
+        }
+    }
+#endif
+    if (len == 0) {
+        len = outbox_peek(&outbox, tx_buf, sizeof(tx_buf));
+    }
+    return len;
+}
+
+
+/*
+ * Hand the next message to the MQTT client. The publish call is made without
+ * telemetry_lock held, as the MQTT task takes its own lock before calling
+ * back into this module.
+ */
+static void pump(void)
+{
+    while (true) {
+        xSemaphoreTake(telemetry_lock, portMAX_DELAY);
+        if (!connected || mqtt_client == NULL || in_flight_msg_id == IN_FLIGHT_SENDING) {
+            xSemaphoreGive(telemetry_lock);
+            return;
+        }
+        if (in_flight_msg_id >= 0) {
+            if (esp_timer_get_time() - in_flight_since_us < TELEMETRY_ACK_TIMEOUT_US) {
+                xSemaphoreGive(telemetry_lock);
+                return;
+            }
+            if (in_flight_evicted) {
+                // Nothing left to resend
+                in_flight_msg_id = IN_FLIGHT_NONE;
+            } else {
+                // tx_buf still holds the unacknowledged message
+                stats.retransmits++;
+            }
+        }
+        size_t len = in_flight_msg_id >= 0 ? in_flight_len : select_next();
+        if (len == 0) {
+            in_flight_msg_id = IN_FLIGHT_NONE;
+            xSemaphoreGive(telemetry_lock);
+            return;
+        }
+        in_flight_msg_id = IN_FLIGHT_SENDING;
+        in_flight_len = len;
+        early_ack_msg_id = IN_FLIGHT_NONE;
+        xSemaphoreGive(telemetry_lock);
+
+        // esp-mqtt copies a QoS1 message until its ack, and we keep only one in flight
+        heap_guard_exempt_begin();
+        int msg_id = esp_mqtt_client_publish(mqtt_client, telemetry_topic, tx_buf, len, 1, false);
+        heap_guard_exempt_end();
+
+        xSemaphoreTake(telemetry_lock, portMAX_DELAY);
+        bool acked = msg_id >= 0 && msg_id == early_ack_msg_id;
+        if (msg_id < 0) {
+            // Retried on the next pump
+            in_flight_msg_id = IN_FLIGHT_NONE;
+        } else if (acked) {
+            complete_in_flight();
+        } else {
+            in_flight_msg_id = msg_id;
+            in_flight_since_us = esp_timer_get_time();
+        }
+        xSemaphoreGive(telemetry_lock);
+
+        if (!acked) {
+            return;
+        }
+    }
+}
+
+
+void telemetry_init(const char *topic)
+{
+    telemetry_topic = topic;
+    telemetry_lock = xSemaphoreCreateMutex();
+    outbox_init(&outbox, outbox_storage, sizeof(outbox_storage));
+#if CONFIG_TELEMETRY_OVERFLOW_SPOOL
+    spool_init();
+#endif
+}
+
+
+void telemetry_set_client(esp_mqtt_client_handle_t client)
+{
+    xSemaphoreTake(telemetry_lock, portMAX_DELAY);
+    mqtt_client = client;
+    xSemaphoreGive(telemetry_lock);
+}
+
+
+esp_err_t telemetry_enqueue(const char *msg, size_t len)
+{
+    if (len > TELEMETRY_MAX_MESSAGE) {
+        return ESP_ERR_INVALID_SIZE;
+    }
+
+    xSemaphoreTake(telemetry_lock, portMAX_DELAY);
+    make_room(len);
+    bool queued = outbox_push(&outbox, msg, len);
+    if (!queued) {
+        stats.dropped++;
+    }
+    xSemaphoreGive(telemetry_lock);
+
+    pump();
+    return queued ? ESP_OK : ESP_ERR_NO_MEM;
+}
+
+
+void telemetry_publish_state(const char *topic, const char *msg, size_t len)
+{
+    if (mqtt_client != NULL && connected) {
+        heap_guard_exempt_begin();
+        esp_mqtt_client_publish(mqtt_client, topic, msg, len, 1, true);
+        heap_guard_exempt_end();
+    }
+}
+
+
+void telemetry_on_connected(void)
+{
+    xSemaphoreTake(telemetry_lock, portMAX_DELAY);
+    connected = true;
+    xSemaphoreGive(telemetry_lock);
+    pump();
+}
+
+
+void telemetry_on_disconnected(void)
+{
+    xSemaphoreTake(telemetry_lock, portMAX_DELAY);
+    // Keep the in-flight message: with a persistent session the client
+    // resends it after reconnecting and we still get its ack
+    connected = false;
+    xSemaphoreGive(telemetry_lock);
+}
+
+
+void telemetry_on_published(int msg_id)
+{
+    xSemaphoreTake(telemetry_lock, portMAX_DELAY);
+    if (in_flight_msg_id == IN_FLIGHT_SENDING) {
+        // Acked before the publishing task got to record the id
+        early_ack_msg_id = msg_id;
+    } else if (msg_id == in_flight_msg_id) {
+        complete_in_flight();
+    }
+    xSemaphoreGive(telemetry_lock);
+    pump();
+}
+
+
+void telemetry_get_stats(telemetry_stats_t *out)
+{
+    xSemaphoreTake(telemetry_lock, portMAX_DELAY);
+    *out = stats;
+    out->depth = outbox.count;
+    out->bytes = outbox.used;
+#if CONFIG_TELEMETRY_OVERFLOW_SPOOL
+    out->spooled_bytes = spool_size - spool_read_offset;
+#else
+    out->spooled_bytes = 0;
+#endif
+    xSemaphoreGive(telemetry_lock);
+}
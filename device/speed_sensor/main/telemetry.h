@@ -0,0 +1,57 @@
+#ifndef __TELEMETRY_H__
+#define __TELEMETRY_H__
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include "esp_err.h"
+#include "mqtt_client.h"
+
+#define TELEMETRY_MAX_MESSAGE 1024
+
+typedef struct
+{
+    uint32_t depth;             //!< Messages waiting in RAM, in-flight one included
+    uint32_t bytes;             //!< RAM outbox bytes in use
+    uint32_t spooled_bytes;     //!< Bytes waiting in the flash spool
+    uint32_t dropped;           //!< Messages discarded by the overflow policy
+    uint32_t retransmits;       //!< Messages republished after the ack timed out
+    int64_t first_ack_ms;       //!< Time since boot of the first acknowledged publish, -1 before
+} telemetry_stats_t;
+
+
+/**
+ * @brief Set up the bounded outbox (and the flash spool, if configured)
+ *
+ * @param topic Telemetry topic, must outlive the module
+ */
+void telemetry_init(const char *topic);
+
+
+void telemetry_set_client(esp_mqtt_client_handle_t client);
+
+
+/**
+ * @brief Queue a message for QoS1 delivery
+ *
+ * Never blocks on the network. When the outbox is full the oldest message is
+ * dropped or moved to the flash spool, depending on the overflow policy.
+ */
+esp_err_t telemetry_enqueue(const char *msg, size_t len);
+
+
+/**
+ * @brief Publish a retained "last state" message, outside the outbox
+ */
+void telemetry_publish_state(const char *topic, const char *msg, size_t len);
+
+
+// Feed from the MQTT event handler
+void telemetry_on_connected(void);
+void telemetry_on_disconnected(void);
+void telemetry_on_published(int msg_id);
+
+
+void telemetry_get_stats(telemetry_stats_t *stats);
+
+#endif /* __TELEMETRY_H__ */
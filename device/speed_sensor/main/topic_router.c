@@ -0,0 +1,188 @@
+#include <string.h>
+
+#include "topic_router.h"
+
+
+uint32_t topic_hash(const char *topic, size_t len)
+{
+    // FNV-1a
+    uint32_t hash = 2166136261u;
+    for (size_t i = 0; i < len; i++) {
+        hash ^= (uint8_t)topic[i];
+        hash *= 16777619u;
+    }
+    return hash;
+}
+
+
+bool topic_matches(const char *pattern, size_t pattern_len, const char *topic, size_t topic_len)
+{
+    size_t p = 0;
+    size_t t = 0;
+
+    // Wildcards never match topics reserved by the broker
+    if (topic_len > 0 && topic[0] == '$' && pattern_len > 0 && (pattern[0] == '+' || pattern[0] == '#')) {
+        return false;
+    }
+
+    while (p < pattern_len) {
+        if (pattern[p] == '#') {
+            // Also matches the parent level: "a/#" matches "a"
+            return p + 1 == pattern_len;
+        }
+
+        if (pattern[p] == '+') {
+            while (t < topic_len && topic[t] != '/') {
+                t++;
+            }
+            p++;
+        } else {
+            while (p < pattern_len && pattern[p] != '/') {
+                if (t >= topic_len || topic[t] != pattern[p]) {
+                    return false;
+                }
+                p++;
+                t++;
+            }
+            if (t < topic_len && topic[t] != '/') {
+                return false;
+            }
+        }
+
+        if (p == pattern_len) {
+            return t == topic_len;
+        }
+
+        // Both sit on a level separator
+        if (t == topic_len) {
+            return pattern_len - p == 2 && pattern[p + 1] == '#';
+        }
+        p++;
+        t++;
+    }
+
+    return t == topic_len;
+}
+
+
+void topic_router_init(topic_router_t *router)
+{
+    memset(router, 0, sizeof(*router));
+}
+
+
+bool topic_router_add(topic_router_t *router, const char *pattern, topic_handler_t handler, void *ctx)
+{
+    if (router->route_count == TOPIC_ROUTER_MAX_ROUTES) {
+        return false;
+    }
+
+    topic_route_t *route = &router->routes[router->route_count];
+    route->pattern = pattern;
+    route->pattern_len = strlen(pattern);
+    route->hash = topic_hash(pattern, route->pattern_len);
+    route->wildcard = strpbrk(pattern, "+#") != NULL;
+    route->handler = handler;
+    route->ctx = ctx;
+
+    if (!route->wildcard) {
+        // Open addressing with linear probing, never full as slots > routes
+        size_t slot = route->hash & (TOPIC_ROUTER_HASH_SLOTS - 1);
+        while (router->exact_slots[slot] != 0) {
+            const topic_route_t *other = &router->routes[router->exact_slots[slot] - 1];
+            if (other->hash == route->hash && other->pattern_len == route->pattern_len &&
+                memcmp(other->pattern, pattern, route->pattern_len) == 0) {
+                return false;
+            }
+            slot = (slot + 1) & (TOPIC_ROUTER_HASH_SLOTS - 1);
+        }
+        router->exact_slots[slot] = router->route_count + 1;
+    }
+
+    router->route_count++;
+    return true;
+}
+
+
+static const topic_route_t *find_route(const topic_router_t *router, const char *topic, size_t topic_len)
+{
+    uint32_t hash = topic_hash(topic, topic_len);
+    size_t slot = hash & (TOPIC_ROUTER_HASH_SLOTS - 1);
+    while (router->exact_slots[slot] != 0) {
+        const topic_route_t *route = &router->routes[router->exact_slots[slot] - 1];
+        if (route->hash == hash && route->pattern_len == topic_len && memcmp(route->pattern, topic, topic_len) == 0) {
+            return route;
+        }
+        slot = (slot + 1) & (TOPIC_ROUTER_HASH_SLOTS - 1);
+    }
+
+    for (size_t i = 0; i < router->route_count; i++) {
+        const topic_route_t *route = &router->routes[i];
+        if (route->wildcard && topic_matches(route->pattern, route->pattern_len, topic, topic_len)) {
+            return route;
+        }
+    }
+    return NULL;
+}
+
+
+topic_router_result_t topic_router_dispatch(topic_router_t *router, const char *topic, size_t topic_len,
+                                            const char *data, size_t data_len, size_t offset, size_t total_len)
+{
+    if (offset == 0) {
+        router->active = find_route(router, topic, topic_len);
+        router->next_offset = 0;
+        if (router->active == NULL) {
+            return TOPIC_ROUTER_NO_ROUTE;
+        }
+    } else if (router->active == NULL || offset != router->next_offset) {
+        router->active = NULL;
+        return TOPIC_ROUTER_OUT_OF_SEQUENCE;
+    }
+
+    topic_fragment_t fragment = {
+        .data = data,
+        .len = data_len,
+        .offset = offset,
+        .total_len = total_len,
+    };
+    const topic_route_t *route = router->active;
+    router->next_offset = offset + data_len;
+    if (topic_fragment_is_last(&fragment)) {
+        router->active = NULL;
+    }
+
+    route->handler(route->ctx, &fragment);
+    return TOPIC_ROUTER_DISPATCHED;
+}
+
+
+topic_collect_result_t topic_collect(topic_collector_t *collector, const topic_fragment_t *fragment)
+{
+    if (topic_fragment_is_first(fragment)) {
+        collector->len = 0;
+        collector->overflow = fragment->total_len > collector->capacity;
+        collector->active = true;
+        collector->next_offset = 0;
+    } else if (!collector->active || fragment->offset != collector->next_offset) {
+        // Writing at its offset could run past the buffer, the rest of the payload is dropped too
+        collector->active = false;
+        return TOPIC_COLLECT_OUT_OF_SEQUENCE;
+    }
+
+    collector->next_offset = fragment->offset + fragment->len;
+    if (!collector->overflow && collector->next_offset > collector->capacity) {
+        // total_len understated what was sent
+        collector->overflow = true;
+    }
+    if (!collector->overflow) {
+        memcpy(collector->buf + fragment->offset, fragment->data, fragment->len);
+        collector->len = collector->next_offset;
+    }
+
+    if (!topic_fragment_is_last(fragment)) {
+        return TOPIC_COLLECT_PARTIAL;
+    }
+    collector->active = false;
+    return collector->overflow ? TOPIC_COLLECT_OVERFLOW : TOPIC_COLLECT_COMPLETE;
+}
@@ -0,0 +1,128 @@
+#ifndef __TOPIC_ROUTER_H__
+#define __TOPIC_ROUTER_H__
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+/*
+ * MQTT topic router.
+ *
+ * Exact topics are found through a hash table filled at registration time,
+ * wildcard patterns ('+' and a trailing '#') are matched level by level.
+ * Payloads split over several MQTT_EVENT_DATA events are handed to the
+ * handler fragment by fragment, pointing into the client's receive buffer.
+ * The router never allocates.
+ *
+ * Plain C with no ESP-IDF dependencies so it can be exercised on a host.
+ */
+
+#define TOPIC_ROUTER_MAX_ROUTES 8
+#define TOPIC_ROUTER_HASH_SLOTS 16 // Power of two, larger than TOPIC_ROUTER_MAX_ROUTES
+
+typedef struct
+{
+    const char *data;   //!< This fragment, not NUL terminated
+    size_t len;
+    size_t offset;      //!< Offset of this fragment in the whole payload
+    size_t total_len;   //!< Length of the whole payload
+} topic_fragment_t;
+
+static inline bool topic_fragment_is_first(const topic_fragment_t *fragment)
+{
+    return fragment->offset == 0;
+}
+
+static inline bool topic_fragment_is_last(const topic_fragment_t *fragment)
+{
+    return fragment->offset + fragment->len >= fragment->total_len;
+}
+
+typedef void (*topic_handler_t)(void *ctx, const topic_fragment_t *fragment);
+
+typedef struct
+{
+    const char *pattern; //!< Must outlive the router
+    size_t pattern_len;
+    uint32_t hash;
+    bool wildcard;
+    topic_handler_t handler;
+    void *ctx;
+} topic_route_t;
+
+typedef struct
+{
+    topic_route_t routes[TOPIC_ROUTER_MAX_ROUTES];
+    size_t route_count;
+    uint8_t exact_slots[TOPIC_ROUTER_HASH_SLOTS]; //!< Route index + 1, 0 when empty
+
+    // Route receiving the payload currently being reassembled
+    const topic_route_t *active;
+    size_t next_offset;
+} topic_router_t;
+
+typedef enum
+{
+    TOPIC_ROUTER_DISPATCHED,
+    TOPIC_ROUTER_NO_ROUTE,
+    TOPIC_ROUTER_OUT_OF_SEQUENCE, //!< Continuation fragment without a matching start
+} topic_router_result_t;
+
+
+uint32_t topic_hash(const char *topic, size_t len);
+
+
+/**
+ * @brief MQTT topic filter matching, '+' for one level and a trailing '#' for any number
+ */
+bool topic_matches(const char *pattern, size_t pattern_len, const char *topic, size_t topic_len);
+
+
+void topic_router_init(topic_router_t *router);
+
+
+/**
+ * @return false if the table is full or the pattern is already registered
+ */
+bool topic_router_add(topic_router_t *router, const char *pattern, topic_handler_t handler, void *ctx);
+
+
+/**
+ * @brief Route one MQTT_EVENT_DATA event
+ *
+ * The topic is only looked at on the first fragment (offset 0), continuation
+ * fragments go to the route picked for the first one.
+ */
+topic_router_result_t topic_router_dispatch(topic_router_t *router, const char *topic, size_t topic_len,
+                                            const char *data, size_t data_len, size_t offset, size_t total_len);
+
+
+/*
+ * Reassembles small payloads into a caller-provided fixed buffer, for handlers
+ * that need the whole message at once.
+ */
+typedef struct
+{
+    char *buf;
+    size_t capacity;
+    size_t len;
+    bool overflow;
+    bool active;        //!< A payload is being collected
+    size_t next_offset; //!< Offset the next fragment of it must start at
+} topic_collector_t;
+
+typedef enum
+{
+    TOPIC_COLLECT_PARTIAL,          //!< More fragments to come
+    TOPIC_COLLECT_COMPLETE,         //!< buf holds the whole payload, len bytes
+    TOPIC_COLLECT_OVERFLOW,         //!< Last fragment of a payload larger than the buffer, which was dropped
+    TOPIC_COLLECT_OUT_OF_SEQUENCE,  //!< Continuation without the fragments before it, dropped
+} topic_collect_result_t;
+
+
+/**
+ * @brief Add a fragment, each result other than TOPIC_COLLECT_PARTIAL is returned once per payload
+ */
+topic_collect_result_t topic_collect(topic_collector_t *collector, const topic_fragment_t *fragment);
+
+#endif /* __TOPIC_ROUTER_H__ */
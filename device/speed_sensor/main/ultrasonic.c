@@ -48,7 +48,7 @@
 #define PING_TIMEOUT 6000
 #define ROUNDTRIP_M 5800.0f
 #define ROUNDTRIP_CM 58
-#define SPEED_OF_SOUND_AT_0C_M_S 331.4 // Speed of sound in m/s at 0 degrees Celsius
+#define SPEED_OF_SOUND_AT_0C_M_S 331.4f // Speed of sound in m/s at 0 degrees Celsius
 
 #if HELPER_TARGET_IS_ESP32
 static portMUX_TYPE mux = portMUX_INITIALIZER_UNLOCKED;
@@ -121,6 +121,75 @@ esp_err_t ultrasonic_measure_raw(const ultrasonic_sensor_t *dev, uint32_t max_ti
     return ESP_OK;
 }
 
+esp_err_t ultrasonic_measure_raw_group(const ultrasonic_sensor_t *devs, size_t count, uint32_t max_time_us, uint32_t *time_us, esp_err_t *results)
+{
+    CHECK_ARG(devs && time_us && results && count > 0 && count <= ULTRASONIC_MAX_GROUP);
+
+    int64_t echo_start[ULTRASONIC_MAX_GROUP];
+    uint32_t pending = 0;
+
+    PORT_ENTER_CRITICAL;
+
+    // Ping all of them: Low for 2..4 us, then high 10 us
+    for (size_t i = 0; i < count; i++)
+        gpio_set_level(devs[i].trigger_pin, 0);
+    ets_delay_us(TRIGGER_LOW_DELAY);
+    for (size_t i = 0; i < count; i++)
+        gpio_set_level(devs[i].trigger_pin, 1);
+    ets_delay_us(TRIGGER_HIGH_DELAY);
+    for (size_t i = 0; i < count; i++)
+        gpio_set_level(devs[i].trigger_pin, 0);
+
+    for (size_t i = 0; i < count; i++)
+    {
+        echo_start[i] = 0;
+        // Previous ping isn't ended
+        if (gpio_get_level(devs[i].echo_pin))
+            results[i] = ESP_ERR_ULTRASONIC_PING;
+        else
+            pending |= 1u << i;
+    }
+
+    int64_t start = esp_timer_get_time();
+    while (pending)
+    {
+        int64_t now = esp_timer_get_time();
+        for (size_t i = 0; i < count; i++)
+        {
+            if (!(pending & (1u << i)))
+                continue;
+
+            int level = gpio_get_level(devs[i].echo_pin);
+            if (!echo_start[i])
+            {
+                // Wait for echo
+                if (level)
+                    echo_start[i] = now;
+                else if (now - start >= PING_TIMEOUT)
+                {
+                    results[i] = ESP_ERR_ULTRASONIC_PING_TIMEOUT;
+                    pending &= ~(1u << i);
+                }
+            }
+            else if (!level)
+            {
+                // got echo
+                time_us[i] = now - echo_start[i];
+                results[i] = ESP_OK;
+                pending &= ~(1u << i);
+            }
+            else if (now - echo_start[i] >= max_time_us)
+            {
+                results[i] = ESP_ERR_ULTRASONIC_ECHO_TIMEOUT;
+                pending &= ~(1u << i);
+            }
+        }
+    }
+    PORT_EXIT_CRITICAL;
+
+    return ESP_OK;
+}
+
 esp_err_t ultrasonic_measure(const ultrasonic_sensor_t *dev, float max_distance, float *distance)
 {
     CHECK_ARG(dev && distance);
@@ -148,7 +217,7 @@ esp_err_t ultrasonic_measure_temp_compensated(const ultrasonic_sensor_t *dev, fl
     CHECK_ARG(dev && distance);
 
     // Calculate the speed of sound in m/us based on temperature
-    float speed_of_sound = (SPEED_OF_SOUND_AT_0C_M_S + 0.6 * temperature_c) / 1000000; // Convert m/s to m/us
+    float speed_of_sound = (SPEED_OF_SOUND_AT_0C_M_S + 0.6f * temperature_c) / 1000000; // Convert m/s to m/us
 
     uint32_t time_us;
     // Adjust max_time_us based on the recalculated speed of sound
@@ -164,7 +233,7 @@ esp_err_t ultrasonic_measure_cm_temp_compensated(const ultrasonic_sensor_t *dev,
     CHECK_ARG(dev && distance);
 
     // Calculate the speed of sound in cm/us based on temperature
-    float speed_of_sound_cm_us = ((SPEED_OF_SOUND_AT_0C_M_S + 0.6 * temperature_c) * 100) / 1000000; // Convert m/s to cm/us
+    float speed_of_sound_cm_us = ((SPEED_OF_SOUND_AT_0C_M_S + 0.6f * temperature_c) * 100) / 1000000; // Convert m/s to cm/us
 
     uint32_t time_us;
     // Adjust max_time_us based on the recalculated speed of sound in cm
@@ -52,6 +52,8 @@ extern "C" {
 #define ESP_ERR_ULTRASONIC_PING_TIMEOUT 0x201
 #define ESP_ERR_ULTRASONIC_ECHO_TIMEOUT 0x202
 
+#define ULTRASONIC_MAX_GROUP 16 //!< Maximum number of sensors measured together
+
 /**
  * Device descriptor
  */
@@ -82,6 +84,20 @@ esp_err_t ultrasonic_init(const ultrasonic_sensor_t *dev);
  */
 esp_err_t ultrasonic_measure_raw(const ultrasonic_sensor_t *dev, uint32_t max_time_us, uint32_t *time_us);
 
+/**
+ * @brief Ping several sensors at once and time their echoes in parallel
+ *
+ * Only use with sensors that cannot hear each other's pings.
+ *
+ * @param devs Array of device descriptors
+ * @param count Number of devices, at most ULTRASONIC_MAX_GROUP
+ * @param max_time_us Maximal time to wait for each echo
+ * @param[out] time_us Per device echo time, us, valid where results[i] is `ESP_OK`
+ * @param[out] results Per device result, as for ultrasonic_measure_raw()
+ * @return `ESP_OK` if the group was measured, the per device outcome is in `results`
+ */
+esp_err_t ultrasonic_measure_raw_group(const ultrasonic_sensor_t *devs, size_t count, uint32_t max_time_us, uint32_t *time_us, esp_err_t *results);
+
 /**
  * @brief Measure distance in meters
  *
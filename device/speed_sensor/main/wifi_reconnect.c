@@ -0,0 +1,233 @@
+#include <string.h>
+#include <inttypes.h>
+
+#include "esp_log.h"
+#include "esp_random.h"
+#include "esp_timer.h"
+#include "nvs.h"
+#include "sdkconfig.h"
+
+#include "backoff.h"
+#include "wifi_reconnect.h"
+
+#define WIFI_NVS_NAMESPACE "wifi"
+#define WIFI_NVS_KEY "ap"
+
+static const char *WIFI_TAG = "WIFI";
+
+// Last AP we got an address from, persisted so it survives a power cut
+typedef struct
+{
+    uint8_t valid;
+    uint8_t channel;
+    uint8_t bssid[6];
+    esp_netif_ip_info_t lease;
+} wifi_ap_cache_t;
+
+static wifi_ap_cache_t ap_cache;
+static esp_netif_t *netif = NULL;
+static esp_timer_handle_t retry_timer = NULL;
+static backoff_t backoff;
+static bool targeted = false;
+static bool retrying = false;
+static int64_t outage_start_us = 0; // 0 unless an established link dropped
+#if CONFIG_WIFI_REUSE_DHCP_LEASE
+static esp_timer_handle_t lease_timer = NULL;
+static bool static_lease = false;   // The cached lease is configured, DHCP is stopped
+#endif
+static wifi_reconnect_stats_t stats;
+
+
+static void save_ap_cache(void)
+{
+    nvs_handle_t nvs;
+    if (nvs_open(WIFI_NVS_NAMESPACE, NVS_READWRITE, &nvs) != ESP_OK) {
+        return;
+    }
+    if (nvs_set_blob(nvs, WIFI_NVS_KEY, &ap_cache, sizeof(ap_cache)) == ESP_OK) {
+        nvs_commit(nvs);
+    }
+    nvs_close(nvs);
+}
+
+
+static void set_targeted(bool enable)
+{
+    wifi_config_t config;
+    if (esp_wifi_get_config(WIFI_IF_STA, &config) != ESP_OK) {
+        return;
+    }
+    targeted = enable && ap_cache.valid;
+    config.sta.bssid_set = targeted;
+    config.sta.channel = targeted ? ap_cache.channel : 0;
+    if (targeted) {
+        memcpy(config.sta.bssid, ap_cache.bssid, sizeof(config.sta.bssid));
+    }
+    esp_wifi_set_config(WIFI_IF_STA, &config);
+}
+
+
+static void retry_timer_cb(void *arg)
+{
+    esp_wifi_connect();
+}
+
+
+#if CONFIG_WIFI_REUSE_DHCP_LEASE
+// The broker wasn't reached on the reused address: forget the lease and ask DHCP
+static void lease_timer_cb(void *arg)
+{
+    ESP_LOGW(WIFI_TAG, "No broker within %d s on lease " IPSTR ", restarting DHCP",
+             CONFIG_WIFI_LEASE_CHECK_TIMEOUT_S, IP2STR(&ap_cache.lease.ip));
+    static_lease = false;
+    memset(&ap_cache.lease, 0, sizeof(ap_cache.lease));
+    save_ap_cache();
+    esp_netif_dhcpc_start(netif);
+}
+#endif
+
+
+void wifi_reconnect_init(esp_netif_t *sta_netif)
+{
+    netif = sta_netif;
+    backoff_init(&backoff, CONFIG_WIFI_RECONNECT_BASE_MS, CONFIG_WIFI_RECONNECT_CAP_MS, esp_random());
+    // The boot connect is the first attempt, a failure goes straight to backoff.
+    // It is not an outage, so it stays out of the reconnect stats
+    retrying = true;
+
+    esp_timer_create_args_t timer_args = {
+        .callback = retry_timer_cb,
+        .name = "wifi_retry",
+    };
+    esp_timer_create(&timer_args, &retry_timer);
+
+    nvs_handle_t nvs;
+    size_t len = sizeof(ap_cache);
+    if (nvs_open(WIFI_NVS_NAMESPACE, NVS_READONLY, &nvs) == ESP_OK) {
+        if (nvs_get_blob(nvs, WIFI_NVS_KEY, &ap_cache, &len) != ESP_OK || len != sizeof(ap_cache)) {
+            memset(&ap_cache, 0, sizeof(ap_cache));
+        }
+        nvs_close(nvs);
+    }
+
+#if CONFIG_WIFI_REUSE_DHCP_LEASE
+    esp_timer_create_args_t lease_timer_args = {
+        .callback = lease_timer_cb,
+        .name = "wifi_lease",
+    };
+    esp_timer_create(&lease_timer_args, &lease_timer);
+
+    if (ap_cache.valid && ap_cache.lease.ip.addr != 0) {
+        esp_netif_dhcpc_stop(netif);
+        esp_netif_set_ip_info(netif, &ap_cache.lease);
+        static_lease = true;
+        ESP_LOGI(WIFI_TAG, "Reusing lease " IPSTR, IP2STR(&ap_cache.lease.ip));
+    }
+#endif
+}
+
+
+void wifi_reconnect_configure(wifi_config_t *config)
+{
+    if (!ap_cache.valid) {
+        return;
+    }
+    targeted = true;
+    config->sta.bssid_set = true;
+    config->sta.channel = ap_cache.channel;
+    config->sta.scan_method = WIFI_FAST_SCAN;
+    memcpy(config->sta.bssid, ap_cache.bssid, sizeof(config->sta.bssid));
+    ESP_LOGI(WIFI_TAG, "Fast connect to cached AP " MACSTR " on channel %d", MAC2STR(ap_cache.bssid), ap_cache.channel);
+}
+
+
+void wifi_reconnect_on_connected(const wifi_event_sta_connected_t *event)
+{
+    if (!ap_cache.valid || ap_cache.channel != event->channel || memcmp(ap_cache.bssid, event->bssid, sizeof(ap_cache.bssid)) != 0) {
+        // Only write when the AP changed, to spare the flash
+        ap_cache.valid = 1;
+        ap_cache.channel = event->channel;
+        memcpy(ap_cache.bssid, event->bssid, sizeof(ap_cache.bssid));
+        save_ap_cache();
+    }
+}
+
+
+void wifi_reconnect_on_disconnected(const wifi_event_sta_disconnected_t *event)
+{
+    uint32_t delay_ms;
+
+#if CONFIG_WIFI_REUSE_DHCP_LEASE
+    // The lease gets a fresh check on the next link
+    esp_timer_stop(lease_timer);
+#endif
+
+    if (!retrying) {
+        // Link just dropped: try the cached AP straight away
+        retrying = true;
+        outage_start_us = esp_timer_get_time();
+        set_targeted(true);
+        delay_ms = 0;
+    } else {
+        if (targeted) {
+            // The AP may have moved channel or been replaced, fall back to a full scan
+            set_targeted(false);
+        }
+        delay_ms = backoff_next_delay_ms(&backoff);
+    }
+
+    ESP_LOGI(WIFI_TAG, "Disconnected (reason %d), retry in %" PRIu32 " ms%s", event->reason, delay_ms, targeted ? " (cached AP)" : "");
+    if (delay_ms == 0) {
+        esp_wifi_connect();
+    } else {
+        esp_timer_stop(retry_timer);
+        esp_timer_start_once(retry_timer, (uint64_t)delay_ms * 1000);
+    }
+}
+
+
+void wifi_reconnect_on_got_ip(const ip_event_got_ip_t *event)
+{
+    if (outage_start_us != 0) {
+        uint32_t duration_ms = (esp_timer_get_time() - outage_start_us) / 1000;
+        stats.reconnects++;
+        stats.last_duration_ms = duration_ms;
+        if (duration_ms > stats.max_duration_ms) {
+            stats.max_duration_ms = duration_ms;
+        }
+        if (targeted) {
+            stats.fast_reconnects++;
+        }
+        ESP_LOGI(WIFI_TAG, "Connected in %" PRIu32 " ms after %" PRIu32 " retries", duration_ms, backoff.attempt);
+    }
+    outage_start_us = 0;
+    retrying = false;
+    backoff_reset(&backoff);
+
+#if CONFIG_WIFI_REUSE_DHCP_LEASE
+    if (static_lease) {
+        // A static address always "gets IP", only reaching the broker shows the lease still holds
+        esp_timer_stop(lease_timer);
+        esp_timer_start_once(lease_timer, (uint64_t)CONFIG_WIFI_LEASE_CHECK_TIMEOUT_S * 1000000);
+        return;
+    }
+    if (memcmp(&ap_cache.lease, &event->ip_info, sizeof(ap_cache.lease)) != 0) {
+        ap_cache.lease = event->ip_info;
+        save_ap_cache();
+    }
+#endif
+}
+
+
+void wifi_reconnect_on_broker_connected(void)
+{
+#if CONFIG_WIFI_REUSE_DHCP_LEASE
+    esp_timer_stop(lease_timer);
+#endif
+}
+
+
+void wifi_reconnect_get_stats(wifi_reconnect_stats_t *out)
+{
+    *out = stats;
+}
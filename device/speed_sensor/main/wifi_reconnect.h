@@ -0,0 +1,52 @@
+#ifndef __WIFI_RECONNECT_H__
+#define __WIFI_RECONNECT_H__
+
+#include <stdint.h>
+
+#include "esp_wifi.h"
+#include "esp_netif.h"
+
+typedef struct
+{
+    uint32_t reconnects;        //!< Completed reconnects since boot
+    uint32_t fast_reconnects;   //!< Of which used the cached BSSID/channel
+    uint32_t last_duration_ms;  //!< Disconnect to IP for the last reconnect
+    uint32_t max_duration_ms;
+} wifi_reconnect_stats_t;
+
+
+/**
+ * @brief Load the cached AP (and optionally the DHCP lease) from NVS
+ *
+ * Must be called before the station config is applied.
+ */
+void wifi_reconnect_init(esp_netif_t *sta_netif);
+
+
+/**
+ * @brief Point the station config at the cached BSSID and channel, if any
+ *
+ * With a cached AP the driver connects without a full scan.
+ */
+void wifi_reconnect_configure(wifi_config_t *config);
+
+
+// Feed from the Wi-Fi / IP event handler
+void wifi_reconnect_on_connected(const wifi_event_sta_connected_t *event);
+void wifi_reconnect_on_disconnected(const wifi_event_sta_disconnected_t *event);
+void wifi_reconnect_on_got_ip(const ip_event_got_ip_t *event);
+
+
+/**
+ * @brief Feed from MQTT_EVENT_CONNECTED
+ *
+ * With WIFI_REUSE_DHCP_LEASE, a reused lease that hasn't reached the broker
+ * within WIFI_LEASE_CHECK_TIMEOUT_S of getting its address is dropped and
+ * DHCP restarted.
+ */
+void wifi_reconnect_on_broker_connected(void);
+
+
+void wifi_reconnect_get_stats(wifi_reconnect_stats_t *stats);
+
+#endif /* __WIFI_RECONNECT_H__ */
@@ -0,0 +1,134 @@
+"""
+Turn deferred log frames (main/dlog.h) back into text, using the format
+strings in the firmware ELF the device is running.
+
+    python dlog_decode.py build/speed_sensor.elf monitor.log
+    mosquitto_sub -t /device/<id>/debug -F %x | python dlog_decode.py --hex build/speed_sensor.elf
+
+Console captures are scanned for "#D <hex>" lines, anything else passes
+through untouched. With --hex every line is a payload of one or more frames.
+"""
+import argparse
+import re
+import struct
+import sys
+
+FRAME_HEAD = struct.Struct("<IIBB")
+LEVELS = {1: "E", 2: "W", 3: "I"}
+CONVERSION = re.compile(r"%([-+ #0]*\d*(?:\.\d+)?)(hh|h|ll|l|z|j|t)?([diouxXfFeEgGcsp%])")
+CONSOLE_FRAME = re.compile(r"#D ([0-9a-fA-F]+)")
+
+
+class Elf:
+    """Just enough ELF to read strings from the allocated sections."""
+
+    def __init__(self, path):
+        with open(path, "rb") as f:
+            self.data = f.read()
+        if self.data[:4] != b"\x7fELF" or self.data[5] != 1:
+            raise ValueError(f"{path} is not a little-endian ELF file")
+        if self.data[4] == 1:
+            shoff, = struct.unpack_from("<I", self.data, 0x20)
+            shentsize, shnum = struct.unpack_from("<HH", self.data, 0x2E)
+            section = struct.Struct("<IIIIIIIIII")
+        else:
+            shoff, = struct.unpack_from("<Q", self.data, 0x28)
+            shentsize, shnum = struct.unpack_from("<HH", self.data, 0x3A)
+            section = struct.Struct("<IIQQQQIIQQ")
+        self.ranges = []
+        for i in range(shnum):
+            _, kind, flags, addr, offset, size = section.unpack_from(self.data, shoff + i * shentsize)[:6]
+            # SHT_PROGBITS with SHF_ALLOC
+            if kind == 1 and flags & 0x2 and size:
+                self.ranges.append((addr, addr + size, offset))
+
+    def string(self, address):
+        for start, end, offset in self.ranges:
+            if start <= address < end:
+                at = offset + address - start
+                stop = self.data.index(b"\0", at)
+                return self.data[at:stop].decode("utf-8", "replace")
+        return None
+
+
+def format_record(elf, fmt_address, args):
+    fmt = elf.string(fmt_address)
+    if fmt is None:
+        return f"<unknown format 0x{fmt_address:08x}> " + " ".join(f"0x{a:08x}" for a in args)
+    values = iter(args)
+
+    def convert(match):
+        flags, _, kind = match.groups()
+        if kind == "%":
+            return "%"
+        raw = next(values, 0)
+        if kind in "fFeEgG":
+            value = struct.unpack("<f", struct.pack("<I", raw))[0]
+        elif kind in "di":
+            value = raw - (1 << 32) if raw & 0x80000000 else raw
+        elif kind == "s":
+            value = elf.string(raw)
+            return value if value is not None else f"<0x{raw:08x}>"
+        elif kind == "p":
+            return f"0x{raw:08x}"
+        else:
+            value = raw
+        return ("%" + flags + kind) % value
+
+    return CONVERSION.sub(convert, fmt)
+
+
+class Decoder:
+    def __init__(self, elf):
+        self.elf = elf
+        self.last_time_us = 0
+        self.wraps = 0
+
+    def frames(self, payload):
+        offset = 0
+        while offset + FRAME_HEAD.size <= len(payload):
+            fmt, time_us, level, nargs = FRAME_HEAD.unpack_from(payload, offset)
+            offset += FRAME_HEAD.size
+            args = struct.unpack_from(f"<{nargs}I", payload, offset)
+            offset += 4 * nargs
+            yield fmt, time_us, level, args
+
+    def decode(self, payload):
+        lines = []
+        for fmt, time_us, level, args in self.frames(payload):
+            if fmt == 0:
+                lines.append(f"W dlog: {args[0]} records dropped")
+                continue
+            # The device keeps 32 bits of microseconds, which wrap every 71 minutes
+            if time_us < self.last_time_us:
+                self.wraps += 1
+            self.last_time_us = time_us
+            ms = ((self.wraps << 32) + time_us) // 1000
+            lines.append(f"{LEVELS.get(level, '?')} ({ms}) {format_record(self.elf, fmt, args)}")
+        return lines
+
+
+def main():
+    parser = argparse.ArgumentParser(description="Decode deferred binary log frames")
+    parser.add_argument("elf", help="Firmware ELF the frames came from")
+    parser.add_argument("input", nargs="?", default="-", help="Capture file, - for stdin")
+    parser.add_argument("--hex", action="store_true", help="Each line is hex frames, e.g. from mosquitto_sub -F %%x")
+    args = parser.parse_args()
+
+    decoder = Decoder(Elf(args.elf))
+    source = sys.stdin if args.input == "-" else open(args.input, errors="replace")
+    for line in source:
+        line = line.rstrip("\r\n")
+        if args.hex:
+            if line.strip():
+                print("\n".join(decoder.decode(bytes.fromhex(line.strip()))))
+            continue
+        match = CONSOLE_FRAME.search(line)
+        if match:
+            print("\n".join(decoder.decode(bytes.fromhex(match.group(1)))))
+        else:
+            print(line)
+
+
+if __name__ == "__main__":
+    main()
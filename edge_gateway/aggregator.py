@@ -0,0 +1,157 @@
+from sketch import SpeedSketch
+
+SKETCH_ACCURACY = 0.02
+
+# Must match device/speed_sensor/main/speed_hist.h
+SPEED_HIST_BUCKETS = 32
+SPEED_HIST_PER_OCTAVE = 8
+SPEED_HIST_BASE_CM_S = 300
+
+
+def speed_hist_value(bucket):
+    """Geometric middle of a device speed bucket, within 4.4% of anything in it."""
+    return SPEED_HIST_BASE_CM_S * 2 ** ((bucket + 0.5) / SPEED_HIST_PER_OCTAVE)
+
+
+def _number(value, default=0.0):
+    # Older firmware sends every metric as a string
+    try:
+        return float(value)
+    except (TypeError, ValueError):
+        return default
+
+
+class Rollup:
+    """
+    Counts, sums, extremes and a speed sketch over any number of windows. The
+    sketch holds one entry per vehicle, from the speed histogram the device
+    sends with each window; windows from firmware without one add nothing to it.
+    """
+
+    def __init__(self):
+        self.windows = 0
+        self.num_cars = 0
+        self.speed_sum = 0.0
+        self.max_speed = None
+        self.min_speed = None
+        self.sensor_1_up = True
+        self.sensor_2_up = True
+        self.first_ts = None
+        self.last_ts = None
+        self.sketch = SpeedSketch(SKETCH_ACCURACY)
+        self.speed_hist = []
+
+    def add_window(self, ts, data):
+        cars = int(_number(data.get("num_cars")))
+        avg_speed = _number(data.get("avg_speed"))
+        self.windows += 1
+        self.num_cars += cars
+        self.speed_sum += avg_speed * cars
+        if cars > 0:
+            max_speed = _number(data.get("max_speed"))
+            min_speed = _number(data.get("min_speed"))
+            self.max_speed = max_speed if self.max_speed is None else max(self.max_speed, max_speed)
+            self.min_speed = min_speed if self.min_speed is None else min(self.min_speed, min_speed)
+            speed_hist = data.get("speed_hist")
+            if isinstance(speed_hist, list):
+                counts = [max(int(_number(count)), 0) for count in speed_hist[:SPEED_HIST_BUCKETS]]
+                for bucket, count in enumerate(counts):
+                    self.sketch.add(speed_hist_value(bucket), count)
+                self._add_speed_hist(counts)
+        self.sensor_1_up = self.sensor_1_up and _number(data.get("sensor_1_up"), 1) != 0
+        self.sensor_2_up = self.sensor_2_up and _number(data.get("sensor_2_up"), 1) != 0
+        self.first_ts = ts if self.first_ts is None else min(self.first_ts, ts)
+        self.last_ts = ts if self.last_ts is None else max(self.last_ts, ts)
+
+    def _add_speed_hist(self, counts):
+        if len(counts) > len(self.speed_hist):
+            self.speed_hist += [0] * (len(counts) - len(self.speed_hist))
+        for bucket, count in enumerate(counts):
+            self.speed_hist[bucket] += count
+
+    def add_quiet_windows(self, count, first_ts):
+        """Zero-traffic windows a device held back before its report, see report_gate.h."""
+        if count <= 0:
+            return
+        self.windows += count
+        self.first_ts = first_ts if self.first_ts is None else min(self.first_ts, first_ts)
+
+    def merge(self, other):
+        self.windows += other.windows
+        self.num_cars += other.num_cars
+        self.speed_sum += other.speed_sum
+        for name, pick in (("max_speed", max), ("min_speed", min), ("last_ts", max), ("first_ts", min)):
+            mine, theirs = getattr(self, name), getattr(other, name)
+            setattr(self, name, theirs if mine is None else mine if theirs is None else pick(mine, theirs))
+        self.sensor_1_up = self.sensor_1_up and other.sensor_1_up
+        self.sensor_2_up = self.sensor_2_up and other.sensor_2_up
+        self.sketch.merge(other.sketch)
+        self._add_speed_hist(other.speed_hist)
+
+    def to_dict(self):
+        return {
+            "windows": self.windows,
+            "num_cars": self.num_cars,
+            "speed_sum": round(self.speed_sum, 2),
+            "max_speed": self.max_speed,
+            "min_speed": self.min_speed,
+            "sensor_1_up": int(self.sensor_1_up),
+            "sensor_2_up": int(self.sensor_2_up),
+            "first_ts": self.first_ts,
+            "last_ts": self.last_ts,
+            "speed_p85": self.sketch.quantile(0.85),
+            "sketch": self.sketch.to_dict(),
+            # Summed device histograms, stored centrally so any grouping can take its own p85
+            "speed_hist": self.speed_hist,
+        }
+
+
+class SiteAggregator:
+    """
+    Folds the window reports of one site's sensors into per-device (and lane)
+    rollups, and hands them over as one batch per forwarding interval.
+    """
+
+    def __init__(self, site_id):
+        self.site_id = site_id
+        self.devices = {}
+        self.versions = {}
+        self.last_ts = {}
+        self.duplicates = 0
+        self.rejected = 0
+
+    def add(self, message, arrival_ms):
+        device = message.get("device")
+        data = message.get("data")
+        if not isinstance(device, str) or not isinstance(data, dict):
+            self.rejected += 1
+            return False
+        lane = int(_number(message.get("lane"), 0))
+        ts = message.get("ts")
+        # Unsynced devices send the window's age, which leaves out time spent in their outbox
+        ts = int(ts) if isinstance(ts, (int, float)) else arrival_ms - max(int(_number(message.get("age_ms"), 0)), 0)
+
+        key = (device, lane)
+        if ts <= self.last_ts.get(key, -1):
+            # QoS1 redelivery
+            self.duplicates += 1
+            return False
+        self.last_ts[key] = ts
+
+        rollup = self.devices.setdefault(key, Rollup())
+        rollup.add_window(ts, data)
+        quiet = int(_number(data.get("quiet_windows"), 0))
+        rollup.add_quiet_windows(quiet, ts - int(quiet * _number(data.get("window_s"), 0) * 1000))
+        self.versions[device] = str(message.get("version", ""))
+        return True
+
+    def flush(self, end_ms):
+        if not self.devices:
+            return None
+        site = Rollup()
+        devices = []
+        for (device, lane), rollup in sorted(self.devices.items()):
+            site.merge(rollup)
+            devices.append({"device": device, "lane": lane, "version": self.versions.get(device, ""), **rollup.to_dict()})
+        self.devices = {}
+        return {"site": self.site_id, "end": end_ms, "total": site.to_dict(), "devices": devices}
@@ -0,0 +1,99 @@
+import argparse
+import json
+import os
+import random
+import sys
+import time
+
+from aggregator import SiteAggregator
+from gateway import FORWARD_INTERVAL_S
+
+# Central ingest parsing, as run by data_pipeline/wow_sub.py
+sys.path.insert(0, os.path.join(os.path.dirname(os.path.abspath(__file__)), "..", "data_pipeline"))
+from schema import parse_message, parse_site_batch
+
+REPORT_INTERVAL_S = 5
+
+
+def sensor_reports(sensors, duration_s, seed):
+    """Window reports of every sensor, in publish order, as (time s, device index, payload)."""
+    rng = random.Random(seed)
+    start_ms = 1_700_000_000_000
+    offsets = [rng.uniform(0, REPORT_INTERVAL_S) for _ in range(sensors)]
+    for tick in range(duration_s // REPORT_INTERVAL_S):
+        for i in range(sensors):
+            t = tick * REPORT_INTERVAL_S + offsets[i]
+            cars = rng.randint(0, 10)
+            speed_hist = [0] * 24
+            for _ in range(cars):
+                speed_hist[rng.randint(8, 23)] += 1
+            payload = json.dumps({
+                "device": f"sensor_{i}", "version": "0.0.1", "ts": start_ms + int(t * 1000), "lane": 0,
+                "data": {"avg_speed": round(rng.uniform(15, 100), 2), "max_speed": round(rng.uniform(100, 150), 2),
+                         "min_speed": round(rng.uniform(0, 15), 2), "num_cars": cars,
+                         "sensor_1_up": 1, "sensor_2_up": 1, "speed_hist": speed_hist},
+            })
+            yield t, i, payload
+
+
+def central_cost(payloads, parse):
+    start = time.process_time()
+    rows = 0
+    for payload in payloads:
+        rows += len(parse(json.loads(payload)))
+    return time.process_time() - start, rows
+
+
+def run(sensors, sites, duration_s, seed):
+    reports = list(sensor_reports(sensors, duration_s, seed))
+
+    # Direct: every sensor holds its own connection and every window goes upstream
+    direct = [payload for _, _, payload in reports]
+    direct_cpu, direct_rows = central_cost(direct, lambda message: [parse_message(message)])
+
+    # Gateway: one connection per site, one batch per site per forwarding interval
+    aggregators = [SiteAggregator(f"site_{s}") for s in range(sites)]
+    batches = []
+    next_forward = FORWARD_INTERVAL_S
+    gateway_start = time.process_time()
+    for t, i, payload in reports:
+        while t >= next_forward:
+            batches += [json.dumps(b, separators=(",", ":")) for a in aggregators if (b := a.flush(int(next_forward * 1000)))]
+            next_forward += FORWARD_INTERVAL_S
+        aggregators[i % sites].add(json.loads(payload), int(t * 1000))
+    batches += [json.dumps(b, separators=(",", ":")) for a in aggregators if (b := a.flush(int(next_forward * 1000)))]
+    gateway_cpu = time.process_time() - gateway_start
+    gateway_central_cpu, gateway_rows = central_cost(batches, parse_site_batch)
+
+    def path(connections, payloads, central_cpu, rows):
+        return {
+            "connections": connections,
+            "messages_per_s": round(len(payloads) / duration_s, 2),
+            "bytes_per_s": round(sum(len(p) for p in payloads) / duration_s, 1),
+            "central_cpu_s": round(central_cpu, 4),
+            "central_rows": rows,
+        }
+
+    return {
+        "sensors": sensors,
+        "sites": sites,
+        "duration_s": duration_s,
+        "seed": seed,
+        "direct": path(sensors, direct, direct_cpu, direct_rows),
+        "gateway": {**path(sites, batches, gateway_central_cpu, gateway_rows),
+                    "site_cpu_s": round(gateway_cpu, 4)},
+    }
+
+
+def main():
+    parser = argparse.ArgumentParser(description="Upstream load of direct sensors versus edge gateways")
+    parser.add_argument("--sensors", type=int, default=1000)
+    parser.add_argument("--sites", type=int, default=20)
+    parser.add_argument("--duration", type=int, default=600, help="simulated seconds")
+    parser.add_argument("--seed", type=int, default=1)
+    args = parser.parse_args()
+    print(json.dumps(run(args.sensors, args.sites, args.duration, args.seed), indent=2))
+
+
+if __name__ == "__main__":
+    main()
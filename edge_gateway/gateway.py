@@ -0,0 +1,129 @@
+import argparse
+import json
+import ssl
+import time
+from collections import deque
+from threading import Lock
+
+import paho.mqtt.client as mqtt
+
+from aggregator import SiteAggregator
+
+# Local broker the site's sensors publish to
+LOCAL_HOST = "172.20.10.10"
+LOCAL_PORT = 1883
+LOCAL_CREDS = ("site_gateway", "mqtttest")  # Read-only, /device/+/data
+
+# Central broker
+UPSTREAM_HOST = "mqtt.wow-iot.ie"
+UPSTREAM_PORT = 8883
+UPSTREAM_PASSWORD = "mqtttest"  # Logged in as the site id, which may only publish /site/<site>/batch
+
+FORWARD_INTERVAL_S = 60
+BUFFER_BATCHES = 1440  # A day of batches while upstream is unreachable
+
+
+def batch_topic(site_id):
+    return f"/site/{site_id}/batch"
+
+
+class Gateway:
+    def __init__(self, site_id):
+        self.site_id = site_id
+        self.lock = Lock()
+        self.aggregator = SiteAggregator(site_id)
+        # Batches waiting for the central broker, oldest first, one in flight at a time
+        self.outbox = deque()
+        self.in_flight_mid = None
+        self.upstream_connected = False
+        self.dropped_batches = 0
+
+        self.local = mqtt.Client(mqtt.CallbackAPIVersion.VERSION2, client_id=f"gateway_{site_id}_local", clean_session=False)
+        self.local.username_pw_set(*LOCAL_CREDS)
+        self.local.on_connect = lambda client, userdata, flags, rc, properties: client.subscribe("/device/+/data", qos=1)
+        self.local.on_message = self.on_local_message
+
+        self.upstream = mqtt.Client(mqtt.CallbackAPIVersion.VERSION2, client_id=f"gateway_{site_id}", clean_session=False)
+        ssl_context = ssl.create_default_context()
+        ssl_context.load_verify_locations("cert.pem")
+        self.upstream.tls_set_context(ssl_context)
+        self.upstream.username_pw_set(site_id, UPSTREAM_PASSWORD)
+        self.upstream.on_connect = self.on_upstream_connect
+        self.upstream.on_disconnect = self.on_upstream_disconnect
+        self.upstream.on_publish = self.on_upstream_publish
+
+    def on_local_message(self, client, userdata, msg):
+        try:
+            message = json.loads(msg.payload.decode())
+        except (UnicodeDecodeError, json.JSONDecodeError):
+            self.aggregator.rejected += 1
+            return
+        if isinstance(message, dict):
+            with self.lock:
+                self.aggregator.add(message, int(time.time() * 1000))
+
+    def on_upstream_connect(self, client, userdata, flags, rc, properties):
+        print(f"Upstream connected with result code {rc}")
+        with self.lock:
+            self.upstream_connected = True
+            # Anything unacknowledged is resent from our own outbox
+            self.in_flight_mid = None
+        self.pump()
+
+    def on_upstream_disconnect(self, client, userdata, flags, rc, properties):
+        with self.lock:
+            self.upstream_connected = False
+
+    def on_upstream_publish(self, client, userdata, mid, rc, properties):
+        with self.lock:
+            if mid == self.in_flight_mid:
+                self.outbox.popleft()
+                self.in_flight_mid = None
+        self.pump()
+
+    def pump(self):
+        with self.lock:
+            if not self.upstream_connected or self.in_flight_mid is not None or not self.outbox:
+                return
+            payload = self.outbox[0]
+            info = self.upstream.publish(batch_topic(self.site_id), payload, qos=1)
+            self.in_flight_mid = info.mid
+
+    def forward(self):
+        with self.lock:
+            batch = self.aggregator.flush(int(time.time() * 1000))
+            if batch is None:
+                return
+            batch["duplicates"] = self.aggregator.duplicates
+            batch["rejected"] = self.aggregator.rejected
+            if len(self.outbox) == BUFFER_BATCHES:
+                # Oldest goes first, unless it is the one in flight
+                if self.in_flight_mid is None:
+                    self.outbox.popleft()
+                else:
+                    del self.outbox[1]
+                self.dropped_batches += 1
+            self.outbox.append(json.dumps(batch, separators=(",", ":")))
+        self.pump()
+
+    def run(self):
+        self.local.connect(LOCAL_HOST, LOCAL_PORT, 60)
+        self.local.loop_start()
+        self.upstream.connect_async(UPSTREAM_HOST, UPSTREAM_PORT, 60)
+        self.upstream.loop_start()
+
+        while True:
+            time.sleep(FORWARD_INTERVAL_S)
+            self.forward()
+            print(f"{len(self.outbox)} batches buffered, {self.dropped_batches} dropped")
+
+
+def main():
+    parser = argparse.ArgumentParser(description="Aggregate a site's sensors and forward batches upstream")
+    parser.add_argument("site")
+    args = parser.parse_args()
+    Gateway(args.site).run()
+
+
+if __name__ == "__main__":
+    main()
@@ -0,0 +1,69 @@
+import math
+
+
+class SpeedSketch:
+    """
+    Mergeable quantile sketch with bounded relative error (DDSketch style).
+    Values fall into logarithmic buckets, so two sketches merge by adding
+    bucket counts and a merged quantile is as accurate as one built from
+    all the values at once. Non-positive values share a single bucket.
+    """
+
+    def __init__(self, relative_accuracy=0.02):
+        self.relative_accuracy = relative_accuracy
+        self.gamma = (1 + relative_accuracy) / (1 - relative_accuracy)
+        self.log_gamma = math.log(self.gamma)
+        self.buckets = {}
+        self.zero_count = 0
+        self.count = 0
+
+    def _index(self, value):
+        return math.ceil(math.log(value) / self.log_gamma)
+
+    def _value(self, index):
+        # Midpoint of the bucket, within relative_accuracy of anything in it
+        return 2 * self.gamma ** index / (self.gamma + 1)
+
+    def add(self, value, count=1):
+        if count <= 0:
+            return
+        if value <= 0:
+            self.zero_count += count
+        else:
+            index = self._index(value)
+            self.buckets[index] = self.buckets.get(index, 0) + count
+        self.count += count
+
+    def merge(self, other):
+        if other.gamma != self.gamma:
+            raise ValueError("Sketches with different accuracy cannot be merged")
+        for index, count in other.buckets.items():
+            self.buckets[index] = self.buckets.get(index, 0) + count
+        self.zero_count += other.zero_count
+        self.count += other.count
+
+    def quantile(self, q):
+        if self.count == 0:
+            return None
+        rank = q * (self.count - 1)
+        seen = self.zero_count
+        if rank < seen:
+            return 0.0
+        for index in sorted(self.buckets):
+            seen += self.buckets[index]
+            if rank < seen:
+                return self._value(index)
+        return self._value(max(self.buckets))
+
+    def to_dict(self):
+        # Sparse and integer-keyed, a site's worth of speeds stays a few dozen entries
+        return {"a": self.relative_accuracy, "z": self.zero_count,
+                "b": [[index, count] for index, count in sorted(self.buckets.items())]}
+
+    @classmethod
+    def from_dict(cls, data):
+        sketch = cls(data["a"])
+        sketch.zero_count = data["z"]
+        sketch.buckets = {index: count for index, count in data["b"]}
+        sketch.count = sketch.zero_count + sum(sketch.buckets.values())
+        return sketch
@@ -1,15 +1,161 @@
+import hashlib
 import http.server
+import io
+import json
 import os
 import ssl
+import struct
+import threading
+
+# Each image in data/ is described by <image>.manifest, which devices fetch
+# before downloading. The manifest and the image carry the image SHA-256 as
+# their ETag, and a device sends the SHA-256 of the image it is running as
+# If-None-Match, so re-issuing an upgrade to a device already on that build
+# costs a 304 instead of the image.
+#
+# Version, project and chip come from the image's app descriptor. An
+# optional <image>.json next to it overrides any manifest field, e.g.
+# {"version": "0.0.2"} to match CONFIG_DEVICE_FIRMWARE_VERSION.
+IMAGE_SUFFIX = ".bin"
+MANIFEST_SUFFIX = ".manifest"
+FLEET_MANIFEST = "manifest.json"
+
+# esp_image_header_t followed by the first segment header, then esp_app_desc_t
+IMAGE_MAGIC = 0xE9
+APP_DESC_OFFSET = 24 + 8
+APP_DESC_MAGIC = 0xABCD5432
+CHIP_NAMES = {0: "esp32", 2: "esp32s2", 5: "esp32c3", 9: "esp32s3", 12: "esp32c2", 13: "esp32c6", 16: "esp32h2"}
+
+_manifests = {}
+_manifests_lock = threading.Lock()
+
+_stats = {"images": 0, "image_bytes": 0, "not_modified": 0, "bytes_saved": 0}
+_stats_lock = threading.Lock()
+
+
+def _c_string(raw: bytes) -> str:
+    return raw.split(b"\0", 1)[0].decode(errors="replace")
+
+
+def build_manifest(path: str) -> dict:
+    """Describe an ESP-IDF app image."""
+    with open(path, "rb") as f:
+        image = f.read()
+
+    manifest = {"name": os.path.basename(path), "size": len(image)}
+    if len(image) > APP_DESC_OFFSET + 256 and image[0] == IMAGE_MAGIC:
+        chip_id, = struct.unpack_from("<H", image, 12)
+        hash_appended = image[23] == 1
+        # Matches esp_partition_get_sha256() of the partition once flashed
+        digest = image[-32:] if hash_appended else hashlib.sha256(image).digest()
+        manifest.update(sha256=digest.hex(), chip_id=chip_id, chip=CHIP_NAMES.get(chip_id, str(chip_id)))
+
+        magic, = struct.unpack_from("<I", image, APP_DESC_OFFSET)
+        if magic == APP_DESC_MAGIC:
+            manifest.update(version=_c_string(image[APP_DESC_OFFSET + 16:APP_DESC_OFFSET + 48]),
+                            project=_c_string(image[APP_DESC_OFFSET + 48:APP_DESC_OFFSET + 80]),
+                            idf=_c_string(image[APP_DESC_OFFSET + 112:APP_DESC_OFFSET + 144]))
+    else:
+        manifest.update(sha256=hashlib.sha256(image).hexdigest())
+    manifest.setdefault("version", "")
+
+    overrides = path + ".json"
+    if os.path.exists(overrides):
+        with open(overrides) as f:
+            manifest.update(json.load(f))
+    return manifest
+
+
+def get_manifest(path: str) -> dict:
+    """Manifest for an image, recomputed only when the file changes."""
+    st = os.stat(path)
+    overrides = path + ".json"
+    key = (st.st_mtime_ns, st.st_size, os.stat(overrides).st_mtime_ns if os.path.exists(overrides) else 0)
+    with _manifests_lock:
+        cached = _manifests.get(path)
+        if cached is not None and cached[0] == key:
+            return cached[1]
+    manifest = build_manifest(path)
+    with _manifests_lock:
+        _manifests[path] = (key, manifest)
+    return manifest
+
+
+def _etag_matches(header: str, etag: str) -> bool:
+    if header is None:
+        return False
+    return any(tag.strip() in ("*", etag) for tag in header.split(","))
+
+
+class OtaRequestHandler(http.server.SimpleHTTPRequestHandler):
+    _etag = None
+
+    def end_headers(self) -> None:
+        if self._etag is not None:
+            self.send_header("ETag", self._etag)
+        super().end_headers()
+
+    def _not_modified(self, image_size: int) -> None:
+        self.send_response(304)
+        self.end_headers()
+        with _stats_lock:
+            _stats["not_modified"] += 1
+            _stats["bytes_saved"] += image_size
+            self.log_message("Not modified, %d image bytes saved over %d skipped downloads",
+                             _stats["bytes_saved"], _stats["not_modified"])
+
+    def _send_json(self, body: dict) -> bytes:
+        payload = json.dumps(body).encode()
+        self.send_response(200)
+        self.send_header("Content-Type", "application/json")
+        self.send_header("Content-Length", str(len(payload)))
+        self.send_header("Cache-Control", "no-cache")
+        self.end_headers()
+        return payload
+
+    def send_head(self):
+        self._etag = None
+        path = self.translate_path(self.path)
+        name = os.path.basename(path)
+
+        if name == FLEET_MANIFEST:
+            images = sorted(entry for entry in os.listdir(os.path.dirname(path)) if entry.endswith(IMAGE_SUFFIX))
+            payload = self._send_json({"images": [get_manifest(os.path.join(os.path.dirname(path), image)) for image in images]})
+            return io.BytesIO(payload)
+
+        if name.endswith(MANIFEST_SUFFIX):
+            image = path[:-len(MANIFEST_SUFFIX)]
+            if not image.endswith(IMAGE_SUFFIX) or not os.path.isfile(image):
+                self.send_error(404, "No such image")
+                return None
+            manifest = get_manifest(image)
+            self._etag = '"{}"'.format(manifest["sha256"])
+            if _etag_matches(self.headers.get("If-None-Match"), self._etag):
+                self._not_modified(manifest["size"])
+                return None
+            return io.BytesIO(self._send_json(manifest))
+
+        if name.endswith(IMAGE_SUFFIX) and os.path.isfile(path):
+            manifest = get_manifest(path)
+            self._etag = '"{}"'.format(manifest["sha256"])
+            if _etag_matches(self.headers.get("If-None-Match"), self._etag):
+                self._not_modified(manifest["size"])
+                return None
+            with _stats_lock:
+                _stats["images"] += 1
+                _stats["image_bytes"] += manifest["size"]
+                self.log_message("Serving image, %d image bytes sent over %d downloads",
+                                 _stats["image_bytes"], _stats["images"])
+        return super().send_head()
 
 
 def start_https_server(server_ip: str, server_port: int, server_file: str = None, key_file: str = None) -> None:
     print('Starting HTTPS server at "https://{}:{}"'.format(server_ip, server_port))
-    
+
     os.chdir("data")
 
-    httpd = http.server.HTTPServer((server_ip, server_port), http.server.SimpleHTTPRequestHandler)
-    
+    httpd = http.server.ThreadingHTTPServer((server_ip, server_port), OtaRequestHandler)
+
     context = ssl.SSLContext(ssl.PROTOCOL_TLS_SERVER)
     context.load_cert_chain(certfile=server_file, keyfile=key_file)
 
@@ -24,4 +170,4 @@ if __name__ == '__main__':
         8443,
         server_file="cert.pem",
         key_file="key.pem"
-    )
\ No newline at end of file
+    )